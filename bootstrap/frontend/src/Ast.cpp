@@ -1,11 +1,101 @@
 #include "CodeGen.h"
 
+#include <atomic>
+#include <map>
+#include <set>
 #include <string>
 #include <stdint.h>
 #include "Ast.h"
 
 using namespace std::literals::string_literals;
 
+// With a profile, the side of an if taken this many times less often than the
+// other is laid out as cold
+#define COLD_BRANCH_RATIO 16
+
+// With a profile, hot counted loops running at least UNROLL_MIN_TRIPS
+// iterations per entry run UNROLL_FACTOR iterations per jump back
+#define UNROLL_FACTOR 4
+#define UNROLL_MIN_TRIPS 16
+
+// The function profile sites are named after. Outlined @parallel bodies count
+// as part of the function they were outlined from.
+static std::string site_owner;
+
+// An arena opened by @arena(name), released when its scope is left
+struct ArenaScope
+{
+    std::string local;
+    int loop_depth;
+};
+
+static std::vector<ArenaScope> arena_scopes;
+static int loop_depth;
+
+// Label ids of the enclosing loops, innermost last, for break and continue
+static std::vector<int> loop_ids;
+
+// The body of a @parallel loop, outlined into a function of its own
+struct ParallelBody
+{
+    AstLoop *loop;
+    std::string name;
+    std::string owner;
+};
+
+// Outlined bodies waiting for the function they are in to end, as the IL can
+// not nest functions
+static std::vector<ParallelBody> parallel_bodies;
+
+// The async function being generated, whose await points resume at
+// "lblawait" + id in the order of their states
+struct AsyncFn
+{
+    std::string suspend;
+    std::vector<int> awaits;
+};
+
+static AsyncFn *async_fn;
+
+// The rarely run side of an if, moved to the end of its function so the
+// other side falls through. It is generated in the state it was found in, and
+// jumps back to resume after the if.
+struct ColdBlock
+{
+    AstBlock *block;
+    std::string label;
+    std::string resume;
+    std::string site;
+    std::vector<AstDec *> scope;
+    std::vector<AstDec *> args;
+    std::vector<int> loop_ids;
+    std::vector<ArenaScope> arena_scopes;
+    int loop_depth;
+};
+
+static std::vector<ColdBlock> cold_blocks;
+
+// The IL function being generated if it calls the --instrument-functions
+// hooks, empty otherwise
+static std::string instrumented_fn;
+
+// Runtime functions the code generator declared itself
+static std::set<std::string> runtime_fns;
+
+// Struct locals of the function being generated that are never used but for
+// their fields, which are kept in locals of their own named "<local>~<field>"
+// instead of allocating the struct
+static std::map<const AstDec *, AstStruct *> scalar_structs;
+
+// Lengths of the array locals of the function being generated that are
+// created by an array literal and never assigned to
+static std::map<std::string, uint32_t> array_lengths;
+
+// Arrays and indices, as variable names or decimal constants, known to be in
+// bounds where code is being generated, so --bounds-check leaves out the
+// check of indexing the one with the other
+static std::set<std::pair<std::string, std::string>> checked_indices;
+
 static const std::map<std::string, int> type_size_map = {
     {"u8", 1},
     {"bool", 1},
@@ -20,6 +110,9 @@ static const std::map<std::string, int> type_size_map = {
     {"f64", 8},
     {"str", 1},
     {"ptr", 4},
+    {"f32x4", 16},
+    {"i32x4", 16},
+    {"u8x16", 16},
     {"void", 1},
 };
 
@@ -66,18 +159,289 @@ static std::string type_to_string(const AstType *type)
     return type->name;
 }
 
+AstAttribute *find_attribute(const AstNode *node, const std::string &name)
+{
+    for (auto attribute : node->attributes)
+    {
+        if (attribute->name == name)
+        {
+            return attribute;
+        }
+    }
+
+    return nullptr;
+}
+
+// Declares a function of the C runtime, unless an extern already did
+static void declare_runtime(
+    ILemitter &il, Semantics &sem, const std::string &name,
+    unsigned char return_type, std::vector<unsigned char> params)
+{
+    if (sem.p2_get_fn(name) || runtime_fns.count(name))
+    {
+        return;
+    }
+
+    runtime_fns.insert(name);
+
+    il.external_function(
+        name.c_str(), return_type, (uint32_t)params.size(), params.data());
+}
+
+// Counts an execution of a site, when generating a profile
+static void profile_count(const std::string &site, ILemitter &il, Semantics &sem)
+{
+    if (!sem.profile_generate)
+    {
+        return;
+    }
+
+    declare_runtime(il, sem, "dusk_profile_count", VOID, {STR});
+    il.push_str(site.c_str());
+    il.call("dusk_profile_count");
+}
+
+// Calls an --instrument-functions hook, dusk_fn_enter or dusk_fn_exit, with
+// the id of the IL function being generated
+static void instrument_hook(const char *hook, ILemitter &il, Semantics &sem)
+{
+    auto id = function_ids.find(instrumented_fn);
+
+    if (!sem.instrument_functions || id == function_ids.end())
+    {
+        return;
+    }
+
+    declare_runtime(il, sem, hook, VOID, {U32});
+    il.push_u32(id->second);
+    il.call(hook);
+}
+
+// Hands the runtime the names of the instrumented functions, one per line in
+// the order of their ids, before main is entered
+static void instrument_names(ILemitter &il, Semantics &sem)
+{
+    std::vector<std::string> names(function_ids.size());
+
+    for (auto &fn : function_ids)
+    {
+        names[fn.second] = fn.first;
+    }
+
+    std::string lines;
+
+    for (auto &name : names)
+    {
+        lines += name + "\n";
+    }
+
+    declare_runtime(il, sem, "dusk_instrument_names", VOID, {STR});
+    il.push_str(lines.c_str());
+    il.call("dusk_instrument_names");
+}
+
+// Allocates the number of bytes on top of the stack, from the innermost arena
+// if there is one. When tracking allocations, the site is described by its
+// position and the type allocated.
+static void emit_alloc(const AstNode *site, const std::string &type,
+                       ILemitter &il, Semantics &sem)
+{
+    if (arena_scopes.empty() && sem.track_allocations)
+    {
+        auto description = source_path + ":" + std::to_string(site->line) +
+                           ":" + std::to_string(site->column) + " " + type;
+
+        declare_runtime(il, sem, "dusk_alloc_track", STR, {STR, U32});
+        il.push_str(description.c_str());
+        il.call("dusk_alloc_track");
+        return;
+    }
+
+    if (arena_scopes.empty())
+    {
+        declare_runtime(il, sem, "malloc", STR, {U32});
+        il.call("malloc");
+        return;
+    }
+
+    declare_runtime(il, sem, "dusk_arena_alloc", STR, {U32, U32});
+    il.load_local(arena_scopes.back().local.c_str());
+    il.call("dusk_arena_alloc");
+}
+
+// Applies the affix op to the two operands on top of the stack
+static void binary_operator(const std::string &op, ILemitter &il, Semantics &sem)
+{
+    auto fn = sem.p2_get_affix(op);
+
+    if (fn)
+    {
+        for (auto attribute : fn->attributes)
+        {
+            if (attribute->name == "inline")
+            {
+                // Inlined code belongs to the expression it is inlined into
+                auto lines = il.lines;
+                il.lines = false;
+
+                for (auto stmt : fn->body->statements)
+                {
+                    generate_il(stmt, il, sem);
+                }
+
+                il.lines = lines;
+                return;
+            }
+        }
+        il.call(op.c_str());
+    }
+}
+
+static void open_arena(AstAttribute *attribute, ILemitter &il, Semantics &sem)
+{
+    auto name = ((AstSymbol *)attribute->args[0])->name;
+    auto local = "~arena_"s + name + std::to_string(g_counter);
+    uint32_t chunk_size = 4096;
+
+    if (attribute->args.size() > 1)
+    {
+        chunk_size = (uint32_t)((AstNumber *)attribute->args[1])->value.u;
+    }
+
+    declare_runtime(il, sem, "dusk_arena_new", U32, {U32});
+
+    il.function_local(scope_owner.c_str(), local.c_str(), U32);
+    il.push_u32(chunk_size);
+    il.call("dusk_arena_new");
+    il.store_local(local.c_str());
+
+    arena_scopes.push_back({local, loop_depth});
+}
+
+static void release_arena(
+    const ArenaScope &arena, ILemitter &il, Semantics &sem)
+{
+    declare_runtime(il, sem, "dusk_arena_release", VOID, {U32});
+
+    il.load_local(arena.local.c_str());
+    il.call("dusk_arena_release");
+}
+
+static void close_arena(ILemitter &il, Semantics &sem)
+{
+    release_arena(arena_scopes.back(), il, sem);
+    arena_scopes.pop_back();
+}
+
+// Releases the arenas a break or continue jumps out of
+static void release_loop_arenas(ILemitter &il, Semantics &sem)
+{
+    for (size_t i = arena_scopes.size(); i; i--)
+    {
+        if (arena_scopes[i - 1].loop_depth != loop_depth)
+        {
+            break;
+        }
+
+        release_arena(arena_scopes[i - 1], il, sem);
+    }
+}
+
+// Gathers the variables code assigns to or declares, including the counters
+// and reductions of its loops
+static void assigned_variables(AstNode *node, std::set<std::string> &names,
+                               Semantics &sem)
+{
+    if (node->node_type == AstNodeType::AstBinaryExpr &&
+        ((AstBinaryExpr *)node)->op == "=" &&
+        ((AstBinaryExpr *)node)->lhs->node_type == AstNodeType::AstSymbol)
+    {
+        names.insert(((AstSymbol *)((AstBinaryExpr *)node)->lhs)->name);
+    }
+    else if (node->node_type == AstNodeType::AstDec)
+    {
+        names.insert(((AstDec *)node)->name);
+    }
+    else if (node->node_type == AstNodeType::AstLoop)
+    {
+        auto loop = (AstLoop *)node;
+
+        if (sem.counter(loop))
+        {
+            names.insert(loop->name);
+        }
+
+        for (auto &reduction : sem.parallel(loop).reductions)
+        {
+            names.insert(reduction.first->name);
+        }
+    }
+
+    for (auto child : ast_children(node))
+    {
+        assigned_variables(child, names, sem);
+    }
+}
+
+// Forgets the indices known in bounds that involve one of the variables
+static void forget_bounds(const std::set<std::string> &names)
+{
+    for (auto it = checked_indices.begin(); it != checked_indices.end();)
+    {
+        if (names.count(it->first) || names.count(it->second))
+        {
+            it = checked_indices.erase(it);
+        }
+        else
+        {
+            it++;
+        }
+    }
+}
+
+// Forgets the indices known in bounds that involve a variable code assigns to
+static void forget_bounds(AstNode *node, Semantics &sem)
+{
+    if (checked_indices.empty())
+    {
+        return;
+    }
+
+    std::set<std::string> names;
+    assigned_variables(node, names, sem);
+    forget_bounds(names);
+}
+
 void AstBlock::code_gen(ILemitter &il, Semantics &sem)
 {
+    // What the block finds out does not hold where it is not run
+    auto outer_checked = checked_indices;
+
     push_scope();
     g_counter++;
 
+    auto arena = find_attribute(this, "arena");
+
+    if (arena)
+    {
+        open_arena(arena, il, sem);
+    }
+
     for (auto stmt : statements)
     {
         generate_il(stmt, il, sem);
     }
 
+    if (arena)
+    {
+        close_arena(il, sem);
+    }
+
     g_counter++;
     pop_scope();
+
+    checked_indices = outer_checked;
+    forget_bounds(this, sem);
 }
 
 void AstString::code_gen(ILemitter &il, Semantics &sem)
@@ -175,15 +539,28 @@ void AstBoolean::code_gen(ILemitter &il, Semantics &sem)
 
 void AstArray::code_gen(ILemitter &il, Semantics &sem)
 {
-    il.push_u32(type_to_size(ele_type) * elements.size());
-    il.call("malloc");
+    auto ele_type = sem.type_of(this);
+    auto element = ele_type->is_array ? ele_type->subtype : ele_type;
+
+    // The length is kept in front of the first element
+    il.push_u32(type_to_size(ele_type) * elements.size() + 4);
+    emit_alloc(this, element->name + "[" + std::to_string(elements.size()) + "]",
+               il, sem);
+    il.push_u32(4);
+    il.integer_add();
     unsigned int offset = 0;
 
-    for (int i = 0; i < elements.size(); i++)
+    for (int i = 0; i <= elements.size(); i++)
     {
         il.duplicate();
     }
 
+    il.push_u32(elements.size());
+    il.swap();
+    il.push_u32(4);
+    il.integer_subtract();
+    il.write();
+
     for (int i = 0; i < elements.size(); i++)
     {
 
@@ -199,88 +576,566 @@ void AstArray::code_gen(ILemitter &il, Semantics &sem)
     }
 }
 
-void AstDec::code_gen(ILemitter &il, Semantics &sem)
+// The field of a struct with the given name, nullptr if it has none
+static AstDec *struct_field(AstStruct *sct, const std::string &name)
 {
-    add_local(this);
-
-    il.function_local( // TODO
-        scope_owner.c_str(),
-        name.c_str(),
-        type_to_il_type(type));
-
-    if (value)
+    for (auto stmt : sct->block->statements)
     {
-        generate_il(value, il, sem);
+        auto field = (AstDec *)stmt;
+
+        if (field->name == name)
+        {
+            return field;
+        }
     }
 
-    il.store_local(name.c_str());
+    return nullptr;
 }
 
-void AstIf::code_gen(ILemitter &il, Semantics &sem)
+// Whether code uses the struct local name for anything but reading and
+// writing its fields, like passing it on or calling its methods, which needs
+// the struct in memory
+static bool struct_escapes(AstNode *node, const std::string &name,
+                           AstStruct *sct, Semantics &sem)
 {
-    //auto buf = g_counter;
-    g_counter++;
+    switch (node->node_type)
+    {
+    case AstNodeType::AstSymbol:
+        return ((AstSymbol *)node)->name == name;
 
-    auto lbl = "lbl"s + std::to_string(g_counter);
-    auto lblout = "lblout"s + std::to_string(g_counter);
+    case AstNodeType::AstBinaryExpr:
+    {
+        auto bin_expr = (AstBinaryExpr *)node;
 
-    generate_il(condition, il, sem);
+        // The right hand side names a field or a method
+        if (bin_expr->op == "." &&
+            bin_expr->rhs->node_type == AstNodeType::AstSymbol)
+        {
+            if (bin_expr->lhs->node_type == AstNodeType::AstSymbol &&
+                ((AstSymbol *)bin_expr->lhs)->name == name)
+            {
+                return !struct_field(sct, ((AstSymbol *)bin_expr->rhs)->name);
+            }
 
-    il.jump_equal_zero(lbl.c_str());
+            return struct_escapes(bin_expr->lhs, name, sct, sem);
+        }
+        break;
+    }
 
-    generate_il(true_block, il, sem);
-    il.jump(lblout.c_str());
+    case AstNodeType::AstLoop:
+    {
+        // A @parallel loop copies what it reads into a function of its own
+        for (auto capture : sem.parallel((AstLoop *)node).captures)
+        {
+            if (capture->name == name)
+            {
+                return true;
+            }
+        }
+        break;
+    }
 
-    il.label(lbl.c_str());
+    default:
+        break;
+    }
 
-    if (false_block)
+    for (auto child : ast_children(node))
     {
-        generate_il(false_block, il, sem);
+        if (struct_escapes(child, name, sct, sem))
+        {
+            return true;
+        }
     }
 
-    il.label(lblout.c_str());
-    g_counter++;
+    return false;
+}
 
-    // g_counter = buf;
+// Gathers the locals declared in code, and the names of all of them
+static void declared_locals(AstNode *node, std::vector<AstDec *> &decls,
+                            std::multiset<std::string> &names)
+{
+    if (node->node_type == AstNodeType::AstDec)
+    {
+        decls.push_back((AstDec *)node);
+        names.insert(((AstDec *)node)->name);
+    }
+    else if (node->node_type == AstNodeType::AstLoop)
+    {
+        names.insert(((AstLoop *)node)->name);
+    }
+
+    for (auto child : ast_children(node))
+    {
+        declared_locals(child, decls, names);
+    }
 }
 
-void AstFn::code_gen(ILemitter &il, Semantics &sem)
+// The struct locals of a function body that are created by a struct literal,
+// declared once and only used to read and write their fields. They are
+// replaced by a local per field, so the struct is never allocated.
+static std::map<const AstDec *, AstStruct *> find_scalar_structs(
+    AstBlock *body, const std::vector<AstDec *> &params, Semantics &sem)
 {
-    scope_owner = mangled_name;
+    std::map<const AstDec *, AstStruct *> result;
+    std::vector<AstDec *> decls;
+    std::multiset<std::string> names;
 
-    if (body)
+    declared_locals(body, decls, names);
+
+    for (auto param : params)
     {
+        names.insert(param->name);
+    }
 
-        for (auto param : params)
+    for (auto dec : decls)
+    {
+        if (!dec->value || dec->value->node_type != AstNodeType::AstFnCall ||
+            names.count(dec->name) != 1)
         {
-            il.function_parameter(
-                mangled_name.c_str(),
-                param->name.c_str(),
-                type_to_il_type(param->type));
+            continue;
         }
-        il.internal_function(
-            mangled_name.c_str(), type_to_il_type(return_type));
-    }
-    else
-    {
-        unsigned char args[params.size()];
 
-        for (size_t i = 0; i < params.size(); i++)
+        auto call = (AstFnCall *)dec->value;
+        auto sct = sem.p2_get_struct(sem.callee(call));
+
+        if (sct && call->args.size() == sct->block->statements.size() &&
+            !struct_escapes(body, dec->name, sct, sem))
         {
-            args[i] = type_to_il_type(params[i]->type);
+            result[dec] = sct;
         }
-
-        il.external_function(
-            unmangled_name.c_str(),
-            type_to_il_type(return_type),
-            (uint32_t)params.size(),
-            args);
     }
 
-    if (body)
-    {
+    return result;
+}
 
-        il.function(mangled_name.c_str());
+// The local a `.` expression reads or writes if it names a field of a struct
+// replaced by its fields, empty otherwise
+static std::string scalar_field(const AstBinaryExpr *node)
+{
+    if (node->op != "." || node->lhs->node_type != AstNodeType::AstSymbol ||
+        node->rhs->node_type != AstNodeType::AstSymbol)
+    {
+        return "";
+    }
+
+    auto local = get_local((AstSymbol *)node->lhs);
+
+    if (!local || !scalar_structs.count(local))
+    {
+        return "";
+    }
+
+    return local->name + "~" + ((AstSymbol *)node->rhs)->name;
+}
+
+static bool assigns_to(AstNode *node, const std::string &name);
+
+// The lengths of the array locals of a function body that are created by an
+// array literal, declared once and never assigned to
+static std::map<std::string, uint32_t> find_array_lengths(
+    AstBlock *body, const std::vector<AstDec *> &params)
+{
+    std::map<std::string, uint32_t> result;
+    std::vector<AstDec *> decls;
+    std::multiset<std::string> names;
+
+    declared_locals(body, decls, names);
+
+    for (auto param : params)
+    {
+        names.insert(param->name);
+    }
+
+    for (auto dec : decls)
+    {
+        if (dec->value && dec->value->node_type == AstNodeType::AstArray &&
+            names.count(dec->name) == 1 && !assigns_to(body, dec->name))
+        {
+            result[dec->name] = ((AstArray *)dec->value)->elements.size();
+        }
+    }
+
+    return result;
+}
+
+static bool integer_constant(AstNode *node, int64_t &value)
+{
+    if (node->node_type != AstNodeType::AstNumber ||
+        ((AstNumber *)node)->is_float)
+    {
+        return false;
+    }
+
+    auto number = (AstNumber *)node;
+    value = number->is_signed ? number->value.i : (int64_t)number->value.u;
+    return true;
+}
+
+// How an array or index is known to checked_indices: the name of a variable
+// or a decimal constant, empty for anything else
+static std::string bounds_key(AstNode *node)
+{
+    int64_t value;
+
+    if (integer_constant(node, value))
+    {
+        return std::to_string(value);
+    }
+
+    if (node->node_type == AstNodeType::AstSymbol &&
+        (has_local((AstSymbol *)node) || has_arg((AstSymbol *)node)))
+    {
+        return ((AstSymbol *)node)->name;
+    }
+
+    return "";
+}
+
+// Whether indexing is known to stay in bounds: the index is a constant within
+// the length of an array literal, or the array was indexed with it before and
+// neither was assigned since. Otherwise the index is about to be checked, so
+// it is known in bounds from here on.
+static bool index_in_bounds(AstIndex *index)
+{
+    auto array = bounds_key(index->array);
+    auto key = bounds_key(index->expr);
+    auto length = array_lengths.find(array);
+    int64_t value;
+
+    if (array.empty() || key.empty())
+    {
+        return false;
+    }
+
+    if (length != array_lengths.end() &&
+        integer_constant(index->expr, value) && value >= 0 &&
+        value < length->second)
+    {
+        return true;
+    }
+
+    return !checked_indices.insert({array, key}).second;
+}
+
+// Marks the counter of a counted loop in bounds, for its body, of the arrays
+// it can not leave: the loop runs up to len(array), or up to a constant no
+// larger than the length of an array literal, and assigns neither the counter
+// nor the array
+static void counter_bounds(AstLoop *loop, Semantics &sem)
+{
+    std::set<std::string> assigned;
+    assigned_variables(loop->body, assigned, sem);
+
+    int64_t bound;
+
+    if (assigned.count(loop->name))
+    {
+        return;
+    }
+
+    if (sem.is_array_length(loop->expr))
+    {
+        auto array = bounds_key(((AstFnCall *)loop->expr)->args[0]);
+
+        if (!array.empty() && !assigned.count(array))
+        {
+            checked_indices.insert({array, loop->name});
+        }
+    }
+    else if (integer_constant(loop->expr, bound))
+    {
+        for (auto &length : array_lengths)
+        {
+            if (bound <= length.second)
+            {
+                checked_indices.insert({length.first, loop->name});
+            }
+        }
+    }
+}
+
+void AstDec::code_gen(ILemitter &il, Semantics &sem)
+{
+    add_local(this);
+
+    auto scalar = scalar_structs.find(this);
+
+    if (scalar != scalar_structs.end())
+    {
+        // The fields are stored in order, like a struct literal writes them
+        auto call = (AstFnCall *)value;
+
+        for (size_t i = 0; i < call->args.size(); i++)
+        {
+            auto field = (AstDec *)scalar->second->block->statements[i];
+            auto local = name + "~" + field->name;
+
+            il.function_local(scope_owner.c_str(), local.c_str(),
+                              type_to_il_type(field->type));
+            generate_il(call->args[i], il, sem);
+            il.store_local(local.c_str());
+        }
+        return;
+    }
+
+    il.function_local( // TODO
+        scope_owner.c_str(),
+        name.c_str(),
+        type_to_il_type(sem.type_of(this)));
+
+    if (value)
+    {
+        generate_il(value, il, sem);
+    }
+
+    il.store_local(name.c_str());
+    forget_bounds({name});
+}
+
+// Whether code calls a @cold function, which marks it as rarely run
+static bool calls_cold(AstNode *node, Semantics &sem)
+{
+    if (node->node_type == AstNodeType::AstFnCall)
+    {
+        auto fn = sem.p2_get_fn(sem.callee((AstFnCall *)node));
+
+        if (fn && find_attribute(fn, "cold"))
+        {
+            return true;
+        }
+    }
+
+    for (auto child : ast_children(node))
+    {
+        if (calls_cold(child, sem))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Emits the cold blocks of the function being generated, after its last
+// return so nothing falls into them
+static void cold_blocks_code_gen(ILemitter &il, Semantics &sem)
+{
+    auto outer_scope = scope;
+    auto outer_args = args;
+    auto outer_loop_ids = loop_ids;
+    auto outer_arenas = arena_scopes;
+    auto outer_loop_depth = loop_depth;
+    auto outer_checked = checked_indices;
+
+    // Cold blocks may defer cold blocks of their own
+    for (size_t i = 0; i < cold_blocks.size(); i++)
+    {
+        auto cold = cold_blocks[i];
+
+        scope = cold.scope;
+        args = cold.args;
+        loop_ids = cold.loop_ids;
+        arena_scopes = cold.arena_scopes;
+        loop_depth = cold.loop_depth;
+
+        // Nothing is known about where the block is entered from
+        checked_indices.clear();
+
+        il.label(cold.label.c_str());
+        profile_count(cold.site, il, sem);
+        generate_il(cold.block, il, sem);
+        il.jump(cold.resume.c_str());
+    }
+
+    cold_blocks.clear();
+
+    scope = outer_scope;
+    args = outer_args;
+    loop_ids = outer_loop_ids;
+    arena_scopes = outer_arenas;
+    loop_depth = outer_loop_depth;
+    checked_indices = outer_checked;
+}
+
+void AstIf::code_gen(ILemitter &il, Semantics &sem)
+{
+    //auto buf = g_counter;
+    g_counter++;
+
+    auto lbl = "lbl"s + std::to_string(g_counter);
+    auto lblout = "lblout"s + std::to_string(g_counter);
+
+    auto then_site = Profile::site("if", site_owner, this, "then");
+    auto else_site = Profile::site("if", site_owner, this, "else");
+
+    // An unlikely side, or one calling a @cold function, is moved to the end
+    // of the function and the branch inverted if need be, so the likely side
+    // falls through. Without hints the profile decides, if there is one.
+    AstBlock *cold = nullptr;
+    bool likely = find_attribute(this, "likely");
+
+    if (find_attribute(this, "unlikely") ||
+        (!likely && calls_cold(true_block, sem)))
+    {
+        cold = true_block;
+    }
+    else if (false_block && (likely || calls_cold(false_block, sem)))
+    {
+        cold = false_block;
+    }
+    else if (!likely && !sem.profile.empty())
+    {
+        auto then_count = sem.profile.count(then_site);
+        auto else_count = sem.profile.count(else_site);
+
+        if (then_count * COLD_BRANCH_RATIO < else_count)
+        {
+            cold = true_block;
+        }
+        else if (false_block && else_count * COLD_BRANCH_RATIO < then_count)
+        {
+            cold = false_block;
+        }
+    }
+
+    generate_il(condition, il, sem);
+
+    if (cold)
+    {
+        auto lblcold = "lblcold"s + std::to_string(g_counter);
+        auto cold_site = cold == true_block ? then_site : else_site;
+
+        cold_blocks.push_back({cold, lblcold, lblout, cold_site, scope, args,
+                               loop_ids, arena_scopes, loop_depth});
+
+        if (cold == true_block)
+        {
+            il.jump_not_equal_zero(lblcold.c_str());
+            profile_count(else_site, il, sem);
+
+            if (false_block)
+            {
+                generate_il(false_block, il, sem);
+            }
+        }
+        else
+        {
+            il.jump_equal_zero(lblcold.c_str());
+            profile_count(then_site, il, sem);
+            generate_il(true_block, il, sem);
+        }
+
+        // The cold block is generated later, but runs before lblout
+        forget_bounds(cold, sem);
+
+        il.label(lblout.c_str());
+        g_counter++;
+        return;
+    }
+
+    il.jump_equal_zero(lbl.c_str());
+
+    profile_count(then_site, il, sem);
+    generate_il(true_block, il, sem);
+    il.jump(lblout.c_str());
+
+    il.label(lbl.c_str());
+    profile_count(else_site, il, sem);
+
+    if (false_block)
+    {
+        generate_il(false_block, il, sem);
+    }
+
+    il.label(lblout.c_str());
+    g_counter++;
+
+    // g_counter = buf;
+}
+
+static void parallel_body(const ParallelBody &outlined, ILemitter &il, Semantics &sem);
+static void async_fn_code_gen(AstFn *fn, ILemitter &il, Semantics &sem);
+
+// Emits the bodies of the @parallel loops of the function just ended
+static void parallel_bodies_code_gen(ILemitter &il, Semantics &sem)
+{
+    while (!parallel_bodies.empty())
+    {
+        auto outlined = parallel_bodies.front();
+        parallel_bodies.erase(parallel_bodies.begin());
+
+        parallel_body(outlined, il, sem);
+    }
+}
+
+void AstFn::code_gen(ILemitter &il, Semantics &sem)
+{
+    auto &mangled_name = sem.symbol(this);
+    auto &params = sem.params(this);
+
+    scope_owner = mangled_name;
+    site_owner = mangled_name;
+    scalar_structs.clear();
+    checked_indices.clear();
+    array_lengths.clear();
+
+    if (body)
+    {
+        array_lengths = find_array_lengths(body, params);
+    }
+
+    if (is_async && body)
+    {
+        async_fn_code_gen(this, il, sem);
+        parallel_bodies_code_gen(il, sem);
+        return;
+    }
+
+    if (body)
+    {
+
+        for (auto param : params)
+        {
+            il.function_parameter(
+                mangled_name.c_str(),
+                param->name.c_str(),
+                type_to_il_type(param->type));
+        }
+        il.internal_function(
+            mangled_name.c_str(), type_to_il_type(return_type));
+    }
+    else
+    {
+        unsigned char args[params.size()];
+
+        for (size_t i = 0; i < params.size(); i++)
+        {
+            args[i] = type_to_il_type(params[i]->type);
+        }
+
+        il.external_function(
+            unmangled_name.c_str(),
+            type_to_il_type(return_type),
+            (uint32_t)params.size(),
+            args);
+    }
+
+    if (body)
+    {
+
+        il.function(mangled_name.c_str());
+
+        if (!find_attribute(this, "il"))
+        {
+            if (sem.instrument_functions && mangled_name == "main")
+            {
+                instrument_names(il, sem);
+            }
+
+            instrumented_fn = mangled_name;
+            instrument_hook("dusk_fn_enter", il, sem);
+            profile_count(Profile::fn_site(mangled_name), il, sem);
+        }
 
         push_scope();
 
@@ -289,41 +1144,61 @@ void AstFn::code_gen(ILemitter &il, Semantics &sem)
             add_arg(param);
         }
 
-        if (attributes.size() == 0)
+        auto outer_arenas = arena_scopes;
+        auto outer_loop_depth = loop_depth;
+        arena_scopes.clear();
+        loop_depth = 0;
+
+        auto arena = find_attribute(this, "arena");
+
+        if (arena)
+        {
+            open_arena(arena, il, sem);
+        }
+
+        if (!find_attribute(this, "il"))
         {
+            scalar_structs = find_scalar_structs(body, params, sem);
             generate_il(body, il, sem);
         }
         else
         {
-            for (auto attribute : attributes)
+            for (auto stmt : body->statements)
             {
-                if (attribute->name == "il")
+                if (stmt->node_type == AstNodeType::AstNumber)
                 {
-                    for (auto stmt : body->statements)
+                    auto number = (AstNumber *)stmt;
+
+                    if (number->is_signed)
                     {
-                        if (stmt->node_type == AstNodeType::AstNumber)
-                        {
-                            auto number = (AstNumber *)stmt;
-
-                            if (number->is_signed)
-                            {
-                                il.w((unsigned char)number->value.i);
-                            }
-                            else
-                            {
-                                il.w((char)number->value.u);
-                            }
-                        }
+                        il.w((unsigned char)number->value.i);
+                    }
+                    else
+                    {
+                        il.w((char)number->value.u);
                     }
-
-                    break;
                 }
             }
         }
 
+        if (arena)
+        {
+            close_arena(il, sem);
+        }
+
+        arena_scopes = outer_arenas;
+        loop_depth = outer_loop_depth;
+
         pop_scope();
 
+        instrument_hook("dusk_fn_exit", il, sem);
         il._return();
+
+        cold_blocks_code_gen(il, sem);
+        instrumented_fn.clear();
+        scalar_structs.clear();
+
+        parallel_bodies_code_gen(il, sem);
     }
 }
 
@@ -341,13 +1216,13 @@ unsigned int calculate_struct_size(AstStruct *node)
 
 void AstFnCall::code_gen(ILemitter &il, Semantics &sem)
 {
-
+    auto &name = sem.callee(this);
     auto sct = sem.p2_get_struct(name);
     if (sct)
     {
         auto size = calculate_struct_size(sct);
         il.push_u32(size);
-        il.call("malloc");
+        emit_alloc(this, name, il, sem);
         unsigned int offset = 0;
 
         for (int i = 0; i < args.size(); i++)
@@ -373,7 +1248,16 @@ void AstFnCall::code_gen(ILemitter &il, Semantics &sem)
         return;
     }
 
-    auto fn = sem.p2_get_fn(name);
+    if (sem.is_array_length(this))
+    {
+        generate_il(args[0], il, sem);
+        il.push_u32(4);
+        il.integer_subtract();
+        il.read();
+        return;
+    }
+
+    auto fn = sem.p2_get_fn(name);
 
     for (size_t i = args.size(); i; i--)
     {
@@ -381,332 +1265,1956 @@ void AstFnCall::code_gen(ILemitter &il, Semantics &sem)
         generate_il(z, il, sem);
     }
 
-    if (fn && fn->attributes.size() == 0)
+    // Arrays are allocated from their length on
+    if (fn && !fn->body && fn->unmangled_name == "free" && args.size() == 1)
+    {
+        auto type = sem.infer_type(args[0]);
+
+        if (type && type->is_array)
+        {
+            il.push_u32(4);
+            il.integer_subtract();
+        }
+
+        delete type;
+    }
+
+    // Memory from the tracking allocator is released through it, so its
+    // live bytes stay right
+    if (fn && !fn->body && fn->unmangled_name == "free" &&
+        sem.track_allocations)
+    {
+        declare_runtime(il, sem, "dusk_alloc_free", VOID, {STR});
+        il.call("dusk_alloc_free");
+    }
+    else if (fn && !find_attribute(fn, "il"))
     {
         il.call(name.c_str());
     }
     else if (fn)
     {
-        for (auto attribute : fn->attributes)
+        for (auto stmt : fn->body->statements)
         {
-            if (attribute->name == "il")
+            if (stmt->node_type == AstNodeType::AstNumber)
             {
-                for (auto stmt : fn->body->statements)
+                auto number = (AstNumber *)stmt;
+
+                if (number->is_signed)
                 {
-                    if (stmt->node_type == AstNodeType::AstNumber)
-                    {
-                        auto number = (AstNumber *)stmt;
-
-                        if (number->is_signed)
-                        {
-                            il.w((uint8_t)number->value.i);
-                        }
-                        else
-                        {
-                            il.w((int8_t)number->value.u);
-                        }
-                    }
+                    il.w((uint8_t)number->value.i);
+                }
+                else
+                {
+                    il.w((int8_t)number->value.u);
+                }
+            }
+        }
+    }
+}
+
+// A counted loop whose every statement is `dst[i] = expr`, where expr is
+// element-wise arithmetic over arrays indexed by the counter and loop
+// invariant scalars of the same element type
+struct VectorLoop
+{
+    std::string element;
+    std::string ops;
+    uint8_t type = VOID;
+    uint32_t lanes = 0;
+    std::vector<AstSymbol *> arrays;
+    std::set<std::string> stored;
+};
+
+static const struct
+{
+    const char *element;
+    uint8_t type;
+    uint32_t lanes;
+    const char *ops;
+} vector_shapes[] = {
+    {"f32", F32X4, 4, "+-*/"},
+    {"i32", I32X4, 4, "+-*"},
+    {"u8", U8X16, 16, "+-"},
+};
+
+static AstSymbol *counter_indexed_array(AstNode *node, const std::string &counter)
+{
+    if (node->node_type != AstNodeType::AstIndex)
+    {
+        return nullptr;
+    }
+
+    auto index = (AstIndex *)node;
+
+    if (index->array->node_type != AstNodeType::AstSymbol ||
+        index->expr->node_type != AstNodeType::AstSymbol ||
+        ((AstSymbol *)index->expr)->name != counter)
+    {
+        return nullptr;
+    }
+
+    return (AstSymbol *)index->array;
+}
+
+static bool has_element_type(AstNode *node, const std::string &element, Semantics &sem)
+{
+    auto type = sem.infer_type(node);
+    bool result = type && !type->is_array && type->name == element;
+
+    delete type;
+
+    return result;
+}
+
+static bool plan_vector_array(AstSymbol *array, VectorLoop &plan, Semantics &sem)
+{
+    if (!has_local(array) && !has_arg(array))
+    {
+        return false;
+    }
+
+    auto type = sem.infer_type(array);
+    bool result = type && type->is_array && type->subtype &&
+                  type->subtype->name == plan.element;
+
+    delete type;
+
+    if (!result)
+    {
+        return false;
+    }
+
+    for (auto known : plan.arrays)
+    {
+        if (known->name == array->name)
+        {
+            return true;
+        }
+    }
+
+    plan.arrays.push_back(array);
+
+    return true;
+}
+
+static bool plan_vector_expr(AstNode *node, const std::string &counter, VectorLoop &plan, Semantics &sem)
+{
+    if (auto array = counter_indexed_array(node, counter))
+    {
+        return plan_vector_array(array, plan, sem);
+    }
+
+    switch (node->node_type)
+    {
+    case AstNodeType::AstBinaryExpr:
+    {
+        auto bin_expr = (AstBinaryExpr *)node;
+        auto &name = sem.op(bin_expr);
+        auto op = name.substr(0, 1);
+
+        return plan.ops.find(op) != std::string::npos &&
+               name == op + plan.element + plan.element &&
+               plan_vector_expr(bin_expr->lhs, counter, plan, sem) &&
+               plan_vector_expr(bin_expr->rhs, counter, plan, sem);
+    }
+
+    case AstNodeType::AstNumber:
+        return has_element_type(node, plan.element, sem);
+
+    case AstNodeType::AstSymbol:
+        return ((AstSymbol *)node)->name != counter &&
+               has_element_type(node, plan.element, sem);
+
+    default:
+        return false;
+    }
+}
+
+// Decides whether a counted loop can run lanes iterations at a time. Every
+// access is to element i of its array, so the only dependences are within an
+// iteration and keep their order; overlapping arrays are checked at runtime
+static bool plan_vector_loop(AstLoop *loop, AstNode *bound, VectorLoop &plan, Semantics &sem)
+{
+    auto &counter = loop->name;
+    auto type = sem.type_of(sem.counter(loop));
+
+    if (!type || type->name != "i32" ||
+        (bound->node_type != AstNodeType::AstNumber &&
+         bound->node_type != AstNodeType::AstSymbol &&
+         !sem.is_array_length(bound)) ||
+        loop->body->statements.empty() || !loop->body->attributes.empty())
+    {
+        return false;
+    }
+
+    for (auto stmt : loop->body->statements)
+    {
+        if (stmt->node_type != AstNodeType::AstBinaryExpr ||
+            ((AstBinaryExpr *)stmt)->op != "=" || !stmt->attributes.empty())
+        {
+            return false;
+        }
+
+        auto assign = (AstBinaryExpr *)stmt;
+        auto dst = counter_indexed_array(assign->lhs, counter);
+
+        if (!dst)
+        {
+            return false;
+        }
+
+        if (plan.element.empty())
+        {
+            auto type = sem.infer_type(assign->lhs);
+
+            for (auto &shape : vector_shapes)
+            {
+                if (type && type->name == shape.element)
+                {
+                    plan.element = shape.element;
+                    plan.ops = shape.ops;
+                    plan.type = shape.type;
+                    plan.lanes = shape.lanes;
                 }
+            }
+
+            delete type;
+
+            if (plan.element.empty())
+            {
+                return false;
+            }
+        }
+
+        if (!plan_vector_array(dst, plan, sem) ||
+            !plan_vector_expr(assign->rhs, counter, plan, sem))
+        {
+            return false;
+        }
 
-                break;
+        plan.stored.insert(dst->name);
+    }
+
+    // Vector loads and stores are not checked
+    if (sem.bounds_check)
+    {
+        for (auto array : plan.arrays)
+        {
+            if (!checked_indices.count({array->name, counter}))
+            {
+                return false;
             }
         }
     }
+
+    return true;
 }
 
-void AstLoop::code_gen(ILemitter &il, Semantics &sem)
+static void vector_element_address(AstSymbol *array, const std::string &counter, const VectorLoop &plan, ILemitter &il, Semantics &sem)
 {
-    auto type = sem.infer_type(expr);
+    generate_il(array, il, sem);
+    il.address_stack();
+    il.push_i32(type_size_map.at(plan.element));
+    il.load_local(counter.c_str());
+    il.integer_multiply();
+    il.integer_add();
+}
 
-    // auto buf = g_counter;
-    g_counter++;
+static void vector_expr(AstNode *node, const std::string &counter, const VectorLoop &plan, ILemitter &il, Semantics &sem)
+{
+    if (auto array = counter_indexed_array(node, counter))
+    {
+        vector_element_address(array, counter, plan, il, sem);
+        il.vector_load(plan.type);
+        return;
+    }
 
-    if (is_foreach)
+    if (node->node_type != AstNodeType::AstBinaryExpr)
     {
-        // TODO: need enumerables for this
+        generate_il(node, il, sem);
+        il.vector_splat(plan.type);
+        return;
     }
-    else if (type && type->name != "bool")
+
+    auto bin_expr = (AstBinaryExpr *)node;
+
+    vector_expr(bin_expr->lhs, counter, plan, il, sem);
+    vector_expr(bin_expr->rhs, counter, plan, il, sem);
+
+    switch (bin_expr->op[0])
     {
-        auto var = "~"s + std::to_string(g_counter++);
+    case '+':
+        il.vector_add(plan.type);
+        break;
+    case '-':
+        il.vector_subtract(plan.type);
+        break;
+    case '*':
+        il.vector_multiply(plan.type);
+        break;
+    case '/':
+        il.vector_divide(plan.type);
+        break;
+    }
+}
 
-        il.function_local(scope_owner.c_str(), var.c_str(), U32);
+// Emits the vector main loop of a counted loop. It steps the counter by the
+// lane count while a whole vector remains and leaves the rest, or everything
+// if two of the arrays partially overlap, to the scalar loop at lbl_scalar
+static void vector_main_loop(AstLoop *loop, AstNode *bound, const VectorLoop &plan, const std::string &lbl_scalar, ILemitter &il, Semantics &sem)
+{
+    auto &counter = loop->name;
+    auto id = std::to_string(g_counter);
+    auto lbl = "lblvec"s + id;
+    auto distance = "~vec"s + id;
+    auto bytes = (int32_t)(type_size_map.at(plan.element) * plan.lanes);
+    bool checked = false;
+
+    for (size_t i = 0; i < plan.arrays.size(); i++)
+    {
+        for (size_t j = i + 1; j < plan.arrays.size(); j++)
+        {
+            if (!plan.stored.count(plan.arrays[i]->name) &&
+                !plan.stored.count(plan.arrays[j]->name))
+            {
+                continue;
+            }
 
-        auto lbl = "lbl"s + std::to_string(g_counter);
-        auto lblout = "lblout"s + std::to_string(g_counter);
-        auto lblcont = "lblcont"s + std::to_string(g_counter);
+            if (!checked)
+            {
+                il.function_local(scope_owner.c_str(), distance.c_str(), I32);
+                checked = true;
+            }
 
-        il.push_u32(1);
-        il.store_local(var.c_str());
+            auto pair = id + "_"s + std::to_string(i) + "_"s + std::to_string(j);
+            auto lbl_before = "lblalias"s + pair;
+            auto lbl_after = "lblaliasb"s + pair;
 
-        // il.jump(lblcont.c_str());
+            // Identical or at least a vector apart is fine, anything in
+            // between would see a lane of the same vector written
+            generate_il(plan.arrays[i], il, sem);
+            il.address_stack();
+            generate_il(plan.arrays[j], il, sem);
+            il.address_stack();
+            il.integer_subtract();
+            il.store_local(distance.c_str());
+
+            il.load_local(distance.c_str());
+            il.jump_less_equal_zero(lbl_before.c_str());
+            il.load_local(distance.c_str());
+            il.push_i32(bytes);
+            il.integer_subtract();
+            il.jump_less_than_zero(lbl_scalar.c_str());
+            il.label(lbl_before.c_str());
+
+            il.load_local(distance.c_str());
+            il.jump_greater_equal_zero(lbl_after.c_str());
+            il.load_local(distance.c_str());
+            il.push_i32(bytes);
+            il.integer_add();
+            il.jump_greater_than_zero(lbl_scalar.c_str());
+            il.label(lbl_after.c_str());
+        }
+    }
 
-        il.label(lbl.c_str());
-        generate_il(body, il, sem);
+    il.label(lbl.c_str());
 
-        il.label(lblcont.c_str());
+    il.load_local(counter.c_str());
+    il.push_i32(plan.lanes);
+    il.integer_add();
+    generate_il(bound, il, sem);
+    il.integer_subtract();
+    il.jump_greater_than_zero(lbl_scalar.c_str());
 
-        il.load_local(var.c_str());
-        il.push_u32(1);
+    for (auto stmt : loop->body->statements)
+    {
+        auto assign = (AstBinaryExpr *)stmt;
+
+        vector_expr(assign->rhs, counter, plan, il, sem);
+        vector_element_address(counter_indexed_array(assign->lhs, counter),
+                               counter, plan, il, sem);
+        il.vector_store(plan.type);
+    }
+
+    il.load_local(counter.c_str());
+    il.push_i32(plan.lanes);
+    il.integer_add();
+    il.store_local(counter.c_str());
+
+    il.jump(lbl.c_str());
+}
+
+// Whether a node has a continue of the loop it is in
+static bool has_continue(AstNode *node)
+{
+    if (node->node_type == AstNodeType::AstContinue)
+    {
+        return true;
+    }
+
+    for (auto child : ast_children(node))
+    {
+        if (child->node_type != AstNodeType::AstLoop && has_continue(child))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Whether a node assigns to the variable called name
+static bool assigns_to(AstNode *node, const std::string &name)
+{
+    if (node->node_type == AstNodeType::AstBinaryExpr &&
+        ((AstBinaryExpr *)node)->op == "=" &&
+        ((AstBinaryExpr *)node)->lhs->node_type == AstNodeType::AstSymbol &&
+        ((AstSymbol *)((AstBinaryExpr *)node)->lhs)->name == name)
+    {
+        return true;
+    }
+
+    for (auto child : ast_children(node))
+    {
+        if (assigns_to(child, name))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Whether the profile found a counted loop hot and long running. Loops that
+// assign to their counter are left as is, as the bound is only checked once
+// per unrolled iteration, and so are those with a continue, which would leave
+// for the scalar loop.
+static bool should_unroll(AstLoop *loop, const std::string &entry_site,
+                          const std::string &body_site, Semantics &sem)
+{
+    auto entries = sem.profile.count(entry_site);
+    auto iterations = sem.profile.count(body_site);
+
+    return entries && iterations / entries >= UNROLL_MIN_TRIPS &&
+           sem.profile.is_hot(iterations) && !has_continue(loop->body) &&
+           !assigns_to(loop->body, loop->name);
+}
+
+// Runs UNROLL_FACTOR iterations per jump back while that many are left, the
+// scalar loop at lbl does the rest
+static void unrolled_main_loop(AstLoop *loop, AstNode *bound,
+                               const std::string &lbl,
+                               const std::string &body_site, ILemitter &il,
+                               Semantics &sem)
+{
+    auto &name = loop->name;
+    auto id = g_counter;
+    auto lblunroll = "lblunroll"s + std::to_string(id);
+
+    il.label(lblunroll.c_str());
+
+    il.load_local(name.c_str());
+    il.push_i32(UNROLL_FACTOR - 1);
+    il.integer_add();
+    generate_il(bound, il, sem);
+    il.integer_subtract();
+    il.jump_greater_equal_zero(lbl.c_str());
+
+    loop_depth++;
+    loop_ids.push_back(id);
+
+    for (int i = 0; i < UNROLL_FACTOR; i++)
+    {
+        profile_count(body_site, il, sem);
+        generate_il(loop->body, il, sem);
+
+        il.load_local(name.c_str());
+        il.push_i32(1);
         il.integer_add();
+        il.store_local(name.c_str());
+    }
+
+    loop_ids.pop_back();
+    loop_depth--;
+
+    il.jump(lblunroll.c_str());
+}
+
+// Runs the body for every value of the counter from the one it holds up to
+// bound, lanes at a time first where the body allows it
+static void counted_loop(AstLoop *loop, AstNode *bound,
+                         const std::string &entry_site,
+                         const std::string &body_site, ILemitter &il,
+                         Semantics &sem)
+{
+    auto &name = loop->name;
+    auto id = g_counter;
+    auto lbl = "lbl"s + std::to_string(id);
+    auto lblout = "lblout"s + std::to_string(id);
+    auto lblcont = "lblcont"s + std::to_string(id);
+
+    profile_count(entry_site, il, sem);
+
+    // What was hoisted out of the body only runs if the body does
+    if (!loop->entry.empty())
+    {
+        il.load_local(name.c_str());
+        generate_il(bound, il, sem);
+        il.integer_subtract();
+        il.jump_greater_equal_zero(lblout.c_str());
+
+        for (auto decl : loop->entry)
+        {
+            generate_il(decl, il, sem);
+        }
+    }
+
+    VectorLoop plan;
+
+    if (plan_vector_loop(loop, bound, plan, sem))
+    {
+        vector_main_loop(loop, bound, plan, lbl, il, sem);
+    }
+    else if (should_unroll(loop, entry_site, body_site, sem))
+    {
+        unrolled_main_loop(loop, bound, lbl, body_site, il, sem);
+    }
+
+    // The scalar loop, which also finishes what the vector loop left
+    il.label(lbl.c_str());
+
+    il.load_local(name.c_str());
+    generate_il(bound, il, sem);
+    il.integer_subtract();
+    il.jump_greater_equal_zero(lblout.c_str());
+
+    loop_depth++;
+    loop_ids.push_back(id);
+    profile_count(body_site, il, sem);
+    generate_il(loop->body, il, sem);
+    loop_ids.pop_back();
+    loop_depth--;
+
+    il.label(lblcont.c_str());
+
+    il.load_local(name.c_str());
+    il.push_i32(1);
+    il.integer_add();
+    il.store_local(name.c_str());
+
+    il.jump(lbl.c_str());
+
+    il.label(lblout.c_str());
+}
+
+static void push_identity(const AstType *type, const std::string &op, ILemitter &il)
+{
+    auto value = op[0] == '*' ? 1 : 0;
+
+    if (type->name == "f32")
+    {
+        il.push_f32((float)value);
+    }
+    else if (type->name == "i32")
+    {
+        il.push_i32(value);
+    }
+    else if (type->name == "i16")
+    {
+        il.push_i16((int16_t)value);
+    }
+    else if (type->name == "i8")
+    {
+        il.push_i8((int8_t)value);
+    }
+    else if (type->name == "u16")
+    {
+        il.push_u16((uint16_t)value);
+    }
+    else if (type->name == "u8")
+    {
+        il.push_u8((uint8_t)value);
+    }
+    else
+    {
+        il.push_u32((uint32_t)value);
+    }
+}
+
+static void env_slot(const char *env, size_t slot, bool is_arg, ILemitter &il)
+{
+    if (is_arg)
+    {
+        il.load_argument(env);
+    }
+    else
+    {
+        il.load_local(env);
+    }
+
+    il.push_u32((uint32_t)(slot * 4));
+    il.integer_add();
+}
+
+// Copies the captures into an environment and hands the index range over to
+// the runtime, which calls the outlined body on chunks of it from several
+// threads. Reductions come back through their slot of the environment
+static void parallel_loop(AstLoop *loop, ILemitter &il, Semantics &sem)
+{
+    auto &captures = sem.parallel(loop).captures;
+    auto &reductions = sem.parallel(loop).reductions;
+    auto id = std::to_string(g_counter);
+    auto env = "~env"s + id;
+    auto name = scope_owner + "~parallel"s + id;
+
+    declare_runtime(il, sem, "malloc", STR, {U32});
+    declare_runtime(il, sem, "free", VOID, {STR});
+    declare_runtime(il, sem, "dusk_parallel_for", VOID, {I32, PTR, U32});
+
+    il.function_local(scope_owner.c_str(), env.c_str(), STR);
+    il.push_u32((uint32_t)(captures.size() * 4 + 4));
+    il.call("malloc");
+    il.store_local(env.c_str());
+
+    for (size_t i = 0; i < captures.size(); i++)
+    {
+        auto &capture = captures[i]->name;
+
+        if (has_local(capture))
+        {
+            il.load_local(capture.c_str());
+        }
+        else
+        {
+            il.load_argument(capture.c_str());
+        }
+
+        env_slot(env.c_str(), i, false, il);
+        il.write();
+    }
+
+    il.load_local(env.c_str());
+    il.push_function(name.c_str());
+    generate_il(loop->expr, il, sem);
+    il.call("dusk_parallel_for");
+
+    for (size_t i = 0; i < captures.size(); i++)
+    {
+        for (auto &reduction : reductions)
+        {
+            if (reduction.first == captures[i])
+            {
+                env_slot(env.c_str(), i, false, il);
+                il.read();
+                il.store_local(reduction.first->name.c_str());
+            }
+        }
+    }
+
+    il.load_local(env.c_str());
+    il.call("free");
+
+    parallel_bodies.push_back({loop, name, site_owner});
+}
+
+// fn(env, begin, end) running the loop over [begin, end) on its own copies of
+// the captures, then folding its partial reductions into the environment
+static void parallel_body(const ParallelBody &outlined, ILemitter &il, Semantics &sem)
+{
+    auto loop = outlined.loop;
+    auto counter = sem.counter(loop);
+    auto &captures = sem.parallel(loop).captures;
+    auto &reductions = sem.parallel(loop).reductions;
+    auto name = outlined.name.c_str();
+
+    il.function_parameter(name, "~env", U32);
+    il.function_parameter(name, "~begin", I32);
+    il.function_parameter(name, "~end", I32);
+    il.internal_function(name, VOID);
+    il.function(name);
+
+    scope_owner = outlined.name;
+    site_owner = outlined.owner;
+    instrumented_fn.clear();
+
+    push_scope();
+    scope.clear();
+    args.clear();
+
+    auto outer_arenas = arena_scopes;
+    auto outer_loop_depth = loop_depth;
+    arena_scopes.clear();
+    loop_depth = 0;
+
+    AstDec range[3];
+    const char *range_names[] = {"~env", "~begin", "~end"};
+
+    for (int i = 0; i < 3; i++)
+    {
+        range[i].name = range_names[i];
+        range[i].type = new AstType();
+        range[i].type->name = i ? "i32" : "u32";
+        add_arg(&range[i]);
+    }
+
+    for (size_t i = 0; i < captures.size(); i++)
+    {
+        auto capture = captures[i];
+
+        il.function_local(name, capture->name.c_str(),
+                          type_to_il_type(sem.type_of(capture)));
+        add_local(capture);
+
+        env_slot("~env", i, true, il);
+        il.read();
+        il.store_local(capture->name.c_str());
+    }
+
+    for (auto &reduction : reductions)
+    {
+        push_identity(sem.type_of(reduction.first), reduction.second, il);
+        il.store_local(reduction.first->name.c_str());
+    }
+
+    il.function_local(name, loop->name.c_str(),
+                      type_to_il_type(sem.type_of(counter)));
+    add_local(counter);
+
+    il.load_argument("~begin");
+    il.store_local(loop->name.c_str());
+
+    // Its range is part of that of the loop
+    checked_indices.clear();
+    counter_bounds(loop, sem);
+
+    AstSymbol end;
+    end.name = "~end";
+
+    // Each worker enters the loop once per range it runs
+    counted_loop(loop, &end,
+                 Profile::site("parallel", outlined.owner, loop, "entry"),
+                 Profile::site("parallel", outlined.owner, loop, "body"),
+                 il, sem);
+    g_counter++;
+    checked_indices.clear();
+
+    declare_runtime(il, sem, "dusk_parallel_lock", VOID, {});
+    declare_runtime(il, sem, "dusk_parallel_unlock", VOID, {});
+
+    if (!reductions.empty())
+    {
+        il.call("dusk_parallel_lock");
+    }
+
+    for (size_t i = 0; i < captures.size(); i++)
+    {
+        for (auto &reduction : reductions)
+        {
+            if (reduction.first != captures[i] || reduction.second.empty())
+            {
+                continue;
+            }
+
+            env_slot("~env", i, true, il);
+            il.read();
+            il.load_local(reduction.first->name.c_str());
+            binary_operator(reduction.second, il, sem);
+            env_slot("~env", i, true, il);
+            il.write();
+        }
+    }
+
+    if (!reductions.empty())
+    {
+        il.call("dusk_parallel_unlock");
+    }
+
+    arena_scopes = outer_arenas;
+    loop_depth = outer_loop_depth;
+
+    pop_scope();
+
+    il._return();
+
+    cold_blocks_code_gen(il, sem);
+}
+
+// An async function becomes a resume function, running it from its state up
+// to the next await that has to wait, and a function of its own name that
+// allocates a frame and creates a task for it. The frame holds the state, the
+// future being awaited and every local, which are spilled to it when
+// suspending and restored when resuming. State 0 is the start of the body
+static void async_fn_code_gen(AstFn *fn, ILemitter &il, Semantics &sem)
+{
+    auto &symbol = sem.symbol(fn);
+    auto &params = sem.params(fn);
+    auto id = std::to_string(g_counter++);
+    auto resume = symbol + "~resume";
+    auto lbl_body = "lblbody"s + id;
+    auto lbl_suspend = "lblsuspend"s + id;
+    auto lbl_restore = "lblrestore"s + id;
+
+    declare_runtime(il, sem, "calloc", STR, {U32, U32});
+    declare_runtime(il, sem, "dusk_task_new", U32, {STR, PTR});
+    declare_runtime(il, sem, "dusk_task_return", VOID, {I32});
+    declare_runtime(il, sem, "dusk_task_await", I32, {U32});
+    declare_runtime(il, sem, "dusk_future_take", I32, {U32});
+
+    il.function_parameter(resume.c_str(), "~frame", STR);
+    il.internal_function(resume.c_str(), I32);
+    il.function(resume.c_str());
+
+    scope_owner = resume;
+    instrumented_fn = resume;
+    instrument_hook("dusk_fn_enter", il, sem);
+
+    push_scope();
+    scope.clear();
+    args.clear();
+
+    // Parameters live in the frame like any other variable
+    for (auto param : params)
+    {
+        il.function_local(resume.c_str(), param->name.c_str(),
+                          type_to_il_type(param->type));
+        add_local(param);
+    }
+
+    auto outer_arenas = arena_scopes;
+    auto outer_loop_depth = loop_depth;
+    arena_scopes.clear();
+    loop_depth = 0;
+
+    AsyncFn state;
+    state.suspend = lbl_suspend;
+    async_fn = &state;
+
+    il.jump(lbl_restore.c_str());
+    il.label(lbl_body.c_str());
+
+    generate_il(fn->body, il, sem);
+
+    il.push_i32(1);
+    instrument_hook("dusk_fn_exit", il, sem);
+    il._return();
+
+    // Before the locals are spilled, cold blocks may declare some
+    cold_blocks_code_gen(il, sem);
+
+    async_fn = nullptr;
+
+    arena_scopes = outer_arenas;
+    loop_depth = outer_loop_depth;
+
+    pop_scope();
+
+    // Every local is known now that the body is generated
+    std::vector<std::pair<std::string, uint8_t>> slots;
+
+    for (auto &local : il.locals[resume])
+    {
+        bool known = false;
+
+        for (auto &slot : slots)
+        {
+            known = known || slot.first == local.first;
+        }
+
+        if (!known)
+        {
+            slots.push_back(local);
+        }
+    }
+
+    il.label(lbl_suspend.c_str());
+
+    for (size_t i = 0; i < slots.size(); i++)
+    {
+        il.load_local(slots[i].first.c_str());
+        env_slot("~frame", i + 2, true, il);
+        il.write();
+    }
+
+    il.push_i32(0);
+    instrument_hook("dusk_fn_exit", il, sem);
+    il._return();
+
+    il.label(lbl_restore.c_str());
+
+    for (size_t i = 0; i < slots.size(); i++)
+    {
+        env_slot("~frame", i + 2, true, il);
+        il.read();
+        il.store_local(slots[i].first.c_str());
+    }
+
+    il.load_argument("~frame");
+    il.read();
+    il.jump_equal_zero(lbl_body.c_str());
+
+    for (size_t i = 0; i < state.awaits.size(); i++)
+    {
+        auto lbl_await = "lblawait"s + std::to_string(state.awaits[i]);
+
+        il.load_argument("~frame");
+        il.read();
+        il.push_u32((uint32_t)(i + 1));
+        il.integer_subtract();
+        il.jump_equal_zero(lbl_await.c_str());
+    }
+
+    il.push_i32(1);
+    instrument_hook("dusk_fn_exit", il, sem);
+    il._return();
+
+    // The function callers see, returning the handle of the new task
+    auto name = symbol.c_str();
+
+    for (auto param : params)
+    {
+        il.function_parameter(
+            name, param->name.c_str(), type_to_il_type(param->type));
+    }
+
+    il.internal_function(name, U32);
+    il.function(name);
+
+    instrumented_fn = symbol;
+    instrument_hook("dusk_fn_enter", il, sem);
+    profile_count(Profile::fn_site(symbol), il, sem);
+
+    il.function_local(name, "~frame", STR);
+    il.push_u32((uint32_t)(slots.size() * 4 + 8));
+    il.push_u32(1);
+    il.call("calloc");
+    il.store_local("~frame");
+
+    for (size_t i = 0; i < params.size(); i++)
+    {
+        il.load_argument(params[i]->name.c_str());
+        env_slot("~frame", i + 2, false, il);
+        il.write();
+    }
+
+    il.push_function(resume.c_str());
+    il.load_local("~frame");
+    il.call("dusk_task_new");
+    instrument_hook("dusk_fn_exit", il, sem);
+    il._return();
+
+    instrumented_fn.clear();
+}
+
+void AstLoop::code_gen(ILemitter &il, Semantics &sem)
+{
+    auto type = sem.infer_type(expr);
+
+    // Known bounds from before only hold for the first iteration if the loop
+    // assigns to the variables involved
+    forget_bounds(this, sem);
+
+    // auto buf = g_counter;
+    g_counter++;
+
+    auto entry_site = Profile::site("loop", site_owner, this, "entry");
+    auto body_site = Profile::site("loop", site_owner, this, "body");
+
+    auto counter = sem.counter(this);
+
+    if (is_foreach && counter && find_attribute(this, "parallel"))
+    {
+        profile_count(entry_site, il, sem);
+        parallel_loop(this, il, sem);
+        g_counter++;
+    }
+    else if (is_foreach && counter && sem.type_of(counter) &&
+             type_size_map.count(sem.type_of(counter)->name) &&
+             sem.type_of(counter)->name != "bool")
+    {
+        add_local(counter);
+        il.function_local(scope_owner.c_str(), name.c_str(),
+                          type_to_il_type(sem.type_of(counter)));
+
+        il.push_i32(0);
+        il.store_local(name.c_str());
+
+        counter_bounds(this, sem);
+        counted_loop(this, expr, entry_site, body_site, il, sem);
+        g_counter++;
+    }
+    else if (is_foreach)
+    {
+        // TODO: need enumerables for this
+    }
+    else if (type && type->name != "bool")
+    {
+        auto var = "~"s + std::to_string(g_counter++);
+
+        il.function_local(scope_owner.c_str(), var.c_str(), U32);
+
+        auto lbl = "lbl"s + std::to_string(g_counter);
+        auto lblout = "lblout"s + std::to_string(g_counter);
+        auto lblcont = "lblcont"s + std::to_string(g_counter);
+
+        profile_count(entry_site, il, sem);
+
+        il.push_u32(1);
+        il.store_local(var.c_str());
+
+        // The body runs at least once
+        for (auto decl : entry)
+        {
+            generate_il(decl, il, sem);
+        }
+
+        // il.jump(lblcont.c_str());
+
+        il.label(lbl.c_str());
+        loop_depth++;
+        loop_ids.push_back(g_counter);
+        profile_count(body_site, il, sem);
+        generate_il(body, il, sem);
+        loop_ids.pop_back();
+        loop_depth--;
+
+        il.label(lblcont.c_str());
+
+        il.load_local(var.c_str());
+        il.push_u32(1);
+        il.integer_add();
+
+        il.duplicate();
+        il.store_local(var.c_str());
+
+        generate_il(expr, il, sem);
+        il.integer_subtract();
+
+        il.jump_less_equal_zero(lbl.c_str());
+
+        il.label(lblout.c_str());
+        g_counter++;
+    }
+    else
+    {
+        auto lbl = "lbl"s + std::to_string(g_counter);
+        auto lbl_cond = "lbl_cond"s + std::to_string(g_counter);
+        auto lblout = "lblout"s + std::to_string(g_counter);
+        auto lblcont = "lblcont"s + std::to_string(g_counter);
+
+        profile_count(entry_site, il, sem);
+
+        // What was hoisted out of the body only runs if the body does
+        if (!entry.empty())
+        {
+            generate_il(expr, il, sem);
+            il.push_i8(1);
+            il.integer_subtract();
+            il.jump_not_equal_zero(lblout.c_str());
+
+            for (auto decl : entry)
+            {
+                generate_il(decl, il, sem);
+            }
+        }
+
+        il.jump(lbl_cond.c_str());
+
+        il.label(lbl.c_str());
+        loop_depth++;
+        loop_ids.push_back(g_counter);
+        profile_count(body_site, il, sem);
+        generate_il(body, il, sem);
+        loop_ids.pop_back();
+        loop_depth--;
+
+        il.label(lbl_cond.c_str());
+        il.label(lblcont.c_str());
+        generate_il(expr, il, sem);
+
+        il.push_i8(1);
+        il.integer_subtract();
+        il.jump_equal_zero(lbl.c_str());
+
+        il.label(lblout.c_str());
+
+        g_counter++;
+    }
+
+    forget_bounds(this, sem);
+
+    delete type;
+
+    //  g_counter = buf;
+}
+
+void AstContinue::code_gen(ILemitter &il, Semantics &sem)
+{
+    if (loop_ids.empty())
+    {
+        return;
+    }
+
+    release_loop_arenas(il, sem);
+    auto lblcont = "lblcont"s + std::to_string(loop_ids.back());
+    il.jump(lblcont.c_str());
+}
+
+void AstBreak::code_gen(ILemitter &il, Semantics &sem)
+{
+    if (loop_ids.empty())
+    {
+        return;
+    }
+
+    release_loop_arenas(il, sem);
+    auto lblout = "lblout"s + std::to_string(loop_ids.back());
+    il.jump(lblout.c_str());
+}
+
+void AstStruct::code_gen(ILemitter &il, Semantics &sem)
+{
+}
+
+void AstImpl::code_gen(ILemitter &il, Semantics &sem)
+{
+    generate_il(block, il, sem);
+}
+
+void AstAttribute::code_gen(ILemitter &il, Semantics &sem)
+{
+    il.data(name.c_str(), "");
+}
+
+void AstAffix::code_gen(ILemitter &il, Semantics &sem)
+{
+    auto &mangled_name = sem.symbol(this);
+
+    site_owner = mangled_name;
+    instrumented_fn.clear();
+
+    il.internal_function(mangled_name.c_str(), type_to_il_type(return_type));
+
+    il.function(mangled_name.c_str());
+
+    scalar_structs = find_scalar_structs(body, params, sem);
+    array_lengths = find_array_lengths(body, params);
+    checked_indices.clear();
+    generate_il(body, il, sem);
+
+    il._return();
+
+    cold_blocks_code_gen(il, sem);
+    scalar_structs.clear();
+}
+
+void AstUnaryExpr::code_gen(ILemitter &il, Semantics &sem)
+{
+    generate_il(expr, il, sem);
+    il.call(sem.op(this).c_str());
+}
+
+unsigned int calculate_struct_field_offset(AstStruct *node, std::string name)
+{
+    unsigned int re = 0;
+
+    for (int i = 0; i < node->block->statements.size(); i++)
+    {
+        auto dec = (AstDec *)node->block->statements[i];
+
+        if (dec->name == name)
+            break;
+
+        re += type_to_size(dec->type);
+    }
+    return re;
+}
+
+static bool is_str_concat(const AstNode *node, Semantics &sem)
+{
+    return node->node_type == AstNodeType::AstBinaryExpr &&
+           sem.op((AstBinaryExpr *)node) == "+strstr";
+}
+
+static void flatten_str_concat(AstNode *node, std::vector<AstNode *> &parts,
+                               Semantics &sem)
+{
+    if (is_str_concat(node, sem))
+    {
+        flatten_str_concat(((AstBinaryExpr *)node)->lhs, parts, sem);
+        flatten_str_concat(((AstBinaryExpr *)node)->rhs, parts, sem);
+    }
+    else
+    {
+        parts.push_back(node);
+    }
+}
+
+// Lowers a chain of string concatenations to a single builder, sized up front
+// so no append has to reallocate, instead of one allocation and copy per `+`
+static void str_concat_chain(AstBinaryExpr *node, ILemitter &il, Semantics &sem)
+{
+    std::vector<AstNode *> parts;
+    flatten_str_concat(node, parts, sem);
+
+    declare_runtime(il, sem, "strlen", U32, {STR});
+    declare_runtime(il, sem, "dusk_sb_new", U32, {U32});
+    declare_runtime(il, sem, "dusk_sb_append", VOID, {U32, STR});
+    declare_runtime(il, sem, "dusk_sb_finish", STR, {U32});
+
+    // Operands are evaluated once, left to right, before anything is appended
+    std::vector<std::string> temps(parts.size());
+    uint32_t literal_length = 0;
+
+    for (size_t i = 0; i < parts.size(); i++)
+    {
+        if (parts[i]->node_type == AstNodeType::AstString)
+        {
+            literal_length += ((AstString *)parts[i])->value.size();
+            continue;
+        }
+
+        temps[i] = "~str"s + std::to_string(g_counter++);
+        il.function_local(scope_owner.c_str(), temps[i].c_str(), STR);
+        generate_il(parts[i], il, sem);
+        il.store_local(temps[i].c_str());
+    }
+
+    il.push_u32(literal_length);
+
+    for (auto &temp : temps)
+    {
+        if (!temp.empty())
+        {
+            il.load_local(temp.c_str());
+            il.call("strlen");
+            il.integer_add();
+        }
+    }
+
+    auto builder = "~sb"s + std::to_string(g_counter++);
+    il.function_local(scope_owner.c_str(), builder.c_str(), U32);
+    il.call("dusk_sb_new");
+    il.store_local(builder.c_str());
+
+    for (size_t i = 0; i < parts.size(); i++)
+    {
+        if (temps[i].empty())
+        {
+            generate_il(parts[i], il, sem);
+        }
+        else
+        {
+            il.load_local(temps[i].c_str());
+        }
+
+        il.load_local(builder.c_str());
+        il.call("dusk_sb_append");
+    }
+
+    il.load_local(builder.c_str());
+    il.call("dusk_sb_finish");
+}
+
+void AstBinaryExpr::code_gen(ILemitter &il, Semantics &sem)
+{
+    if (op == "=")
+    {
+        generate_il(rhs, il, sem);
+
+        if (lhs->node_type == AstNodeType::AstIndex)
+        {
+            generate_il(lhs, il, sem);
+            il.remove_last();
+            il.write();
+        }
+        else if (lhs->node_type == AstNodeType::AstSymbol)
+        {
+            auto x = (AstSymbol *)lhs;
+            auto local = get_local(x->name);
+
+            if (local && !local->immutable)
+            {
+                il.store_local(x->name.c_str());
+                forget_bounds({x->name});
+            }
+            else
+            {
+                printf("You can not assign a value to an immutable. \n");
+            }
+        }
+        else if (lhs->node_type == AstNodeType::AstBinaryExpr &&
+                 !scalar_field((AstBinaryExpr *)lhs).empty())
+        {
+            il.store_local(scalar_field((AstBinaryExpr *)lhs).c_str());
+        }
+        else
+        {
+            generate_il(lhs, il, sem);
+            il.address_stack();
+            il.write();
+        }
+        return;
+    }
+
+    if (op == ".")
+    {
+        auto field = scalar_field(this);
+
+        if (!field.empty())
+        {
+            il.load_local(field.c_str());
+            return;
+        }
+
+        if (rhs->node_type == AstNodeType::AstFnCall)
+        {
+            auto call = (AstFnCall *)rhs;
+
+            generate_il(lhs, il, sem);
+            generate_il(call, il, sem);
+
+            return;
+        }
+
+        //we have a struct
+        auto x = sem.infer_type(lhs);
+        auto sct = sem.p2_get_struct(x->name);
+        if (sct)
+        {
+            unsigned int offset = 0;
+
+            if (rhs->node_type == AstNodeType::AstSymbol)
+            {
+                auto symbol = (AstSymbol *)rhs;
+                offset = calculate_struct_field_offset(sct, symbol->name);
+
+                generate_il(lhs, il, sem);
+                il.address_stack();
+                il.push_u32(offset);
+                il.integer_add();
+
+                il.read();
+            }
+        }
+
+        return;
+    }
+
+    if (is_str_concat(this, sem) &&
+        (is_str_concat(lhs, sem) || is_str_concat(rhs, sem)))
+    {
+        str_concat_chain(this, il, sem);
+        return;
+    }
+
+    generate_il(lhs, il, sem);
+    generate_il(rhs, il, sem);
+    // il.call(op.c_str());
+    binary_operator(sem.op(this), il, sem);
+}
+
+void AstIndex::code_gen(ILemitter &il, Semantics &sem)
+{
+    if (!array)
+        return;
+
+    generate_il(array, il, sem);
+
+    auto type = sem.infer_type(array);
+
+    if (!type)
+        return;
+
+    auto size = type_to_size(type);
+    delete type;
+
+    // The array is needed again for the check, anything but a variable is
+    // only evaluated once
+    std::string temp;
+    bool check = sem.bounds_check && !index_in_bounds(this);
+
+    if (check && array->node_type != AstNodeType::AstSymbol)
+    {
+        temp = "~array"s + std::to_string(g_counter++);
+        il.function_local(scope_owner.c_str(), temp.c_str(), U32);
+        il.duplicate();
+        il.store_local(temp.c_str());
+    }
+
+    il.address_stack();
+
+    il.push_i32(size);
+
+    generate_il(expr, il, sem);
+
+    if (check)
+    {
+        auto site = source_path + ":" + std::to_string(line) + ":" +
+                    std::to_string(column);
+
+        // Gives the index back, or ends the program if it is out of bounds
+        declare_runtime(il, sem, "dusk_bounds_check", I32, {STR, U32, I32});
+
+        if (temp.empty())
+        {
+            generate_il(array, il, sem);
+        }
+        else
+        {
+            il.load_local(temp.c_str());
+        }
+
+        il.push_str(site.c_str());
+        il.call("dusk_bounds_check");
+    }
+
+    il.integer_multiply();
+    il.integer_add();
+
+    il.read();
+}
+
+void AstType::code_gen(ILemitter &il, Semantics &sem)
+{
+    (void)il;
+    (void)sem;
+}
+
+void AstSymbol::code_gen(ILemitter &il, Semantics &sem)
+{
+    (void)sem;
+    if (has_local(name))
+    {
+        il.load_local(name.c_str());
+    }
+    else if (has_arg(name))
+    {
+        il.load_argument(name.c_str());
+    }
+    else
+    {
+        il.push_function(name.c_str());
+    }
+}
+
+void AstReturn::code_gen(ILemitter &il, Semantics &sem)
+{
+    if (expr)
+    {
+        generate_il(expr, il, sem);
+    }
+
+    // The result of a task is kept by the runtime until it is awaited
+    if (async_fn && expr)
+    {
+        il.call("dusk_task_return");
+    }
+
+    for (size_t i = arena_scopes.size(); i; i--)
+    {
+        release_arena(arena_scopes[i - 1], il, sem);
+    }
+
+    if (async_fn)
+    {
+        il.push_i32(1);
+    }
+
+    instrument_hook("dusk_fn_exit", il, sem);
+    il._return();
+}
+
+// Stores the future in the frame along with the state to resume in, and
+// suspends unless the future is done already. The result of the future is
+// left on the stack either way
+void AstAwait::code_gen(ILemitter &il, Semantics &sem)
+{
+    if (!async_fn)
+    {
+        return;
+    }
+
+    auto id = g_counter++;
+    auto lbl_await = "lblawait"s + std::to_string(id);
+
+    async_fn->awaits.push_back(id);
+
+    generate_il(expr, il, sem);
+    env_slot("~frame", 1, true, il);
+    il.write();
+
+    il.push_u32((uint32_t)async_fn->awaits.size());
+    env_slot("~frame", 0, true, il);
+    il.write();
+
+    env_slot("~frame", 1, true, il);
+    il.read();
+    il.call("dusk_task_await");
+    il.jump_equal_zero(async_fn->suspend.c_str());
+
+    il.label(lbl_await.c_str());
+
+    env_slot("~frame", 1, true, il);
+    il.read();
+    il.call("dusk_future_take");
+}
+
+void AstExtern::code_gen(ILemitter &il, Semantics &sem)
+{
+    for (auto decl : decls)
+    {
+        generate_il(decl, il, sem);
+    }
+}
+
+void AstImport::code_gen(ILemitter &il, Semantics &sem)
+{
+    (void)il;
+    (void)sem;
+}
+
+Error::Error(ErrorType type, AstNode *node, std::string message)
+    : type(type), line(node ? node->line : 0), column(node ? node->column : 0),
+      offset(0), count(0), message(message)
+{
+}
+
+unsigned int new_node_id()
+{
+    // Ids stay unique if trees are parsed on several threads
+    static std::atomic<unsigned int> next_id(1);
+
+    return next_id++;
+}
+
+std::vector<AstNode *> ast_children(AstNode *node)
+{
+    std::vector<AstNode *> children;
+
+    if (!node)
+    {
+        return children;
+    }
 
-        il.duplicate();
-        il.store_local(var.c_str());
+    switch (node->node_type)
+    {
+    case AstNodeType::AstBlock:
+        children = ((AstBlock *)node)->statements;
+        break;
 
-        generate_il(expr, il, sem);
-        il.integer_subtract();
+    case AstNodeType::AstArray:
+    {
+        auto array = (AstArray *)node;
+        children = array->elements;
+        children.push_back(array->ele_type);
+        break;
+    }
 
-        il.jump_less_equal_zero(lbl.c_str());
+    case AstNodeType::AstDec:
+        children = {((AstDec *)node)->type, ((AstDec *)node)->value};
+        break;
 
-        il.label(lblout.c_str());
-        g_counter++;
+    case AstNodeType::AstIf:
+    {
+        auto if_stmt = (AstIf *)node;
+        children = {
+            if_stmt->condition, if_stmt->true_block, if_stmt->false_block};
+        break;
     }
-    else
+
+    case AstNodeType::AstFn:
     {
-        auto lbl = "lbl"s + std::to_string(g_counter);
-        auto lbl_cond = "lbl_cond"s + std::to_string(g_counter);
+        auto fn = (AstFn *)node;
+        children.assign(fn->params.begin(), fn->params.end());
+        children.push_back(fn->return_type);
+        children.push_back(fn->body);
+        break;
+    }
 
-        il.jump(lbl_cond.c_str());
+    case AstNodeType::AstFnCall:
+        children = ((AstFnCall *)node)->args;
+        break;
 
-        il.label(lbl.c_str());
-        generate_il(body, il, sem);
+    case AstNodeType::AstLoop:
+    {
+        auto loop = (AstLoop *)node;
+        children = {loop->expr};
+        children.insert(children.end(), loop->entry.begin(), loop->entry.end());
+        children.push_back(loop->body);
+        break;
+    }
 
-        il.label(lbl_cond.c_str());
-        generate_il(expr, il, sem);
+    case AstNodeType::AstStruct:
+        children = {((AstStruct *)node)->block};
+        break;
 
-        il.push_i8(1);
-        il.integer_subtract();
-        il.jump_equal_zero(lbl.c_str());
+    case AstNodeType::AstImpl:
+        children = {((AstImpl *)node)->block};
+        break;
 
-        g_counter++;
+    case AstNodeType::AstAttribute:
+        children = ((AstAttribute *)node)->args;
+        break;
+
+    case AstNodeType::AstAffix:
+    {
+        auto affix = (AstAffix *)node;
+        children.assign(affix->params.begin(), affix->params.end());
+        children.push_back(affix->return_type);
+        children.push_back(affix->body);
+        break;
     }
 
-    delete type;
+    case AstNodeType::AstUnaryExpr:
+        children = {((AstUnaryExpr *)node)->expr};
+        break;
 
-    //  g_counter = buf;
-}
+    case AstNodeType::AstBinaryExpr:
+        children = {((AstBinaryExpr *)node)->lhs, ((AstBinaryExpr *)node)->rhs};
+        break;
 
-void AstContinue::code_gen(ILemitter &il, Semantics &sem)
-{
-    (void)sem;
-    auto lblcont = ("lblcont"s + std::to_string(g_counter)).c_str();
-    il.jump(lblcont);
-}
+    case AstNodeType::AstIndex:
+        children = {((AstIndex *)node)->array, ((AstIndex *)node)->expr};
+        break;
 
-void AstBreak::code_gen(ILemitter &il, Semantics &sem)
-{
-    (void)sem;
-    auto lblout = ("lblout"s + std::to_string(g_counter)).c_str();
-    il.jump(lblout);
-}
+    case AstNodeType::AstType:
+        children = {((AstType *)node)->subtype};
+        break;
 
-void AstStruct::code_gen(ILemitter &il, Semantics &sem)
-{
-}
+    case AstNodeType::AstReturn:
+        children = {((AstReturn *)node)->expr};
+        break;
 
-void AstImpl::code_gen(ILemitter &il, Semantics &sem)
-{
-    generate_il(block, il, sem);
-}
+    case AstNodeType::AstAwait:
+        children = {((AstAwait *)node)->expr};
+        break;
 
-void AstAttribute::code_gen(ILemitter &il, Semantics &sem)
-{
-    il.data(name.c_str(), "");
-}
+    case AstNodeType::AstExtern:
+    {
+        auto ext = (AstExtern *)node;
+        children.assign(ext->decls.begin(), ext->decls.end());
+        break;
+    }
 
-void AstAffix::code_gen(ILemitter &il, Semantics &sem)
-{
-    il.internal_function(mangled_name.c_str(), type_to_il_type(return_type));
+    default:
+        break;
+    }
 
-    il.function(mangled_name.c_str());
+    std::vector<AstNode *> result;
 
-    generate_il(body, il, sem);
+    for (auto child : children)
+    {
+        if (child)
+        {
+            result.push_back(child);
+        }
+    }
 
-    il._return();
+    return result;
 }
 
-void AstUnaryExpr::code_gen(ILemitter &il, Semantics &sem)
+template <typename T>
+static T *clone_of(const T *node)
 {
-    generate_il(expr, il, sem);
-    il.call(op.c_str());
+    return node ? (T *)clone_ast(node) : nullptr;
 }
 
-unsigned int calculate_struct_field_offset(AstStruct *node, std::string name)
+template <typename T>
+static void clone_each(std::vector<T *> &nodes)
 {
-    unsigned int re = 0;
-
-    for (int i = 0; i < node->block->statements.size(); i++)
+    for (auto &node : nodes)
     {
-        auto dec = (AstDec *)node->block->statements[i];
-
-        if (dec->name == name)
-            break;
-
-        re += type_to_size(dec->type);
+        node = clone_of(node);
     }
-    return re;
 }
 
-void AstBinaryExpr::code_gen(ILemitter &il, Semantics &sem)
+AstNode *clone_ast(const AstNode *node)
 {
-    if (op == "=")
+    switch (node->node_type)
     {
-        generate_il(rhs, il, sem);
+    case AstNodeType::AstBlock:
+    {
+        auto block = new AstBlock(*(const AstBlock *)node);
+        std::map<const AstNode *, AstAttribute *> attributes;
 
-        if (lhs->node_type == AstNodeType::AstIndex)
-        {
-            generate_il(lhs, il, sem);
-            il.remove_last();
-            il.write();
-        }
-        else if (lhs->node_type == AstNodeType::AstSymbol)
+        // The attributes of a statement are statements before it
+        for (auto &stmt : block->statements)
         {
-            auto x = (AstSymbol *)lhs;
-            auto local = get_local(x->name);
+            auto original = stmt;
+            stmt = clone_ast(original);
 
-            if (local && !local->immutable)
+            if (stmt->node_type == AstNodeType::AstAttribute)
             {
-                il.store_local(x->name.c_str());
+                attributes[original] = (AstAttribute *)stmt;
             }
-            else
+
+            for (auto &attribute : stmt->attributes)
             {
-                printf("You can not assign a value to an immutable. \n");
+                attribute = attributes[attribute];
             }
         }
-        else
-        {
-            generate_il(lhs, il, sem);
-            il.address_stack();
-            il.write();
-        }
-        return;
+
+        return block;
     }
 
-    if (op == ".")
+    case AstNodeType::AstString:
+        return new AstString(*(const AstString *)node);
+
+    case AstNodeType::AstNumber:
+        return new AstNumber(*(const AstNumber *)node);
+
+    case AstNodeType::AstBoolean:
+        return new AstBoolean(*(const AstBoolean *)node);
+
+    case AstNodeType::AstArray:
     {
+        auto array = new AstArray(*(const AstArray *)node);
+        clone_each(array->elements);
+        array->ele_type = clone_of(array->ele_type);
+        return array;
+    }
 
-        if (rhs->node_type == AstNodeType::AstFnCall)
-        {
-            auto call = (AstFnCall *)rhs;
+    case AstNodeType::AstDec:
+    {
+        auto decl = new AstDec(*(const AstDec *)node);
+        decl->type = clone_of(decl->type);
+        decl->value = clone_of(decl->value);
+        return decl;
+    }
 
-            generate_il(lhs, il, sem);
-            generate_il(call, il, sem);
+    case AstNodeType::AstIf:
+    {
+        auto if_stmt = new AstIf(*(const AstIf *)node);
+        if_stmt->condition = clone_of(if_stmt->condition);
+        if_stmt->true_block = clone_of(if_stmt->true_block);
+        if_stmt->false_block = clone_of(if_stmt->false_block);
+        return if_stmt;
+    }
 
-            return;
-        }
+    case AstNodeType::AstFn:
+    {
+        auto fn = new AstFn(*(const AstFn *)node);
+        clone_each(fn->params);
+        fn->return_type = clone_of(fn->return_type);
+        fn->body = clone_of(fn->body);
+        return fn;
+    }
 
-        //we have a struct
-        auto x = sem.infer_type(lhs);
-        auto sct = sem.p2_get_struct(x->name);
-        if (sct)
-        {
-            unsigned int offset = 0;
+    case AstNodeType::AstFnCall:
+    {
+        auto fn_call = new AstFnCall(*(const AstFnCall *)node);
+        clone_each(fn_call->args);
+        return fn_call;
+    }
 
-            if (rhs->node_type == AstNodeType::AstSymbol)
-            {
-                auto symbol = (AstSymbol *)rhs;
-                offset = calculate_struct_field_offset(sct, symbol->name);
+    case AstNodeType::AstLoop:
+    {
+        auto loop = new AstLoop(*(const AstLoop *)node);
+        loop->body = clone_of(loop->body);
+        loop->expr = clone_of(loop->expr);
+        clone_each(loop->entry);
+        return loop;
+    }
 
-                generate_il(lhs, il, sem);
-                il.address_stack();
-                il.push_u32(offset);
-                il.integer_add();
+    case AstNodeType::AstContinue:
+        return new AstContinue(*(const AstContinue *)node);
 
-                il.read();
-            }
-        }
+    case AstNodeType::AstBreak:
+        return new AstBreak(*(const AstBreak *)node);
 
-        return;
+    case AstNodeType::AstStruct:
+    {
+        auto struct_node = new AstStruct(*(const AstStruct *)node);
+        struct_node->block = clone_of(struct_node->block);
+        return struct_node;
     }
 
-    generate_il(lhs, il, sem);
-    generate_il(rhs, il, sem);
-    // il.call(op.c_str());
+    case AstNodeType::AstImpl:
     {
-        auto fn = sem.p2_get_affix(op);
+        auto impl = new AstImpl(*(const AstImpl *)node);
+        impl->block = clone_of(impl->block);
+        return impl;
+    }
 
-        if (fn)
-        {
-            for (auto attribute : fn->attributes)
-            {
-                if (attribute->name == "inline")
-                {
-                    for (auto stmt : fn->body->statements)
-                    {
-                        generate_il(stmt, il, sem);
-                    }
-                    return;
-                }
-            }
-            il.call(op.c_str());
-        }
+    case AstNodeType::AstAttribute:
+    {
+        auto attribute = new AstAttribute(*(const AstAttribute *)node);
+        clone_each(attribute->args);
+        return attribute;
     }
-}
 
-void AstIndex::code_gen(ILemitter &il, Semantics &sem)
-{
-    if (!array)
-        return;
+    case AstNodeType::AstAffix:
+    {
+        auto affix = new AstAffix(*(const AstAffix *)node);
+        clone_each(affix->params);
+        affix->return_type = clone_of(affix->return_type);
+        affix->body = clone_of(affix->body);
+        return affix;
+    }
 
-    generate_il(array, il, sem);
+    case AstNodeType::AstUnaryExpr:
+    {
+        auto unary = new AstUnaryExpr(*(const AstUnaryExpr *)node);
+        unary->expr = clone_of(unary->expr);
+        return unary;
+    }
 
-    auto type = sem.infer_type(array);
+    case AstNodeType::AstBinaryExpr:
+    {
+        auto binary = new AstBinaryExpr(*(const AstBinaryExpr *)node);
+        binary->lhs = clone_of(binary->lhs);
+        binary->rhs = clone_of(binary->rhs);
+        return binary;
+    }
 
-    if (!type)
-        return;
+    case AstNodeType::AstIndex:
+    {
+        auto index = new AstIndex(*(const AstIndex *)node);
+        index->array = clone_of(index->array);
+        index->expr = clone_of(index->expr);
+        return index;
+    }
 
-    auto size = type_to_size(type);
+    case AstNodeType::AstType:
+    {
+        auto type = new AstType(*(const AstType *)node);
+        type->subtype = clone_of(type->subtype);
+        return type;
+    }
 
-    il.address_stack();
+    case AstNodeType::AstSymbol:
+        return new AstSymbol(*(const AstSymbol *)node);
 
-    il.push_i32(type_to_size(type));
+    case AstNodeType::AstReturn:
+    {
+        auto ret = new AstReturn(*(const AstReturn *)node);
+        ret->expr = clone_of(ret->expr);
+        return ret;
+    }
 
-    generate_il(expr, il, sem);
+    case AstNodeType::AstExtern:
+    {
+        auto ext = new AstExtern(*(const AstExtern *)node);
+        clone_each(ext->decls);
+        return ext;
+    }
 
-    il.integer_multiply();
-    il.integer_add();
+    case AstNodeType::AstImport:
+        return new AstImport(*(const AstImport *)node);
 
-    il.read();
+    case AstNodeType::AstAwait:
+    {
+        auto await = new AstAwait(*(const AstAwait *)node);
+        await->expr = clone_of(await->expr);
+        return await;
+    }
+    }
 
-    //delete type;
+    return nullptr;
 }
 
-void AstType::code_gen(ILemitter &il, Semantics &sem)
+// What a node holds besides its children and position
+static std::string node_value(const AstNode *node)
 {
-    (void)il;
-    (void)sem;
-}
+    switch (node->node_type)
+    {
+    case AstNodeType::AstString:
+        return ((const AstString *)node)->value;
 
-void AstSymbol::code_gen(ILemitter &il, Semantics &sem)
-{
-    (void)sem;
-    if (has_local(name))
+    case AstNodeType::AstNumber:
     {
-        il.load_local(name.c_str());
+        auto number = (const AstNumber *)node;
+        return std::to_string(number->is_float) +
+               std::to_string(number->is_signed) +
+               std::to_string(number->bits) + ":" +
+               std::to_string(number->value.u);
     }
-    else if (has_arg(name))
+
+    case AstNodeType::AstBoolean:
+        return std::to_string(((const AstBoolean *)node)->value);
+
+    case AstNodeType::AstSymbol:
+        return ((const AstSymbol *)node)->name;
+
+    case AstNodeType::AstType:
+        return ((const AstType *)node)->name +
+               std::to_string(((const AstType *)node)->is_array);
+
+    case AstNodeType::AstDec:
+        return ((const AstDec *)node)->name +
+               std::to_string(((const AstDec *)node)->immutable);
+
+    case AstNodeType::AstFn:
     {
-        il.load_argument(name.c_str());
+        auto fn = (const AstFn *)node;
+        return fn->unmangled_name + ":" + fn->mangled_name + ":" +
+               fn->type_self + std::to_string(fn->is_async);
     }
-    else
+
+    case AstNodeType::AstFnCall:
+        return ((const AstFnCall *)node)->name;
+
+    case AstNodeType::AstLoop:
+        return ((const AstLoop *)node)->name +
+               std::to_string(((const AstLoop *)node)->is_foreach);
+
+    case AstNodeType::AstStruct:
+        return ((const AstStruct *)node)->name;
+
+    case AstNodeType::AstImpl:
+        return ((const AstImpl *)node)->name;
+
+    case AstNodeType::AstAttribute:
+        return ((const AstAttribute *)node)->name;
+
+    case AstNodeType::AstAffix:
     {
-        il.push_function(name.c_str());
+        auto affix = (const AstAffix *)node;
+        return affix->unmangled_name + ":" + affix->mangled_name +
+               std::to_string((int)affix->affix_type);
+    }
+
+    case AstNodeType::AstUnaryExpr:
+        return ((const AstUnaryExpr *)node)->op;
+
+    case AstNodeType::AstBinaryExpr:
+        return ((const AstBinaryExpr *)node)->op;
+
+    case AstNodeType::AstImport:
+        return ((const AstImport *)node)->name;
+
+    default:
+        return "";
     }
 }
 
-void AstReturn::code_gen(ILemitter &il, Semantics &sem)
+bool same_ast(const AstNode *a, const AstNode *b)
 {
-    if (expr)
+    if (a->node_type != b->node_type || a->line != b->line ||
+        a->column != b->column || a->offset != b->offset ||
+        a->end != b->end || a->end_line != b->end_line ||
+        a->end_column != b->end_column ||
+        a->attributes.size() != b->attributes.size() ||
+        node_value(a) != node_value(b))
     {
-        generate_il(expr, il, sem);
+        return false;
     }
 
-    il._return();
-}
+    auto children_a = ast_children((AstNode *)a);
+    auto children_b = ast_children((AstNode *)b);
 
-void AstExtern::code_gen(ILemitter &il, Semantics &sem)
-{
-    for (auto decl : decls)
+    if (children_a.size() != children_b.size())
     {
-        generate_il(decl, il, sem);
+        return false;
+    }
+
+    for (size_t i = 0; i < children_a.size(); i++)
+    {
+        if (!same_ast(children_a[i], children_b[i]))
+        {
+            return false;
+        }
     }
+
+    return true;
 }
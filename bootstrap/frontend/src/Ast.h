@@ -33,7 +33,9 @@
         F(AstType),       \
         F(AstSymbol),     \
         F(AstReturn),     \
-        F(AstExtern),
+        F(AstExtern),     \
+        F(AstImport),     \
+        F(AstAwait),
 
 enum class AstNodeType {
     AstNodeTypes(AstNodeType_ENUM)
@@ -49,14 +51,28 @@ enum class AffixType {
     Suffix,
 };
 
+/**
+ * Returns an id no other node has. What semantic analysis finds out about a
+ * node is kept by Semantics under its id, not in the node.
+ */
+unsigned int new_node_id();
+
 struct AstNode {
     AstNodeType node_type;
+    unsigned int id;
     unsigned int line, column;
-    bool emit = true;
 
+    // The source of a top level statement or a block, from the offset of its
+    // first token up to that of the token after it, which is at end_line and
+    // end_column. Zero for other nodes, which are never reparsed on their own.
+    unsigned int offset = 0, end = 0;
+    unsigned int end_line = 0, end_column = 0;
+
+    // The attributes written in front of the node, which are also statements
+    // of the block it is in
     std::vector<AstAttribute *> attributes;
 
-    AstNode(AstNodeType node_type, unsigned int line, unsigned int column) : node_type(node_type), line(line), column(column) {}
+    AstNode(AstNodeType node_type, unsigned int line, unsigned int column) : node_type(node_type), id(new_node_id()), line(line), column(column) {}
 
     virtual void code_gen(ILemitter &il, Semantics &sem) = 0;
 
@@ -194,6 +210,7 @@ struct AstFn : public AstNode {
     std::vector<AstDec *> params;
     AstType *return_type = nullptr;
     AstBlock *body = nullptr;
+    bool is_async = false;
 
     AstFn(unsigned int line = 0, unsigned int column = 0):
         AstNode(AstNodeType::AstFn, line, column) {}
@@ -213,7 +230,6 @@ struct AstFn : public AstNode {
 struct AstFnCall : public AstNode {
     std::string name;
     std::vector<AstNode *> args;
-    bool mangled = false;
 
     AstFnCall(unsigned int line = 0, unsigned int column = 0):
         AstNode(AstNodeType::AstFnCall, line, column) {}
@@ -233,6 +249,10 @@ struct AstLoop : public AstNode {
     AstBlock *body = nullptr;
     AstNode  *expr = nullptr;
 
+    // Calls the optimizer moved out of the body, declared once the loop is
+    // entered, so they do not run if the body runs zero times
+    std::vector<AstDec *> entry;
+
     AstLoop(unsigned int line = 0, unsigned int column = 0):
         AstNode(AstNodeType::AstLoop, line, column) {}
 
@@ -241,6 +261,10 @@ struct AstLoop : public AstNode {
     virtual ~AstLoop() {
         delete body;
         delete expr;
+
+        for (auto decl : entry) {
+            delete decl;
+        }
     }
 };
 
@@ -309,7 +333,6 @@ struct AstAffix : public AstNode {
     AstType *return_type = nullptr;
     AstBlock *body = nullptr;
     AffixType affix_type;
-    bool mangled = false;
 
     AstAffix(unsigned int line = 0, unsigned int column = 0):
         AstNode(AstNodeType::AstAffix, line, column) {}
@@ -339,6 +362,19 @@ struct AstReturn : public AstNode {
     }
 };
 
+struct AstAwait : public AstNode {
+    AstNode *expr = nullptr;
+
+    AstAwait(unsigned int line = 0, unsigned int column = 0):
+        AstNode(AstNodeType::AstAwait, line, column) {}
+
+    virtual void code_gen(ILemitter &il, Semantics &sem);
+
+    virtual ~AstAwait() {
+        delete expr;
+    }
+};
+
 struct AstUnaryExpr : public AstNode {
     std::string op;
     AstNode *expr = nullptr;
@@ -356,7 +392,6 @@ struct AstUnaryExpr : public AstNode {
 struct AstBinaryExpr : public AstNode {
     std::string op;
     AstNode *lhs = nullptr, *rhs = nullptr;
-    bool mangled = false;
 
     AstBinaryExpr(unsigned int line = 0, unsigned int column = 0):
         AstNode(AstNodeType::AstBinaryExpr, line, column) {}
@@ -398,4 +433,36 @@ struct AstExtern : public AstNode {
     }
 };
 
+struct AstImport : public AstNode {
+    std::string name;
+
+    AstImport(unsigned int line = 0, unsigned int column = 0):
+        AstNode(AstNodeType::AstImport, line, column) {}
+
+    virtual void code_gen(ILemitter &il, Semantics &sem);
+};
+
+/**
+ * Returns the direct children of a node, in source order, as parsed.
+ * Attributes are not included, as they are also statements of the enclosing
+ * block.
+ */
+std::vector<AstNode *> ast_children(AstNode *node);
+
+/**
+ * Returns a copy of a tree. Every node of the copy has the id and position of
+ * the node it copies, so a tree parsed once can be analysed and optimized more
+ * than once, which both change the tree they are given.
+ */
+AstNode *clone_ast(const AstNode *node);
+
+/**
+ * Whether two trees are the same, down to the position of every node, with
+ * whatever ids.
+ */
+bool same_ast(const AstNode *a, const AstNode *b);
+
+/** Returns the attribute of a node with the given name, or nullptr. */
+AstAttribute *find_attribute(const AstNode *node, const std::string &name);
+
 #endif /* AST_H */
@@ -1,6 +1,8 @@
 #ifndef ASTDEFS_H
 #define ASTDEFS_H
 
+#include <string>
+
 typedef struct AstNode AstNode;
 typedef struct AstBlock AstBlock;
 typedef struct AstString AstString;
@@ -24,10 +26,15 @@ typedef struct AstIndex AstIndex;
 typedef struct AstType AstType;
 typedef struct AstSymbol AstSymbol;
 typedef struct AstReturn AstReturn;
+typedef struct AstAwait AstAwait;
 typedef struct AstExtern AstExtern;
+typedef struct AstImport AstImport;
 
 struct Ast {
     AstBlock *root = nullptr;
+
+    /** The file the ast was parsed from */
+    std::string path;
 };
 
 #endif /* ASTDEFS_H */
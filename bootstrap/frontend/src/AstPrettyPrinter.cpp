@@ -40,7 +40,9 @@ void pretty_print_index(const AstIndex *node, std::string indent);
 void pretty_print_type(const AstType *node, std::string indent);
 void pretty_print_symbol(const AstSymbol *node, std::string indent);
 void pretty_print_return(const AstReturn *node, std::string indent);
+void pretty_print_await(const AstAwait *node, std::string indent);
 void pretty_print_extern(const AstExtern *node, std::string indent);
+void pretty_print_import(const AstImport *node, std::string indent);
 
 void pretty_print_node(const AstNode *node, std::string indent) {
     switch(node->node_type) {
@@ -132,10 +134,18 @@ void pretty_print_node(const AstNode *node, std::string indent) {
         pretty_print_return((const AstReturn *)node, indent);
         break;
 
+    case AstNodeType::AstAwait:
+        pretty_print_await((const AstAwait *)node, indent);
+        break;
+
     case AstNodeType::AstExtern:
         pretty_print_extern((const AstExtern *)node, indent);
         break;
 
+    case AstNodeType::AstImport:
+        pretty_print_import((const AstImport *)node, indent);
+        break;
+
     default:
         printf("Uh what\n");
         break;
@@ -247,9 +257,10 @@ void pretty_print_if(const AstIf *node, std::string indent) {
 
 void pretty_print_fn(const AstFn *node, std::string indent) {
     printf(
-        "%s%sfn%s %s%s%s",
+        "%s%s%sfn%s %s%s%s",
         indent.c_str(),
         term_fg[TermColour::Yellow],
+        node->is_async ? "async " : "",
         term_reset,
         term_fg[TermColour::Blue],
         node->mangled_name.c_str(),
@@ -460,6 +471,15 @@ void pretty_print_return(const AstReturn *node, std::string indent) {
     }
 }
 
+void pretty_print_await(const AstAwait *node, std::string indent) {
+    printf(
+        "%s%sawait%s\n",
+        indent.c_str(),
+        term_fg[TermColour::Yellow],
+        term_reset);
+    pretty_print_node(node->expr, indent + INDENT_CHARS);
+}
+
 void pretty_print_extern(const AstExtern *node, std::string indent) {
     printf(
         "%s%sextern%s\n",
@@ -472,6 +492,17 @@ void pretty_print_extern(const AstExtern *node, std::string indent) {
     }
 }
 
+void pretty_print_import(const AstImport *node, std::string indent) {
+    printf(
+        "%s%simport%s %s%s%s\n",
+        indent.c_str(),
+        term_fg[TermColour::Yellow],
+        term_reset,
+        term_fg[TermColour::Blue],
+        node->name.c_str(),
+        term_reset);
+}
+
 void pretty_print_ast(Ast &ast) {
     pretty_print_block(ast.root, "");
 }
@@ -494,6 +525,7 @@ static void set_colour(size_t i, const TokenStream &tokens) {
             case TokenType::Prefix:
             case TokenType::Suffix:
             case TokenType::Extern:
+            case TokenType::Import:
             case TokenType::Struct:
             case TokenType::Impl:
             case TokenType::Var:
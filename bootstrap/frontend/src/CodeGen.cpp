@@ -1,13 +1,203 @@
 #include "CodeGen.h"
+#include "FunctionFolder.h"
+#include "LinkOptimizer.h"
+
+#include <algorithm>
+
+std::vector<AstDec *> scope;
+std::vector<AstDec *> args;
+std::stack<std::vector<AstDec *>> scope_stack;
+std::stack<std::vector<AstDec *>> arg_stack;
+std::string source_path;
+std::map<std::string, uint32_t> function_ids;
 
 void generate_il(AstNode *node, ILemitter &il, Semantics &sem) {
     if(!node) {
         return;
     }
 
-    if(!node->emit) {
+    if(!sem.emits(node)) {
+        return;
+    }
+
+    // Code is attributed to the innermost node with a position
+    if(il.lines && node->line) {
+        auto outer = il.position;
+
+        SourcePosition at;
+        at.file = il.source_file(source_path);
+        at.line = node->line;
+        at.column = node->column;
+
+        il.set_position(at);
+        node->code_gen(il, sem);
+        il.set_position(outer);
         return;
     }
 
     node->code_gen(il, sem);
 }
+
+// Adds the @hot and @cold functions of a block, including those of impls.
+// Without either attribute a profile decides: functions it found hot are
+// added to profiled, and those it never saw entered are cold.
+static void collect_fns(AstBlock *block, const Semantics &sem,
+                        std::vector<AstFn *> &hot,
+                        std::vector<AstFn *> &profiled,
+                        std::vector<AstFn *> &cold)
+{
+    for (auto stmt : block->statements)
+    {
+        if (stmt->node_type == AstNodeType::AstImpl)
+        {
+            collect_fns(((AstImpl *)stmt)->block, sem, hot, profiled, cold);
+        }
+        else if (stmt->node_type == AstNodeType::AstFn)
+        {
+            auto fn = (AstFn *)stmt;
+
+            if (find_attribute(fn, "hot"))
+            {
+                hot.push_back(fn);
+            }
+            else if (find_attribute(fn, "cold"))
+            {
+                cold.push_back(fn);
+            }
+            else if (!sem.profile.empty() && fn->body &&
+                     !find_attribute(fn, "il"))
+            {
+                auto count = sem.profile.count(Profile::fn_site(sem.symbol(fn)));
+
+                if (sem.profile.is_hot(count))
+                {
+                    profiled.push_back(fn);
+                }
+                else if (!count)
+                {
+                    cold.push_back(fn);
+                }
+            }
+        }
+    }
+}
+
+// Numbers the functions of a block, including those of impls, in the order
+// they appear. An async function is two IL functions, the one creating its
+// task and the one resuming it.
+static void number_fns(AstBlock *block, const Semantics &sem)
+{
+    for (auto stmt : block->statements)
+    {
+        if (stmt->node_type == AstNodeType::AstImpl)
+        {
+            number_fns(((AstImpl *)stmt)->block, sem);
+        }
+        else if (stmt->node_type == AstNodeType::AstFn &&
+                 ((AstFn *)stmt)->body && !find_attribute(stmt, "il"))
+        {
+            auto fn = (AstFn *)stmt;
+            auto id = (uint32_t)function_ids.size();
+
+            function_ids.emplace(sem.symbol(fn), id);
+
+            if (fn->is_async)
+            {
+                id = (uint32_t)function_ids.size();
+                function_ids.emplace(sem.symbol(fn) + "~resume", id);
+            }
+        }
+    }
+}
+
+// Generates a function moved out of its place, along with the attribute
+// records that were emitted in front of it
+static void generate_moved_fn(AstFn *fn, const std::set<AstAttribute *> &records,
+                              ILemitter &il, Semantics &sem) {
+    for (auto attribute : fn->attributes) {
+        if (records.count(attribute)) {
+            sem.set_emits(attribute, true);
+            generate_il(attribute, il, sem);
+            sem.set_emits(attribute, false);
+        }
+    }
+
+    sem.set_emits(fn, true);
+    generate_il(fn, il, sem);
+    sem.set_emits(fn, false);
+}
+
+void generate_program(std::vector<Ast> &asts, ILemitter &il, Semantics &sem) {
+    std::vector<AstFn *> hot;
+    std::vector<AstFn *> cold;
+    std::set<AstAttribute *> records;
+
+    std::vector<AstFn *> profiled;
+
+    // The file every moved function comes from
+    std::map<AstFn *, std::string> paths;
+
+    for (auto &ast : asts) {
+        collect_fns(ast.root, sem, hot, profiled, cold);
+
+        for (auto fns : {&hot, &profiled, &cold}) {
+            for (auto fn : *fns) {
+                paths.emplace(fn, ast.path);
+            }
+        }
+
+        if (sem.instrument_functions) {
+            number_fns(ast.root, sem);
+        }
+    }
+
+    // Hottest first, after those marked @hot
+    std::stable_sort(profiled.begin(), profiled.end(), [&](AstFn *a, AstFn *b) {
+        return sem.profile.count(Profile::fn_site(sem.symbol(a))) >
+               sem.profile.count(Profile::fn_site(sem.symbol(b)));
+    });
+
+    hot.insert(hot.end(), profiled.begin(), profiled.end());
+
+    // The attribute records of moved functions move with them
+    for (auto fns : {&hot, &cold}) {
+        for (auto fn : *fns) {
+            sem.set_emits(fn, false);
+
+            for (auto attribute : fn->attributes) {
+                if (sem.emits(attribute)) {
+                    records.insert(attribute);
+                    sem.set_emits(attribute, false);
+                }
+            }
+        }
+    }
+
+    // @hot functions come first so they are packed together, @cold ones last
+    // so they stay out of the way of everything else
+    for (auto fn : hot) {
+        source_path = paths[fn];
+        generate_moved_fn(fn, records, il, sem);
+    }
+
+    for (auto &ast : asts) {
+        source_path = ast.path;
+        generate_il(ast.root, il, sem);
+    }
+
+    for (auto fn : cold) {
+        source_path = paths[fn];
+        generate_moved_fn(fn, records, il, sem);
+    }
+
+    if (sem.link_time_optimization) {
+        LinkOptimizer(il).optimize();
+    }
+
+    // The copies of generic code for every type often come out the same
+    FunctionFolder(il).fold();
+
+    if (il.lines) {
+        il.line_table();
+    }
+}
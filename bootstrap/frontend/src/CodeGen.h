@@ -1,6 +1,7 @@
 #ifndef SRC_CODEGEN_H
 #define SRC_CODEGEN_H
 
+#include <map>
 #include <stack>
 #include <vector>
 #include "ILemitter.h"
@@ -15,10 +16,19 @@ static std::string scope_owner;
 
 static int g_counter;
 
-static std::vector<AstDec *> scope;
-static std::vector<AstDec *> args;
-static std::stack<std::vector<AstDec *>> scope_stack;
-static std::stack<std::vector<AstDec *>> arg_stack;
+// Shared by semantic analysis and code generation, so types can be inferred
+// while generating code
+extern std::vector<AstDec *> scope;
+extern std::vector<AstDec *> args;
+extern std::stack<std::vector<AstDec *>> scope_stack;
+extern std::stack<std::vector<AstDec *>> arg_stack;
+
+// The file of the code being generated
+extern std::string source_path;
+
+// Ids of the IL functions --instrument-functions hooks, given out before code
+// generation so main can hand the runtime the names of all of them
+extern std::map<std::string, uint32_t> function_ids;
 
 static bool has_local(const std::string &name)
 {
@@ -118,6 +128,7 @@ static void pop_scope()
 }
 
 void generate_il(AstNode *node, ILemitter &il, Semantics &sem);
+void generate_program(std::vector<Ast> &asts, ILemitter &il, Semantics &sem);
 
 //};
 
@@ -14,6 +14,7 @@ enum class ErrorType {
 
     UnexpectedToken,
     InvalidDecl,
+    ModuleNotFound,
 
     TypeNotFound,
     NoType,
@@ -21,6 +22,11 @@ enum class ErrorType {
     DuplicateFunctionDeclaration,
     TooManyArguments,
     NotEnoughArguments,
+    InvalidAttribute,
+    LoopDependence,
+    InvalidAwait,
+    InvalidJump,
+    ImpureFunction,
 };
 
 struct Error {
@@ -31,7 +37,7 @@ struct Error {
 
     // Don't break the semantic analyser now
     // Remove these when it's rewritten
-    Error(ErrorType, AstNode*, std::string) {}
+    Error(ErrorType type, AstNode *node, std::string message);
     Error(ErrorType type, unsigned int line, unsigned int column,
             unsigned int offset, unsigned int count, std::string message):
         type(type), line(line), column(column), offset(offset), count(count),
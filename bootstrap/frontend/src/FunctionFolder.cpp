@@ -0,0 +1,215 @@
+#include "FunctionFolder.h"
+#include <unordered_map>
+
+static int index_of(const std::vector<std::pair<std::string, uint8_t>> &vars,
+                    const std::string &name)
+{
+    for (size_t i = 0; i < vars.size(); i++)
+    {
+        if (vars[i].first == name)
+        {
+            return (int)i;
+        }
+    }
+
+    return -1;
+}
+
+std::string FunctionFolder::resolve(const std::string &name) const
+{
+    auto result = name;
+
+    for (auto it = folded.find(result); it != folded.end();
+         it = folded.find(result))
+    {
+        result = it->second;
+    }
+
+    return result;
+}
+
+// The code of a function with everything that does not change what it does
+// made the same, prefixed with its signature
+std::string FunctionFolder::normalize(const Function &fn) const
+{
+    auto &signature = signatures.at(fn.name);
+    std::map<std::string, size_t> labels;
+    std::string key(1, (char)signature.type);
+
+    for (auto &param : signature.params)
+    {
+        key += (char)param.second;
+    }
+
+    key += '|';
+
+    for (auto &local : signature.locals)
+    {
+        key += (char)local.second;
+    }
+
+    key += '|';
+
+    for (auto i = fn.func + 1; i < fn.end; i++)
+    {
+        auto &instruction = code[i];
+        auto opcode = instruction.opcode;
+
+        if (is_meta(opcode))
+        {
+            continue;
+        }
+
+        if (opcode == LARG || opcode == SARG || opcode == ADRA)
+        {
+            auto &name = instruction.names[0];
+            auto index = index_of(signature.params, name);
+
+            key += (char)opcode;
+            key += index < 0 ? "?" + name : "p" + std::to_string(index);
+            key += ';';
+        }
+        else if (opcode == LLOC || opcode == SLOC || opcode == ADRL)
+        {
+            auto &name = instruction.names[0];
+            auto index = index_of(signature.locals, name);
+
+            key += (char)opcode;
+            key += index < 0 ? "?" + name : "l" + std::to_string(index);
+            key += ';';
+        }
+        else if (is_label(opcode))
+        {
+            auto label = labels.emplace(instruction.names[0], labels.size());
+
+            key += (char)opcode;
+            key += "L" + std::to_string(label.first->second) + ";";
+        }
+        else if (opcode == CALL || opcode == PFUN)
+        {
+            auto target = resolve(instruction.names[0]);
+
+            key += (char)opcode;
+            key += target == fn.name ? "self" : "f" + target;
+            key += ';';
+        }
+        else
+        {
+            key += (char)opcode;
+
+            for (auto &name : instruction.names)
+            {
+                key += std::to_string(name.size()) + ":" + name;
+            }
+
+            key.append(instruction.data.begin(), instruction.data.end());
+        }
+    }
+
+    return key;
+}
+
+// Writes the IL again without the folded functions and their declarations,
+// calling the functions they were folded into instead
+void FunctionFolder::rewrite()
+{
+    std::vector<bool> removed(code.size());
+
+    for (auto &fn : functions)
+    {
+        if (!folded.count(fn.name))
+        {
+            continue;
+        }
+
+        for (auto i = fn.func; i < fn.end; i++)
+        {
+            removed[i] = !is_meta(code[i].opcode);
+        }
+    }
+
+    std::vector<ILinstruction> result;
+
+    for (size_t i = 0; i < code.size(); i++)
+    {
+        auto &instruction = code[i];
+        auto opcode = instruction.opcode;
+
+        if (removed[i] ||
+            ((opcode == INFN || opcode == FPRM || opcode == FLOC) &&
+             folded.count(instruction.names[0])))
+        {
+            continue;
+        }
+
+        result.push_back(instruction);
+
+        if (opcode == CALL || opcode == PFUN)
+        {
+            result.back().names[0] = resolve(instruction.names[0]);
+        }
+    }
+
+    encode_il(result, il);
+}
+
+size_t FunctionFolder::fold()
+{
+    if (!decode_il(il, code))
+    {
+        return 0;
+    }
+
+    signatures = find_signatures(code);
+
+    for (size_t i = 0; i < code.size(); i++)
+    {
+        if (code[i].opcode != FUNC)
+        {
+            continue;
+        }
+
+        if (!functions.empty())
+        {
+            functions.back().end = i;
+        }
+
+        functions.push_back({code[i].names[0], i, code.size()});
+    }
+
+    size_t count = 0;
+    bool changed = true;
+
+    while (changed)
+    {
+        changed = false;
+
+        // The first function of every normalized code
+        std::unordered_map<std::string, std::string> kept;
+
+        for (auto &fn : functions)
+        {
+            if (fn.name == "main" || folded.count(fn.name) ||
+                !signatures.count(fn.name))
+            {
+                continue;
+            }
+
+            auto first = kept.emplace(normalize(fn), fn.name);
+
+            if (!first.second)
+            {
+                folded[fn.name] = first.first->second;
+                changed = true;
+                count++;
+            }
+        }
+    }
+
+    if (count)
+    {
+        rewrite();
+    }
+
+    return count;
+}
@@ -0,0 +1,49 @@
+#ifndef FRONTEND_FUNCTIONFOLDER_H
+#define FRONTEND_FUNCTIONFOLDER_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+#include "ILcode.h"
+
+/**
+ * Folds IL functions that do the same thing into one once the whole program
+ * is generated, like the copies of a method for every integer type. Functions
+ * are compared by their signature and code, with parameters and locals
+ * numbered in the order they are declared, labels in the order they appear
+ * and calls of themselves made anonymous. Only the first of each set of equal
+ * functions is kept, and every call and PFUN of the others is redirected to
+ * it. Folding repeats until no more functions are equal, as callers can become
+ * equal once their callees are folded.
+ */
+class FunctionFolder
+{
+public:
+  explicit FunctionFolder(ILemitter &il) : il(il) {}
+
+  /** Folds the functions of the IL, returns the number folded */
+  size_t fold();
+
+private:
+  struct Function
+  {
+    std::string name;
+    size_t func;
+    size_t end;
+  };
+
+  ILemitter &il;
+  std::vector<ILinstruction> code;
+  std::vector<Function> functions;
+  std::map<std::string, ILsignature> signatures;
+
+  // The function each folded function was folded into
+  std::map<std::string, std::string> folded;
+
+  std::string resolve(const std::string &name) const;
+  std::string normalize(const Function &fn) const;
+  void rewrite();
+};
+
+#endif // FRONTEND_FUNCTIONFOLDER_H
@@ -0,0 +1,250 @@
+#include "ILcode.h"
+
+// The arguments of an instruction: s is a string, digits are that many bytes.
+// Strings always come first. EXFN and CALS end in arrays and are decoded on
+// their own. nullptr for opcodes the frontend does not emit.
+static const char *layout(uint8_t opcode)
+{
+    switch (opcode)
+    {
+    case NOOP: case PTRU: case PFLS: case DELE: case SWAP: case DUPE:
+    case CMPE: case CMPG: case CPGE: case CMPL: case CPLE: case CPNE:
+    case RETN: case ADRS: case READ: case WRIT: case MCPY: case MSET:
+    case IADD: case ISUB: case IMUL: case IDIV: case IMOD: case INEG:
+    case FADD: case FSUB: case FMUL: case FDIV: case FMOD: case FNEG:
+    case BSHL: case BSHR: case BAND: case BWOR: case BXOR:
+        return "";
+
+    case PU08: case PI08: case CAST:
+    case BROL: case BROR: case BPOP: case BCLZ: case BCTZ: case BSWP:
+    case VADD: case VSUB: case VMUL: case VDIV: case VCPE: case VCPG:
+    case VCPL: case VSHF: case VLOD: case VSTR: case VSPL: case VBLD:
+    case VEXT: case VINS: case VSUM:
+        return "1";
+
+    case PU16: case PI16:
+        return "2";
+
+    case PU32: case PI32: case PF32:
+        return "4";
+
+    case PU64: case PI64: case PF64:
+        return "8";
+
+    case PSTR: case PFUN: case PLBL: case FUNC: case CALL: case LABL:
+    case JUMP: case JEQZ: case JNEZ: case JGTZ: case JGEZ: case JLTZ:
+    case JLEZ: case LLOC: case SLOC: case ADRL: case LARG: case SARG:
+    case ADRA: case LGLO: case SGLO: case ADRG:
+        return "s";
+
+    case INFN: case GLOB:
+        return "s1";
+
+    case FPRM: case FLOC:
+        return "ss1";
+
+    case DATA:
+        return "ss";
+
+    default:
+        return nullptr;
+    }
+}
+
+bool is_meta(uint8_t opcode)
+{
+    return opcode == EXFN || opcode == INFN || opcode == FPRM ||
+           opcode == FLOC || opcode == GLOB || opcode == DATA;
+}
+
+bool is_label(uint8_t opcode)
+{
+    return opcode == LABL || opcode == PLBL ||
+           (opcode >= JUMP && opcode <= JLEZ);
+}
+
+uint8_t pushed_type(uint8_t opcode)
+{
+    // The push opcodes are numbered like the types they push
+    if (opcode <= PF64)
+    {
+        return opcode;
+    }
+
+    if (opcode == PTRU || opcode == PFLS)
+    {
+        return U8;
+    }
+
+    return VOID;
+}
+
+std::map<std::string, ILsignature> find_signatures(
+    const std::vector<ILinstruction> &code)
+{
+    std::map<std::string, ILsignature> signatures;
+
+    for (auto &instruction : code)
+    {
+        switch (instruction.opcode)
+        {
+        case INFN:
+            signatures[instruction.names[0]].type = instruction.data[0];
+            break;
+
+        case FPRM:
+            signatures[instruction.names[0]].params.emplace_back(
+                instruction.names[1], instruction.data[0]);
+            break;
+
+        case FLOC:
+            signatures[instruction.names[0]].locals.emplace_back(
+                instruction.names[1], instruction.data[0]);
+            break;
+        }
+    }
+
+    return signatures;
+}
+
+bool decode_il(const ILemitter &il, std::vector<ILinstruction> &code)
+{
+    auto &stream = il.stream;
+    auto position = il.positions.begin();
+    SourcePosition current;
+    size_t at = 0;
+
+    auto read_u32 = [&](size_t p, uint32_t &x) {
+        if (p + 4 > stream.size())
+        {
+            return false;
+        }
+
+        x = (uint32_t)stream[p] << 24 | (uint32_t)stream[p + 1] << 16 |
+            (uint32_t)stream[p + 2] << 8 | (uint32_t)stream[p + 3];
+        return true;
+    };
+
+    auto read_string = [&](size_t &p, ILinstruction &instruction) {
+        uint32_t length;
+
+        if (!read_u32(p, length) || p + 4 + length > stream.size())
+        {
+            return false;
+        }
+
+        instruction.names.emplace_back(stream.begin() + p + 4,
+                                       stream.begin() + p + 4 + length);
+        p += 4 + length;
+        return true;
+    };
+
+    code.clear();
+
+    while (at < stream.size())
+    {
+        ILinstruction instruction;
+        instruction.opcode = stream[at];
+
+        // An entry applies from its offset on
+        while (position != il.positions.end() && position->first <= at)
+        {
+            current = position->second;
+            position++;
+        }
+
+        instruction.position = current;
+
+        size_t p = at + 1;
+        size_t end;
+        uint32_t count;
+
+        if (instruction.opcode == EXFN)
+        {
+            if (!read_string(p, instruction) || !read_u32(p + 1, count))
+            {
+                return false;
+            }
+
+            end = p + 5 + count;
+        }
+        else if (instruction.opcode == CALS)
+        {
+            if (!read_u32(p + 1, count))
+            {
+                return false;
+            }
+
+            end = p + 5 + 4 * (size_t)count;
+        }
+        else
+        {
+            auto arguments = layout(instruction.opcode);
+
+            if (!arguments)
+            {
+                return false;
+            }
+
+            end = p;
+
+            for (auto c = arguments; *c; c++)
+            {
+                if (*c == 's')
+                {
+                    if (!read_string(p, instruction))
+                    {
+                        return false;
+                    }
+
+                    end = p;
+                }
+                else
+                {
+                    end += *c - '0';
+                }
+            }
+        }
+
+        if (end > stream.size())
+        {
+            return false;
+        }
+
+        instruction.data.assign(stream.begin() + p, stream.begin() + end);
+        code.push_back(std::move(instruction));
+        at = end;
+    }
+
+    return true;
+}
+
+void encode_il(const std::vector<ILinstruction> &code, ILemitter &il)
+{
+    il.stream.clear();
+    il.positions.clear();
+
+    for (auto &instruction : code)
+    {
+        auto &at = instruction.position;
+
+        // Code starts out without a position, it needs no entry until one
+        // was set
+        if (il.lines && (!il.positions.empty() || at.line || at.file))
+        {
+            il.set_position(at);
+        }
+
+        il.w(instruction.opcode);
+
+        // Written with their length, string literals can hold zeros
+        for (auto &name : instruction.names)
+        {
+            il.w((uint32_t)name.size());
+            il.stream.insert(il.stream.end(), name.begin(), name.end());
+        }
+
+        il.stream.insert(il.stream.end(), instruction.data.begin(),
+                         instruction.data.end());
+    }
+}
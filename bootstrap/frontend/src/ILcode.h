@@ -0,0 +1,59 @@
+#ifndef FRONTEND_ILCODE_H
+#define FRONTEND_ILCODE_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+#include "ILemitter.h"
+
+/**
+ * An instruction of IL that was already written, for the passes that work on
+ * the whole program once it is generated. The string arguments are kept apart
+ * from the rest so names are easy to change.
+ */
+struct ILinstruction
+{
+    uint8_t opcode = NOOP;
+
+    // The string arguments, in order
+    std::vector<std::string> names;
+
+    // The bytes of the other arguments, in order
+    std::vector<uint8_t> data;
+
+    SourcePosition position;
+};
+
+/** The declared type of a function, and its parameters and locals in order */
+struct ILsignature
+{
+    uint8_t type = VOID;
+    std::vector<std::pair<std::string, uint8_t>> params;
+    std::vector<std::pair<std::string, uint8_t>> locals;
+};
+
+/**
+ * Reads the IL written to il with the source position of every instruction.
+ * Returns false if it holds anything that can not be decoded, like an opcode
+ * the frontend does not emit.
+ */
+bool decode_il(const ILemitter &il, std::vector<ILinstruction> &code);
+
+/** Replaces the IL written to il and its source positions with code */
+void encode_il(const std::vector<ILinstruction> &code, ILemitter &il);
+
+/** The signatures of the functions defined in code, by name */
+std::map<std::string, ILsignature> find_signatures(
+    const std::vector<ILinstruction> &code);
+
+/** Declarations rather than code, like INFN and FLOC */
+bool is_meta(uint8_t opcode);
+
+/** Whether the instruction defines or refers to a label */
+bool is_label(uint8_t opcode);
+
+/** The type pushed by a constant push, VOID for any other instruction */
+uint8_t pushed_type(uint8_t opcode);
+
+#endif // FRONTEND_ILCODE_H
@@ -241,6 +241,14 @@ void ILemitter::write() {
     w(WRIT);
 }
 
+void ILemitter::memory_copy() {
+    w(MCPY);
+}
+
+void ILemitter::memory_set() {
+    w(MSET);
+}
+
 void ILemitter::integer_add() {
     w(IADD);
 }
@@ -309,6 +317,111 @@ void ILemitter::bitwise_xor() {
     w(BXOR);
 }
 
+void ILemitter::rotate_left(uint8_t type) {
+    w(BROL);
+    w(type);
+}
+
+void ILemitter::rotate_right(uint8_t type) {
+    w(BROR);
+    w(type);
+}
+
+void ILemitter::population_count(uint8_t type) {
+    w(BPOP);
+    w(type);
+}
+
+void ILemitter::count_leading_zeros(uint8_t type) {
+    w(BCLZ);
+    w(type);
+}
+
+void ILemitter::count_trailing_zeros(uint8_t type) {
+    w(BCTZ);
+    w(type);
+}
+
+void ILemitter::byte_swap(uint8_t type) {
+    w(BSWP);
+    w(type);
+}
+
+void ILemitter::vector_add(uint8_t type) {
+    w(VADD);
+    w(type);
+}
+
+void ILemitter::vector_subtract(uint8_t type) {
+    w(VSUB);
+    w(type);
+}
+
+void ILemitter::vector_multiply(uint8_t type) {
+    w(VMUL);
+    w(type);
+}
+
+void ILemitter::vector_divide(uint8_t type) {
+    w(VDIV);
+    w(type);
+}
+
+void ILemitter::vector_compare_equal(uint8_t type) {
+    w(VCPE);
+    w(type);
+}
+
+void ILemitter::vector_compare_greater_than(uint8_t type) {
+    w(VCPG);
+    w(type);
+}
+
+void ILemitter::vector_compare_less_than(uint8_t type) {
+    w(VCPL);
+    w(type);
+}
+
+void ILemitter::vector_shuffle(uint8_t type) {
+    w(VSHF);
+    w(type);
+}
+
+void ILemitter::vector_load(uint8_t type) {
+    w(VLOD);
+    w(type);
+}
+
+void ILemitter::vector_store(uint8_t type) {
+    w(VSTR);
+    w(type);
+}
+
+void ILemitter::vector_splat(uint8_t type) {
+    w(VSPL);
+    w(type);
+}
+
+void ILemitter::vector_build(uint8_t type) {
+    w(VBLD);
+    w(type);
+}
+
+void ILemitter::vector_extract(uint8_t type) {
+    w(VEXT);
+    w(type);
+}
+
+void ILemitter::vector_insert(uint8_t type) {
+    w(VINS);
+    w(type);
+}
+
+void ILemitter::vector_sum(uint8_t type) {
+    w(VSUM);
+    w(type);
+}
+
 void ILemitter::external_function(
     const char *name,
     uint8_t type,
@@ -340,6 +453,8 @@ void ILemitter::function_parameter(
 
 void ILemitter::function_local(
     const char *func, const char *name, uint8_t type) {
+    locals[func].emplace_back(name, type);
+
     w(FLOC);
     w(func);
     w(name);
@@ -357,3 +472,97 @@ void ILemitter::data(const char *name, const char *data) {
     w(name);
     w(data);
 }
+
+uint32_t ILemitter::source_file(const std::string &path) {
+    for (uint32_t i = 0; i < source_files.size(); i++) {
+        if (source_files[i] == path) {
+            return i;
+        }
+    }
+
+    source_files.push_back(path);
+    return (uint32_t)(source_files.size() - 1);
+}
+
+void ILemitter::set_position(const SourcePosition &at) {
+    position = at;
+
+    auto offset = (uint32_t)stream.size();
+
+    // A position no code was generated for is replaced
+    if (!positions.empty() && positions.back().first == offset) {
+        positions.pop_back();
+    }
+
+    if (!positions.empty()) {
+        auto &last = positions.back().second;
+
+        if (last.file == at.file && last.line == at.line &&
+            last.column == at.column) {
+            return;
+        }
+    }
+
+    positions.emplace_back(offset, at);
+}
+
+static void write_unsigned(std::vector<uint8_t> &table, uint32_t x) {
+    while (x >= 0x80) {
+        table.push_back((uint8_t)(x | 0x80));
+        x >>= 7;
+    }
+
+    table.push_back((uint8_t)x);
+}
+
+static void write_signed(std::vector<uint8_t> &table, int32_t x) {
+    write_unsigned(table, ((uint32_t)x << 1) ^ (uint32_t)(x >> 31));
+}
+
+// The LINE section holds the source files, then a table of the positions in
+// order of their IL offsets. Every entry is the offset from the previous one,
+// shifted left with the lowest bit set if the file changes, the index of the
+// new file if it does, then the changes in line and column, zigzag encoded.
+// All numbers are LEB128, and the table starts at offset, file, line and
+// column 0.
+void ILemitter::line_table() {
+    std::vector<uint8_t> table;
+    SourcePosition last;
+    uint32_t last_offset = 0;
+    auto end = (uint32_t)stream.size();
+
+    for (auto &entry : positions) {
+        auto &at = entry.second;
+
+        if (entry.first >= end) {
+            break;
+        }
+
+        bool file_changed = at.file != last.file;
+
+        write_unsigned(table, (entry.first - last_offset) << 1 | file_changed);
+
+        if (file_changed) {
+            write_unsigned(table, at.file);
+        }
+
+        write_signed(table, (int32_t)(at.line - last.line));
+        write_signed(table, (int32_t)(at.column - last.column));
+
+        last = at;
+        last_offset = entry.first;
+    }
+
+    w(LINE);
+    w((uint32_t)source_files.size());
+
+    for (auto &file : source_files) {
+        w(file.c_str());
+    }
+
+    w((uint32_t)table.size());
+
+    for (auto byte : table) {
+        w(byte);
+    }
+}
@@ -3,6 +3,7 @@
 
 #include <vector>
 #include <map>
+#include <string>
 #include <stdio.h>
 #include <string.h>
 #include <stddef.h>
@@ -34,6 +35,7 @@
 #define CPGE (uint8_t)0x32
 #define CMPL (uint8_t)0x33
 #define CPLE (uint8_t)0x34
+#define CPNE (uint8_t)0x35
 #define FUNC (uint8_t)0x40
 #define RETN (uint8_t)0x41
 #define CALL (uint8_t)0x42
@@ -74,7 +76,32 @@
 #define BAND (uint8_t)0x92
 #define BWOR (uint8_t)0x93
 #define BXOR (uint8_t)0x94
+//**Bit Manipulation** followed by the integer type
+#define BROL (uint8_t)0x95
+#define BROR (uint8_t)0x96
+#define BPOP (uint8_t)0x97
+#define BCLZ (uint8_t)0x98
+#define BCTZ (uint8_t)0x99
+#define BSWP (uint8_t)0x9A
 #define ADRS (uint8_t)0x6b
+#define MCPY (uint8_t)0x6c
+#define MSET (uint8_t)0x6d
+//**Vector** A0 is the vector type
+#define VADD (uint8_t)0xA0
+#define VSUB (uint8_t)0xA1
+#define VMUL (uint8_t)0xA2
+#define VDIV (uint8_t)0xA3
+#define VCPE (uint8_t)0xA4
+#define VCPG (uint8_t)0xA5
+#define VCPL (uint8_t)0xA6
+#define VSHF (uint8_t)0xA7
+#define VLOD (uint8_t)0xA8
+#define VSTR (uint8_t)0xA9
+#define VSPL (uint8_t)0xAA
+#define VBLD (uint8_t)0xAB
+#define VEXT (uint8_t)0xAC
+#define VINS (uint8_t)0xAD
+#define VSUM (uint8_t)0xAE
 
 #define EXFN (uint8_t)0xE0
 #define INFN (uint8_t)0xE1
@@ -82,6 +109,7 @@
 #define FLOC (uint8_t)0xE3
 #define GLOB (uint8_t)0xE4
 #define DATA (uint8_t)0xE5
+#define LINE (uint8_t)0xE6
 
 // DataType Encoding
 #define U8   (uint8_t)0x0
@@ -96,6 +124,9 @@
 #define F64  (uint8_t)0x9
 #define STR  (uint8_t)0xA
 #define PTR  (uint8_t)0xB
+#define F32X4 (uint8_t)0xC
+#define I32X4 (uint8_t)0xD
+#define U8X16 (uint8_t)0xE
 #define VOID (uint8_t)0xF
 
 static const std::map<std::string, uint8_t> type_map = {
@@ -112,13 +143,34 @@ static const std::map<std::string, uint8_t> type_map = {
     {"f64",  F64},
     {"str",  STR},
     {"ptr",  PTR},
+    {"f32x4", F32X4},
+    {"i32x4", I32X4},
+    {"u8x16", U8X16},
     {"void", VOID},
 };
 
+// A position in the source files of a program. A line of 0 is code with no
+// position, generated by the compiler itself.
+struct SourcePosition {
+    uint32_t file = 0;
+    uint32_t line = 0;
+    uint32_t column = 0;
+};
+
 class ILemitter {
 public:
     std::vector<uint8_t> stream;
 
+    // With lines set, the source position of the code is recorded at every IL
+    // offset it changes at, and written as the LINE section by line_table
+    bool lines = false;
+    SourcePosition position;
+    std::vector<std::string> source_files;
+    std::vector<std::pair<uint32_t, SourcePosition>> positions;
+
+    // The locals declared so far and their types, by function
+    std::map<std::string, std::vector<std::pair<std::string, uint8_t>>> locals;
+
     void remove_last();
     void no_operation();
     void push_u8(uint8_t x);
@@ -169,6 +221,8 @@ public:
     void address_global(const char *lbl);
     void read();
     void write();
+    void memory_copy();
+    void memory_set();
     void integer_add();
     void integer_subtract();
     void integer_multiply();
@@ -186,6 +240,27 @@ public:
     void bitwise_and();
     void bitwise_or();
     void bitwise_xor();
+    void rotate_left(uint8_t type);
+    void rotate_right(uint8_t type);
+    void population_count(uint8_t type);
+    void count_leading_zeros(uint8_t type);
+    void count_trailing_zeros(uint8_t type);
+    void byte_swap(uint8_t type);
+    void vector_add(uint8_t type);
+    void vector_subtract(uint8_t type);
+    void vector_multiply(uint8_t type);
+    void vector_divide(uint8_t type);
+    void vector_compare_equal(uint8_t type);
+    void vector_compare_greater_than(uint8_t type);
+    void vector_compare_less_than(uint8_t type);
+    void vector_shuffle(uint8_t type);
+    void vector_load(uint8_t type);
+    void vector_store(uint8_t type);
+    void vector_splat(uint8_t type);
+    void vector_build(uint8_t type);
+    void vector_extract(uint8_t type);
+    void vector_insert(uint8_t type);
+    void vector_sum(uint8_t type);
 
     void external_function(
         const char *name,
@@ -199,6 +274,10 @@ public:
     void global(const char *name, uint8_t type);
     void data(const char *name, const char *data);
 
+    uint32_t source_file(const std::string &path);
+    void set_position(const SourcePosition &at);
+    void line_table();
+
     void w(uint8_t x) {
         stream.push_back(x);
         // printf("%hhu ", x);
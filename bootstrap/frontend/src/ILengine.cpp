@@ -0,0 +1,3518 @@
+#include "ILengine.h"
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <set>
+
+#ifdef _WIN32
+#include <fstream>
+#include <iterator>
+#else
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Addresses below this are never handed out, so 0 stays null
+static const uint32_t reserved = 16;
+
+// Allocations are rounded up to this, with room for a WRIT of four bytes at
+// their last byte
+static const uint32_t alignment = 8;
+
+// Calls nested deeper than this fail, rather than recursion without end
+// running out of memory
+static const size_t max_frames = 100000;
+
+// Snapshots start with this, the second part is the version of their format
+static const char snapshot_magic[] = "DUSKSNAP";
+static const uint32_t snapshot_version = 2;
+
+// The type of a word READ pushes. Memory is untyped, so the word takes the
+// type of what it meets: the other operand of an instruction, or the variable
+// or parameter it is stored in. Anywhere else it is the i32 the native target
+// compares and divides it as.
+static const uint8_t WORD = 0x10;
+
+static unsigned width(uint8_t type)
+{
+    switch (type)
+    {
+    case U8: case I8:
+        return 8;
+
+    case U16: case I16:
+        return 16;
+
+    case U64: case I64: case F64:
+        return 64;
+
+    default:
+        return 32;
+    }
+}
+
+static bool is_signed(uint8_t type)
+{
+    return type == I8 || type == I16 || type == I32 || type == I64;
+}
+
+static bool is_float(uint8_t type)
+{
+    return type == F32 || type == F64;
+}
+
+static uint64_t mask(uint8_t type, uint64_t bits)
+{
+    auto n = width(type);
+    return n == 64 ? bits : bits & ((1ull << n) - 1);
+}
+
+// The value as an integer, extended from the width of its type
+static int64_t as_int(const ILvalue &value)
+{
+    if (value.type == F32)
+    {
+        float f;
+        auto bits = (uint32_t)value.bits;
+        memcpy(&f, &bits, sizeof(f));
+        return (int64_t)f;
+    }
+
+    if (value.type == F64)
+    {
+        double d;
+        memcpy(&d, &value.bits, sizeof(d));
+        return (int64_t)d;
+    }
+
+    if (value.type == WORD)
+    {
+        return (int32_t)value.bits;
+    }
+
+    auto n = width(value.type);
+    auto bits = mask(value.type, value.bits);
+
+    if (is_signed(value.type) && n < 64 && (bits >> (n - 1)) & 1)
+    {
+        bits |= ~0ull << n;
+    }
+
+    return (int64_t)bits;
+}
+
+static double as_float(const ILvalue &value)
+{
+    if (value.type == F32)
+    {
+        float f;
+        auto bits = (uint32_t)value.bits;
+        memcpy(&f, &bits, sizeof(f));
+        return f;
+    }
+
+    if (value.type == F64)
+    {
+        double d;
+        memcpy(&d, &value.bits, sizeof(d));
+        return d;
+    }
+
+    return (double)as_int(value);
+}
+
+// Float instructions and printf take words read from memory, which are
+// untyped, as the f32 they hold
+static double float_operand(ILvalue value)
+{
+    if (!is_float(value.type))
+    {
+        value.type = F32;
+    }
+
+    return as_float(value);
+}
+
+// The type an operand is taken as next to the other operand of an instruction
+static uint8_t operand_type(uint8_t type, uint8_t other)
+{
+    if (type != WORD)
+    {
+        return type;
+    }
+
+    return other != WORD ? other : I32;
+}
+
+// A word stored in a variable or parameter takes its declared type
+static ILvalue stored(ILvalue value, uint8_t type)
+{
+    if (value.type == WORD && type != VOID)
+    {
+        value.type = type;
+    }
+
+    return value;
+}
+
+static ILvalue make_int(uint8_t type, int64_t x)
+{
+    ILvalue value;
+    value.type = type;
+    value.bits = mask(type, (uint64_t)x);
+    return value;
+}
+
+static ILvalue make_float(uint8_t type, double x)
+{
+    ILvalue value;
+    value.type = type;
+
+    if (type == F64)
+    {
+        memcpy(&value.bits, &x, sizeof(x));
+    }
+    else
+    {
+        float f = (float)x;
+        uint32_t bits;
+        memcpy(&bits, &f, sizeof(f));
+        value.bits = bits;
+    }
+
+    return value;
+}
+
+static uint64_t big_endian(const std::vector<uint8_t> &data, size_t count)
+{
+    uint64_t x = 0;
+
+    for (size_t i = 0; i < count && i < data.size(); i++)
+    {
+        x = x << 8 | data[i];
+    }
+
+    return x;
+}
+
+static std::string hex(uint32_t x)
+{
+    char buffer[16];
+    snprintf(buffer, sizeof(buffer), "0x%X", x);
+    return buffer;
+}
+
+static bool is_vector(uint8_t type)
+{
+    return type == F32X4 || type == I32X4 || type == U8X16;
+}
+
+static unsigned lane_count(uint8_t type)
+{
+    return type == U8X16 ? 16 : 4;
+}
+
+// The bits of a lane of a vector of the given type, zero extended
+static uint32_t get_lane(const ILvalue &vector, uint8_t type, unsigned lane)
+{
+    auto bits = 128 / lane_count(type);
+    auto offset = lane * bits;
+    auto half = offset < 64 ? vector.bits : vector.high;
+    auto x = half >> (offset % 64);
+
+    return (uint32_t)(bits == 32 ? x : x & 0xFF);
+}
+
+static void set_lane(ILvalue &vector, uint8_t type, unsigned lane, uint32_t x)
+{
+    auto bits = 128 / lane_count(type);
+    auto offset = lane * bits;
+    auto &half = offset < 64 ? vector.bits : vector.high;
+    auto lane_mask = (bits == 32 ? 0xFFFFFFFFull : 0xFFull) << (offset % 64);
+
+    half = (half & ~lane_mask) | ((uint64_t)x << (offset % 64) & lane_mask);
+}
+
+static float lane_float(uint32_t bits)
+{
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+static uint32_t float_lane(float f)
+{
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(f));
+    return bits;
+}
+
+// One lane of an arithmetic or comparison vector instruction. Integer lanes
+// wrap around, u8 lanes compare unsigned and i32 lanes signed, and
+// comparisons give all ones where they hold.
+static bool vector_lane(uint8_t opcode, uint8_t type, uint32_t a, uint32_t b,
+                        uint32_t &result)
+{
+    if (type == F32X4)
+    {
+        auto x = lane_float(a), y = lane_float(b);
+
+        switch (opcode)
+        {
+        case VADD: result = float_lane(x + y); break;
+        case VSUB: result = float_lane(x - y); break;
+        case VMUL: result = float_lane(x * y); break;
+        case VDIV: result = float_lane(x / y); break;
+        case VCPE: result = x == y ? ~0u : 0; break;
+        case VCPG: result = x > y ? ~0u : 0; break;
+        case VCPL: result = x < y ? ~0u : 0; break;
+        }
+
+        return true;
+    }
+
+    auto all = type == U8X16 ? 0xFFu : ~0u;
+    auto x = (int32_t)a, y = (int32_t)b;
+
+    switch (opcode)
+    {
+    case VADD: result = a + b; break;
+    case VSUB: result = a - b; break;
+    case VMUL: result = a * b; break;
+    case VDIV:
+        if (!b)
+        {
+            return false;
+        }
+
+        result = type == U8X16 ? a / b
+                 : y == -1     ? 0u - a
+                               : (uint32_t)(x / y);
+        break;
+    case VCPE: result = a == b ? all : 0; break;
+    case VCPG: result = (type == U8X16 ? a > b : x > y) ? all : 0; break;
+    case VCPL: result = (type == U8X16 ? a < b : x < y) ? all : 0; break;
+    }
+
+    result &= all;
+    return true;
+}
+
+// Snapshots are little endian whatever the host is, like memory
+static void put(std::string &out, uint64_t x, unsigned bytes)
+{
+    for (unsigned i = 0; i < bytes; i++)
+    {
+        out += (char)(x >> (8 * i));
+    }
+}
+
+static void put_text(std::string &out, const std::string &text)
+{
+    put(out, text.size(), 4);
+    out += text;
+}
+
+// Reads a snapshot, every read past its end fails and reads zero from then on
+struct SnapshotReader
+{
+    const uint8_t *at;
+    const uint8_t *end;
+    bool ok = true;
+
+    const uint8_t *bytes(size_t count)
+    {
+        if (!ok || (size_t)(end - at) < count)
+        {
+            ok = false;
+            return nullptr;
+        }
+
+        auto begin = at;
+        at += count;
+        return begin;
+    }
+
+    uint64_t get(unsigned count)
+    {
+        auto data = bytes(count);
+        uint64_t x = 0;
+
+        for (unsigned i = 0; data && i < count; i++)
+        {
+            x |= (uint64_t)data[i] << (8 * i);
+        }
+
+        return x;
+    }
+
+    std::string text()
+    {
+        auto size = get(4);
+        auto data = bytes(size);
+        return data ? std::string((const char *)data, size) : "";
+    }
+};
+
+// A file mapped into memory for reading, or read into it where files can not
+// be mapped
+class MappedFile
+{
+public:
+    const uint8_t *data = nullptr;
+    size_t size = 0;
+
+    explicit MappedFile(const std::string &path)
+    {
+#ifdef _WIN32
+        std::ifstream stream(path, std::ios::binary);
+        contents.assign(std::istreambuf_iterator<char>(stream),
+                        std::istreambuf_iterator<char>());
+
+        if (stream)
+        {
+            data = (const uint8_t *)contents.data();
+            size = contents.size();
+        }
+#else
+        auto fd = open(path.c_str(), O_RDONLY);
+        struct stat info;
+
+        if (fd < 0)
+        {
+            return;
+        }
+
+        if (fstat(fd, &info) == 0 && info.st_size > 0)
+        {
+            auto mapped = mmap(nullptr, (size_t)info.st_size, PROT_READ,
+                               MAP_PRIVATE, fd, 0);
+
+            if (mapped != MAP_FAILED)
+            {
+                data = (const uint8_t *)mapped;
+                size = (size_t)info.st_size;
+            }
+        }
+
+        close(fd);
+#endif
+    }
+
+    ~MappedFile()
+    {
+#ifndef _WIN32
+        if (data)
+        {
+            munmap((void *)data, size);
+        }
+#endif
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+private:
+#ifdef _WIN32
+    std::string contents;
+#endif
+};
+
+const std::map<std::string, ILengine::External> ILengine::externals = {
+    {"printf", &ILengine::ext_printf},
+    {"puts", &ILengine::ext_puts},
+    {"putchar", &ILengine::ext_putchar},
+    {"malloc", &ILengine::ext_malloc},
+    {"calloc", &ILengine::ext_calloc},
+    {"free", &ILengine::ext_free},
+    {"dusk_str_concat", &ILengine::ext_concat},
+    {"dusk_bounds_check", &ILengine::ext_bounds_check},
+    {"dusk_snapshot", &ILengine::ext_snapshot},
+    {"strlen", &ILengine::ext_strlen},
+    {"dusk_arena_new", &ILengine::ext_arena_new},
+    {"dusk_arena_alloc", &ILengine::ext_arena_alloc},
+    {"dusk_arena_reset", &ILengine::ext_arena_reset},
+    {"dusk_arena_release", &ILengine::ext_arena_release},
+    {"dusk_pool_new", &ILengine::ext_pool_new},
+    {"dusk_pool_alloc", &ILengine::ext_pool_alloc},
+    {"dusk_pool_free", &ILengine::ext_pool_free},
+    {"dusk_pool_release", &ILengine::ext_pool_release},
+    {"dusk_sb_new", &ILengine::ext_sb_new},
+    {"dusk_sb_append", &ILengine::ext_sb_append},
+    {"dusk_sb_append_char", &ILengine::ext_sb_append_char},
+    {"dusk_sb_length", &ILengine::ext_sb_length},
+    {"dusk_sb_finish", &ILengine::ext_sb_finish},
+    {"dusk_sb_release", &ILengine::ext_sb_release},
+    {"dusk_rope_leaf", &ILengine::ext_rope_leaf},
+    {"dusk_rope_concat", &ILengine::ext_rope_concat},
+    {"dusk_rope_length", &ILengine::ext_rope_length},
+    {"dusk_rope_char_at", &ILengine::ext_rope_char_at},
+    {"dusk_rope_flatten", &ILengine::ext_rope_flatten},
+    {"dusk_rope_release", &ILengine::ext_rope_release},
+    {"dusk_parallel_for", &ILengine::ext_parallel_for},
+    {"dusk_parallel_lock", &ILengine::ext_parallel_lock},
+    {"dusk_parallel_unlock", &ILengine::ext_parallel_lock},
+    {"dusk_task_new", &ILengine::ext_task_new},
+    {"dusk_task_return", &ILengine::ext_task_return},
+    {"dusk_task_await", &ILengine::ext_task_await},
+    {"dusk_future_take", &ILengine::ext_future_take},
+    {"dusk_spawn", &ILengine::ext_spawn},
+    {"dusk_run", &ILengine::ext_run},
+    {"dusk_block_on", &ILengine::ext_block_on},
+#ifndef _WIN32
+    {"dusk_read", &ILengine::ext_io},
+    {"dusk_write", &ILengine::ext_io},
+    {"dusk_accept", &ILengine::ext_io},
+#endif
+};
+
+ILengine::ILengine() : memory(reserved)
+{
+}
+
+size_t ILengine::function(const std::string &name)
+{
+    auto found = function_index.find(name);
+
+    if (found != function_index.end())
+    {
+        return found->second;
+    }
+
+    bodies.emplace_back(new Function());
+    bodies.back()->name = name;
+
+    functions.emplace_back(bodies.back().get());
+    function_index.emplace(name, functions.size() - 1);
+    return functions.size() - 1;
+}
+
+bool ILengine::fail(const std::string &message)
+{
+    if (error.empty())
+    {
+        error = message;
+    }
+
+    return false;
+}
+
+bool ILengine::load(const ILemitter &il)
+{
+    std::vector<ILinstruction> code;
+    error.clear();
+
+    if (!decode_il(il, code))
+    {
+        return fail("The IL can not be decoded");
+    }
+
+    std::lock_guard<std::mutex> lock(update);
+
+    if (!define(code))
+    {
+        return false;
+    }
+
+    add_fingerprint(il);
+    return true;
+}
+
+// Adds the external and internal functions of code, all of them or none if
+// one can not be translated
+bool ILengine::define(const std::vector<ILinstruction> &code)
+{
+    auto signatures = find_signatures(code);
+    std::vector<std::unique_ptr<Function>> defined;
+
+    for (size_t i = 0; i < code.size(); i++)
+    {
+        if (code[i].opcode != EXFN && code[i].opcode != FUNC)
+        {
+            continue;
+        }
+
+        std::unique_ptr<Function> fn;
+        std::string why;
+
+        if (!declare(code, i, signatures, false, fn, why))
+        {
+            return fail(why);
+        }
+
+        defined.push_back(std::move(fn));
+    }
+
+    for (auto &fn : defined)
+    {
+        functions[function(fn->name)].store(fn.get());
+        bodies.push_back(std::move(fn));
+    }
+
+    return true;
+}
+
+// Reads the function code[i] declares as external or defines. Functions and
+// variables that are not there yet are added, unless the engine is running.
+bool ILengine::declare(const std::vector<ILinstruction> &code, size_t i,
+                       const std::map<std::string, ILsignature> &signatures,
+                       bool running, std::unique_ptr<Function> &fn,
+                       std::string &why)
+{
+    auto &instruction = code[i];
+
+    fn.reset(new Function());
+    fn->name = instruction.names[0];
+    fn->defined = true;
+
+    if (instruction.opcode == EXFN)
+    {
+        fn->type = instruction.data[0];
+        fn->external = true;
+        fn->params.resize(big_endian(
+            std::vector<uint8_t>(instruction.data.begin() + 1,
+                                 instruction.data.end()), 4));
+        return true;
+    }
+
+    auto signature = signatures.find(fn->name);
+
+    if (signature != signatures.end())
+    {
+        fn->type = signature->second.type;
+
+        for (auto &param : signature->second.params)
+        {
+            fn->params.push_back(param.first);
+            fn->param_types.push_back(param.second);
+        }
+
+        for (auto &local : signature->second.locals)
+        {
+            if (std::find(fn->locals.begin(), fn->locals.end(),
+                          local.first) == fn->locals.end())
+            {
+                fn->locals.push_back(local.first);
+                fn->local_types.push_back(local.second);
+            }
+        }
+    }
+
+    // The attributes and declarations right before a function are its own
+    for (auto record = i; record--;)
+    {
+        auto &before = code[record];
+
+        if (before.opcode != DATA &&
+            ((before.opcode != FPRM && before.opcode != INFN) ||
+             before.names[0] != fn->name))
+        {
+            break;
+        }
+
+        if (before.opcode == DATA && before.names[0] == "il")
+        {
+            fn->raw = true;
+        }
+    }
+
+    auto end = i + 1;
+
+    while (end < code.size() && code[end].opcode != FUNC)
+    {
+        end++;
+    }
+
+    return translate(code, i + 1, end, running, *fn, why);
+}
+
+// Translates the instructions from begin to end into the code of fn, with
+// names resolved to the slots, functions and jump targets they refer to
+bool ILengine::translate(const std::vector<ILinstruction> &code, size_t begin,
+                         size_t end, bool running, Function &fn,
+                         std::string &why)
+{
+    std::map<std::string, uint32_t> labels;
+    std::vector<std::pair<size_t, std::string>> jumps;
+
+    for (auto i = begin; i < end; i++)
+    {
+        auto &instruction = code[i];
+        auto opcode = instruction.opcode;
+
+        if (is_meta(opcode) || opcode == NOOP)
+        {
+            continue;
+        }
+
+        if (opcode == LABL)
+        {
+            labels[instruction.names[0]] = (uint32_t)fn.code.size();
+            continue;
+        }
+
+        Op op;
+        op.opcode = opcode;
+
+        if (opcode <= PF64)
+        {
+            auto size = instruction.data.size();
+            op.value.type = opcode;
+
+            if (is_float(opcode))
+            {
+                // Floats are written in the byte order of the host
+                if (size == 4)
+                {
+                    uint32_t bits;
+                    memcpy(&bits, instruction.data.data(), 4);
+                    op.value.bits = bits;
+                }
+                else
+                {
+                    memcpy(&op.value.bits, instruction.data.data(), 8);
+                }
+            }
+            else
+            {
+                op.value = make_int(opcode, (int64_t)big_endian(
+                                                instruction.data, size));
+
+                if (is_signed(opcode))
+                {
+                    op.value = make_int(opcode, as_int(op.value));
+                }
+            }
+        }
+        else if (opcode == PTRU || opcode == PFLS)
+        {
+            op.value = make_int(U8, opcode == PTRU);
+        }
+        else if (opcode == PSTR)
+        {
+            op.value.type = STR;
+            op.text = instruction.names[0];
+        }
+        else if (opcode == CALL || opcode == PFUN)
+        {
+            auto &name = instruction.names[0];
+            auto found = function_index.find(name);
+
+            if (found == function_index.end() && running)
+            {
+                why = fn.name + " uses " + name +
+                      ", which the running program does not have";
+                return false;
+            }
+
+            op.index = (uint32_t)(found != function_index.end()
+                                      ? found->second
+                                      : function(name));
+
+            // Function values are their index plus one, so 0 stays null
+            if (opcode == PFUN)
+            {
+                op.value = make_int(PTR, op.index + 1);
+            }
+        }
+        else if (opcode == CALS)
+        {
+            op.type = instruction.data[0];
+        }
+        else if (opcode >= JUMP && opcode <= JLEZ)
+        {
+            jumps.emplace_back(fn.code.size(), instruction.names[0]);
+        }
+        else if (opcode == LLOC || opcode == SLOC)
+        {
+            auto &name = instruction.names[0];
+            auto local = std::find(fn.locals.begin(), fn.locals.end(), name);
+
+            if (local != fn.locals.end())
+            {
+                op.type = 0;
+                op.index = (uint32_t)(fn.params.size() +
+                                      (local - fn.locals.begin()));
+            }
+            else
+            {
+                auto found = outer_index.find(name);
+
+                if (found == outer_index.end() && running)
+                {
+                    why = fn.name + " uses the variable " + name +
+                          ", which the running program does not have";
+                    return false;
+                }
+
+                if (found == outer_index.end())
+                {
+                    found = outer_index.emplace(name, outer.size()).first;
+                    outer.emplace_back();
+                }
+
+                op.type = 1;
+                op.index = (uint32_t)found->second;
+            }
+        }
+        else if (opcode == LARG || opcode == SARG)
+        {
+            auto &name = instruction.names[0];
+            auto param = std::find(fn.params.begin(), fn.params.end(), name);
+
+            if (param == fn.params.end())
+            {
+                why = "Use of undeclared argument " + name + " in " + fn.name;
+                return false;
+            }
+
+            op.type = 0;
+            op.index = (uint32_t)(param - fn.params.begin());
+        }
+        else if (!instruction.data.empty())
+        {
+            op.type = instruction.data[0];
+        }
+
+        fn.code.push_back(op);
+    }
+
+    for (auto &jump : jumps)
+    {
+        auto label = labels.find(jump.second);
+
+        if (label == labels.end())
+        {
+            why = "Jump to undefined label " + jump.second + " in " + fn.name;
+            return false;
+        }
+
+        fn.code[jump.first].index = label->second;
+    }
+
+    return true;
+}
+
+// Whether two bodies of a function run the same code
+bool ILengine::same_code(const std::vector<Op> &a, const std::vector<Op> &b)
+{
+    if (a.size() != b.size())
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < a.size(); i++)
+    {
+        // The address of a string is only known once it ran
+        if (a[i].opcode != b[i].opcode || a[i].type != b[i].type ||
+            a[i].index != b[i].index || a[i].text != b[i].text ||
+            (a[i].opcode != PSTR && (a[i].value.type != b[i].value.type ||
+                                     a[i].value.bits != b[i].value.bits)))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool ILengine::replace(const ILemitter &il,
+                       const std::map<std::string, std::string> &names,
+                       std::vector<std::string> &replaced, std::string &reason)
+{
+    auto source_name = [&](const std::string &name) {
+        auto found = names.find(name);
+        return found != names.end() ? found->second : name;
+    };
+
+    std::vector<ILinstruction> code;
+
+    if (!decode_il(il, code))
+    {
+        reason = "The IL can not be decoded";
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(update);
+
+    auto signatures = find_signatures(code);
+    std::vector<std::pair<size_t, std::unique_ptr<Function>>> changed;
+    std::set<std::string> in_code;
+
+    for (auto &instr : code)
+    {
+        if (instr.opcode == EXFN || instr.opcode == FUNC)
+        {
+            in_code.insert(instr.names[0]);
+        }
+    }
+
+    for (size_t i = 0; i < code.size(); i++)
+    {
+        if (code[i].opcode != EXFN && code[i].opcode != FUNC)
+        {
+            continue;
+        }
+
+        auto &name = code[i].names[0];
+        auto found = function_index.find(name);
+
+        if (found == function_index.end() ||
+            !functions[found->second].load()->defined)
+        {
+            // Parameter types are part of the name in the IL, so an overload
+            // whose parameters changed replaces a loaded function under
+            // another name
+            for (auto &loaded : function_index)
+            {
+                if (!in_code.count(loaded.first) &&
+                    functions[loaded.second].load()->defined &&
+                    source_name(loaded.first) == source_name(name))
+                {
+                    reason = "The signature of " + source_name(name) +
+                             " changed, changing it needs a restart";
+                    return false;
+                }
+            }
+
+            reason = source_name(name) + " is new, adding it needs a restart";
+            return false;
+        }
+
+        std::unique_ptr<Function> fn;
+
+        if (!declare(code, i, signatures, true, fn, reason))
+        {
+            return false;
+        }
+
+        auto current = functions[found->second].load();
+
+        if (fn->external != current->external || fn->raw != current->raw ||
+            fn->type != current->type ||
+            fn->params.size() != current->params.size() ||
+            fn->param_types != current->param_types)
+        {
+            reason = "The signature of " + source_name(name) +
+                     " changed, changing it needs a restart";
+            return false;
+        }
+
+        if (!fn->external && (fn->locals != current->locals ||
+                              !same_code(fn->code, current->code)))
+        {
+            changed.emplace_back(found->second, std::move(fn));
+        }
+    }
+
+    add_fingerprint(il);
+
+    for (auto &fn : changed)
+    {
+        replaced.push_back(source_name(fn.second->name));
+        functions[fn.first].store(fn.second.get(), std::memory_order_release);
+        bodies.push_back(std::move(fn.second));
+    }
+
+    return true;
+}
+
+bool ILengine::run(const ILemitter &il, std::vector<ILvalue> &results)
+{
+    std::vector<ILinstruction> code;
+    error.clear();
+
+    if (!decode_il(il, code))
+    {
+        return fail("The IL can not be decoded");
+    }
+
+    // The code outside of functions works on the outer frame, like the body
+    // of an @il function does on its caller's
+    Function outside;
+    outside.name = "<outside>";
+    outside.defined = true;
+    outside.raw = true;
+
+    {
+        std::lock_guard<std::mutex> lock(update);
+
+        if (!define(code))
+        {
+            return false;
+        }
+
+        size_t end = 0;
+
+        while (end < code.size() && code[end].opcode != FUNC)
+        {
+            end++;
+        }
+
+        std::string why;
+
+        if (!translate(code, 0, end, false, outside, why))
+        {
+            return fail(why);
+        }
+
+        add_fingerprint(il);
+    }
+
+    auto base = stack.size();
+    auto depth = frames.size();
+
+    frames.push_back({&outside, 0, base, slots.size()});
+
+    if (!execute(depth))
+    {
+        frames.resize(depth);
+        stack.resize(base);
+        return false;
+    }
+
+    results.insert(results.end(), stack.begin() + base, stack.end());
+    stack.resize(base);
+    return true;
+}
+
+bool ILengine::run(const std::string &name, std::vector<ILvalue> &results)
+{
+    const Function *fn = nullptr;
+    error.clear();
+
+    {
+        std::lock_guard<std::mutex> lock(update);
+        auto found = function_index.find(name);
+
+        if (found != function_index.end())
+        {
+            fn = functions[found->second].load();
+        }
+    }
+
+    if (!fn || !fn->defined || fn->external || !fn->params.empty())
+    {
+        return fail("There is no function " + name +
+                    " without parameters to run");
+    }
+
+    auto base = stack.size();
+    auto slot_base = slots.size();
+    auto depth = frames.size();
+
+    if (!call(fn) || !execute(depth))
+    {
+        frames.resize(depth);
+        stack.resize(base);
+        slots.resize(slot_base);
+        return false;
+    }
+
+    results.insert(results.end(), stack.begin() + base, stack.end());
+    stack.resize(base);
+    return true;
+}
+
+bool ILengine::restore(const std::string &path)
+{
+    error.clear();
+
+    MappedFile file(path);
+
+    if (!file.data)
+    {
+        return fail("The snapshot " + path + " can not be read");
+    }
+
+    SnapshotReader in{file.data, file.data + file.size};
+    auto magic = in.bytes(sizeof(snapshot_magic) - 1);
+
+    if (!magic || memcmp(magic, snapshot_magic, sizeof(snapshot_magic) - 1) ||
+        in.get(4) != snapshot_version)
+    {
+        return fail(path + " is not a snapshot of this version");
+    }
+
+    std::lock_guard<std::mutex> lock(update);
+
+    if (in.get(8) != fingerprint)
+    {
+        return fail("The snapshot " + path +
+                    " was saved from another program");
+    }
+
+    // Everything is read before any of it replaces the state of the engine
+    std::vector<uint8_t> restored(in.get(4));
+    std::map<uint32_t, std::vector<uint32_t>> restored_free;
+    uint64_t next = reserved;
+
+    if (restored.size() < reserved)
+    {
+        in.ok = false;
+    }
+
+    for (auto count = in.get(4); in.ok && count; count--)
+    {
+        auto address = in.get(4);
+        auto size = in.get(4);
+        auto live = in.get(1);
+
+        // Blocks follow each other from the first to the end of memory
+        if (address != next + alignment || size < alignment ||
+            address + size > restored.size())
+        {
+            in.ok = false;
+            break;
+        }
+
+        restored[address - 4] = (uint8_t)size;
+        restored[address - 3] = (uint8_t)(size >> 8);
+        restored[address - 2] = (uint8_t)(size >> 16);
+        restored[address - 1] = (uint8_t)(size >> 24);
+
+        if (live)
+        {
+            auto data = in.bytes(size);
+
+            if (data)
+            {
+                memcpy(&restored[address], data, size);
+            }
+        }
+        else
+        {
+            restored_free[(uint32_t)size].push_back((uint32_t)address);
+        }
+
+        next = address + size;
+    }
+
+    if (next != restored.size())
+    {
+        in.ok = false;
+    }
+
+    std::map<std::string, uint32_t> restored_strings;
+
+    for (auto count = in.get(4); in.ok && count; count--)
+    {
+        auto text = in.text();
+        restored_strings[text] = (uint32_t)in.get(4);
+    }
+
+    std::vector<std::pair<size_t, ILvalue>> restored_outer;
+
+    for (auto count = in.get(4); in.ok && count; count--)
+    {
+        auto found = outer_index.find(in.text());
+        ILvalue value;
+        value.type = (uint8_t)in.get(1);
+        value.bits = in.get(8);
+        value.high = in.get(8);
+
+        if (found == outer_index.end())
+        {
+            in.ok = false;
+            break;
+        }
+
+        restored_outer.emplace_back(found->second, value);
+    }
+
+    std::vector<ILvalue> values[2];
+
+    for (auto &restored_values : values)
+    {
+        for (auto count = in.get(4); in.ok && count; count--)
+        {
+            ILvalue value;
+            value.type = (uint8_t)in.get(1);
+            value.bits = in.get(8);
+            value.high = in.get(8);
+            restored_values.push_back(value);
+        }
+    }
+
+    std::vector<Frame> restored_frames;
+
+    for (auto count = in.get(4); in.ok && count; count--)
+    {
+        auto found = function_index.find(in.text());
+        Frame frame;
+        frame.pc = in.get(4);
+        frame.stack = in.get(4);
+        frame.slots = in.get(4);
+
+        if (found == function_index.end())
+        {
+            in.ok = false;
+            break;
+        }
+
+        frame.fn = functions[found->second].load();
+
+        if (!frame.fn->defined || frame.fn->external ||
+            frame.pc > frame.fn->code.size() ||
+            frame.stack > values[0].size() || frame.slots > values[1].size())
+        {
+            in.ok = false;
+            break;
+        }
+
+        restored_frames.push_back(frame);
+    }
+
+    if (!in.ok || in.at != in.end)
+    {
+        return fail("The snapshot " + path + " is damaged");
+    }
+
+    memory.swap(restored);
+    free_blocks.swap(restored_free);
+    strings.swap(restored_strings);
+
+    for (auto &variable : restored_outer)
+    {
+        outer[variable.first] = variable.second;
+    }
+
+    stack.swap(values[0]);
+    slots.swap(values[1]);
+    frames.swap(restored_frames);
+    return true;
+}
+
+bool ILengine::resume(std::vector<ILvalue> &results)
+{
+    error.clear();
+
+    if (frames.empty())
+    {
+        return fail("There are no calls restored to resume");
+    }
+
+    if (!execute(0))
+    {
+        frames.clear();
+        stack.clear();
+        slots.clear();
+        return false;
+    }
+
+    results.insert(results.end(), stack.begin(), stack.end());
+    stack.clear();
+    return true;
+}
+
+ILvalue ILengine::pop()
+{
+    if (stack.size() <= (frames.empty() ? 0 : frames.back().stack))
+    {
+        fail("Pop of an empty stack" +
+             (frames.empty() ? "" : " in " + frames.back().fn->name));
+        return ILvalue();
+    }
+
+    auto value = stack.back();
+    stack.pop_back();
+    return value;
+}
+
+void ILengine::push(uint8_t type, uint64_t bits)
+{
+    ILvalue value;
+    value.type = type;
+    value.bits = bits;
+    stack.push_back(value);
+}
+
+bool ILengine::call(const Function *fn)
+{
+    if (!fn->defined)
+    {
+        return fail("Call of undefined function " + fn->name);
+    }
+
+    if (fn->external)
+    {
+        auto external = externals.find(fn->name);
+
+        if (external == externals.end())
+        {
+            return fail("External function " + fn->name +
+                        " is not available in the engine");
+        }
+
+        return external->second(*this, *fn);
+    }
+
+    if (frames.size() >= max_frames)
+    {
+        return fail("Too many nested calls of " + fn->name);
+    }
+
+    if (fn->raw)
+    {
+        auto &caller = frames.back();
+        frames.push_back({fn, 0, caller.stack, caller.slots});
+        return true;
+    }
+
+    auto base = slots.size();
+    slots.resize(base + fn->params.size() + fn->locals.size());
+
+    // The first parameter is pushed last
+    for (size_t i = 0; i < fn->params.size(); i++)
+    {
+        slots[base + i] = stored(pop(), fn->slot_type(i));
+    }
+
+    frames.push_back({fn, 0, stack.size(), base});
+    return error.empty();
+}
+
+// Runs the frames above depth until they have all returned
+bool ILengine::execute(size_t depth)
+{
+    while (frames.size() > depth)
+    {
+        if (!error.empty())
+        {
+            return false;
+        }
+
+        auto &frame = frames.back();
+        auto fn = frame.fn;
+
+        if (frame.pc >= fn->code.size() || fn->code[frame.pc].opcode == RETN)
+        {
+            if (fn->raw)
+            {
+                frames.pop_back();
+                continue;
+            }
+
+            ILvalue result;
+            bool returns = fn->type != VOID;
+
+            if (returns && stack.size() > frame.stack)
+            {
+                result = stack.back();
+            }
+
+            stack.resize(frame.stack);
+            slots.resize(frame.slots);
+            frames.pop_back();
+
+            if (returns)
+            {
+                // The declared type says how the bits are meant
+                result.type = fn->type;
+                result.bits = mask(fn->type, result.bits);
+                stack.push_back(result);
+            }
+
+            continue;
+        }
+
+        auto &op = fn->code[frame.pc++];
+
+        switch (op.opcode)
+        {
+        case PU08: case PU16: case PU32: case PU64:
+        case PI08: case PI16: case PI32: case PI64:
+        case PF32: case PF64: case PTRU: case PFLS:
+        case PFUN:
+            stack.push_back(op.value);
+            break;
+
+        case PSTR:
+            if (!op.value.bits)
+            {
+                op.value.bits = string(op.text);
+
+                if (!op.value.bits)
+                {
+                    fail("Out of memory");
+                    break;
+                }
+            }
+
+            stack.push_back(op.value);
+            break;
+
+        case CAST:
+        {
+            auto value = pop();
+
+            if (is_float(op.type))
+            {
+                stack.push_back(make_float(op.type, as_float(value)));
+            }
+            else
+            {
+                stack.push_back(make_int(op.type, as_int(value)));
+            }
+            break;
+        }
+
+        case DELE:
+            pop();
+            break;
+
+        case SWAP:
+        {
+            auto x = pop();
+            auto y = pop();
+            stack.push_back(x);
+            stack.push_back(y);
+            break;
+        }
+
+        case DUPE:
+        {
+            auto x = pop();
+            stack.push_back(x);
+            stack.push_back(x);
+            break;
+        }
+
+        case CMPE: case CMPG: case CPGE: case CMPL: case CPLE: case CPNE:
+        {
+            auto x = pop();
+            auto y = pop();
+            int order;
+
+            if (is_float(x.type) || is_float(y.type))
+            {
+                auto a = float_operand(x), b = float_operand(y);
+                order = a < b ? -1 : a > b ? 1 : 0;
+            }
+            else
+            {
+                auto x_type = x.type;
+                x.type = operand_type(x.type, y.type);
+                y.type = operand_type(y.type, x_type);
+
+                auto a = as_int(x), b = as_int(y);
+                order = a < b ? -1 : a > b ? 1 : 0;
+            }
+
+            bool holds = op.opcode == CMPE ? order == 0
+                       : op.opcode == CPNE ? order != 0
+                       : op.opcode == CMPG ? order > 0
+                       : op.opcode == CPGE ? order >= 0
+                       : op.opcode == CMPL ? order < 0
+                       : order <= 0;
+
+            stack.push_back(make_int(U8, holds));
+            break;
+        }
+
+        case CALL:
+            call(functions[op.index].load(std::memory_order_acquire));
+            break;
+
+        case CALS:
+        {
+            auto target = pop().bits;
+
+            if (!target || target > functions.size())
+            {
+                fail("Indirect call of an invalid function " +
+                     hex((uint32_t)target) + " in " + fn->name);
+                break;
+            }
+
+            call(functions[target - 1].load(std::memory_order_acquire));
+            break;
+        }
+
+        case JUMP:
+            frame.pc = op.index;
+            break;
+
+        case JEQZ: case JNEZ: case JGTZ: case JGEZ: case JLTZ: case JLEZ:
+        {
+            auto value = pop();
+            auto sign = is_float(value.type)
+                            ? (as_float(value) > 0) - (as_float(value) < 0)
+                            : (as_int(value) > 0) - (as_int(value) < 0);
+
+            bool taken = op.opcode == JEQZ ? sign == 0
+                       : op.opcode == JNEZ ? sign != 0
+                       : op.opcode == JGTZ ? sign > 0
+                       : op.opcode == JGEZ ? sign >= 0
+                       : op.opcode == JLTZ ? sign < 0
+                       : sign <= 0;
+
+            if (taken)
+            {
+                frames.back().pc = op.index;
+            }
+            break;
+        }
+
+        case LLOC: case LARG:
+            stack.push_back(op.type ? outer[op.index]
+                                    : slots[frame.slots + op.index]);
+            break;
+
+        case SLOC: case SARG:
+        {
+            auto value = pop();
+
+            if (op.type)
+            {
+                outer[op.index] = value;
+            }
+            else
+            {
+                slots[frame.slots + op.index] =
+                    stored(value, fn->raw ? VOID : fn->slot_type(op.index));
+            }
+            break;
+        }
+
+        case ADRS:
+            break;
+
+        case READ:
+        {
+            auto address = (uint32_t)pop().bits;
+
+            if (!valid(address, 4))
+            {
+                fail("Read of invalid address " + hex(address) + " in " +
+                     fn->name);
+                break;
+            }
+
+            stack.push_back(make_int(WORD, read(address)));
+            break;
+        }
+
+        case WRIT:
+        {
+            auto address = (uint32_t)pop().bits;
+            auto value = pop();
+
+            if (!valid(address, 4))
+            {
+                fail("Write to invalid address " + hex(address) + " in " +
+                     fn->name);
+                break;
+            }
+
+            write(address, (uint32_t)value.bits);
+            break;
+        }
+
+        case MCPY: case MSET:
+        {
+            auto to = (uint32_t)pop().bits;
+            auto from = pop();
+            auto count = (uint32_t)pop().bits;
+
+            if (!valid(to, count) ||
+                (op.opcode == MCPY && !valid((uint32_t)from.bits, count)))
+            {
+                fail("Copy to or from an invalid address in " + fn->name);
+                break;
+            }
+
+            if (op.opcode == MCPY)
+            {
+                memmove(&memory[to], &memory[(uint32_t)from.bits], count);
+            }
+            else
+            {
+                memset(&memory[to], (int)from.bits, count);
+            }
+            break;
+        }
+
+        case IADD: case ISUB: case IMUL: case IDIV: case IMOD:
+        case BSHL: case BSHR: case BAND: case BWOR: case BXOR:
+        {
+            auto x = pop();
+            auto y = pop();
+            auto x_type = x.type;
+            x.type = operand_type(x.type, y.type);
+            y.type = operand_type(y.type, x_type);
+
+            auto type = y.type;
+            auto a = as_int(y), b = as_int(x);
+            auto ua = mask(type, y.bits), ub = mask(x.type, x.bits);
+            int64_t result = 0;
+
+            if ((op.opcode == IDIV || op.opcode == IMOD) && !b)
+            {
+                fail("Division by zero in " + fn->name);
+                break;
+            }
+
+            switch (op.opcode)
+            {
+            case IADD: result = (int64_t)(ua + ub); break;
+            case ISUB: result = (int64_t)(ua - ub); break;
+            case IMUL: result = (int64_t)(ua * ub); break;
+            case IDIV:
+                result = is_signed(type) ? (b == -1 ? (int64_t)(0 - ua) : a / b)
+                                         : (int64_t)(ua / ub);
+                break;
+            case IMOD:
+                result = is_signed(type) ? (b == -1 ? 0 : a % b)
+                                         : (int64_t)(ua % ub);
+                break;
+            case BSHL: result = (int64_t)(ua << (b & 63)); break;
+            case BSHR:
+                result = is_signed(type) ? a >> (b & 63)
+                                         : (int64_t)(ua >> (b & 63));
+                break;
+            case BAND: result = (int64_t)(ua & ub); break;
+            case BWOR: result = (int64_t)(ua | ub); break;
+            case BXOR: result = (int64_t)(ua ^ ub); break;
+            }
+
+            stack.push_back(make_int(type, result));
+            break;
+        }
+
+        case INEG:
+        {
+            auto x = pop();
+            stack.push_back(make_int(x.type, -as_int(x)));
+            break;
+        }
+
+        case FADD: case FSUB: case FMUL: case FDIV: case FMOD:
+        {
+            auto x = pop();
+            auto y = pop();
+            auto type = x.type == F64 || y.type == F64 ? F64 : F32;
+            auto a = float_operand(y), b = float_operand(x);
+
+            auto result = op.opcode == FADD ? a + b
+                        : op.opcode == FSUB ? a - b
+                        : op.opcode == FMUL ? a * b
+                        : op.opcode == FDIV ? a / b
+                        : fmod(a, b);
+
+            stack.push_back(make_float(type, result));
+            break;
+        }
+
+        case FNEG:
+        {
+            auto x = pop();
+            stack.push_back(make_float(x.type == F64 ? F64 : F32, -float_operand(x)));
+            break;
+        }
+
+        case BROL: case BROR: case BPOP: case BCLZ: case BCTZ: case BSWP:
+        {
+            auto bits = width(op.type);
+            uint64_t n = 0;
+
+            if (op.opcode == BROL || op.opcode == BROR)
+            {
+                n = pop().bits % bits;
+            }
+
+            auto x = mask(op.type, pop().bits);
+            uint64_t result = 0;
+
+            switch (op.opcode)
+            {
+            case BROL:
+                result = n ? x << n | x >> (bits - n) : x;
+                break;
+            case BROR:
+                result = n ? x >> n | x << (bits - n) : x;
+                break;
+            case BPOP:
+                for (; x; x &= x - 1)
+                {
+                    result++;
+                }
+                break;
+            case BCLZ:
+                result = bits;
+                for (; x; x >>= 1)
+                {
+                    result--;
+                }
+                break;
+            case BCTZ:
+                result = x ? 0 : bits;
+                for (; x && !(x & 1); x >>= 1)
+                {
+                    result++;
+                }
+                break;
+            case BSWP:
+                for (unsigned i = 0; i < bits; i += 8)
+                {
+                    result = result << 8 | ((x >> i) & 0xFF);
+                }
+                break;
+            }
+
+            stack.push_back(make_int(op.type, (int64_t)result));
+            break;
+        }
+
+        case VADD: case VSUB: case VMUL: case VDIV:
+        case VCPE: case VCPG: case VCPL:
+        {
+            auto b = pop();
+            auto a = pop();
+            ILvalue result;
+
+            // Masks of f32 lanes are i32 lanes
+            result.type = op.type == F32X4 && op.opcode >= VCPE ? I32X4
+                                                                : op.type;
+
+            for (unsigned i = 0; i < lane_count(op.type); i++)
+            {
+                uint32_t lane = 0;
+
+                if (!vector_lane(op.opcode, op.type, get_lane(a, op.type, i),
+                                 get_lane(b, op.type, i), lane))
+                {
+                    fail("Division by zero in " + fn->name);
+                    break;
+                }
+
+                set_lane(result, op.type, i, lane);
+            }
+
+            stack.push_back(result);
+            break;
+        }
+
+        case VSHF:
+        {
+            auto v = pop();
+            auto lanes = pop();
+            ILvalue result;
+            result.type = op.type;
+
+            for (unsigned i = 0; i < lane_count(op.type); i++)
+            {
+                auto from = get_lane(lanes, op.type, i) % lane_count(op.type);
+                set_lane(result, op.type, i, get_lane(v, op.type, from));
+            }
+
+            stack.push_back(result);
+            break;
+        }
+
+        case VLOD: case VSTR:
+        {
+            auto address = (uint32_t)pop().bits;
+            auto v = op.opcode == VSTR ? pop() : ILvalue();
+
+            if (!valid(address, 16))
+            {
+                fail("Vector access of invalid address " + hex(address) +
+                     " in " + fn->name);
+                break;
+            }
+
+            if (op.opcode == VSTR)
+            {
+                for (int i = 0; i < 16; i++)
+                {
+                    memory[address + i] =
+                        (uint8_t)((i < 8 ? v.bits : v.high) >> (i % 8 * 8));
+                }
+
+                break;
+            }
+
+            v.type = op.type;
+
+            for (int i = 0; i < 16; i++)
+            {
+                (i < 8 ? v.bits : v.high) |= (uint64_t)memory[address + i]
+                                             << (i % 8 * 8);
+            }
+
+            stack.push_back(v);
+            break;
+        }
+
+        case VSPL: case VBLD:
+        {
+            ILvalue result;
+            result.type = op.type;
+            uint32_t x = 0;
+
+            // Build pops lane 0 first
+            for (unsigned i = 0; i < lane_count(op.type); i++)
+            {
+                if (op.opcode == VBLD || i == 0)
+                {
+                    x = (uint32_t)pop().bits;
+                }
+
+                set_lane(result, op.type, i, x);
+            }
+
+            stack.push_back(result);
+            break;
+        }
+
+        case VEXT: case VINS:
+        {
+            auto v = pop();
+            auto lane = (uint32_t)pop().bits % lane_count(op.type);
+
+            if (op.opcode == VINS)
+            {
+                set_lane(v, op.type, lane, (uint32_t)pop().bits);
+                v.type = op.type;
+                stack.push_back(v);
+                break;
+            }
+
+            push(op.type == F32X4 ? F32 : op.type == I32X4 ? I32 : U8,
+                 get_lane(v, op.type, lane));
+            break;
+        }
+
+        case VSUM:
+        {
+            auto v = pop();
+
+            // In the order SSE adds them: lanes half a vector apart first
+            if (op.type == F32X4)
+            {
+                auto sum = (lane_float(get_lane(v, op.type, 0)) +
+                            lane_float(get_lane(v, op.type, 2))) +
+                           (lane_float(get_lane(v, op.type, 1)) +
+                            lane_float(get_lane(v, op.type, 3)));
+                push(F32, float_lane(sum));
+                break;
+            }
+
+            uint32_t sum = 0;
+
+            for (unsigned i = 0; i < lane_count(op.type); i++)
+            {
+                sum += get_lane(v, op.type, i);
+            }
+
+            push(op.type == I32X4 ? I32 : U8,
+                 op.type == I32X4 ? sum : sum & 0xFF);
+            break;
+        }
+
+        default:
+        {
+            char opcode[8];
+            snprintf(opcode, sizeof(opcode), "0x%02X", op.opcode);
+            fail(std::string("The engine does not run opcode ") + opcode +
+                 ", used in " + fn->name);
+            break;
+        }
+        }
+    }
+
+    return error.empty();
+}
+
+uint32_t ILengine::allocate(uint32_t size)
+{
+    auto rounded = (size + 4 + alignment - 1) / alignment * alignment;
+    auto &reusable = free_blocks[rounded];
+
+    if (!reusable.empty())
+    {
+        auto address = reusable.back();
+        reusable.pop_back();
+        return address;
+    }
+
+    // Blocks start with their size, in front of the address handed out
+    auto address = (uint64_t)memory.size() + alignment;
+
+    if (address + rounded > UINT32_MAX)
+    {
+        return 0;
+    }
+
+    memory.resize(address + rounded);
+    write((uint32_t)address - 4, rounded);
+    return (uint32_t)address;
+}
+
+void ILengine::release(uint32_t address)
+{
+    if (address >= reserved + alignment && valid(address - 4, 4))
+    {
+        free_blocks[read(address - 4)].push_back(address);
+    }
+}
+
+bool ILengine::valid(uint32_t address, uint32_t size) const
+{
+    return address >= reserved && (uint64_t)address + size <= memory.size();
+}
+
+uint32_t ILengine::read(uint32_t address) const
+{
+    return (uint32_t)memory[address] | (uint32_t)memory[address + 1] << 8 |
+           (uint32_t)memory[address + 2] << 16 |
+           (uint32_t)memory[address + 3] << 24;
+}
+
+void ILengine::write(uint32_t address, uint32_t value)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        memory[address + i] = (uint8_t)(value >> (8 * i));
+    }
+}
+
+// The address of a string literal, placed in memory the first time it is used
+uint32_t ILengine::string(const std::string &text)
+{
+    auto found = strings.find(text);
+
+    if (found != strings.end())
+    {
+        return found->second;
+    }
+
+    auto address = allocate((uint32_t)text.size() + 1);
+
+    if (address)
+    {
+        memcpy(&memory[address], text.c_str(), text.size() + 1);
+        strings.emplace(text, address);
+    }
+
+    return address;
+}
+
+bool ILengine::text(uint32_t address, std::string &result) const
+{
+    if (!valid(address, 1))
+    {
+        return false;
+    }
+
+    auto begin = memory.begin() + address;
+    auto end = std::find(begin, memory.end(), 0);
+
+    if (end == memory.end())
+    {
+        return false;
+    }
+
+    result.assign(begin, end);
+    return true;
+}
+
+void ILengine::add_fingerprint(const ILemitter &il)
+{
+    // FNV-1a
+    for (auto byte : il.stream)
+    {
+        fingerprint = (fingerprint ^ byte) * 1099511628211ull;
+    }
+}
+
+// The address and size of every block allocated, free or not, in the order
+// they are in memory
+std::vector<std::pair<uint32_t, uint32_t>> ILengine::blocks() const
+{
+    std::vector<std::pair<uint32_t, uint32_t>> result;
+    uint64_t next = reserved;
+
+    while (next + alignment <= memory.size())
+    {
+        auto address = (uint32_t)(next + alignment);
+        auto size = read(address - 4);
+
+        result.emplace_back(address, size);
+        next = (uint64_t)address + size;
+    }
+
+    return result;
+}
+
+// Which blocks the values of the engine can reach through the blocks they
+// point into. Memory has no types, so any four bytes that hold an address
+// inside a block are taken for a pointer to it.
+std::vector<bool> ILengine::reachable(
+    const std::vector<std::pair<uint32_t, uint32_t>> &blocks) const
+{
+    std::vector<bool> live(blocks.size());
+    std::vector<size_t> pending;
+
+    auto mark = [&](uint64_t value) {
+        auto address = (uint32_t)value;
+        auto after = std::upper_bound(blocks.begin(), blocks.end(),
+                                      std::make_pair(address, UINT32_MAX));
+
+        if (after == blocks.begin())
+        {
+            return;
+        }
+
+        auto i = (size_t)(after - blocks.begin() - 1);
+
+        if (address < (uint64_t)blocks[i].first + blocks[i].second && !live[i])
+        {
+            live[i] = true;
+            pending.push_back(i);
+        }
+    };
+
+    for (auto values : {&stack, &slots, &outer})
+    {
+        for (auto &value : *values)
+        {
+            mark(value.bits);
+        }
+    }
+
+    for (auto &string : strings)
+    {
+        mark(string.second);
+    }
+
+    while (!pending.empty())
+    {
+        auto &block = blocks[pending.back()];
+        pending.pop_back();
+
+        for (uint32_t offset = 0; offset + 4 <= block.second; offset += 4)
+        {
+            mark(read(block.first + offset));
+        }
+    }
+
+    return live;
+}
+
+// Writes the state of the engine to path, through a file next to it that
+// replaces it once complete. Only the blocks that can be reached are saved,
+// the others are free when the state is restored.
+bool ILengine::save(const std::string &path, std::string &why)
+{
+    std::lock_guard<std::mutex> lock(update);
+    std::string out(snapshot_magic, sizeof(snapshot_magic) - 1);
+
+    put(out, snapshot_version, 4);
+    put(out, fingerprint, 8);
+    put(out, memory.size(), 4);
+
+    auto all = blocks();
+    auto live = reachable(all);
+
+    std::vector<bool> released(all.size());
+
+    for (auto &reusable : free_blocks)
+    {
+        for (auto address : reusable.second)
+        {
+            auto found = std::lower_bound(all.begin(), all.end(),
+                                          std::make_pair(address, 0u));
+
+            if (found != all.end() && found->first == address)
+            {
+                released[found - all.begin()] = true;
+            }
+        }
+    }
+
+    put(out, all.size(), 4);
+
+    for (size_t i = 0; i < all.size(); i++)
+    {
+        bool saved = live[i] && !released[i];
+
+        put(out, all[i].first, 4);
+        put(out, all[i].second, 4);
+        put(out, saved, 1);
+
+        if (saved)
+        {
+            out.append((const char *)&memory[all[i].first], all[i].second);
+        }
+    }
+
+    put(out, strings.size(), 4);
+
+    for (auto &string : strings)
+    {
+        put_text(out, string.first);
+        put(out, string.second, 4);
+    }
+
+    put(out, outer_index.size(), 4);
+
+    for (auto &variable : outer_index)
+    {
+        put_text(out, variable.first);
+        put(out, outer[variable.second].type, 1);
+        put(out, outer[variable.second].bits, 8);
+        put(out, outer[variable.second].high, 8);
+    }
+
+    for (auto values : {&stack, &slots})
+    {
+        put(out, values->size(), 4);
+
+        for (auto &value : *values)
+        {
+            put(out, value.type, 1);
+            put(out, value.bits, 8);
+            put(out, value.high, 8);
+        }
+    }
+
+    put(out, frames.size(), 4);
+
+    // Frames are restored by the name of their function, which has to be
+    // the body they run
+    for (auto &frame : frames)
+    {
+        auto found = function_index.find(frame.fn->name);
+
+        if (found == function_index.end() ||
+            functions[found->second].load() != frame.fn)
+        {
+            why = "it is only saved from functions that were not replaced";
+            return false;
+        }
+
+        put_text(out, frame.fn->name);
+        put(out, frame.pc, 4);
+        put(out, frame.stack, 4);
+        put(out, frame.slots, 4);
+    }
+
+    auto partial = path + ".tmp";
+    auto file = fopen(partial.c_str(), "wb");
+
+    if (!file)
+    {
+        why = partial + " can not be written";
+        return false;
+    }
+
+    bool written = fwrite(out.data(), 1, out.size(), file) == out.size();
+
+    if (fclose(file) != 0 || !written)
+    {
+        remove(partial.c_str());
+        why = partial + " can not be written";
+        return false;
+    }
+
+#ifdef _WIN32
+    remove(path.c_str());
+#endif
+
+    if (rename(partial.c_str(), path.c_str()) != 0)
+    {
+        remove(partial.c_str());
+        why = path + " can not be replaced";
+        return false;
+    }
+
+    return true;
+}
+
+std::string ILengine::format(const ILvalue &value, uint8_t type) const
+{
+    ILvalue typed = value;
+    typed.type = type;
+    char buffer[64];
+
+    if (type == STR)
+    {
+        std::string result;
+
+        if (!value.bits)
+        {
+            return "null";
+        }
+
+        if (!text((uint32_t)value.bits, result))
+        {
+            return hex((uint32_t)value.bits);
+        }
+
+        return "\"" + result + "\"";
+    }
+
+    if (type == PTR)
+    {
+        return hex((uint32_t)value.bits);
+    }
+
+    if (is_vector(type))
+    {
+        std::string result = "[";
+        ILvalue lane;
+        lane.type = type == F32X4 ? F32 : type == I32X4 ? I32 : U8;
+
+        for (unsigned i = 0; i < lane_count(type); i++)
+        {
+            lane.bits = get_lane(value, type, i);
+            result += (i ? ", " : "") + format(lane, lane.type);
+        }
+
+        return result + "]";
+    }
+
+    if (is_float(type))
+    {
+        snprintf(buffer, sizeof(buffer), "%.*g", type == F32 ? 9 : 17,
+                 as_float(typed));
+    }
+    else if (is_signed(type))
+    {
+        snprintf(buffer, sizeof(buffer), "%lld", (long long)as_int(typed));
+    }
+    else
+    {
+        snprintf(buffer, sizeof(buffer), "%llu",
+                 (unsigned long long)mask(type, value.bits));
+    }
+
+    return buffer;
+}
+
+// The external functions pop their arguments, the first is on top, and push
+// what they return if they are declared to return something
+
+bool ILengine::ext_printf(ILengine &engine, const Function &fn)
+{
+    std::string format, output;
+
+    if (!engine.text((uint32_t)engine.pop().bits, format))
+    {
+        return engine.fail("printf of an invalid string");
+    }
+
+    for (size_t i = 0; i < format.size(); i++)
+    {
+        if (format[i] != '%')
+        {
+            output += format[i];
+            continue;
+        }
+
+        // Flags, width and precision are passed on, length modifiers are
+        // replaced as every value is formatted as 64 bits
+        auto start = i++;
+        std::string spec = "%";
+
+        while (i < format.size() && strchr("-+ #0123456789.*hljztL", format[i]))
+        {
+            if (format[i] == '*')
+            {
+                spec += std::to_string(as_int(engine.pop()));
+            }
+            else if (!strchr("hljztL", format[i]))
+            {
+                spec += format[i];
+            }
+
+            i++;
+        }
+
+        if (i == format.size())
+        {
+            output += format.substr(start);
+            break;
+        }
+
+        auto conversion = format[i];
+        std::string formatted;
+        char buffer[512];
+
+        switch (conversion)
+        {
+        case '%':
+            formatted = "%";
+            break;
+
+        case 'd': case 'i':
+            snprintf(buffer, sizeof(buffer), (spec + "lld").c_str(),
+                     (long long)as_int(engine.pop()));
+            formatted = buffer;
+            break;
+
+        case 'u': case 'x': case 'X': case 'o':
+            snprintf(buffer, sizeof(buffer), (spec + "ll" + conversion).c_str(),
+                     (unsigned long long)mask(U32, engine.pop().bits));
+            formatted = buffer;
+            break;
+
+        case 'c':
+            snprintf(buffer, sizeof(buffer), (spec + "c").c_str(),
+                     (int)engine.pop().bits);
+            formatted = buffer;
+            break;
+
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G':
+            snprintf(buffer, sizeof(buffer), (spec + conversion).c_str(),
+                     float_operand(engine.pop()));
+            formatted = buffer;
+            break;
+
+        case 's':
+        {
+            std::string text;
+
+            if (!engine.text((uint32_t)engine.pop().bits, text))
+            {
+                return engine.fail("printf of an invalid string");
+            }
+
+            snprintf(buffer, sizeof(buffer), (spec + "s").c_str(), text.c_str());
+            formatted = text.size() < sizeof(buffer) / 2 ? buffer : text;
+            break;
+        }
+
+        case 'p':
+            formatted = hex((uint32_t)engine.pop().bits);
+            break;
+
+        default:
+            formatted = format.substr(start, i + 1 - start);
+            break;
+        }
+
+        output += formatted;
+    }
+
+    fwrite(output.data(), 1, output.size(), stdout);
+
+    if (fn.type != VOID)
+    {
+        engine.push(I32, output.size());
+    }
+
+    return engine.error.empty();
+}
+
+bool ILengine::ext_puts(ILengine &engine, const Function &fn)
+{
+    std::string text;
+
+    if (!engine.text((uint32_t)engine.pop().bits, text))
+    {
+        return engine.fail("puts of an invalid string");
+    }
+
+    puts(text.c_str());
+
+    if (fn.type != VOID)
+    {
+        engine.push(I32, 0);
+    }
+
+    return true;
+}
+
+bool ILengine::ext_putchar(ILengine &engine, const Function &fn)
+{
+    auto c = (int)(uint8_t)engine.pop().bits;
+    putchar(c);
+
+    if (fn.type != VOID)
+    {
+        engine.push(I32, (uint64_t)c);
+    }
+
+    return engine.error.empty();
+}
+
+bool ILengine::ext_malloc(ILengine &engine, const Function &fn)
+{
+    (void)fn;
+    auto size = (uint32_t)engine.pop().bits;
+    engine.push(STR, engine.allocate(size));
+    return engine.error.empty();
+}
+
+bool ILengine::ext_calloc(ILengine &engine, const Function &fn)
+{
+    (void)fn;
+    auto count = (uint64_t)(uint32_t)engine.pop().bits;
+    auto size = count * (uint32_t)engine.pop().bits;
+    uint32_t address = size > UINT32_MAX ? 0 : engine.allocate((uint32_t)size);
+
+    if (address)
+    {
+        memset(&engine.memory[address], 0, size);
+    }
+
+    engine.push(STR, address);
+    return engine.error.empty();
+}
+
+bool ILengine::ext_free(ILengine &engine, const Function &fn)
+{
+    (void)fn;
+    engine.release((uint32_t)engine.pop().bits);
+    return engine.error.empty();
+}
+
+bool ILengine::ext_concat(ILengine &engine, const Function &fn)
+{
+    (void)fn;
+    std::string a, b;
+
+    if (!engine.text((uint32_t)engine.pop().bits, a) ||
+        !engine.text((uint32_t)engine.pop().bits, b))
+    {
+        return engine.fail("Concatenation of an invalid string");
+    }
+
+    auto address = engine.allocate((uint32_t)(a.size() + b.size() + 1));
+
+    if (!address)
+    {
+        return engine.fail("Out of memory");
+    }
+
+    memcpy(&engine.memory[address], a.data(), a.size());
+    memcpy(&engine.memory[address + a.size()], b.c_str(), b.size() + 1);
+    engine.push(STR, address);
+    return true;
+}
+
+bool ILengine::ext_bounds_check(ILengine &engine, const Function &fn)
+{
+    (void)fn;
+    std::string site;
+
+    if (!engine.text((uint32_t)engine.pop().bits, site))
+    {
+        site = "?";
+    }
+
+    auto array = (uint32_t)engine.pop().bits;
+    auto index = engine.pop();
+
+    if (!engine.valid(array - 4, 4))
+    {
+        return engine.fail(site + ": index of an invalid array");
+    }
+
+    auto length = engine.read(array - 4);
+
+    // Negative indices are too large as unsigned
+    if ((uint32_t)index.bits >= length)
+    {
+        return engine.fail(site + ": index " +
+                           std::to_string(as_int(index)) +
+                           " out of bounds of an array of length " +
+                           std::to_string(length));
+    }
+
+    engine.stack.push_back(make_int(I32, as_int(index)));
+    return true;
+}
+
+bool ILengine::ext_snapshot(ILengine &engine, const Function &fn)
+{
+    (void)fn;
+
+    if (engine.snapshot_path.empty())
+    {
+        return true;
+    }
+
+    // Only the first call saves, the program goes on either way
+    std::string path, why;
+    path.swap(engine.snapshot_path);
+
+    // Calls back into the program and the queues of the event loop are not
+    // part of the state saved
+    if (engine.callbacks || engine.ready_head || !engine.waiting_io.empty())
+    {
+        fprintf(stderr, "The snapshot is not saved: it was taken while a "
+                        "parallel loop or async tasks were running\n");
+    }
+    else if (!engine.save(path, why))
+    {
+        fprintf(stderr, "The snapshot is not saved: %s\n", why.c_str());
+    }
+
+    return true;
+}
+
+bool ILengine::ext_strlen(ILengine &engine, const Function &fn)
+{
+    (void)fn;
+    std::string text;
+
+    if (!engine.text((uint32_t)engine.pop().bits, text))
+    {
+        return engine.fail("strlen of an invalid string");
+    }
+
+    engine.push(U32, text.size());
+    return true;
+}
+
+// The runtime of stdlib/runtime is kept in memory as blocks of words laid out
+// like its structs, with addresses for pointers, so snapshots save it along
+// with the program. Handles are the addresses of the blocks.
+
+bool ILengine::object(uint32_t address, uint32_t size, const Function &fn,
+                      const char *what)
+{
+    if (!valid(address, size))
+    {
+        return fail(fn.name + " of an invalid " + what);
+    }
+
+    return true;
+}
+
+// An arena is its newest chunk and the size of its chunks, a chunk is the one
+// before it, its capacity and how much of it is used, then its data
+static const uint32_t arena_head = 0;
+static const uint32_t arena_chunk_size = 4;
+static const uint32_t arena_size = 8;
+static const uint32_t chunk_next = 0;
+static const uint32_t chunk_capacity = 4;
+static const uint32_t chunk_used = 8;
+static const uint32_t chunk_data = 16;
+
+static uint32_t align_up(uint32_t size)
+{
+    return (uint32_t)(((uint64_t)size + alignment - 1) / alignment * alignment);
+}
+
+bool ILengine::ext_arena_new(ILengine &engine, const Function &fn)
+{
+    (void)fn;
+    auto chunk_size = (uint32_t)engine.pop().bits;
+    auto arena = engine.allocate(arena_size);
+
+    if (arena)
+    {
+        engine.write(arena + arena_head, 0);
+        engine.write(arena + arena_chunk_size,
+                     chunk_size ? align_up(chunk_size) : 4096);
+    }
+
+    engine.push(U32, arena);
+    return engine.error.empty();
+}
+
+bool ILengine::ext_arena_alloc(ILengine &engine, const Function &fn)
+{
+    auto arena = (uint32_t)engine.pop().bits;
+    auto size = align_up((uint32_t)engine.pop().bits);
+
+    if (!engine.object(arena, arena_size, fn, "arena"))
+    {
+        return false;
+    }
+
+    auto chunk = engine.read(arena + arena_head);
+
+    if (!chunk || engine.read(chunk + chunk_capacity) -
+                          engine.read(chunk + chunk_used) < size)
+    {
+        // Oversized requests get a chunk of their own
+        uint64_t capacity = engine.read(arena + arena_chunk_size);
+
+        while (capacity < size)
+        {
+            capacity *= 2;
+        }
+
+        chunk = capacity > UINT32_MAX - chunk_data
+                    ? 0
+                    : engine.allocate((uint32_t)capacity + chunk_data);
+
+        if (!chunk)
+        {
+            engine.push(STR, 0);
+            return engine.error.empty();
+        }
+
+        engine.write(chunk + chunk_next, engine.read(arena + arena_head));
+        engine.write(chunk + chunk_capacity, (uint32_t)capacity);
+        engine.write(chunk + chunk_used, 0);
+        engine.write(arena + arena_head, chunk);
+    }
+
+    auto used = engine.read(chunk + chunk_used);
+    engine.write(chunk + chunk_used, used + size);
+    engine.push(STR, chunk + chunk_data + used);
+    return engine.error.empty();
+}
+
+bool ILengine::ext_arena_reset(ILengine &engine, const Function &fn)
+{
+    auto arena = (uint32_t)engine.pop().bits;
+
+    if (!engine.object(arena, arena_size, fn, "arena"))
+    {
+        return false;
+    }
+
+    auto head = engine.read(arena + arena_head);
+
+    if (!head)
+    {
+        return true;
+    }
+
+    for (auto chunk = engine.read(head + chunk_next); chunk;)
+    {
+        auto next = engine.read(chunk + chunk_next);
+        engine.release(chunk);
+        chunk = next;
+    }
+
+    engine.write(head + chunk_next, 0);
+    engine.write(head + chunk_used, 0);
+    return true;
+}
+
+bool ILengine::ext_arena_release(ILengine &engine, const Function &fn)
+{
+    auto arena = (uint32_t)engine.pop().bits;
+
+    if (!engine.object(arena, arena_size, fn, "arena"))
+    {
+        return false;
+    }
+
+    for (auto chunk = engine.read(arena + arena_head); chunk;)
+    {
+        auto next = engine.read(chunk + chunk_next);
+        engine.release(chunk);
+        chunk = next;
+    }
+
+    engine.release(arena);
+    return true;
+}
+
+// A pool is the size of its objects, how many a block holds, the first free
+// one and its newest block. Free objects hold the next free one, blocks the
+// one before them
+static const uint32_t pool_object_size = 0;
+static const uint32_t pool_per_block = 4;
+static const uint32_t pool_free_list = 8;
+static const uint32_t pool_blocks = 12;
+static const uint32_t pool_size = 16;
+static const uint32_t block_objects = 8;
+
+bool ILengine::ext_pool_new(ILengine &engine, const Function &fn)
+{
+    (void)fn;
+    auto object_size = (uint32_t)engine.pop().bits;
+    auto per_block = (uint32_t)engine.pop().bits;
+    auto pool = engine.allocate(pool_size);
+
+    if (pool)
+    {
+        engine.write(pool + pool_object_size,
+                     align_up(object_size < 4 ? 4 : object_size));
+        engine.write(pool + pool_per_block, per_block ? per_block : 64);
+        engine.write(pool + pool_free_list, 0);
+        engine.write(pool + pool_blocks, 0);
+    }
+
+    engine.push(U32, pool);
+    return engine.error.empty();
+}
+
+bool ILengine::ext_pool_alloc(ILengine &engine, const Function &fn)
+{
+    auto pool = (uint32_t)engine.pop().bits;
+
+    if (!engine.object(pool, pool_size, fn, "pool"))
+    {
+        return false;
+    }
+
+    if (!engine.read(pool + pool_free_list))
+    {
+        uint64_t object_size = engine.read(pool + pool_object_size);
+        uint64_t count = engine.read(pool + pool_per_block);
+        uint64_t size = block_objects + object_size * count;
+        auto block = size > UINT32_MAX ? 0 : engine.allocate((uint32_t)size);
+
+        if (!block)
+        {
+            engine.push(STR, 0);
+            return engine.error.empty();
+        }
+
+        engine.write(block, engine.read(pool + pool_blocks));
+        engine.write(pool + pool_blocks, block);
+
+        // Thread the new objects onto the free list, lowest address first
+        for (auto i = count; i > 0; i--)
+        {
+            auto object = (uint32_t)(block + block_objects +
+                                     (i - 1) * object_size);
+            engine.write(object, engine.read(pool + pool_free_list));
+            engine.write(pool + pool_free_list, object);
+        }
+    }
+
+    auto object = engine.read(pool + pool_free_list);
+    engine.write(pool + pool_free_list, engine.read(object));
+    engine.push(STR, object);
+    return engine.error.empty();
+}
+
+bool ILengine::ext_pool_free(ILengine &engine, const Function &fn)
+{
+    auto pool = (uint32_t)engine.pop().bits;
+    auto object = (uint32_t)engine.pop().bits;
+
+    if (!engine.object(pool, pool_size, fn, "pool") ||
+        !engine.object(object, 4, fn, "object"))
+    {
+        return false;
+    }
+
+    engine.write(object, engine.read(pool + pool_free_list));
+    engine.write(pool + pool_free_list, object);
+    return true;
+}
+
+bool ILengine::ext_pool_release(ILengine &engine, const Function &fn)
+{
+    auto pool = (uint32_t)engine.pop().bits;
+
+    if (!engine.object(pool, pool_size, fn, "pool"))
+    {
+        return false;
+    }
+
+    for (auto block = engine.read(pool + pool_blocks); block;)
+    {
+        auto next = engine.read(block);
+        engine.release(block);
+        block = next;
+    }
+
+    engine.release(pool);
+    return true;
+}
+
+// A builder is its buffer, the length of its text and the capacity of the
+// buffer
+static const uint32_t sb_data = 0;
+static const uint32_t sb_length = 4;
+static const uint32_t sb_capacity = 8;
+static const uint32_t sb_size = 12;
+
+bool ILengine::sb_reserve(uint32_t sb, uint32_t extra)
+{
+    uint64_t length = read(sb + sb_length);
+    uint64_t needed = length + extra + 1;
+    uint64_t capacity = read(sb + sb_capacity);
+
+    if (needed <= capacity)
+    {
+        return true;
+    }
+
+    capacity = capacity ? capacity : 16;
+
+    while (capacity < needed)
+    {
+        capacity *= 2;
+    }
+
+    auto data = capacity > UINT32_MAX ? 0 : allocate((uint32_t)capacity);
+
+    if (!data)
+    {
+        return false;
+    }
+
+    auto old = read(sb + sb_data);
+
+    if (old)
+    {
+        memcpy(&memory[data], &memory[old], (size_t)length + 1);
+        release(old);
+    }
+
+    write(sb + sb_data, data);
+    write(sb + sb_capacity, (uint32_t)capacity);
+    return true;
+}
+
+bool ILengine::ext_sb_new(ILengine &engine, const Function &fn)
+{
+    (void)fn;
+    auto capacity = (uint32_t)engine.pop().bits;
+    auto sb = engine.allocate(sb_size);
+
+    if (sb)
+    {
+        engine.write(sb + sb_data, 0);
+        engine.write(sb + sb_length, 0);
+        engine.write(sb + sb_capacity, 0);
+
+        if (engine.sb_reserve(sb, capacity))
+        {
+            engine.memory[engine.read(sb + sb_data)] = 0;
+        }
+        else
+        {
+            engine.release(sb);
+            sb = 0;
+        }
+    }
+
+    engine.push(U32, sb);
+    return engine.error.empty();
+}
+
+bool ILengine::ext_sb_append(ILengine &engine, const Function &fn)
+{
+    auto sb = (uint32_t)engine.pop().bits;
+    std::string text;
+
+    if (!engine.object(sb, sb_size, fn, "builder"))
+    {
+        return false;
+    }
+
+    if (!engine.text((uint32_t)engine.pop().bits, text))
+    {
+        return engine.fail(fn.name + " of an invalid string");
+    }
+
+    if (engine.sb_reserve(sb, (uint32_t)text.size()))
+    {
+        auto length = engine.read(sb + sb_length);
+        auto end = engine.read(sb + sb_data) + length;
+
+        memcpy(&engine.memory[end], text.c_str(), text.size() + 1);
+        engine.write(sb + sb_length, length + (uint32_t)text.size());
+    }
+
+    return true;
+}
+
+bool ILengine::ext_sb_append_char(ILengine &engine, const Function &fn)
+{
+    auto sb = (uint32_t)engine.pop().bits;
+    auto c = (uint8_t)engine.pop().bits;
+
+    if (!engine.object(sb, sb_size, fn, "builder"))
+    {
+        return false;
+    }
+
+    if (engine.sb_reserve(sb, 1))
+    {
+        auto length = engine.read(sb + sb_length);
+        auto end = engine.read(sb + sb_data) + length;
+
+        engine.memory[end] = c;
+        engine.memory[end + 1] = 0;
+        engine.write(sb + sb_length, length + 1);
+    }
+
+    return true;
+}
+
+bool ILengine::ext_sb_length(ILengine &engine, const Function &fn)
+{
+    auto sb = (uint32_t)engine.pop().bits;
+
+    if (!engine.object(sb, sb_size, fn, "builder"))
+    {
+        return false;
+    }
+
+    engine.push(U32, engine.read(sb + sb_length));
+    return true;
+}
+
+// Frees the builder and hands its buffer over to the caller
+bool ILengine::ext_sb_finish(ILengine &engine, const Function &fn)
+{
+    auto sb = (uint32_t)engine.pop().bits;
+
+    if (!engine.object(sb, sb_size, fn, "builder"))
+    {
+        return false;
+    }
+
+    engine.push(STR, engine.read(sb + sb_data));
+    engine.release(sb);
+    return true;
+}
+
+bool ILengine::ext_sb_release(ILengine &engine, const Function &fn)
+{
+    auto sb = (uint32_t)engine.pop().bits;
+
+    if (!engine.object(sb, sb_size, fn, "builder"))
+    {
+        return false;
+    }
+
+    engine.release(engine.read(sb + sb_data));
+    engine.release(sb);
+    return true;
+}
+
+// A rope is its two halves or its leaf, its length and depth, how many ropes
+// and handles refer to it, and whether it owns its leaf
+static const uint32_t rope_left = 0;
+static const uint32_t rope_right = 4;
+static const uint32_t rope_leaf = 8;
+static const uint32_t rope_length = 12;
+static const uint32_t rope_depth = 16;
+static const uint32_t rope_refs = 20;
+static const uint32_t rope_owns_leaf = 24;
+static const uint32_t rope_size = 28;
+
+// Degenerate trees are collapsed into a single leaf past this depth
+static const uint32_t rope_max_depth = 48;
+
+void ILengine::rope_copy(uint32_t rope, uint32_t out)
+{
+    // Walk down the right spine iteratively, the left one recursively
+    while (!read(rope + rope_leaf))
+    {
+        auto left = read(rope + rope_left);
+        rope_copy(left, out);
+        out += read(left + rope_length);
+        rope = read(rope + rope_right);
+    }
+
+    memmove(&memory[out], &memory[read(rope + rope_leaf)],
+            read(rope + rope_length));
+}
+
+uint32_t ILengine::rope_flatten(uint32_t rope)
+{
+    auto length = read(rope + rope_length);
+    auto result = length == UINT32_MAX ? 0 : allocate(length + 1);
+
+    if (result)
+    {
+        rope_copy(rope, result);
+        memory[result + length] = 0;
+    }
+
+    return result;
+}
+
+void ILengine::rope_release(uint32_t rope)
+{
+    while (rope && valid(rope, rope_size))
+    {
+        auto refs = read(rope + rope_refs) - 1;
+        write(rope + rope_refs, refs);
+
+        if (refs)
+        {
+            return;
+        }
+
+        auto right = read(rope + rope_right);
+
+        if (read(rope + rope_owns_leaf))
+        {
+            release(read(rope + rope_leaf));
+        }
+
+        rope_release(read(rope + rope_left));
+        release(rope);
+        rope = right;
+    }
+}
+
+bool ILengine::ext_rope_leaf(ILengine &engine, const Function &fn)
+{
+    auto leaf = (uint32_t)engine.pop().bits;
+    std::string text;
+
+    if (!engine.text(leaf, text))
+    {
+        return engine.fail(fn.name + " of an invalid string");
+    }
+
+    auto rope = engine.allocate(rope_size);
+
+    if (rope)
+    {
+        memset(&engine.memory[rope], 0, rope_size);
+        engine.write(rope + rope_leaf, leaf);
+        engine.write(rope + rope_length, (uint32_t)text.size());
+        engine.write(rope + rope_refs, 1);
+    }
+
+    engine.push(U32, rope);
+    return engine.error.empty();
+}
+
+bool ILengine::ext_rope_concat(ILengine &engine, const Function &fn)
+{
+    auto left = (uint32_t)engine.pop().bits;
+    auto right = (uint32_t)engine.pop().bits;
+
+    if (!engine.object(left, rope_size, fn, "rope") ||
+        !engine.object(right, rope_size, fn, "rope"))
+    {
+        return false;
+    }
+
+    auto rope = engine.allocate(rope_size);
+
+    if (!rope)
+    {
+        engine.push(U32, 0);
+        return engine.error.empty();
+    }
+
+    auto depth = std::max(engine.read(left + rope_depth),
+                          engine.read(right + rope_depth)) + 1;
+
+    memset(&engine.memory[rope], 0, rope_size);
+    engine.write(left + rope_refs, engine.read(left + rope_refs) + 1);
+    engine.write(right + rope_refs, engine.read(right + rope_refs) + 1);
+    engine.write(rope + rope_left, left);
+    engine.write(rope + rope_right, right);
+    engine.write(rope + rope_length, engine.read(left + rope_length) +
+                                         engine.read(right + rope_length));
+    engine.write(rope + rope_depth, depth);
+    engine.write(rope + rope_refs, 1);
+
+    if (depth > rope_max_depth)
+    {
+        auto flat = engine.rope_flatten(rope);
+
+        if (flat)
+        {
+            engine.rope_release(left);
+            engine.rope_release(right);
+            engine.write(rope + rope_left, 0);
+            engine.write(rope + rope_right, 0);
+            engine.write(rope + rope_leaf, flat);
+            engine.write(rope + rope_owns_leaf, 1);
+            engine.write(rope + rope_depth, 0);
+        }
+    }
+
+    engine.push(U32, rope);
+    return engine.error.empty();
+}
+
+bool ILengine::ext_rope_length(ILengine &engine, const Function &fn)
+{
+    auto rope = (uint32_t)engine.pop().bits;
+
+    if (!engine.object(rope, rope_size, fn, "rope"))
+    {
+        return false;
+    }
+
+    engine.push(U32, engine.read(rope + rope_length));
+    return true;
+}
+
+bool ILengine::ext_rope_char_at(ILengine &engine, const Function &fn)
+{
+    auto rope = (uint32_t)engine.pop().bits;
+    auto index = (uint32_t)engine.pop().bits;
+
+    if (!engine.object(rope, rope_size, fn, "rope"))
+    {
+        return false;
+    }
+
+    if (index >= engine.read(rope + rope_length))
+    {
+        engine.push(U8, 0);
+        return true;
+    }
+
+    while (!engine.read(rope + rope_leaf))
+    {
+        auto left = engine.read(rope + rope_left);
+        auto left_length = engine.read(left + rope_length);
+
+        if (index < left_length)
+        {
+            rope = left;
+        }
+        else
+        {
+            index -= left_length;
+            rope = engine.read(rope + rope_right);
+        }
+    }
+
+    engine.push(U8, engine.memory[engine.read(rope + rope_leaf) + index]);
+    return true;
+}
+
+bool ILengine::ext_rope_flatten(ILengine &engine, const Function &fn)
+{
+    auto rope = (uint32_t)engine.pop().bits;
+
+    if (!engine.object(rope, rope_size, fn, "rope"))
+    {
+        return false;
+    }
+
+    engine.push(STR, engine.rope_flatten(rope));
+    return engine.error.empty();
+}
+
+bool ILengine::ext_rope_release(ILengine &engine, const Function &fn)
+{
+    auto rope = (uint32_t)engine.pop().bits;
+
+    if (rope && !engine.object(rope, rope_size, fn, "rope"))
+    {
+        return false;
+    }
+
+    engine.rope_release(rope);
+    return true;
+}
+
+// Calls the function a PTR value points to, with its arguments pushed first
+// parameter last, and runs it until it returns
+bool ILengine::call_back(uint64_t function)
+{
+    if (!function || function > functions.size())
+    {
+        return fail("Call of an invalid function " + hex((uint32_t)function));
+    }
+
+    auto depth = frames.size();
+    callbacks++;
+
+    bool ok = call(functions[function - 1].load(std::memory_order_acquire)) &&
+              execute(depth);
+
+    callbacks--;
+    return ok;
+}
+
+// The whole range runs on the calling thread, as the body of the loop is
+// written for any split of it
+bool ILengine::ext_parallel_for(ILengine &engine, const Function &fn)
+{
+    (void)fn;
+    auto n = (int32_t)engine.pop().bits;
+    auto body = engine.pop().bits;
+    auto env = engine.pop().bits;
+
+    if (n <= 0)
+    {
+        return true;
+    }
+
+    engine.push(I32, (uint32_t)n);
+    engine.push(I32, 0);
+    engine.push(STR, env);
+    return engine.call_back(body);
+}
+
+// With a single thread there is nothing to guard the reductions from
+bool ILengine::ext_parallel_lock(ILengine &engine, const Function &fn)
+{
+    (void)engine;
+    (void)fn;
+    return true;
+}
+
+// A future is its kind, whether it is done and detached, its result, the task
+// waiting for it and the next ready task. Tasks add their resume function and
+// frame, I/O operations their descriptor, buffer and count
+enum : uint32_t
+{
+    FUTURE_TASK,
+    FUTURE_READ,
+    FUTURE_WRITE,
+    FUTURE_ACCEPT,
+};
+
+static const uint32_t future_kind = 0;
+static const uint32_t future_done = 4;
+static const uint32_t future_detached = 8;
+static const uint32_t future_result = 12;
+static const uint32_t future_waiter = 16;
+static const uint32_t future_next_ready = 20;
+static const uint32_t future_resume = 24;
+static const uint32_t future_frame = 28;
+static const uint32_t future_fd = 32;
+static const uint32_t future_buf = 36;
+static const uint32_t future_count = 40;
+static const uint32_t future_size = 44;
+
+uint32_t ILengine::new_future(uint32_t kind)
+{
+    auto future = allocate(future_size);
+
+    if (future)
+    {
+        memset(&memory[future], 0, future_size);
+        write(future + future_kind, kind);
+    }
+
+    return future;
+}
+
+void ILengine::free_future(uint32_t future)
+{
+    release(read(future + future_frame));
+    release(future);
+}
+
+void ILengine::make_ready(uint32_t task)
+{
+    write(task + future_next_ready, 0);
+
+    if (ready_tail)
+    {
+        write(ready_tail + future_next_ready, task);
+    }
+    else
+    {
+        ready_head = task;
+    }
+
+    ready_tail = task;
+}
+
+void ILengine::complete(uint32_t future, int32_t result)
+{
+    write(future + future_done, 1);
+    write(future + future_result, (uint32_t)result);
+
+    if (read(future + future_waiter))
+    {
+        make_ready(read(future + future_waiter));
+    }
+
+    if (read(future + future_detached))
+    {
+        free_future(future);
+    }
+}
+
+// Runs ready tasks and waits for I/O until target is done, or until nothing
+// is left to run if target is 0
+bool ILengine::run_until(uint32_t target)
+{
+    while (!target || !read(target + future_done))
+    {
+        if (!error.empty())
+        {
+            return false;
+        }
+
+        if (ready_head)
+        {
+            auto task = ready_head;
+            auto caller = current_task;
+
+            ready_head = read(task + future_next_ready);
+
+            if (!ready_head)
+            {
+                ready_tail = 0;
+            }
+
+            current_task = task;
+            push(STR, read(task + future_frame));
+
+            bool ok = call_back(read(task + future_resume));
+            auto returned = ok && as_int(pop()) != 0;
+
+            current_task = caller;
+
+            if (returned)
+            {
+                complete(task, (int32_t)read(task + future_result));
+            }
+
+            continue;
+        }
+
+#ifdef _WIN32
+        return true;
+#else
+        if (waiting_io.empty())
+        {
+            return true;
+        }
+
+        if (!wait_io())
+        {
+            return false;
+        }
+#endif
+    }
+
+    return true;
+}
+
+// Creates a task for a frame the compiler allocated, ready to run
+bool ILengine::ext_task_new(ILengine &engine, const Function &fn)
+{
+    (void)fn;
+    auto frame = (uint32_t)engine.pop().bits;
+    auto resume = (uint32_t)engine.pop().bits;
+    auto task = engine.new_future(FUTURE_TASK);
+
+    if (task)
+    {
+        engine.write(task + future_resume, resume);
+        engine.write(task + future_frame, frame);
+        engine.make_ready(task);
+    }
+
+    engine.push(U32, task);
+    return engine.error.empty();
+}
+
+bool ILengine::ext_task_return(ILengine &engine, const Function &fn)
+{
+    (void)fn;
+    auto result = (uint32_t)engine.pop().bits;
+
+    if (!engine.current_task)
+    {
+        return engine.fail("dusk_task_return outside of a task");
+    }
+
+    engine.write(engine.current_task + future_result, result);
+    return true;
+}
+
+// Makes the running task wait for the future, unless it is done already
+bool ILengine::ext_task_await(ILengine &engine, const Function &fn)
+{
+    auto future = (uint32_t)engine.pop().bits;
+
+    if (!engine.object(future, future_size, fn, "future"))
+    {
+        return false;
+    }
+
+    auto done = engine.read(future + future_done);
+
+    if (!done)
+    {
+        engine.write(future + future_waiter, engine.current_task);
+    }
+
+    engine.push(I32, done);
+    return true;
+}
+
+bool ILengine::ext_future_take(ILengine &engine, const Function &fn)
+{
+    auto future = (uint32_t)engine.pop().bits;
+
+    if (!engine.object(future, future_size, fn, "future"))
+    {
+        return false;
+    }
+
+    engine.push(I32, engine.read(future + future_result));
+    engine.free_future(future);
+    return true;
+}
+
+bool ILengine::ext_spawn(ILengine &engine, const Function &fn)
+{
+    auto task = (uint32_t)engine.pop().bits;
+
+    if (!engine.object(task, future_size, fn, "task"))
+    {
+        return false;
+    }
+
+    if (engine.read(task + future_done))
+    {
+        engine.free_future(task);
+    }
+    else
+    {
+        engine.write(task + future_detached, 1);
+    }
+
+    return true;
+}
+
+bool ILengine::ext_run(ILengine &engine, const Function &fn)
+{
+    (void)fn;
+    return engine.run_until(0);
+}
+
+bool ILengine::ext_block_on(ILengine &engine, const Function &fn)
+{
+    auto task = (uint32_t)engine.pop().bits;
+
+    if (!engine.object(task, future_size, fn, "task") ||
+        !engine.run_until(task))
+    {
+        return false;
+    }
+
+    uint32_t result = 0;
+
+    if (engine.read(task + future_done))
+    {
+        result = engine.read(task + future_result);
+        engine.free_future(task);
+    }
+
+    engine.push(I32, result);
+    return true;
+}
+
+#ifndef _WIN32
+// Tries the operation once, returns false if it would block
+bool ILengine::attempt_io(uint32_t future)
+{
+    auto fd = (int)read(future + future_fd);
+    auto buf = read(future + future_buf);
+    auto count = read(future + future_count);
+    ssize_t result;
+
+    switch (read(future + future_kind))
+    {
+    case FUTURE_READ:
+        result = ::read(fd, &memory[buf], count);
+        break;
+
+    case FUTURE_WRITE:
+        // What printf buffered comes first
+        fflush(stdout);
+        result = ::write(fd, &memory[buf], count);
+        break;
+
+    default:
+        result = accept(fd, nullptr, nullptr);
+
+        if (result >= 0)
+        {
+            fcntl((int)result, F_SETFL,
+                  fcntl((int)result, F_GETFL) | O_NONBLOCK);
+        }
+        break;
+    }
+
+    if (result < 0 &&
+        (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+    {
+        return false;
+    }
+
+    complete(future, result < 0 ? -errno : (int32_t)result);
+    return true;
+}
+
+// Waits until a descriptor an operation waits for is ready, and tries the
+// operations of those that are
+bool ILengine::wait_io()
+{
+    std::vector<pollfd> fds;
+
+    for (auto future : waiting_io)
+    {
+        auto kind = read(future + future_kind);
+        fds.push_back({(int)read(future + future_fd),
+                       (short)(kind == FUTURE_WRITE ? POLLOUT : POLLIN), 0});
+    }
+
+    if (poll(fds.data(), fds.size(), -1) < 0 && errno != EINTR)
+    {
+        return fail(std::string("poll failed: ") + strerror(errno));
+    }
+
+    std::vector<uint32_t> still_waiting;
+
+    for (size_t i = 0; i < fds.size(); i++)
+    {
+        if (!fds[i].revents || !attempt_io(waiting_io[i]))
+        {
+            still_waiting.push_back(waiting_io[i]);
+        }
+    }
+
+    waiting_io.swap(still_waiting);
+    return true;
+}
+
+// dusk_read, dusk_write and dusk_accept start their operation right away and
+// return its future
+bool ILengine::ext_io(ILengine &engine, const Function &fn)
+{
+    auto kind = fn.name == "dusk_read"    ? FUTURE_READ
+              : fn.name == "dusk_write"   ? FUTURE_WRITE
+                                          : FUTURE_ACCEPT;
+    auto fd = (int32_t)engine.pop().bits;
+    uint32_t buf = 0, count = 0;
+
+    if (kind != FUTURE_ACCEPT)
+    {
+        buf = (uint32_t)engine.pop().bits;
+        count = (uint32_t)engine.pop().bits;
+
+        if (!engine.object(buf, count, fn, "buffer"))
+        {
+            return false;
+        }
+    }
+
+    auto future = engine.new_future(kind);
+
+    if (future)
+    {
+        engine.write(future + future_fd, (uint32_t)fd);
+        engine.write(future + future_buf, buf);
+        engine.write(future + future_count, count);
+
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+        if (!engine.attempt_io(future))
+        {
+            engine.waiting_io.push_back(future);
+        }
+    }
+
+    engine.push(U32, future);
+    return engine.error.empty();
+}
+#endif
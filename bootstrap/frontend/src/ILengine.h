@@ -0,0 +1,324 @@
+#ifndef FRONTEND_ILENGINE_H
+#define FRONTEND_ILENGINE_H
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "ILcode.h"
+
+/**
+ * A value on the stack of the engine: the bits of the value and the IL type
+ * it was pushed as. Floats are kept as their bits, so a float read from
+ * memory is the same as one pushed. Vectors keep their lanes in bits and
+ * high, lane 0 in the lowest bits like in memory.
+ */
+struct ILvalue
+{
+  uint8_t type = U32;
+  uint64_t bits = 0;
+  uint64_t high = 0;
+};
+
+/**
+ * Runs IL in the process that generated it, for the REPL. Functions are added
+ * as they are generated and stay for everything run after, and code outside
+ * of functions runs in a frame of its own that lives as long as the engine,
+ * so its variables are there for the next code run. Functions read and write
+ * variables they do not declare from that frame.
+ *
+ * Memory is a single block addressed with 32 bits like the native target,
+ * with the length of arrays in front of them and READ and WRIT moving four
+ * bytes. Comparisons are of the top of the stack with the value below it,
+ * like the NASM emitter compares. External functions are provided by the
+ * engine itself for the runtime the standard library and the code generator
+ * use, with its objects kept in memory like the rest of the program, others
+ * fail when called. Parallel loops run on the calling thread, and async I/O
+ * waits with poll. Vector instructions run lane by lane.
+ *
+ * Calls go through a table of the current body of every function, so a
+ * function can be replaced while code runs on another thread. Frames keep the
+ * body they were called with until they return.
+ *
+ * A program can save its state once it is initialized by calling
+ * dusk_snapshot, for a later run of the same program to restore and resume
+ * from there. Addresses are offsets into memory, so the state is saved as it
+ * is and memory can be placed anywhere when it is restored.
+ */
+class ILengine
+{
+public:
+  ILengine();
+
+  /**
+   * Adds the functions defined and declared in il. A function that was
+   * defined before is replaced for the calls made after. Code outside of
+   * functions is run by run, not here.
+   *
+   * @return false with error set if il can not be decoded
+   */
+  bool load(const ILemitter &il);
+
+  /**
+   * Runs the code of il that is outside of functions, after loading its
+   * functions. Values the code leaves on the stack, like those of expression
+   * statements, are added to results.
+   *
+   * @return false with error set if il can not be decoded or running it
+   *         fails
+   */
+  bool run(const ILemitter &il, std::vector<ILvalue> &results);
+
+  /**
+   * Calls a function without parameters, like main, and adds what it returns
+   * to results.
+   *
+   * @return false with error set if the function is not defined or running
+   *         it fails
+   */
+  bool run(const std::string &name, std::vector<ILvalue> &results);
+
+  /**
+   * Replaces the functions loaded before whose code in il is different, for
+   * the calls made after. Calls running already finish with the code they
+   * started with. This can be called while the engine runs on another thread,
+   * but not alongside load or another replace.
+   *
+   * Nothing is replaced if a function in il is not loaded yet, if its return
+   * or parameter types changed, or if its code uses a function or variable
+   * the engine does not have. A function that is not loaded yet, but has the
+   * source name of a loaded one that il no longer has, is an overload whose
+   * parameter types changed.
+   *
+   * @param il       The IL of the whole program, changed or not
+   * @param names    The name in the source of each function by its name in
+   *                 the IL, functions without one go by their IL name
+   * @param replaced The source names of the functions replaced
+   * @param reason   Why nothing was replaced
+   *
+   * @return Whether the replacement was made
+   */
+  bool replace(const ILemitter &il,
+               const std::map<std::string, std::string> &names,
+               std::vector<std::string> &replaced, std::string &reason);
+
+  /**
+   * Restores the state dusk_snapshot saved, to be continued by resume. The
+   * program loaded has to be the one the state was saved from.
+   *
+   * @return false with error set if the file can not be read or was saved
+   *         from another program
+   */
+  bool restore(const std::string &path);
+
+  /**
+   * Runs the calls restored until they all returned, adding what the first
+   * of them returns to results.
+   *
+   * @return false with error set if running them fails
+   */
+  bool resume(std::vector<ILvalue> &results);
+
+  /**
+   * The file dusk_snapshot saves the state to, the first time it is called.
+   * It does nothing while this is empty.
+   */
+  std::string snapshot_path;
+
+  /** Writes a value as the given IL type, strings as the text they point to */
+  std::string format(const ILvalue &value, uint8_t type) const;
+
+  /** Why loading or running failed */
+  std::string error;
+
+private:
+  struct Op
+  {
+    uint8_t opcode = NOOP;
+
+    // The type operand, or whether a variable is one of the outer frame
+    uint8_t type = VOID;
+
+    // The function, slot, jump target or argument count operated on
+    uint32_t index = 0;
+
+    // String constants are placed in memory the first time they run, by the
+    // thread running them
+    mutable ILvalue value;
+    std::string text;
+  };
+
+  struct Function
+  {
+    std::string name;
+    uint8_t type = VOID;
+    bool defined = false;
+    bool external = false;
+
+    // @il functions work on the stack and variables of their caller
+    bool raw = false;
+
+    std::vector<std::string> params;
+    std::vector<uint8_t> param_types;
+    std::vector<std::string> locals;
+    std::vector<uint8_t> local_types;
+    std::vector<Op> code;
+
+    /** The declared type of a parameter or local by its slot, or VOID */
+    uint8_t slot_type(size_t slot) const
+    {
+      if (slot < params.size())
+      {
+        return slot < param_types.size() ? param_types[slot] : VOID;
+      }
+
+      slot -= params.size();
+      return slot < local_types.size() ? local_types[slot] : VOID;
+    }
+  };
+
+  struct Frame
+  {
+    const Function *fn;
+    size_t pc;
+    size_t stack;
+    size_t slots;
+  };
+
+  typedef bool (*External)(ILengine &engine, const Function &fn);
+
+  // Every function by name, bodies of replaced functions stay alive for the
+  // frames still running them. The table only grows while nothing runs, the
+  // bodies in it change at any time.
+  std::map<std::string, size_t> function_index;
+  std::deque<std::atomic<const Function *>> functions;
+  std::vector<std::unique_ptr<Function>> bodies;
+
+  // Held while functions are added or replaced
+  std::mutex update;
+
+  // A hash of the IL loaded, so a snapshot is only restored into the program
+  // it was saved from
+  uint64_t fingerprint = 14695981039346656037ull;
+
+  // The variables of the outer frame by name
+  std::map<std::string, size_t> outer_index;
+  std::vector<ILvalue> outer;
+
+  std::vector<ILvalue> stack;
+  std::vector<ILvalue> slots;
+  std::vector<Frame> frames;
+
+  std::vector<uint8_t> memory;
+  std::map<uint32_t, std::vector<uint32_t>> free_blocks;
+  std::map<std::string, uint32_t> strings;
+
+  // The async tasks ready to run, the one running and the I/O operations
+  // waiting for their descriptor, as the addresses of their futures
+  uint32_t ready_head = 0;
+  uint32_t ready_tail = 0;
+  uint32_t current_task = 0;
+  std::vector<uint32_t> waiting_io;
+
+  // How many calls external functions make back into the program are running
+  unsigned int callbacks = 0;
+
+  static const std::map<std::string, External> externals;
+
+  size_t function(const std::string &name);
+  bool define(const std::vector<ILinstruction> &code);
+  bool declare(const std::vector<ILinstruction> &code, size_t i,
+               const std::map<std::string, ILsignature> &signatures,
+               bool running, std::unique_ptr<Function> &fn, std::string &why);
+  bool translate(const std::vector<ILinstruction> &code, size_t begin,
+                 size_t end, bool running, Function &fn, std::string &why);
+  static bool same_code(const std::vector<Op> &a, const std::vector<Op> &b);
+  bool execute(size_t depth);
+  bool call(const Function *fn);
+  bool call_back(uint64_t function);
+  bool fail(const std::string &message);
+  bool object(uint32_t address, uint32_t size, const Function &fn,
+              const char *what);
+
+  ILvalue pop();
+  void push(uint8_t type, uint64_t bits);
+
+  uint32_t allocate(uint32_t size);
+  void release(uint32_t address);
+  bool valid(uint32_t address, uint32_t size) const;
+  uint32_t read(uint32_t address) const;
+  void write(uint32_t address, uint32_t value);
+  uint32_t string(const std::string &text);
+  bool text(uint32_t address, std::string &result) const;
+
+  void add_fingerprint(const ILemitter &il);
+  std::vector<std::pair<uint32_t, uint32_t>> blocks() const;
+  std::vector<bool>
+  reachable(const std::vector<std::pair<uint32_t, uint32_t>> &blocks) const;
+  bool save(const std::string &path, std::string &why);
+
+  static bool ext_printf(ILengine &engine, const Function &fn);
+  static bool ext_puts(ILengine &engine, const Function &fn);
+  static bool ext_putchar(ILengine &engine, const Function &fn);
+  static bool ext_malloc(ILengine &engine, const Function &fn);
+  static bool ext_calloc(ILengine &engine, const Function &fn);
+  static bool ext_free(ILengine &engine, const Function &fn);
+  static bool ext_concat(ILengine &engine, const Function &fn);
+  static bool ext_bounds_check(ILengine &engine, const Function &fn);
+  static bool ext_snapshot(ILengine &engine, const Function &fn);
+  static bool ext_strlen(ILengine &engine, const Function &fn);
+
+  static bool ext_arena_new(ILengine &engine, const Function &fn);
+  static bool ext_arena_alloc(ILengine &engine, const Function &fn);
+  static bool ext_arena_reset(ILengine &engine, const Function &fn);
+  static bool ext_arena_release(ILengine &engine, const Function &fn);
+  static bool ext_pool_new(ILengine &engine, const Function &fn);
+  static bool ext_pool_alloc(ILengine &engine, const Function &fn);
+  static bool ext_pool_free(ILengine &engine, const Function &fn);
+  static bool ext_pool_release(ILengine &engine, const Function &fn);
+
+  bool sb_reserve(uint32_t sb, uint32_t extra);
+  static bool ext_sb_new(ILengine &engine, const Function &fn);
+  static bool ext_sb_append(ILengine &engine, const Function &fn);
+  static bool ext_sb_append_char(ILengine &engine, const Function &fn);
+  static bool ext_sb_length(ILengine &engine, const Function &fn);
+  static bool ext_sb_finish(ILengine &engine, const Function &fn);
+  static bool ext_sb_release(ILengine &engine, const Function &fn);
+
+  void rope_copy(uint32_t rope, uint32_t out);
+  uint32_t rope_flatten(uint32_t rope);
+  void rope_release(uint32_t rope);
+  static bool ext_rope_leaf(ILengine &engine, const Function &fn);
+  static bool ext_rope_concat(ILengine &engine, const Function &fn);
+  static bool ext_rope_length(ILengine &engine, const Function &fn);
+  static bool ext_rope_char_at(ILengine &engine, const Function &fn);
+  static bool ext_rope_flatten(ILengine &engine, const Function &fn);
+  static bool ext_rope_release(ILengine &engine, const Function &fn);
+
+  static bool ext_parallel_for(ILengine &engine, const Function &fn);
+  static bool ext_parallel_lock(ILengine &engine, const Function &fn);
+
+  uint32_t new_future(uint32_t kind);
+  void free_future(uint32_t future);
+  void make_ready(uint32_t task);
+  void complete(uint32_t future, int32_t result);
+  bool run_until(uint32_t target);
+  static bool ext_task_new(ILengine &engine, const Function &fn);
+  static bool ext_task_return(ILengine &engine, const Function &fn);
+  static bool ext_task_await(ILengine &engine, const Function &fn);
+  static bool ext_future_take(ILengine &engine, const Function &fn);
+  static bool ext_spawn(ILengine &engine, const Function &fn);
+  static bool ext_run(ILengine &engine, const Function &fn);
+  static bool ext_block_on(ILengine &engine, const Function &fn);
+#ifndef _WIN32
+  bool attempt_io(uint32_t future);
+  bool wait_io();
+  static bool ext_io(ILengine &engine, const Function &fn);
+#endif
+};
+
+#endif // FRONTEND_ILENGINE_H
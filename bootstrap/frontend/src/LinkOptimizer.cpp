@@ -0,0 +1,1176 @@
+#include "LinkOptimizer.h"
+#include <algorithm>
+
+// Functions with at most this many instructions are inlined
+static const size_t inline_size = 16;
+
+// Functions with at most this many instructions are specialized, into at most
+// specialization_count copies each
+static const size_t specialization_size = 64;
+static const size_t specialization_count = 4;
+
+// An argument that is not a constant
+static const size_t none = (size_t)-1;
+
+// The value of an integer or boolean constant push. Only types of at most 32
+// bits are folded, the width of the registers of the NASM emitter.
+static bool constant_value(const ILinstruction &instruction, int64_t &value)
+{
+    auto opcode = instruction.opcode;
+
+    if (opcode == PTRU || opcode == PFLS)
+    {
+        value = opcode == PTRU;
+        return true;
+    }
+
+    auto type = pushed_type(opcode);
+
+    if (type == VOID || type == U64 || type == I64 || type > I64)
+    {
+        return false;
+    }
+
+    uint64_t bits = 0;
+
+    for (auto byte : instruction.data)
+    {
+        bits = bits << 8 | byte;
+    }
+
+    auto width = 8 * instruction.data.size();
+
+    if (type >= I8 && bits >> (width - 1))
+    {
+        bits |= ~(uint64_t)0 << width;
+    }
+
+    value = (int64_t)bits;
+    return true;
+}
+
+static bool fits(uint8_t type, int64_t value)
+{
+    auto width = 8 << (type & 3);
+
+    if (type >= I8)
+    {
+        return value >= -((int64_t)1 << (width - 1)) &&
+               value < (int64_t)1 << (width - 1);
+    }
+
+    return value >= 0 && value < (int64_t)1 << width;
+}
+
+static ILinstruction constant(uint8_t type, int64_t value,
+                              const SourcePosition &position)
+{
+    ILinstruction instruction;
+    instruction.opcode = type;
+    instruction.position = position;
+
+    for (auto width = 1 << (type & 3); width; width--)
+    {
+        instruction.data.push_back((uint8_t)(value >> 8 * (width - 1)));
+    }
+
+    return instruction;
+}
+
+// Folds below op top into result. Comparisons are of the top of the stack
+// with the value below it, signed like the NASM emitter compares. CPLE is left
+// alone as the NASM emitter compares it like CPGE.
+static bool fold_binary(uint8_t op, const ILinstruction &below, int64_t y,
+                        int64_t x, ILinstruction &result)
+{
+    auto type = pushed_type(below.opcode);
+    int64_t value;
+    bool comparable = fits(I32, x) && fits(I32, y);
+
+    switch (op)
+    {
+    case IADD: value = y + x; break;
+    case ISUB: value = y - x; break;
+    case IMUL: value = y * x; break;
+    case BAND: value = y & x; break;
+    case BWOR: value = y | x; break;
+    case BXOR: value = y ^ x; break;
+
+    case CMPE: case CPNE: case CMPG: case CMPL: case CPGE:
+    {
+        if (!comparable)
+        {
+            return false;
+        }
+
+        bool holds = op == CMPE ? x == y
+                   : op == CPNE ? x != y
+                   : op == CMPG ? x > y
+                   : op == CMPL ? x < y
+                   : x >= y;
+
+        result = ILinstruction();
+        result.opcode = holds ? PTRU : PFLS;
+        result.position = below.position;
+        return true;
+    }
+
+    default:
+        return false;
+    }
+
+    if (below.opcode == PTRU || below.opcode == PFLS || !fits(type, value))
+    {
+        return false;
+    }
+
+    result = constant(type, value, below.position);
+    return true;
+}
+
+static bool jumps(uint8_t op, int64_t value)
+{
+    switch (op)
+    {
+    case JEQZ: return value == 0;
+    case JNEZ: return value != 0;
+    case JGTZ: return value > 0;
+    case JGEZ: return value >= 0;
+    case JLTZ: return value < 0;
+    default:   return value <= 0;
+    }
+}
+
+// Removes the instructions at indices from code
+static void erase(std::vector<ILinstruction> &code, std::vector<size_t> indices)
+{
+    std::sort(indices.rbegin(), indices.rend());
+
+    for (auto i : indices)
+    {
+        code.erase(code.begin() + i);
+    }
+}
+
+// Pushes a value without doing anything else
+static bool pushes_only(uint8_t opcode)
+{
+    switch (opcode)
+    {
+    case PSTR: case PFUN: case LLOC: case LARG: case LGLO:
+    case ADRL: case ADRA: case ADRG:
+        return true;
+
+    default:
+        return pushed_type(opcode) != VOID;
+    }
+}
+
+void LinkOptimizer::split(std::vector<ILinstruction> &code)
+{
+    auto current = &prefix;
+
+    for (auto &instruction : code)
+    {
+        if (instruction.opcode != FUNC)
+        {
+            current->push_back(std::move(instruction));
+            continue;
+        }
+
+        Function fn;
+        fn.name = instruction.names[0];
+
+        // The attributes and declarations right before a function are its own
+        auto start = current->end();
+
+        while (start != current->begin())
+        {
+            auto &record = *(start - 1);
+
+            if (record.opcode != DATA &&
+                ((record.opcode != FPRM && record.opcode != INFN) ||
+                 record.names[0] != fn.name))
+            {
+                break;
+            }
+
+            start--;
+        }
+
+        fn.code.assign(std::make_move_iterator(start),
+                       std::make_move_iterator(current->end()));
+        current->erase(start, current->end());
+        fn.code.push_back(std::move(instruction));
+
+        functions.push_back(std::move(fn));
+        current = &functions.back().code;
+    }
+}
+
+int LinkOptimizer::find(const std::string &name) const
+{
+    for (size_t i = 0; i < functions.size(); i++)
+    {
+        if (functions[i].name == name)
+        {
+            return (int)i;
+        }
+    }
+
+    return -1;
+}
+
+// The index of the first instruction after the FUNC
+size_t LinkOptimizer::body(const Function &fn) const
+{
+    size_t i = 0;
+
+    while (fn.code[i].opcode != FUNC)
+    {
+        i++;
+    }
+
+    return i + 1;
+}
+
+size_t LinkOptimizer::size(const Function &fn) const
+{
+    size_t count = 0;
+
+    for (auto i = body(fn); i < fn.code.size(); i++)
+    {
+        count += !is_meta(fn.code[i].opcode);
+    }
+
+    return count;
+}
+
+// Whether the calls of a function can be changed
+bool LinkOptimizer::optimizable(const std::string &name) const
+{
+    return name != "main" && !raw.count(name) && signatures.count(name) &&
+           find(name) >= 0;
+}
+
+// Parameters stored to or whose address is taken, they can not be replaced by
+// a constant
+std::set<std::string> LinkOptimizer::fixed_params(const Function &fn) const
+{
+    std::set<std::string> fixed;
+
+    for (auto &instruction : fn.code)
+    {
+        if (instruction.opcode == SARG || instruction.opcode == ADRA)
+        {
+            fixed.insert(instruction.names[0]);
+        }
+    }
+
+    return fixed;
+}
+
+// The index of the push of each argument of the call at index that is a
+// constant of the type of its parameter, or none. Arguments are pushed from
+// the last to the first, so they are found from the call back by what they
+// do to the stack.
+std::vector<size_t> LinkOptimizer::constant_args(
+    const std::vector<ILinstruction> &code, size_t call,
+    const ILsignature &signature) const
+{
+    std::vector<size_t> pushes(signature.params.size(), none);
+    auto end = call;
+
+    for (size_t j = 0; j < signature.params.size(); j++)
+    {
+        // The values the code from start to end takes from below it, and the
+        // number of values it leaves
+        int taken = 0;
+        int left = 0;
+        auto start = end;
+
+        while (taken || left != 1)
+        {
+            int pops, pushed;
+
+            if (start == 0 || code[start - 1].opcode == FUNC ||
+                is_label(code[start - 1].opcode))
+            {
+                return pushes;
+            }
+
+            auto &instruction = code[--start];
+
+            if (is_meta(instruction.opcode))
+            {
+                continue;
+            }
+
+            if (!stack_effect(instruction, pops, pushed))
+            {
+                return pushes;
+            }
+
+            taken = pops + std::max(0, taken - pushed);
+            left += pushed - pops;
+        }
+
+        size_t count = 0;
+
+        for (auto i = start; i < end; i++)
+        {
+            if (!is_meta(code[i].opcode))
+            {
+                pushes[j] = i;
+                count++;
+            }
+        }
+
+        if (count != 1 ||
+            pushed_type(code[pushes[j]].opcode) != signature.params[j].second)
+        {
+            pushes[j] = none;
+        }
+
+        end = start;
+    }
+
+    return pushes;
+}
+
+bool LinkOptimizer::stack_effect(const ILinstruction &instruction,
+                                 int &pops, int &pushes) const
+{
+    pops = 0;
+    pushes = 0;
+
+    if (pushes_only(instruction.opcode))
+    {
+        pushes = 1;
+        return true;
+    }
+
+    switch (instruction.opcode)
+    {
+    case NOOP:
+        return true;
+
+    case DELE: case SLOC: case SARG: case SGLO:
+        pops = 1;
+        return true;
+
+    case CAST: case INEG: case FNEG: case READ:
+        pops = 1;
+        pushes = 1;
+        return true;
+
+    case DUPE:
+        pops = 1;
+        pushes = 2;
+        return true;
+
+    case SWAP:
+        pops = 2;
+        pushes = 2;
+        return true;
+
+    case WRIT:
+        pops = 2;
+        return true;
+
+    case IADD: case ISUB: case IMUL: case IDIV: case IMOD:
+    case FADD: case FSUB: case FMUL: case FDIV: case FMOD:
+    case BSHL: case BSHR: case BAND: case BWOR: case BXOR:
+    case CMPE: case CMPG: case CPGE: case CMPL: case CPLE: case CPNE:
+        pops = 2;
+        pushes = 1;
+        return true;
+
+    case CALL:
+    {
+        auto &name = instruction.names[0];
+        auto external = externs.find(name);
+
+        if (external != externs.end())
+        {
+            pops = (int)external->second.second;
+            pushes = external->second.first != VOID;
+            return true;
+        }
+
+        auto signature = signatures.find(name);
+
+        if (signature == signatures.end() || raw.count(name) ||
+            find(name) < 0)
+        {
+            return false;
+        }
+
+        pops = (int)signature->second.params.size();
+        pushes = signature->second.type != VOID;
+        return true;
+    }
+
+    default:
+        return false;
+    }
+}
+
+// Small functions without branches that leave nothing on the stack but what
+// they return
+bool LinkOptimizer::inlinable(const Function &fn) const
+{
+    if (!optimizable(fn.name))
+    {
+        return false;
+    }
+
+    auto &signature = signatures.at(fn.name);
+    int depth = 0;
+    size_t count = 0;
+
+    // Parameters and locals become locals of the caller with the same prefix
+    for (auto &param : signature.params)
+    {
+        for (auto &local : signature.locals)
+        {
+            if (param.first == local.first)
+            {
+                return false;
+            }
+        }
+    }
+
+    for (auto i = body(fn); i < fn.code.size(); i++)
+    {
+        auto &instruction = fn.code[i];
+        int pops, pushes;
+
+        if (is_meta(instruction.opcode))
+        {
+            continue;
+        }
+
+        if (instruction.opcode == RETN)
+        {
+            return depth == (signature.type != VOID);
+        }
+
+        if (is_label(instruction.opcode) || ++count > inline_size ||
+            (instruction.opcode == CALL && instruction.names[0] == fn.name) ||
+            !stack_effect(instruction, pops, pushes) || depth < pops)
+        {
+            return false;
+        }
+
+        depth += pushes - pops;
+    }
+
+    return false;
+}
+
+// Folds constant expressions and branches, and removes code that is never
+// reached and labels nothing jumps to. The frontend only jumps within a
+// function.
+void LinkOptimizer::fold(Function &fn)
+{
+    bool changed = true;
+
+    while (changed)
+    {
+        changed = false;
+
+        std::vector<size_t> ops;
+        std::vector<bool> removed(fn.code.size());
+        std::set<std::string> targets;
+
+        for (auto i = body(fn); i < fn.code.size(); i++)
+        {
+            auto opcode = fn.code[i].opcode;
+
+            if (!is_meta(opcode))
+            {
+                ops.push_back(i);
+            }
+
+            if (is_label(opcode) && opcode != LABL)
+            {
+                targets.insert(fn.code[i].names[0]);
+            }
+        }
+
+        for (size_t n = 0; n < ops.size(); n++)
+        {
+            auto &a = fn.code[ops[n]];
+            auto b = n + 1 < ops.size() ? &fn.code[ops[n + 1]] : nullptr;
+            auto c = n + 2 < ops.size() ? &fn.code[ops[n + 2]] : nullptr;
+            int64_t x, y;
+            ILinstruction result;
+
+            if (a.opcode == LABL && !targets.count(a.names[0]))
+            {
+                removed[ops[n]] = true;
+                changed = true;
+            }
+            else if (a.opcode == JUMP || a.opcode == RETN)
+            {
+                auto next = n + 1;
+
+                while (next < ops.size() && fn.code[ops[next]].opcode != LABL)
+                {
+                    removed[ops[next++]] = true;
+                    changed = true;
+                }
+
+                // A jump to the label right after it
+                if (a.opcode == JUMP && next == n + 1 && next < ops.size() &&
+                    fn.code[ops[next]].names[0] == a.names[0])
+                {
+                    removed[ops[n]] = true;
+                    changed = true;
+                }
+
+                n = next - 1;
+            }
+            else if (c && constant_value(a, y) && constant_value(*b, x) &&
+                     a.opcode == b->opcode &&
+                     fold_binary(c->opcode, a, y, x, result))
+            {
+                a = result;
+                removed[ops[n + 1]] = true;
+                removed[ops[n + 2]] = true;
+                changed = true;
+                n += 2;
+            }
+            else if (b && b->opcode >= JEQZ && b->opcode <= JLEZ &&
+                     constant_value(a, x) && fits(I32, x))
+            {
+                removed[ops[n]] = true;
+
+                if (jumps(b->opcode, x))
+                {
+                    b->opcode = JUMP;
+                }
+                else
+                {
+                    removed[ops[n + 1]] = true;
+                }
+
+                changed = true;
+                n++;
+            }
+            else if (b && b->opcode == DELE && pushes_only(a.opcode))
+            {
+                removed[ops[n]] = true;
+                removed[ops[n + 1]] = true;
+                changed = true;
+                n++;
+            }
+        }
+
+        if (!changed)
+        {
+            break;
+        }
+
+        std::vector<ILinstruction> code;
+
+        for (size_t i = 0; i < fn.code.size(); i++)
+        {
+            if (!removed[i])
+            {
+                code.push_back(std::move(fn.code[i]));
+            }
+        }
+
+        fn.code.swap(code);
+    }
+}
+
+// Moves arguments every call of a function passes the same constant for into
+// the function, removing the parameter
+void LinkOptimizer::propagate_constants()
+{
+    for (size_t f = 0; f < functions.size(); f++)
+    {
+        auto &callee = functions[f];
+        auto &name = callee.name;
+
+        if (!optimizable(name) || addressed.count(name) ||
+            signatures[name].params.empty())
+        {
+            continue;
+        }
+
+        auto &params = signatures[name].params;
+        bool unknown = false;
+
+        for (auto &instruction : prefix)
+        {
+            unknown |= instruction.opcode == CALL && instruction.names[0] == name;
+        }
+
+        // Every call, as the function and the index of its CALL, and the
+        // constants it passes
+        std::vector<std::pair<size_t, size_t>> sites;
+        std::vector<std::vector<size_t>> pushes;
+
+        for (size_t g = 0; g < functions.size(); g++)
+        {
+            auto &code = functions[g].code;
+
+            for (size_t i = 0; i < code.size(); i++)
+            {
+                if (code[i].opcode == CALL && code[i].names[0] == name)
+                {
+                    sites.emplace_back(g, i);
+                    pushes.push_back(constant_args(code, i, signatures[name]));
+                }
+            }
+        }
+
+        if (unknown || sites.empty())
+        {
+            continue;
+        }
+
+        auto fixed = fixed_params(callee);
+        std::map<std::string, ILinstruction> constants;
+        std::vector<size_t> propagated;
+
+        for (size_t j = 0; j < params.size(); j++)
+        {
+            bool same = !fixed.count(params[j].first) && pushes[0][j] != none;
+
+            for (size_t k = 1; same && k < sites.size(); k++)
+            {
+                auto &first = functions[sites[0].first].code[pushes[0][j]];
+                auto at = pushes[k][j];
+                auto &push = functions[sites[k].first].code[at == none ? 0 : at];
+
+                same = at != none && push.opcode == first.opcode &&
+                       push.data == first.data;
+            }
+
+            if (same)
+            {
+                constants[params[j].first] =
+                    functions[sites[0].first].code[pushes[0][j]];
+                propagated.push_back(j);
+            }
+        }
+
+        if (propagated.empty())
+        {
+            continue;
+        }
+
+        // From the last call on, so removing pushes does not move the others
+        for (auto k = sites.size(); k--;)
+        {
+            std::vector<size_t> removed;
+
+            for (auto j : propagated)
+            {
+                removed.push_back(pushes[k][j]);
+            }
+
+            erase(functions[sites[k].first].code, removed);
+        }
+
+        for (auto &instruction : callee.code)
+        {
+            if (instruction.opcode == LARG && constants.count(instruction.names[0]))
+            {
+                auto position = instruction.position;
+                instruction = constants[instruction.names[0]];
+                instruction.position = position;
+            }
+        }
+
+        callee.code.erase(
+            std::remove_if(callee.code.begin(), callee.code.end(),
+                [&](const ILinstruction &instruction) {
+                    return instruction.opcode == FPRM &&
+                           instruction.names[0] == name &&
+                           constants.count(instruction.names[1]);
+                }),
+            callee.code.end());
+
+        params.erase(
+            std::remove_if(params.begin(), params.end(),
+                [&](const std::pair<std::string, uint8_t> &param) {
+                    return constants.count(param.first) != 0;
+                }),
+            params.end());
+
+        fold(callee);
+    }
+}
+
+// A copy of the function at index with constants in place of params, or an
+// empty name if the copy would be no smaller than the function
+std::string LinkOptimizer::specialization(
+    size_t index, const std::vector<size_t> &params,
+    const std::vector<ILinstruction> &constants)
+{
+    auto original = functions[index].name;
+    auto &signature = signatures[original];
+    auto &count = clone_counts[original];
+
+    if (count >= specialization_count ||
+        size(functions[index]) > specialization_size)
+    {
+        return "";
+    }
+
+    Function clone;
+    ILsignature cloned;
+
+    do
+    {
+        clone.name = original + "~" + std::to_string(++count);
+    } while (signatures.count(clone.name) || externs.count(clone.name));
+
+    auto declare = [&](uint8_t opcode, std::vector<std::string> names,
+                       uint8_t type) {
+        ILinstruction record;
+        record.opcode = opcode;
+        record.names = std::move(names);
+        record.data.push_back(type);
+        record.position = functions[index].code[body(functions[index]) - 1].position;
+        clone.code.push_back(std::move(record));
+    };
+
+    std::map<std::string, const ILinstruction *> replaced;
+
+    for (size_t j = 0; j < params.size(); j++)
+    {
+        replaced[signature.params[params[j]].first] = &constants[j];
+    }
+
+    for (auto &param : signature.params)
+    {
+        if (!replaced.count(param.first))
+        {
+            declare(FPRM, {clone.name, param.first}, param.second);
+            cloned.params.push_back(param);
+        }
+    }
+
+    declare(INFN, {clone.name}, signature.type);
+    clone.code.push_back(clone.code.back());
+    clone.code.back().opcode = FUNC;
+    clone.code.back().data.clear();
+
+    for (auto &local : signature.locals)
+    {
+        declare(FLOC, {clone.name, local.first}, local.second);
+    }
+
+    cloned.type = signature.type;
+    cloned.locals = signature.locals;
+
+    auto &code = functions[index].code;
+
+    for (auto i = body(functions[index]); i < code.size(); i++)
+    {
+        auto instruction = code[i];
+
+        if (is_meta(instruction.opcode))
+        {
+            continue;
+        }
+
+        // Labels are global
+        if (is_label(instruction.opcode))
+        {
+            instruction.names[0] += "~" + clone.name;
+        }
+
+        if (instruction.opcode == LARG && replaced.count(instruction.names[0]))
+        {
+            auto position = instruction.position;
+            instruction = *replaced[instruction.names[0]];
+            instruction.position = position;
+        }
+
+        clone.code.push_back(std::move(instruction));
+    }
+
+    fold(clone);
+
+    if (size(clone) >= size(functions[index]))
+    {
+        count--;
+        return "";
+    }
+
+    signatures[clone.name] = cloned;
+    functions.push_back(std::move(clone));
+    return functions.back().name;
+}
+
+// Redirects calls with constant arguments to copies of the function they call
+// with the constants in place of the parameters
+void LinkOptimizer::specialize()
+{
+    // The specialization for each function and its constant arguments, empty
+    // if it was not worth it
+    std::map<std::string, std::string> made;
+
+    // Specializations are added to the end, and specialized themselves
+    for (size_t g = 0; g < functions.size(); g++)
+    {
+        for (size_t i = body(functions[g]); i < functions[g].code.size(); i++)
+        {
+            auto &code = functions[g].code;
+
+            if (code[i].opcode != CALL)
+            {
+                continue;
+            }
+
+            auto name = code[i].names[0];
+            auto callee = find(name);
+
+            if (!optimizable(name) || name == functions[g].name)
+            {
+                continue;
+            }
+
+            auto &signature = signatures[name];
+            auto fixed = fixed_params(functions[callee]);
+            auto pushes = constant_args(code, i, signature);
+            std::vector<size_t> params;
+            std::vector<size_t> removed;
+            std::vector<ILinstruction> constants;
+            auto key = name;
+
+            for (size_t j = 0; j < pushes.size(); j++)
+            {
+                if (pushes[j] == none || fixed.count(signature.params[j].first))
+                {
+                    continue;
+                }
+
+                auto &push = code[pushes[j]];
+                params.push_back(j);
+                removed.push_back(pushes[j]);
+                constants.push_back(push);
+                key += "|" + std::to_string(j) + ":" + std::to_string(push.opcode);
+                key.append(push.data.begin(), push.data.end());
+            }
+
+            if (params.empty())
+            {
+                continue;
+            }
+
+            auto found = made.find(key);
+
+            if (found == made.end())
+            {
+                found = made.emplace(
+                    key, specialization((size_t)callee, params, constants)).first;
+            }
+
+            if (found->second.empty())
+            {
+                continue;
+            }
+
+            functions[g].code[i].names[0] = found->second;
+            erase(functions[g].code, removed);
+            i -= removed.size();
+        }
+    }
+}
+
+// Replaces the call at index by the code of callee, returns the index of the
+// last instruction put in its place
+size_t LinkOptimizer::inline_call(Function &caller, size_t call,
+                                  const Function &callee)
+{
+    auto &signature = signatures[callee.name];
+    auto &locals = signatures[caller.name].locals;
+    auto fixed = fixed_params(callee);
+    auto position = caller.code[call].position;
+    auto prefix = "~inline" + std::to_string(inline_counter++) + "~";
+
+    // Constant arguments are put in place of their parameters, unless they
+    // are stored to
+    auto pushes = constant_args(caller.code, call, signature);
+    std::map<std::string, ILinstruction> arguments;
+    std::vector<size_t> removed;
+
+    for (size_t j = 0; j < pushes.size(); j++)
+    {
+        if (pushes[j] != none && !fixed.count(signature.params[j].first))
+        {
+            arguments[signature.params[j].first] = caller.code[pushes[j]];
+            removed.push_back(pushes[j]);
+        }
+    }
+
+    std::vector<ILinstruction> code;
+
+    auto declare = [&](const std::pair<std::string, uint8_t> &local) {
+        ILinstruction record;
+        record.opcode = FLOC;
+        record.names = {caller.name, prefix + local.first};
+        record.data.push_back(local.second);
+        record.position = position;
+        code.push_back(std::move(record));
+        locals.emplace_back(prefix + local.first, local.second);
+    };
+
+    for (auto &param : signature.params)
+    {
+        if (!arguments.count(param.first))
+        {
+            declare(param);
+        }
+    }
+
+    for (auto &local : signature.locals)
+    {
+        declare(local);
+    }
+
+    // The other arguments are stored to locals, the first is on top
+    for (auto &param : signature.params)
+    {
+        if (arguments.count(param.first))
+        {
+            continue;
+        }
+
+        ILinstruction store;
+        store.opcode = SLOC;
+        store.names.push_back(prefix + param.first);
+        store.position = position;
+        code.push_back(std::move(store));
+    }
+
+    for (auto i = body(callee); callee.code[i].opcode != RETN; i++)
+    {
+        auto instruction = callee.code[i];
+        instruction.position = position;
+
+        switch (instruction.opcode)
+        {
+        case LARG:
+            if (arguments.count(instruction.names[0]))
+            {
+                instruction = arguments[instruction.names[0]];
+                instruction.position = position;
+                break;
+            }
+
+            instruction.opcode = LLOC;
+            instruction.names[0] = prefix + instruction.names[0];
+            break;
+
+        case SARG:
+            instruction.opcode = SLOC;
+            instruction.names[0] = prefix + instruction.names[0];
+            break;
+
+        case ADRA:
+            instruction.opcode = ADRL;
+            instruction.names[0] = prefix + instruction.names[0];
+            break;
+
+        case LLOC: case SLOC: case ADRL:
+            instruction.names[0] = prefix + instruction.names[0];
+            break;
+
+        default:
+            if (is_meta(instruction.opcode))
+            {
+                continue;
+            }
+        }
+
+        code.push_back(std::move(instruction));
+    }
+
+    removed.push_back(call);
+    erase(caller.code, removed);
+
+    auto at = call + 1 - removed.size();
+    caller.code.insert(caller.code.begin() + at, code.begin(), code.end());
+
+    return at + code.size() - 1;
+}
+
+void LinkOptimizer::inline_calls()
+{
+    std::set<std::string> inlined;
+
+    for (auto &fn : functions)
+    {
+        if (inlinable(fn))
+        {
+            inlined.insert(fn.name);
+        }
+    }
+
+    for (auto &caller : functions)
+    {
+        for (auto i = body(caller); i < caller.code.size(); i++)
+        {
+            auto &call = caller.code[i];
+
+            if (call.opcode == CALL && inlined.count(call.names[0]) &&
+                call.names[0] != caller.name)
+            {
+                i = inline_call(caller, i, functions[find(call.names[0])]);
+            }
+        }
+    }
+}
+
+void LinkOptimizer::remove_dead_functions()
+{
+    if (find("main") < 0)
+    {
+        return;
+    }
+
+    std::set<std::string> live = {"main"};
+    std::vector<std::string> work = {"main"};
+
+    auto refer = [&](const std::vector<ILinstruction> &code) {
+        for (auto &instruction : code)
+        {
+            if ((instruction.opcode == CALL || instruction.opcode == PFUN) &&
+                live.insert(instruction.names[0]).second)
+            {
+                work.push_back(instruction.names[0]);
+            }
+        }
+    };
+
+    refer(prefix);
+
+    while (!work.empty())
+    {
+        auto index = find(work.back());
+        work.pop_back();
+
+        if (index >= 0)
+        {
+            refer(functions[index].code);
+        }
+    }
+
+    std::set<std::string> dead;
+
+    for (auto &fn : functions)
+    {
+        if (live.count(fn.name))
+        {
+            continue;
+        }
+
+        dead.insert(fn.name);
+
+        // The external functions and globals declared in it are still used
+        for (auto &instruction : fn.code)
+        {
+            if (instruction.opcode == EXFN || instruction.opcode == GLOB)
+            {
+                prefix.push_back(instruction);
+            }
+        }
+    }
+
+    functions.erase(
+        std::remove_if(functions.begin(), functions.end(),
+            [&](const Function &fn) { return dead.count(fn.name) != 0; }),
+        functions.end());
+
+    // Declarations of removed functions elsewhere
+    auto declares_dead = [&](const ILinstruction &instruction) {
+        auto opcode = instruction.opcode;
+
+        return (opcode == INFN || opcode == FPRM || opcode == FLOC) &&
+               dead.count(instruction.names[0]);
+    };
+
+    prefix.erase(std::remove_if(prefix.begin(), prefix.end(), declares_dead),
+                 prefix.end());
+
+    for (auto &fn : functions)
+    {
+        fn.code.erase(
+            std::remove_if(fn.code.begin(), fn.code.end(), declares_dead),
+            fn.code.end());
+    }
+}
+
+void LinkOptimizer::optimize()
+{
+    std::vector<ILinstruction> code;
+
+    if (!decode_il(il, code))
+    {
+        return;
+    }
+
+    signatures = find_signatures(code);
+
+    for (auto &instruction : code)
+    {
+        if (instruction.opcode == EXFN)
+        {
+            auto &data = instruction.data;
+            size_t count = (size_t)data[1] << 24 | (size_t)data[2] << 16 |
+                           (size_t)data[3] << 8 | data[4];
+
+            externs[instruction.names[0]] = {data[0], count};
+        }
+        else if (instruction.opcode == PFUN)
+        {
+            addressed.insert(instruction.names[0]);
+        }
+    }
+
+    split(code);
+
+    for (auto &fn : functions)
+    {
+        for (auto i = body(fn); i--;)
+        {
+            if (fn.code[i].opcode == DATA && fn.code[i].names[0] == "il")
+            {
+                raw.insert(fn.name);
+            }
+        }
+
+        fold(fn);
+    }
+
+    propagate_constants();
+    specialize();
+    inline_calls();
+
+    for (auto &fn : functions)
+    {
+        fold(fn);
+    }
+
+    remove_dead_functions();
+
+    code = std::move(prefix);
+
+    for (auto &fn : functions)
+    {
+        code.insert(code.end(), std::make_move_iterator(fn.code.begin()),
+                    std::make_move_iterator(fn.code.end()));
+    }
+
+    encode_il(code, il);
+}
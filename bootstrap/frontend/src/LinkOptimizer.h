@@ -0,0 +1,79 @@
+#ifndef FRONTEND_LINKOPTIMIZER_H
+#define FRONTEND_LINKOPTIMIZER_H
+
+#include <cstdint>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "ILcode.h"
+
+/**
+ * Optimizes the IL of the whole program with --lto, once the code of every
+ * module is generated, so calls into other modules are optimized like any
+ * other. Arguments that are the same constant in every call of a function are
+ * moved into it, calls with other constant arguments are redirected to copies
+ * of the function specialized for them where that makes the copy smaller,
+ * small functions without branches are inlined and functions no longer
+ * reachable from main are removed. Constants are folded and unreachable code
+ * dropped along the way.
+ */
+class LinkOptimizer
+{
+public:
+  explicit LinkOptimizer(ILemitter &il) : il(il) {}
+
+  /** Optimizes the IL in place */
+  void optimize();
+
+private:
+  // A function with the attributes and declarations before its FUNC
+  struct Function
+  {
+    std::string name;
+    std::vector<ILinstruction> code;
+  };
+
+  ILemitter &il;
+
+  // The code before the first function
+  std::vector<ILinstruction> prefix;
+  std::vector<Function> functions;
+  std::map<std::string, ILsignature> signatures;
+
+  // The return type and parameter count of every external function
+  std::map<std::string, std::pair<uint8_t, size_t>> externs;
+
+  // Functions whose address is taken, so not all their calls are known
+  std::set<std::string> addressed;
+
+  // @il functions, their code works on the stack of the caller
+  std::set<std::string> raw;
+
+  std::map<std::string, size_t> clone_counts;
+  size_t inline_counter = 0;
+
+  void split(std::vector<ILinstruction> &code);
+  int find(const std::string &name) const;
+  size_t body(const Function &fn) const;
+  size_t size(const Function &fn) const;
+  bool optimizable(const std::string &name) const;
+  std::set<std::string> fixed_params(const Function &fn) const;
+  std::vector<size_t> constant_args(const std::vector<ILinstruction> &code,
+                                    size_t call,
+                                    const ILsignature &signature) const;
+  bool stack_effect(const ILinstruction &instruction,
+                    int &pops, int &pushes) const;
+  bool inlinable(const Function &fn) const;
+
+  void fold(Function &fn);
+  void propagate_constants();
+  std::string specialization(size_t index, const std::vector<size_t> &params,
+                             const std::vector<ILinstruction> &constants);
+  void specialize();
+  size_t inline_call(Function &caller, size_t call, const Function &callee);
+  void inline_calls();
+  void remove_dead_functions();
+};
+
+#endif // FRONTEND_LINKOPTIMIZER_H
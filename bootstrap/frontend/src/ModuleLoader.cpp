@@ -0,0 +1,386 @@
+#include "ModuleLoader.h"
+
+#include <fstream>
+#include <set>
+#include "Parser.h"
+
+static std::string directory_of(const std::string &path) {
+    size_t slash = path.find_last_of("/\\");
+
+    if(slash == std::string::npos) {
+        return "";
+    }
+
+    return path.substr(0, slash + 1);
+}
+
+static std::string module_to_path(const std::string &name) {
+    std::string path = name;
+
+    for(auto &c : path) {
+        if(c == '.') {
+            c = '/';
+        }
+    }
+
+    return path + ".ds";
+}
+
+static bool file_exists(const std::string &path) {
+    std::ifstream stream(path);
+    return stream.good();
+}
+
+static std::string load_text_from_file(const std::string &path) {
+    std::ifstream stream(path);
+    std::string str(
+        (std::istreambuf_iterator<char>(stream)),
+        std::istreambuf_iterator<char>());
+    return str;
+}
+
+ModuleLoader::~ModuleLoader() {
+    for(auto module : modules) {
+        delete module->ast.root;
+        delete module;
+    }
+}
+
+Module *ModuleLoader::load_file(const std::string &path) {
+    auto it = cache.find(path);
+
+    if(it != cache.end()) {
+        it->second->is_root = true;
+        return it->second;
+    }
+
+    return load(path, path, true);
+}
+
+Module *ModuleLoader::import(const std::string &name, const Module *importer) {
+    std::string relative = module_to_path(name);
+
+    std::vector<std::string> candidates;
+    candidates.push_back(directory_of(importer->path) + relative);
+
+    for(auto &dir : search_path) {
+        if(!dir.empty() && dir.back() != '/' && dir.back() != '\\') {
+            candidates.push_back(dir + "/" + relative);
+        } else {
+            candidates.push_back(dir + relative);
+        }
+    }
+
+    for(auto &path : candidates) {
+        auto it = cache.find(path);
+
+        if(it != cache.end()) {
+            return it->second;
+        }
+
+        if(file_exists(path)) {
+            return load(name, path, false);
+        }
+    }
+
+    return nullptr;
+}
+
+Module *ModuleLoader::load(
+    const std::string &name, const std::string &path, bool is_root) {
+    Module *module = new Module();
+    module->name    = name;
+    module->path    = path;
+    module->is_root = is_root;
+    module->source  = load_text_from_file(path);
+
+    // Cached before parsing so that import cycles terminate
+    cache[path] = module;
+
+    parse(module);
+
+    modules.push_back(module);
+
+    return module;
+}
+
+Module *ModuleLoader::load_source(const std::string &path,
+                                  const std::string &source) {
+    Module *module = new Module();
+    module->name    = path;
+    module->path    = path;
+    module->is_root = true;
+    module->source  = source;
+
+    parse(module);
+
+    return module;
+}
+
+void ModuleLoader::parse(Module *module) {
+    module->tokens.lex(module->source);
+
+    if(module->tokens.errors.empty()) {
+        Parser parser;
+        parser.on_import = [this, module](const AstImport *node) {
+            return import(node->name, module) != nullptr;
+        };
+
+        module->ast    = parser.parse(module->tokens.tokens);
+        module->errors = parser.errors;
+    } else {
+        module->ast.root = new AstBlock();
+    }
+
+    module->ast.path = module->path;
+}
+
+void ModuleLoader::edit(Module *module, unsigned int offset,
+                        unsigned int removed, const std::string &text) {
+    // A tree with errors misses the statements from the first error on
+    bool complete = module->tokens.errors.empty() && module->errors.empty();
+
+    module->source.replace(offset, removed, text);
+    module->tokens = TokenStream();
+
+    if(!complete) {
+        delete module->ast.root;
+        parse(module);
+        return;
+    }
+
+    module->tokens.lex(module->source);
+
+    if(module->tokens.errors.empty()) {
+        Parser parser;
+        parser.on_import = [this, module](const AstImport *node) {
+            return import(node->name, module) != nullptr;
+        };
+
+        parser.reparse(module->ast, module->tokens.tokens,
+                       {offset, removed, (unsigned int)text.size()});
+        module->errors = parser.errors;
+    } else {
+        delete module->ast.root;
+        module->ast.root = new AstBlock();
+        module->errors.clear();
+    }
+}
+
+static void collect_references(AstNode *node, std::set<std::string> &refs) {
+    switch(node->node_type) {
+    case AstNodeType::AstString:
+        refs.insert("str");
+        break;
+
+    case AstNodeType::AstBoolean:
+        refs.insert("bool");
+        break;
+
+    case AstNodeType::AstNumber: {
+        auto number = (AstNumber *)node;
+
+        if(number->is_float) {
+            refs.insert("f" + std::to_string(number->bits));
+        } else if(number->is_signed) {
+            refs.insert("i" + std::to_string(number->bits));
+        } else {
+            refs.insert("u" + std::to_string(number->bits));
+        }
+
+        break;
+    }
+
+    case AstNodeType::AstArray:
+        refs.insert("malloc");
+        break;
+
+    case AstNodeType::AstSymbol:
+        refs.insert(((AstSymbol *)node)->name);
+        break;
+
+    case AstNodeType::AstFnCall:
+        refs.insert(((AstFnCall *)node)->name);
+        // Might be a struct construction
+        refs.insert("malloc");
+        break;
+
+    case AstNodeType::AstType:
+        refs.insert(((AstType *)node)->name);
+        break;
+
+    case AstNodeType::AstImpl:
+        refs.insert(((AstImpl *)node)->name);
+        break;
+
+    case AstNodeType::AstUnaryExpr:
+        refs.insert(((AstUnaryExpr *)node)->op);
+        break;
+
+    case AstNodeType::AstBinaryExpr:
+        refs.insert(((AstBinaryExpr *)node)->op);
+        break;
+
+    default:
+        break;
+    }
+
+    for(auto child : ast_children(node)) {
+        collect_references(child, refs);
+    }
+}
+
+static std::vector<std::string> declared_names(AstNode *node) {
+    switch(node->node_type) {
+    case AstNodeType::AstFn:
+        return {((AstFn *)node)->unmangled_name};
+
+    case AstNodeType::AstAffix:
+        return {((AstAffix *)node)->unmangled_name};
+
+    case AstNodeType::AstStruct:
+        return {((AstStruct *)node)->name};
+
+    case AstNodeType::AstImpl:
+        return {((AstImpl *)node)->name};
+
+    case AstNodeType::AstDec:
+        return {((AstDec *)node)->name};
+
+    default:
+        return {};
+    }
+}
+
+struct PruneUnit {
+    AstNode *node;
+    std::vector<AstNode *> attributes;
+    std::vector<std::string> names;
+    bool live = false;
+};
+
+void ModuleLoader::prune_unreferenced() {
+    std::set<std::string> refs;
+    std::vector<PruneUnit> units;
+
+    for(auto module : modules) {
+        if(module->is_root) {
+            collect_references(module->ast.root, refs);
+            continue;
+        }
+
+        std::vector<AstNode *> attributes;
+
+        for(auto stmt : module->ast.root->statements) {
+            if(stmt->node_type == AstNodeType::AstAttribute) {
+                attributes.push_back(stmt);
+                continue;
+            }
+
+            if(stmt->node_type == AstNodeType::AstExtern) {
+                for(auto decl : ((AstExtern *)stmt)->decls) {
+                    units.push_back({decl, {}, declared_names(decl)});
+                }
+            } else if(declared_names(stmt).empty()) {
+                // Not a declaration, it might have side effects
+                for(auto attribute : attributes) {
+                    collect_references(attribute, refs);
+                }
+
+                collect_references(stmt, refs);
+            } else {
+                units.push_back({stmt, attributes, declared_names(stmt)});
+            }
+
+            attributes.clear();
+        }
+    }
+
+    bool changed = true;
+
+    while(changed) {
+        changed = false;
+
+        for(auto &unit : units) {
+            if(unit.live) {
+                continue;
+            }
+
+            for(auto &name : unit.names) {
+                if(refs.count(name)) {
+                    unit.live = true;
+                    break;
+                }
+            }
+
+            if(unit.live) {
+                changed = true;
+
+                for(auto attribute : unit.attributes) {
+                    collect_references(attribute, refs);
+                }
+
+                collect_references(unit.node, refs);
+            }
+        }
+    }
+
+    std::set<AstNode *> dead;
+
+    for(auto &unit : units) {
+        if(!unit.live) {
+            dead.insert(unit.node);
+        }
+    }
+
+    for(auto module : modules) {
+        if(module->is_root) {
+            continue;
+        }
+
+        std::vector<AstNode *> kept;
+        std::vector<AstNode *> attributes;
+
+        for(auto stmt : module->ast.root->statements) {
+            if(stmt->node_type == AstNodeType::AstAttribute) {
+                attributes.push_back(stmt);
+                continue;
+            }
+
+            if(stmt->node_type == AstNodeType::AstExtern) {
+                auto ext = (AstExtern *)stmt;
+                std::vector<AstFn *> decls;
+
+                for(auto decl : ext->decls) {
+                    if(dead.count(decl)) {
+                        delete decl;
+                    } else {
+                        decls.push_back(decl);
+                    }
+                }
+
+                ext->decls = decls;
+
+                if(decls.empty()) {
+                    dead.insert(ext);
+                }
+            }
+
+            if(dead.count(stmt)) {
+                for(auto attribute : attributes) {
+                    delete attribute;
+                }
+
+                delete stmt;
+            } else {
+                kept.insert(kept.end(), attributes.begin(), attributes.end());
+                kept.push_back(stmt);
+            }
+
+            attributes.clear();
+        }
+
+        kept.insert(kept.end(), attributes.begin(), attributes.end());
+        module->ast.root->statements = kept;
+    }
+}
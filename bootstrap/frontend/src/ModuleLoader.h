@@ -0,0 +1,112 @@
+#ifndef SRC_MODULELOADER_H
+#define SRC_MODULELOADER_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include "Ast.h"
+#include "Error.h"
+#include "TokenStream.h"
+
+struct Module {
+    /** The dotted module name, or the file path for modules given as input */
+    std::string name;
+
+    /** The path the module was loaded from */
+    std::string path;
+
+    /** The contents of the file, kept around for error reporting */
+    std::string source;
+
+    TokenStream tokens;
+
+    Ast ast;
+
+    /** Errors that occurred while parsing the module */
+    std::vector<Error> errors;
+
+    /**
+     * Whether the module was given as input. Everything in an input module is
+     * analysed and emitted, imported modules are pruned down to the
+     * declarations that are actually referenced.
+     */
+    bool is_root = false;
+};
+
+class ModuleLoader {
+public:
+    /** Directories searched for imported modules, after the importer's own */
+    std::vector<std::string> search_path;
+
+    /**
+     * Every module loaded so far. Imported modules come before the module
+     * importing them.
+     */
+    std::vector<Module *> modules;
+
+    ~ModuleLoader();
+
+    /**
+     * Loads, lexes and parses a file given as input.
+     *
+     * @param path The path of the file
+     *
+     * @return The module
+     */
+    Module *load_file(const std::string &path);
+
+    /**
+     * Resolves an import against the importing module's directory and then
+     * the search path. A module is only loaded, lexed and parsed the first
+     * time it is imported.
+     *
+     * @param name     The dotted module name, e.g. "util.fileutil"
+     * @param importer The module containing the import statement
+     *
+     * @return The module, or nullptr if it could not be found
+     */
+    Module *import(const std::string &name, const Module *importer);
+
+    /**
+     * Lexes and parses source that was not read from a file, like the input
+     * of the REPL. Its imports are resolved like those of a file at path. The
+     * module is not one of modules, it belongs to the caller.
+     *
+     * @param path   The path the source is reported under
+     * @param source The source
+     *
+     * @return The module
+     */
+    Module *load_source(const std::string &path, const std::string &source);
+
+    /**
+     * Changes the source of a loaded module, as an editor does, and parses
+     * again only the part of it the change is in. Nodes outside that part
+     * keep their ids. A module that did not parse is parsed anew.
+     *
+     * @param module  The module
+     * @param offset  Where the changed text starts in the source
+     * @param removed The length of the changed text
+     * @param text    The text replacing it
+     */
+    void edit(Module *module, unsigned int offset, unsigned int removed,
+              const std::string &text);
+
+    /**
+     * Removes every top level declaration of the imported modules that is not
+     * reachable from the input modules, so it is neither analysed nor
+     * emitted. Must be called before semantic analysis.
+     */
+    void prune_unreferenced();
+
+private:
+    /** Loaded modules by path */
+    std::map<std::string, Module *> cache;
+
+    Module *load(const std::string &name, const std::string &path,
+                 bool is_root);
+
+    void parse(Module *module);
+};
+
+#endif // SRC_MODULELOADER_H
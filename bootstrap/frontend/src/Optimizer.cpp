@@ -0,0 +1,1805 @@
+#include "Optimizer.h"
+
+#include <cstdint>
+#include "Ast.h"
+
+// Bounds on evaluating a call at compile time, past which it is left to run
+#define MAX_EVAL_STEPS 100000
+#define MAX_EVAL_DEPTH 64
+
+// An expression of constants, variables and pure calls, in a form where equal
+// expressions have equal text
+struct CallKey
+{
+    std::string text;
+    std::set<std::string> vars;
+    bool memory = false; // It reads memory, which stores may change
+};
+
+// A value computed at compile time. Integers are kept exact, and only ever
+// within the range of their type.
+struct PureValue
+{
+    std::string type;
+    int64_t i = 0;
+    double f = 0;
+};
+
+typedef std::map<std::string, PureValue> Frame;
+
+enum class Flow
+{
+    Next,
+    Break,
+    Continue,
+    Return,
+    Fail,
+};
+
+static bool in_range(const PureValue &value)
+{
+    static const std::map<std::string, std::pair<int64_t, int64_t>> ranges = {
+        {"bool", {0, 1}},
+        {"u8", {0, UINT8_MAX}},
+        {"u16", {0, UINT16_MAX}},
+        {"u32", {0, UINT32_MAX}},
+        {"i8", {INT8_MIN, INT8_MAX}},
+        {"i16", {INT16_MIN, INT16_MAX}},
+        {"i32", {INT32_MIN, INT32_MAX}},
+    };
+
+    if (value.type == "f32" || value.type == "f64")
+    {
+        return true;
+    }
+
+    auto range = ranges.find(value.type);
+
+    return range != ranges.end() && value.i >= range->second.first &&
+           value.i <= range->second.second;
+}
+
+// Gives a value the type it is stored as. Integers and floats are never
+// converted into each other, and integers that do not fit are not wrapped, as
+// the backends keep narrow integers in wider registers.
+static bool convert(PureValue &value, const AstType *type)
+{
+    if (!type || type->is_array ||
+        (type->name[0] == 'f') != (value.type[0] == 'f'))
+    {
+        return false;
+    }
+
+    value.type = type->name;
+
+    if (value.type == "f32")
+    {
+        value.f = (float)value.f;
+    }
+
+    return in_range(value);
+}
+
+// The intrinsic an operator inlines, if that is all it does
+static std::string operator_intrinsic(const AstAffix *affix,
+                                      const Semantics &sem)
+{
+    if (!affix || !affix->body || !find_attribute(affix, "inline") ||
+        affix->body->statements.size() != 1 ||
+        affix->body->statements[0]->node_type != AstNodeType::AstFnCall)
+    {
+        return "";
+    }
+
+    return sem.callee((AstFnCall *)affix->body->statements[0]);
+}
+
+// Applies an intrinsic the way the NASM backend does
+static bool apply_intrinsic(const std::string &intrinsic, const PureValue &a,
+                            const PureValue &b, PureValue &result)
+{
+    bool is_float = a.type[0] == 'f';
+
+    if (intrinsic == "cmpe" || intrinsic == "cpne" || intrinsic == "cmpl" ||
+        intrinsic == "cmpg")
+    {
+        // Floats are compared as raw words
+        if (is_float)
+        {
+            return false;
+        }
+
+        bool value = intrinsic == "cmpe"   ? a.i == b.i
+                     : intrinsic == "cpne" ? a.i != b.i
+                     : intrinsic == "cmpl" ? a.i > b.i
+                                           : a.i < b.i;
+        result.i = value;
+        return true;
+    }
+
+    if (is_float)
+    {
+        if (intrinsic == "f_add")
+        {
+            result.f = a.f + b.f;
+        }
+        else if (intrinsic == "f_sub")
+        {
+            result.f = a.f - b.f;
+        }
+        else if (intrinsic == "f_mul")
+        {
+            result.f = a.f * b.f;
+        }
+        else if (intrinsic == "f_div")
+        {
+            result.f = a.f / b.f;
+        }
+        else
+        {
+            return false;
+        }
+
+        return true;
+    }
+
+    if (intrinsic == "i_add")
+    {
+        result.i = a.i + b.i;
+    }
+    else if (intrinsic == "i_sub")
+    {
+        result.i = a.i - b.i;
+    }
+    else if (intrinsic == "i_mul")
+    {
+        // Kept small enough not to overflow
+        if (a.i > INT32_MAX || b.i > INT32_MAX)
+        {
+            return false;
+        }
+
+        result.i = a.i * b.i;
+    }
+    else if (intrinsic == "i_div")
+    {
+        // Division is signed, and faults on these
+        if (b.i == 0 || (a.i == INT32_MIN && b.i == -1) || a.i > INT32_MAX ||
+            b.i > INT32_MAX)
+        {
+            return false;
+        }
+
+        result.i = a.i / b.i;
+    }
+    else
+    {
+        return false;
+    }
+
+    return true;
+}
+
+// Runs @pure functions on constant arguments
+struct Evaluator
+{
+    Semantics &sem;
+    int steps = 0;
+    int depth = 0;
+
+    explicit Evaluator(Semantics &sem) : sem(sem) {}
+
+    bool call(AstFn *fn, std::vector<PureValue> args, PureValue &result);
+    bool eval(AstNode *node, Frame &frame, PureValue &value);
+    Flow exec(AstNode *node, Frame &frame, PureValue &result);
+};
+
+bool Evaluator::call(AstFn *fn, std::vector<PureValue> args,
+                     PureValue &result)
+{
+    auto &params = sem.params(fn);
+
+    if (!fn->body || find_attribute(fn, "il") ||
+        params.size() != args.size() || depth >= MAX_EVAL_DEPTH)
+    {
+        return false;
+    }
+
+    Frame frame;
+
+    for (size_t i = 0; i < args.size(); i++)
+    {
+        if (!convert(args[i], params[i]->type))
+        {
+            return false;
+        }
+
+        frame[params[i]->name] = args[i];
+    }
+
+    depth++;
+    auto flow = exec(fn->body, frame, result);
+    depth--;
+
+    return flow == Flow::Return && convert(result, fn->return_type);
+}
+
+bool Evaluator::eval(AstNode *node, Frame &frame, PureValue &value)
+{
+    if (!node || ++steps > MAX_EVAL_STEPS)
+    {
+        return false;
+    }
+
+    switch (node->node_type)
+    {
+    case AstNodeType::AstNumber:
+    {
+        auto number = (AstNumber *)node;
+
+        if (number->is_float)
+        {
+            value.type = "f" + std::to_string(number->bits);
+            value.f = number->value.f;
+            return convert(value, sem.infer_type(number));
+        }
+
+        value.type = (number->is_signed ? "i" : "u") +
+                     std::to_string(number->bits);
+        value.i = number->is_signed ? number->value.i
+                                    : (int64_t)number->value.u;
+        return number->bits <= 32 && in_range(value);
+    }
+
+    case AstNodeType::AstBoolean:
+        value.type = "bool";
+        value.i = ((AstBoolean *)node)->value;
+        return true;
+
+    case AstNodeType::AstSymbol:
+    {
+        auto found = frame.find(((AstSymbol *)node)->name);
+
+        if (found == frame.end())
+        {
+            return false;
+        }
+
+        value = found->second;
+        return true;
+    }
+
+    case AstNodeType::AstBinaryExpr:
+    {
+        auto bin_expr = (AstBinaryExpr *)node;
+        auto affix = sem.p2_get_affix(sem.op(bin_expr));
+        auto intrinsic = operator_intrinsic(affix, sem);
+        PureValue lhs, rhs;
+
+        if (intrinsic.empty() || affix->params.size() != 2 ||
+            !eval(bin_expr->lhs, frame, lhs) ||
+            !eval(bin_expr->rhs, frame, rhs) ||
+            !convert(lhs, affix->params[0]->type) ||
+            !convert(rhs, affix->params[1]->type) ||
+            !apply_intrinsic(intrinsic, lhs, rhs, value))
+        {
+            return false;
+        }
+
+        value.type = lhs.type;
+        return convert(value, affix->return_type);
+    }
+
+    case AstNodeType::AstFnCall:
+    {
+        auto fn = sem.p2_get_fn(sem.callee((AstFnCall *)node));
+        std::vector<PureValue> args;
+
+        if (!sem.is_pure(fn))
+        {
+            return false;
+        }
+
+        for (auto arg : ((AstFnCall *)node)->args)
+        {
+            PureValue arg_value;
+
+            if (!eval(arg, frame, arg_value))
+            {
+                return false;
+            }
+
+            args.push_back(arg_value);
+        }
+
+        return call(fn, args, value);
+    }
+
+    default:
+        return false;
+    }
+}
+
+Flow Evaluator::exec(AstNode *node, Frame &frame, PureValue &result)
+{
+    if (++steps > MAX_EVAL_STEPS)
+    {
+        return Flow::Fail;
+    }
+
+    switch (node->node_type)
+    {
+    case AstNodeType::AstBlock:
+        for (auto stmt : ((AstBlock *)node)->statements)
+        {
+            auto flow = exec(stmt, frame, result);
+
+            if (flow != Flow::Next)
+            {
+                return flow;
+            }
+        }
+        return Flow::Next;
+
+    case AstNodeType::AstAttribute:
+        return Flow::Next;
+
+    case AstNodeType::AstBreak:
+        return Flow::Break;
+
+    case AstNodeType::AstContinue:
+        return Flow::Continue;
+
+    case AstNodeType::AstReturn:
+        return eval(((AstReturn *)node)->expr, frame, result) ? Flow::Return
+                                                              : Flow::Fail;
+
+    case AstNodeType::AstDec:
+    {
+        auto decl = (AstDec *)node;
+        PureValue value;
+
+        if (!eval(decl->value, frame, value) ||
+            !convert(value, sem.type_of(decl)))
+        {
+            return Flow::Fail;
+        }
+
+        frame[decl->name] = value;
+        return Flow::Next;
+    }
+
+    case AstNodeType::AstIf:
+    {
+        auto if_stmt = (AstIf *)node;
+        PureValue condition;
+
+        if (!eval(if_stmt->condition, frame, condition) ||
+            condition.type[0] == 'f')
+        {
+            return Flow::Fail;
+        }
+
+        if (condition.i)
+        {
+            return exec(if_stmt->true_block, frame, result);
+        }
+
+        return if_stmt->false_block
+                   ? exec(if_stmt->false_block, frame, result)
+                   : Flow::Next;
+    }
+
+    case AstNodeType::AstLoop:
+    {
+        auto loop = (AstLoop *)node;
+        auto decl = sem.counter(loop);
+        PureValue limit;
+
+        // The kind of loop depends on the type of its expression
+        if (!eval(loop->expr, frame, limit) || limit.type[0] == 'f' ||
+            (loop->is_foreach && !decl))
+        {
+            return Flow::Fail;
+        }
+
+        PureValue counter;
+        counter.type = "i32";
+        counter.i = loop->is_foreach ? 0 : 1;
+
+        if (loop->is_foreach &&
+            (!convert(counter, sem.type_of(decl)) ||
+             sem.type_of(decl)->name == "bool"))
+        {
+            return Flow::Fail;
+        }
+
+        for (;;)
+        {
+            // `loop(i in n)` and `loop(condition)` test before each run
+            if (loop->is_foreach || limit.type == "bool")
+            {
+                if (!eval(loop->expr, frame, limit))
+                {
+                    return Flow::Fail;
+                }
+
+                if (loop->is_foreach)
+                {
+                    frame[loop->name] = counter;
+                }
+
+                if (loop->is_foreach ? counter.i >= limit.i : !limit.i)
+                {
+                    return Flow::Next;
+                }
+            }
+
+            auto flow = exec(loop->body, frame, result);
+
+            if (flow == Flow::Break)
+            {
+                return Flow::Next;
+            }
+            else if (flow == Flow::Return || flow == Flow::Fail)
+            {
+                return flow;
+            }
+
+            if (loop->is_foreach)
+            {
+                counter = frame[loop->name];
+            }
+
+            counter.i++;
+
+            if (!in_range(counter))
+            {
+                return Flow::Fail;
+            }
+
+            // `loop(n)` runs at least once, and tests after each run
+            if (!loop->is_foreach && limit.type != "bool")
+            {
+                if (!eval(loop->expr, frame, limit))
+                {
+                    return Flow::Fail;
+                }
+
+                if (counter.i > limit.i)
+                {
+                    return Flow::Next;
+                }
+            }
+        }
+    }
+
+    case AstNodeType::AstBinaryExpr:
+    {
+        auto bin_expr = (AstBinaryExpr *)node;
+
+        if (bin_expr->op == "=" &&
+            bin_expr->lhs->node_type == AstNodeType::AstSymbol)
+        {
+            auto variable = frame.find(((AstSymbol *)bin_expr->lhs)->name);
+            PureValue value;
+
+            if (variable == frame.end() ||
+                !eval(bin_expr->rhs, frame, value) ||
+                (value.type[0] == 'f') != (variable->second.type[0] == 'f'))
+            {
+                return Flow::Fail;
+            }
+
+            value.type = variable->second.type;
+
+            if (value.type == "f32")
+            {
+                value.f = (float)value.f;
+            }
+
+            if (!in_range(value))
+            {
+                return Flow::Fail;
+            }
+
+            variable->second = value;
+            return Flow::Next;
+        }
+
+        PureValue value;
+        return eval(node, frame, value) ? Flow::Next : Flow::Fail;
+    }
+
+    case AstNodeType::AstFnCall:
+    {
+        PureValue value;
+        return eval(node, frame, value) ? Flow::Next : Flow::Fail;
+    }
+
+    default:
+        return Flow::Fail;
+    }
+}
+
+static AstNode *make_constant(const PureValue &value, const AstNode *at)
+{
+    if (value.type == "bool")
+    {
+        auto boolean = new AstBoolean(at->line, at->column);
+        boolean->value = value.i != 0;
+        return boolean;
+    }
+
+    auto number = new AstNumber(at->line, at->column);
+    number->is_float = value.type[0] == 'f';
+    number->is_signed = value.type[0] != 'u';
+    number->bits = std::stoi(value.type.substr(1));
+
+    if (number->is_float)
+    {
+        number->value.f = value.f;
+    }
+    else
+    {
+        number->value.i = value.i;
+    }
+
+    return number;
+}
+
+static AstSymbol *make_symbol(const AstDec *decl, const AstNode *at)
+{
+    auto symbol = new AstSymbol(at->line, at->column);
+    symbol->name = decl->name;
+    return symbol;
+}
+
+// Names a statement declares, including those of loop counters
+static void collect_declared(AstNode *node, std::set<std::string> &names)
+{
+    if (node->node_type == AstNodeType::AstDec)
+    {
+        names.insert(((AstDec *)node)->name);
+    }
+    else if (node->node_type == AstNodeType::AstLoop &&
+             ((AstLoop *)node)->is_foreach)
+    {
+        names.insert(((AstLoop *)node)->name);
+    }
+
+    for (auto child : ast_children(node))
+    {
+        collect_declared(child, names);
+    }
+}
+
+// Names a statement declares or assigns to
+static void collect_assigned(AstNode *node, std::set<std::string> &names)
+{
+    collect_declared(node, names);
+
+    if (node->node_type == AstNodeType::AstBinaryExpr &&
+        ((AstBinaryExpr *)node)->op == "=" &&
+        ((AstBinaryExpr *)node)->lhs->node_type == AstNodeType::AstSymbol)
+    {
+        names.insert(((AstSymbol *)((AstBinaryExpr *)node)->lhs)->name);
+    }
+
+    for (auto child : ast_children(node))
+    {
+        collect_assigned(child, names);
+    }
+}
+
+void Optimizer::optimize(Ast &ast)
+{
+    for (auto stmt : ast.root->statements)
+    {
+        if (stmt->node_type == AstNodeType::AstFn)
+        {
+            optimize_fn((AstFn *)stmt);
+        }
+        else if (stmt->node_type == AstNodeType::AstImpl)
+        {
+            for (auto method : ((AstImpl *)stmt)->block->statements)
+            {
+                if (method->node_type == AstNodeType::AstFn)
+                {
+                    optimize_fn((AstFn *)method);
+                }
+            }
+        }
+    }
+}
+
+void Optimizer::optimize_fn(AstFn *fn)
+{
+    if (!fn->body || find_attribute(fn, "il"))
+    {
+        return;
+    }
+
+    fn_locals.clear();
+
+    for (auto param : sem.params(fn))
+    {
+        fn_locals.insert(param->name);
+    }
+
+    collect_declared(fn->body, fn_locals);
+
+    optimize_block(fn->body);
+}
+
+// Inner blocks go first, so calls hoisted out of an inner loop can be hoisted
+// further out of the loops around it
+void Optimizer::optimize_block(AstBlock *block)
+{
+    for (auto &stmt : block->statements)
+    {
+        optimize_statement(stmt);
+    }
+
+    hoist_invariants(block);
+    reuse_calls(block);
+    remove_dead_calls(block);
+}
+
+void Optimizer::optimize_statement(AstNode *&stmt)
+{
+    switch (stmt->node_type)
+    {
+    case AstNodeType::AstBlock:
+        optimize_block((AstBlock *)stmt);
+        break;
+
+    case AstNodeType::AstIf:
+    {
+        auto if_stmt = (AstIf *)stmt;
+
+        fold(if_stmt->condition);
+        optimize_block(if_stmt->true_block);
+
+        if (if_stmt->false_block)
+        {
+            optimize_block(if_stmt->false_block);
+        }
+        break;
+    }
+
+    case AstNodeType::AstLoop:
+    {
+        auto loop = (AstLoop *)stmt;
+
+        fold(loop->expr);
+
+        // The captures of a @parallel loop are already known, so it only gets
+        // constants
+        if (find_attribute(loop, "parallel"))
+        {
+            fold_block(loop->body);
+        }
+        else
+        {
+            optimize_block(loop->body);
+        }
+        break;
+    }
+
+    case AstNodeType::AstFnCall:
+        // A call whose result is unused is not replaced by a constant, it is
+        // dropped if it is pure
+        for (auto &arg : ((AstFnCall *)stmt)->args)
+        {
+            fold(arg);
+        }
+        break;
+
+    default:
+        fold(stmt);
+        break;
+    }
+}
+
+void Optimizer::fold_block(AstBlock *block)
+{
+    for (auto &stmt : block->statements)
+    {
+        switch (stmt->node_type)
+        {
+        case AstNodeType::AstBlock:
+            fold_block((AstBlock *)stmt);
+            break;
+
+        case AstNodeType::AstIf:
+            fold(((AstIf *)stmt)->condition);
+            fold_block(((AstIf *)stmt)->true_block);
+
+            if (((AstIf *)stmt)->false_block)
+            {
+                fold_block(((AstIf *)stmt)->false_block);
+            }
+            break;
+
+        case AstNodeType::AstLoop:
+            fold(((AstLoop *)stmt)->expr);
+            fold_block(((AstLoop *)stmt)->body);
+            break;
+
+        case AstNodeType::AstFnCall:
+            for (auto &arg : ((AstFnCall *)stmt)->args)
+            {
+                fold(arg);
+            }
+            break;
+
+        default:
+            fold(stmt);
+            break;
+        }
+    }
+}
+
+// Replaces pure calls with constant arguments by their result
+void Optimizer::fold(AstNode *&node)
+{
+    if (!node)
+    {
+        return;
+    }
+
+    switch (node->node_type)
+    {
+    case AstNodeType::AstDec:
+        fold(((AstDec *)node)->value);
+        break;
+
+    case AstNodeType::AstReturn:
+        fold(((AstReturn *)node)->expr);
+        break;
+
+    case AstNodeType::AstAwait:
+        fold(((AstAwait *)node)->expr);
+        break;
+
+    case AstNodeType::AstUnaryExpr:
+        fold(((AstUnaryExpr *)node)->expr);
+        break;
+
+    case AstNodeType::AstIndex:
+        fold(((AstIndex *)node)->array);
+        fold(((AstIndex *)node)->expr);
+        break;
+
+    case AstNodeType::AstArray:
+        for (auto &element : ((AstArray *)node)->elements)
+        {
+            fold(element);
+        }
+        break;
+
+    case AstNodeType::AstBinaryExpr:
+    {
+        auto bin_expr = (AstBinaryExpr *)node;
+
+        fold(bin_expr->lhs);
+
+        // The right hand side of `.` names a field or a method
+        if (bin_expr->op != ".")
+        {
+            fold(bin_expr->rhs);
+        }
+        else if (bin_expr->rhs->node_type == AstNodeType::AstFnCall)
+        {
+            for (auto &arg : ((AstFnCall *)bin_expr->rhs)->args)
+            {
+                fold(arg);
+            }
+        }
+        break;
+    }
+
+    case AstNodeType::AstFnCall:
+    {
+        auto call = (AstFnCall *)node;
+
+        for (auto &arg : call->args)
+        {
+            fold(arg);
+        }
+
+        if (!evaluate_call(node))
+        {
+            inline_call(node);
+        }
+        break;
+    }
+
+    default:
+        break;
+    }
+}
+
+// Replaces a pure call with constant arguments by its result
+bool Optimizer::evaluate_call(AstNode *&node)
+{
+    auto call = (AstFnCall *)node;
+    auto fn = pure_call(call);
+
+    if (!fn || !fn->body || find_attribute(fn, "il"))
+    {
+        return false;
+    }
+
+    Evaluator evaluator(sem);
+    Frame constants;
+    std::vector<PureValue> args;
+    PureValue result;
+
+    for (auto arg : call->args)
+    {
+        PureValue value;
+
+        if (!evaluator.eval(arg, constants, value))
+        {
+            return false;
+        }
+
+        args.push_back(value);
+    }
+
+    if (!evaluator.call(fn, args, result))
+    {
+        return false;
+    }
+
+    node = make_constant(result, call);
+    delete call;
+    return true;
+}
+
+// Counts the uses of each parameter in an expression the inliner can copy,
+// false if it has anything else
+static bool count_uses(AstNode *node, const std::vector<AstDec *> &params,
+                       std::map<std::string, int> &uses)
+{
+    switch (node->node_type)
+    {
+    case AstNodeType::AstNumber:
+    case AstNodeType::AstBoolean:
+    case AstNodeType::AstString:
+        return true;
+
+    case AstNodeType::AstSymbol:
+        for (auto param : params)
+        {
+            if (param->name == ((AstSymbol *)node)->name)
+            {
+                uses[param->name]++;
+                return true;
+            }
+        }
+        return false;
+
+    case AstNodeType::AstUnaryExpr:
+        return count_uses(((AstUnaryExpr *)node)->expr, params, uses);
+
+    case AstNodeType::AstBinaryExpr:
+    {
+        auto bin_expr = (AstBinaryExpr *)node;
+
+        return bin_expr->op != "=" && bin_expr->op != "." &&
+               count_uses(bin_expr->lhs, params, uses) &&
+               count_uses(bin_expr->rhs, params, uses);
+    }
+
+    case AstNodeType::AstIndex:
+        return count_uses(((AstIndex *)node)->array, params, uses) &&
+               count_uses(((AstIndex *)node)->expr, params, uses);
+
+    case AstNodeType::AstFnCall:
+        for (auto arg : ((AstFnCall *)node)->args)
+        {
+            if (!count_uses(arg, params, uses))
+            {
+                return false;
+            }
+        }
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+// Copies an expression count_uses accepted, with parameters replaced by the
+// arguments they are bound to. An argument used once is moved rather than
+// copied, the others are constants or variables.
+static AstNode *copy_inlined(AstNode *node,
+                             std::map<std::string, AstNode *> &bindings,
+                             Semantics &sem)
+{
+    switch (node->node_type)
+    {
+    case AstNodeType::AstNumber:
+    {
+        auto number = new AstNumber(node->line, node->column);
+        number->is_float = ((AstNumber *)node)->is_float;
+        number->is_signed = ((AstNumber *)node)->is_signed;
+        number->bits = ((AstNumber *)node)->bits;
+        number->value = ((AstNumber *)node)->value;
+        return number;
+    }
+
+    case AstNodeType::AstBoolean:
+    {
+        auto boolean = new AstBoolean(node->line, node->column);
+        boolean->value = ((AstBoolean *)node)->value;
+        return boolean;
+    }
+
+    case AstNodeType::AstString:
+    {
+        auto string = new AstString(node->line, node->column);
+        string->value = ((AstString *)node)->value;
+        return string;
+    }
+
+    case AstNodeType::AstSymbol:
+    {
+        auto &arg = bindings[((AstSymbol *)node)->name];
+
+        if (arg->node_type == AstNodeType::AstSymbol)
+        {
+            auto symbol = new AstSymbol(arg->line, arg->column);
+            symbol->name = ((AstSymbol *)arg)->name;
+            return symbol;
+        }
+
+        if (arg->node_type == AstNodeType::AstNumber ||
+            arg->node_type == AstNodeType::AstBoolean)
+        {
+            std::map<std::string, AstNode *> none;
+            return copy_inlined(arg, none, sem);
+        }
+
+        auto moved = arg;
+        arg = nullptr;
+        return moved;
+    }
+
+    case AstNodeType::AstUnaryExpr:
+    {
+        auto unary = new AstUnaryExpr(node->line, node->column);
+        unary->op = ((AstUnaryExpr *)node)->op;
+        unary->expr = copy_inlined(((AstUnaryExpr *)node)->expr, bindings, sem);
+        sem.copy_results(node, unary);
+        return unary;
+    }
+
+    case AstNodeType::AstBinaryExpr:
+    {
+        auto bin_expr = (AstBinaryExpr *)node;
+        auto copy = new AstBinaryExpr(node->line, node->column);
+        copy->op = bin_expr->op;
+        copy->lhs = copy_inlined(bin_expr->lhs, bindings, sem);
+        copy->rhs = copy_inlined(bin_expr->rhs, bindings, sem);
+        sem.copy_results(node, copy);
+        return copy;
+    }
+
+    case AstNodeType::AstIndex:
+    {
+        auto index = new AstIndex(node->line, node->column);
+        index->array = copy_inlined(((AstIndex *)node)->array, bindings, sem);
+        index->expr = copy_inlined(((AstIndex *)node)->expr, bindings, sem);
+        return index;
+    }
+
+    case AstNodeType::AstFnCall:
+    {
+        auto call = (AstFnCall *)node;
+        auto copy = new AstFnCall(node->line, node->column);
+        copy->name = call->name;
+
+        for (auto arg : call->args)
+        {
+            copy->args.push_back(copy_inlined(arg, bindings, sem));
+        }
+
+        sem.copy_results(node, copy);
+        return copy;
+    }
+
+    default:
+        return nullptr;
+    }
+}
+
+// Replaces a call to a function the profile found hot, whose body only
+// returns an expression of its parameters, by that expression. Arguments
+// must be free of effects, as they may be evaluated in another order, and
+// those used more than once must be constants or variables.
+void Optimizer::inline_call(AstNode *&node)
+{
+    auto call = (AstFnCall *)node;
+
+    if (sem.profile.empty() || !sem.emits(call))
+    {
+        return;
+    }
+
+    auto fn = sem.p2_get_fn(sem.callee(call));
+
+    if (!fn || !fn->body || fn->is_async || !fn->return_type ||
+        find_attribute(fn, "il") ||
+        sem.params(fn).size() != call->args.size() ||
+        !sem.profile.is_hot(
+            sem.profile.count(Profile::fn_site(sem.symbol(fn)))))
+    {
+        return;
+    }
+
+    auto &params = sem.params(fn);
+
+    auto &statements = fn->body->statements;
+
+    if (statements.size() != 1 ||
+        statements[0]->node_type != AstNodeType::AstReturn ||
+        !((AstReturn *)statements[0])->expr)
+    {
+        return;
+    }
+
+    auto expr = ((AstReturn *)statements[0])->expr;
+    std::map<std::string, int> uses;
+
+    if (!count_uses(expr, params, uses))
+    {
+        return;
+    }
+
+    std::map<std::string, AstNode *> bindings;
+
+    for (size_t i = 0; i < params.size(); i++)
+    {
+        auto arg = call->args[i];
+        bool simple = arg->node_type == AstNodeType::AstSymbol ||
+                      arg->node_type == AstNodeType::AstNumber ||
+                      arg->node_type == AstNodeType::AstBoolean;
+
+        if (has_effects(arg) || (uses[params[i]->name] > 1 && !simple))
+        {
+            return;
+        }
+
+        bindings[params[i]->name] = arg;
+    }
+
+    node = copy_inlined(expr, bindings, sem);
+
+    // Moved arguments are no longer the call's to delete
+    for (size_t i = 0; i < params.size(); i++)
+    {
+        if (!bindings[params[i]->name])
+        {
+            call->args[i] = nullptr;
+        }
+    }
+
+    delete call;
+}
+
+// The function a call calls if it is @pure and returns a value
+AstFn *Optimizer::pure_call(AstNode *node)
+{
+    if (node->node_type != AstNodeType::AstFnCall || !sem.emits(node))
+    {
+        return nullptr;
+    }
+
+    auto fn = sem.p2_get_fn(sem.callee((AstFnCall *)node));
+
+    if (!sem.is_pure(fn) || !fn->return_type)
+    {
+        return nullptr;
+    }
+
+    return fn;
+}
+
+bool Optimizer::reads_memory(const AstFn *fn)
+{
+    if (find_attribute(fn, "il"))
+    {
+        return false;
+    }
+
+    auto known = memory_reads.find(fn);
+
+    if (known != memory_reads.end())
+    {
+        return known->second;
+    }
+
+    // Assumed while the function is being looked at, for recursion
+    memory_reads[fn] = true;
+
+    std::set<std::string> locals;
+
+    for (auto param : sem.params(fn))
+    {
+        locals.insert(param->name);
+    }
+
+    return memory_reads[fn] = reads_memory_node(fn->body, locals);
+}
+
+bool Optimizer::reads_memory_node(AstNode *node, std::set<std::string> &locals)
+{
+    switch (node->node_type)
+    {
+    case AstNodeType::AstNumber:
+    case AstNodeType::AstString:
+    case AstNodeType::AstBoolean:
+    case AstNodeType::AstType:
+    case AstNodeType::AstAttribute:
+    case AstNodeType::AstBreak:
+    case AstNodeType::AstContinue:
+        return false;
+
+    case AstNodeType::AstIndex:
+        return true;
+
+    case AstNodeType::AstSymbol:
+        // Anything but a variable of the function is a global
+        return !locals.count(((AstSymbol *)node)->name);
+
+    case AstNodeType::AstDec:
+    {
+        auto decl = (AstDec *)node;
+        locals.insert(decl->name);
+        return decl->value && reads_memory_node(decl->value, locals);
+    }
+
+    case AstNodeType::AstLoop:
+        if (((AstLoop *)node)->is_foreach)
+        {
+            locals.insert(((AstLoop *)node)->name);
+        }
+        break;
+
+    case AstNodeType::AstFnCall:
+    {
+        auto fn = sem.p2_get_fn(sem.callee((AstFnCall *)node));
+
+        if (!sem.is_pure(fn) || reads_memory(fn))
+        {
+            return true;
+        }
+        break;
+    }
+
+    case AstNodeType::AstBinaryExpr:
+    {
+        auto bin_expr = (AstBinaryExpr *)node;
+
+        if (bin_expr->op == ".")
+        {
+            return true;
+        }
+
+        if (bin_expr->op == "=")
+        {
+            return reads_memory_node(bin_expr->rhs, locals);
+        }
+
+        if (operator_intrinsic(sem.p2_get_affix(sem.op(bin_expr)), sem).empty())
+        {
+            return true;
+        }
+        break;
+    }
+
+    case AstNodeType::AstBlock:
+    case AstNodeType::AstIf:
+    case AstNodeType::AstReturn:
+        break;
+
+    default:
+        return true;
+    }
+
+    for (auto child : ast_children(node))
+    {
+        if (reads_memory_node(child, locals))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Whether evaluating a node may store to memory, allocate, suspend or call
+// anything impure. Stores to variables of the function do not count.
+bool Optimizer::has_effects(AstNode *node)
+{
+    if (!node)
+    {
+        return false;
+    }
+
+    switch (node->node_type)
+    {
+    case AstNodeType::AstNumber:
+    case AstNodeType::AstString:
+    case AstNodeType::AstBoolean:
+    case AstNodeType::AstSymbol:
+    case AstNodeType::AstType:
+    case AstNodeType::AstAttribute:
+    case AstNodeType::AstBreak:
+    case AstNodeType::AstContinue:
+        return false;
+
+    case AstNodeType::AstBlock:
+    case AstNodeType::AstDec:
+    case AstNodeType::AstIf:
+    case AstNodeType::AstLoop:
+    case AstNodeType::AstReturn:
+    case AstNodeType::AstIndex:
+        break;
+
+    case AstNodeType::AstFnCall:
+        if (!pure_call(node))
+        {
+            return true;
+        }
+        break;
+
+    case AstNodeType::AstUnaryExpr:
+        if (!sem.is_pure_op(sem.op((AstUnaryExpr *)node)))
+        {
+            return true;
+        }
+        break;
+
+    case AstNodeType::AstBinaryExpr:
+    {
+        auto bin_expr = (AstBinaryExpr *)node;
+
+        if (bin_expr->op == "=")
+        {
+            return bin_expr->lhs->node_type != AstNodeType::AstSymbol ||
+                   !fn_locals.count(((AstSymbol *)bin_expr->lhs)->name) ||
+                   has_effects(bin_expr->rhs);
+        }
+
+        if (bin_expr->op == ".")
+        {
+            return bin_expr->rhs->node_type == AstNodeType::AstFnCall ||
+                   has_effects(bin_expr->lhs);
+        }
+
+        if (!sem.is_pure_op(sem.op(bin_expr)))
+        {
+            return true;
+        }
+        break;
+    }
+
+    default:
+        return true;
+    }
+
+    for (auto child : ast_children(node))
+    {
+        if (has_effects(child))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool Optimizer::describe(AstNode *node, CallKey &key)
+{
+    switch (node->node_type)
+    {
+    case AstNodeType::AstNumber:
+    {
+        auto number = (AstNumber *)node;
+        key.text += (number->is_float ? "f" : number->is_signed ? "i" : "u") +
+                    std::to_string(number->bits) + ":" +
+                    std::to_string(number->value.u);
+        return true;
+    }
+
+    case AstNodeType::AstBoolean:
+        key.text += ((AstBoolean *)node)->value ? "true" : "false";
+        return true;
+
+    case AstNodeType::AstSymbol:
+    {
+        auto &name = ((AstSymbol *)node)->name;
+
+        key.text += "$" + name;
+        key.vars.insert(name);
+        key.memory = key.memory || !fn_locals.count(name);
+        return true;
+    }
+
+    case AstNodeType::AstFnCall:
+    {
+        auto call = (AstFnCall *)node;
+        auto fn = pure_call(call);
+
+        if (!fn)
+        {
+            return false;
+        }
+
+        key.memory = key.memory || reads_memory(fn);
+        key.text += sem.callee(call) + "(";
+
+        for (auto arg : call->args)
+        {
+            if (!describe(arg, key))
+            {
+                return false;
+            }
+
+            key.text += ",";
+        }
+
+        key.text += ")";
+        return true;
+    }
+
+    case AstNodeType::AstBinaryExpr:
+    {
+        auto bin_expr = (AstBinaryExpr *)node;
+
+        if (bin_expr->op == "=" || bin_expr->op == "." ||
+            !sem.is_pure_op(sem.op(bin_expr)))
+        {
+            return false;
+        }
+
+        key.text += "(";
+
+        if (!describe(bin_expr->lhs, key))
+        {
+            return false;
+        }
+
+        key.text += sem.op(bin_expr);
+
+        if (!describe(bin_expr->rhs, key))
+        {
+            return false;
+        }
+
+        key.text += ")";
+        return true;
+    }
+
+    default:
+        return false;
+    }
+}
+
+// Collects the outermost pure calls of an expression that can be reused
+void Optimizer::collect_calls(AstNode *&slot, std::vector<AstNode **> &sites)
+{
+    if (!slot)
+    {
+        return;
+    }
+
+    CallKey key;
+
+    if (pure_call(slot) && describe(slot, key))
+    {
+        sites.push_back(&slot);
+        return;
+    }
+
+    collect_child_calls(slot, sites);
+}
+
+void Optimizer::collect_child_calls(AstNode *node,
+                                    std::vector<AstNode **> &sites)
+{
+    switch (node->node_type)
+    {
+    case AstNodeType::AstFnCall:
+        for (auto &arg : ((AstFnCall *)node)->args)
+        {
+            collect_calls(arg, sites);
+        }
+        break;
+
+    case AstNodeType::AstUnaryExpr:
+        collect_calls(((AstUnaryExpr *)node)->expr, sites);
+        break;
+
+    case AstNodeType::AstIndex:
+        collect_calls(((AstIndex *)node)->array, sites);
+        collect_calls(((AstIndex *)node)->expr, sites);
+        break;
+
+    case AstNodeType::AstArray:
+        for (auto &element : ((AstArray *)node)->elements)
+        {
+            collect_calls(element, sites);
+        }
+        break;
+
+    case AstNodeType::AstBinaryExpr:
+    {
+        auto bin_expr = (AstBinaryExpr *)node;
+
+        if (bin_expr->op == "." &&
+            bin_expr->rhs->node_type == AstNodeType::AstFnCall)
+        {
+            collect_calls(bin_expr->lhs, sites);
+            collect_child_calls(bin_expr->rhs, sites);
+        }
+        else if (bin_expr->op == ".")
+        {
+            collect_calls(bin_expr->lhs, sites);
+        }
+        else if (bin_expr->op == "=" &&
+                 bin_expr->lhs->node_type != AstNodeType::AstIndex)
+        {
+            collect_calls(bin_expr->rhs, sites);
+        }
+        else
+        {
+            collect_calls(bin_expr->lhs, sites);
+            collect_calls(bin_expr->rhs, sites);
+        }
+        break;
+    }
+
+    default:
+        break;
+    }
+}
+
+// Collects the pure calls a statement always evaluates, before anything in
+// it that branches
+void Optimizer::collect_statement_calls(AstNode *stmt,
+                                        std::vector<AstNode **> &sites)
+{
+    switch (stmt->node_type)
+    {
+    case AstNodeType::AstDec:
+        collect_calls(((AstDec *)stmt)->value, sites);
+        break;
+
+    case AstNodeType::AstReturn:
+        collect_calls(((AstReturn *)stmt)->expr, sites);
+        break;
+
+    case AstNodeType::AstIf:
+        collect_calls(((AstIf *)stmt)->condition, sites);
+        break;
+
+    case AstNodeType::AstFnCall:
+    case AstNodeType::AstUnaryExpr:
+    case AstNodeType::AstBinaryExpr:
+    case AstNodeType::AstIndex:
+        collect_child_calls(stmt, sites);
+        break;
+
+    default:
+        break;
+    }
+}
+
+AstDec *Optimizer::make_temp(const std::string &prefix, AstNode *value)
+{
+    auto type = sem.infer_type(value);
+
+    if (!type)
+    {
+        return nullptr;
+    }
+
+    auto decl = new AstDec(value->line, value->column);
+    decl->name = prefix + std::to_string(temp_counter++);
+    decl->type = type;
+    decl->value = value;
+    return decl;
+}
+
+// Whether a statement can leave the loop it is in or skip the rest of its
+// body, so the statements after it do not run on every iteration
+static bool leaves_loop(AstNode *node, bool nested = false)
+{
+    if (!node)
+    {
+        return false;
+    }
+
+    if (node->node_type == AstNodeType::AstReturn ||
+        (!nested && (node->node_type == AstNodeType::AstBreak ||
+                     node->node_type == AstNodeType::AstContinue)))
+    {
+        return true;
+    }
+
+    for (auto child : ast_children(node))
+    {
+        if (leaves_loop(child, nested ||
+                                   node->node_type == AstNodeType::AstLoop))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Moves pure calls a loop evaluates on every run into variables, when their
+// arguments do not change in the loop. Calls reading memory are only moved
+// out of loops that do not store to it. Calls of the condition or bound run
+// before the loop anyway and go before it. Calls of the body are only taken
+// up to the first statement that can leave it, and go into the entry of the
+// loop, which runs them only if the body runs at least once.
+void Optimizer::hoist_invariants(AstBlock *block)
+{
+    std::vector<AstNode *> statements;
+
+    for (auto stmt : block->statements)
+    {
+        if (stmt->node_type != AstNodeType::AstLoop ||
+            find_attribute(stmt, "parallel"))
+        {
+            statements.push_back(stmt);
+            continue;
+        }
+
+        auto loop = (AstLoop *)stmt;
+        std::set<std::string> variant;
+        std::vector<AstNode **> sites;
+        std::vector<AstNode **> body_sites;
+        std::map<std::string, AstDec *> temps;
+
+        collect_assigned(loop->body, variant);
+
+        if (loop->is_foreach)
+        {
+            variant.insert(loop->name);
+        }
+
+        bool memory_stable = !has_effects(loop->expr) && !has_effects(loop->body);
+
+        // `loop (n)` runs its body before it first looks at n, the others
+        // test before every run and can test once more to enter
+        auto type = sem.infer_type(loop->expr);
+        bool repeat = !loop->is_foreach && type && type->name != "bool";
+        bool leaves = false;
+
+        delete type;
+
+        if (!repeat)
+        {
+            collect_calls(loop->expr, sites);
+        }
+
+        for (auto inner : loop->body->statements)
+        {
+            collect_statement_calls(inner, body_sites);
+
+            if ((leaves = leaves_loop(inner)))
+            {
+                break;
+            }
+        }
+
+        if (repeat && !leaves)
+        {
+            collect_calls(loop->expr, body_sites);
+        }
+
+        if (!repeat && has_effects(loop->expr))
+        {
+            body_sites.clear();
+        }
+
+        for (auto group : {&sites, &body_sites})
+        {
+            for (auto site : *group)
+            {
+                CallKey key;
+                describe(*site, key);
+
+                bool invariant = memory_stable || !key.memory;
+
+                for (auto &var : key.vars)
+                {
+                    invariant = invariant && !variant.count(var);
+                }
+
+                if (!invariant)
+                {
+                    continue;
+                }
+
+                auto &temp = temps[key.text];
+
+                if (temp)
+                {
+                    auto call = *site;
+                    *site = make_symbol(temp, call);
+                    delete call;
+                }
+                else if ((temp = make_temp("~licm", *site)))
+                {
+                    if (group == &sites)
+                    {
+                        statements.push_back(temp);
+                    }
+                    else
+                    {
+                        loop->entry.push_back(temp);
+                    }
+
+                    *site = make_symbol(temp, temp->value);
+                }
+            }
+        }
+
+        statements.push_back(loop);
+    }
+
+    block->statements = statements;
+}
+
+// A pure call repeated with the same arguments, and nothing in between that
+// changes them or the memory the call reads
+struct CallGeneration
+{
+    std::vector<AstNode **> sites;
+    size_t stmt; // The statement of the first call
+    std::set<std::string> vars;
+    bool memory;
+};
+
+// Evaluates pure calls repeated in a block once, into a variable declared
+// before the first of them
+void Optimizer::reuse_calls(AstBlock *block)
+{
+    auto &statements = block->statements;
+    std::vector<CallGeneration> generations;
+    std::map<std::string, size_t> live;
+
+    auto kill = [&](const std::set<std::string> &vars, bool memory) {
+        for (auto it = live.begin(); it != live.end();)
+        {
+            auto &generation = generations[it->second];
+            bool dead = memory && generation.memory;
+
+            for (auto &var : vars)
+            {
+                dead = dead || generation.vars.count(var);
+            }
+
+            it = dead ? live.erase(it) : std::next(it);
+        }
+    };
+
+    for (size_t i = 0; i < statements.size(); i++)
+    {
+        auto stmt = statements[i];
+        std::vector<AstNode **> sites;
+        std::set<std::string> assigned;
+
+        collect_statement_calls(stmt, sites);
+
+        // Within a statement the order of evaluation is up to the code
+        // generator, so a statement with effects reads memory afresh
+        bool effects = has_effects(stmt->node_type == AstNodeType::AstIf
+                                       ? ((AstIf *)stmt)->condition
+                                       : stmt);
+
+        if (effects)
+        {
+            kill({}, true);
+        }
+
+        for (auto site : sites)
+        {
+            CallKey key;
+            describe(*site, key);
+
+            auto found = live.find(key.text);
+
+            if (found != live.end())
+            {
+                generations[found->second].sites.push_back(site);
+            }
+            else if (!key.memory || !effects)
+            {
+                live[key.text] = generations.size();
+                generations.push_back({{site}, i, key.vars, key.memory});
+            }
+        }
+
+        collect_assigned(stmt, assigned);
+        kill(assigned, has_effects(stmt));
+    }
+
+    std::map<size_t, std::vector<AstDec *>> temps;
+
+    for (auto &generation : generations)
+    {
+        if (generation.sites.size() < 2)
+        {
+            continue;
+        }
+
+        auto first = generation.sites[0];
+        auto temp = make_temp("~cse", *first);
+
+        if (!temp)
+        {
+            continue;
+        }
+
+        *first = make_symbol(temp, temp->value);
+
+        for (size_t i = 1; i < generation.sites.size(); i++)
+        {
+            auto call = *generation.sites[i];
+            *generation.sites[i] = make_symbol(temp, call);
+            delete call;
+        }
+
+        temps[generation.stmt].push_back(temp);
+    }
+
+    if (temps.empty())
+    {
+        return;
+    }
+
+    std::vector<AstNode *> result;
+
+    for (size_t i = 0; i < statements.size(); i++)
+    {
+        for (auto temp : temps[i])
+        {
+            result.push_back(temp);
+        }
+
+        result.push_back(statements[i]);
+    }
+
+    statements = result;
+}
+
+// Drops statements that only call a pure function
+void Optimizer::remove_dead_calls(AstBlock *block)
+{
+    std::vector<AstNode *> statements;
+
+    for (auto stmt : block->statements)
+    {
+        if (pure_call(stmt) && !has_effects(stmt))
+        {
+            delete stmt;
+        }
+        else
+        {
+            statements.push_back(stmt);
+        }
+    }
+
+    block->statements = statements;
+}
@@ -0,0 +1,62 @@
+#ifndef FRONTEND_OPTIMIZER_H
+#define FRONTEND_OPTIMIZER_H
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "AstDefs.h"
+#include "Semantics.h"
+
+struct CallKey;
+
+/**
+ * Rewrites calls to @pure functions between semantic analysis and code
+ * generation. Calls with constant arguments are evaluated, calls repeated in
+ * a block reuse the first result, loop invariant calls are hoisted out of
+ * their loop and calls whose result is unused are dropped. With a profile,
+ * calls to hot functions that only return an expression are inlined.
+ */
+class Optimizer
+{
+public:
+  explicit Optimizer(Semantics &sem) : sem(sem) {}
+
+  void optimize(Ast &ast);
+
+private:
+  Semantics &sem;
+  int temp_counter = 0;
+
+  // Whether a @pure function reads memory, rather than only its arguments
+  std::map<const AstFn *, bool> memory_reads;
+
+  // Parameters and variables of the function being optimized, stores to
+  // anything else are stores to memory
+  std::set<std::string> fn_locals;
+
+  AstFn *pure_call(AstNode *node);
+  bool reads_memory(const AstFn *fn);
+  bool reads_memory_node(AstNode *node, std::set<std::string> &locals);
+  bool has_effects(AstNode *node);
+  bool describe(AstNode *node, CallKey &key);
+
+  void collect_calls(AstNode *&slot, std::vector<AstNode **> &sites);
+  void collect_child_calls(AstNode *node, std::vector<AstNode **> &sites);
+  void collect_statement_calls(AstNode *stmt, std::vector<AstNode **> &sites);
+
+  void optimize_fn(AstFn *fn);
+  void optimize_block(AstBlock *block);
+  void optimize_statement(AstNode *&stmt);
+  void fold(AstNode *&node);
+  bool evaluate_call(AstNode *&node);
+  void inline_call(AstNode *&node);
+  void fold_block(AstBlock *block);
+
+  AstDec *make_temp(const std::string &prefix, AstNode *value);
+  void hoist_invariants(AstBlock *block);
+  void reuse_calls(AstBlock *block);
+  void remove_dead_calls(AstBlock *block);
+};
+
+#endif // FRONTEND_OPTIMIZER_H
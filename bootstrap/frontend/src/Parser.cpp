@@ -1,5 +1,6 @@
 #include "Parser.h"
 
+#include <algorithm>
 #include <map>
 
 #define cur_tok (this->tokens[this->token_index])
@@ -17,20 +18,187 @@ Ast Parser::parse(const std::vector<Token> &tokens) {
     return parse_root();
 }
 
+// Whether a change is inside the source of a node, leaving its first token
+// and the token after it as they are
+static bool surrounds(const AstNode *node, const SourceEdit &edit) {
+    return node->end && node->offset < edit.offset &&
+           edit.offset + edit.removed < node->end;
+}
+
+// The innermost block around a change, nullptr if there is none
+static AstBlock *block_around(AstNode *node, const SourceEdit &edit) {
+    for(auto child : ast_children(node)) {
+        if(auto block = block_around(child, edit)) {
+            return block;
+        }
+    }
+
+    if(node->node_type == AstNodeType::AstBlock && surrounds(node, edit)) {
+        return (AstBlock*)node;
+    }
+
+    return nullptr;
+}
+
+// Where the nodes after a changed part of the source were, and how far the
+// change moved them
+struct SourceShift {
+    unsigned int end, line, column;
+    int offset_delta, line_delta, column_delta;
+};
+
+static void shift_position(unsigned int &line, unsigned int &column,
+                           const SourceShift &shift) {
+    if(line < shift.line || (line == shift.line && column < shift.column)) {
+        return;
+    }
+
+    // Columns only change on the line the change ends on
+    if(line == shift.line) {
+        column += shift.column_delta;
+    }
+
+    line += shift.line_delta;
+}
+
+// Moves the nodes after a changed part of the source, except those of the
+// part itself, to where the change put them
+static void shift_nodes(AstNode *node, const AstNode *changed,
+                        const SourceShift &shift) {
+    if(node == changed) {
+        return;
+    }
+
+    if(node->line) {
+        shift_position(node->line, node->column, shift);
+    }
+
+    if(node->end && node->end >= shift.end) {
+        if(node->offset >= shift.end) {
+            node->offset += shift.offset_delta;
+        }
+
+        node->end += shift.offset_delta;
+        shift_position(node->end_line, node->end_column, shift);
+    }
+
+    for(auto child : ast_children(node)) {
+        shift_nodes(child, changed, shift);
+    }
+}
+
+bool Parser::reparse(Ast &ast, const std::vector<Token> &tokens,
+                     const SourceEdit &edit) {
+    this->tokens = tokens;
+    this->errors.clear();
+
+    auto &statements = ast.root->statements;
+    size_t index = 0;
+
+    while(index < statements.size() && !surrounds(statements[index], edit)) {
+        index++;
+    }
+
+    AstNode *changed = nullptr;
+    AstBlock *block = nullptr;
+
+    if(index < statements.size()) {
+        block   = block_around(statements[index], edit);
+        changed = block ? block : statements[index];
+    }
+
+    // Attributes are attached to the statement after them, and operators
+    // change how everything after them parses
+    bool in_place = changed &&
+        changed->node_type != AstNodeType::AstAttribute &&
+        changed->node_type != AstNodeType::AstAffix;
+
+    AstNode *parsed = nullptr;
+    int delta = (int)edit.inserted - (int)edit.removed;
+    size_t first = 0;
+
+    if(in_place) {
+        first = std::lower_bound(
+            this->tokens.begin(), this->tokens.end(), changed->offset,
+            [](const Token &token, unsigned int offset) {
+                return token.offset < offset;
+            }) - this->tokens.begin();
+
+        // The statement before ends where the first token starts, so the
+        // change must leave that token as it was
+        this->token_index = first;
+        in_place = first + 1 < this->tokens.size() &&
+                   this->tokens[first].offset == changed->offset &&
+                   this->tokens[first + 1].offset <= edit.offset;
+    }
+
+    if(in_place) {
+        parsed = block ? parse_block() : parse_stmt();
+
+        in_place = parsed && this->errors.empty() &&
+                   cur_tok.offset == changed->end + delta;
+    }
+
+    if(!in_place) {
+        delete parsed;
+
+        auto path = ast.path;
+        delete ast.root;
+
+        this->errors.clear();
+        this->precedences.clear();
+        this->token_index = 0;
+        ast = parse_root();
+        ast.path = path;
+        return false;
+    }
+
+    SourceShift shift;
+    shift.end          = changed->end;
+    shift.line         = changed->end_line;
+    shift.column       = changed->end_column;
+    shift.offset_delta = delta;
+    shift.line_delta   = (int)cur_tok.line - (int)changed->end_line;
+    shift.column_delta = (int)cur_tok.column - (int)changed->end_column;
+
+    shift_nodes(ast.root, changed, shift);
+
+    if(block) {
+        // The block stays, with the statements it has now
+        block->statements.swap(((AstBlock*)parsed)->statements);
+        block->line   = parsed->line;
+        block->column = parsed->column;
+        set_range(block, this->tokens[first]);
+        delete parsed;
+    } else {
+        set_range(parsed, this->tokens[first]);
+        parsed->attributes = changed->attributes;
+        statements[index]  = parsed;
+        delete changed;
+    }
+
+    passes_done++;
+    return true;
+}
+
 Ast Parser::parse_root() {
     Ast ast;
     ast.root = new AstBlock();
 
     while(this->token_index < this->tokens.size() - 1) {
+        auto &first = cur_tok;
         AstNode *statement = parse_stmt();
 
         if(this->errors.size() == 0 && statement) {
+            set_range(statement, first);
             ast.root->statements.push_back(statement);
         } else {
             delete statement;
         }
     }
 
+    attach_attributes(ast.root->statements);
+
     passes_done++;
     return ast;
 }
@@ -45,7 +213,8 @@ AstNode *Parser::parse_stmt() {
     case TokenType::IntegerLiteral: // Fall through
     case TokenType::HexLiteral:     // Fall through
     case TokenType::FloatLiteral:   // Fall through
-    case TokenType::Boolean:
+    case TokenType::Boolean:        // Fall through
+    case TokenType::Await:
         return parse_expr();
 
     case TokenType::Var: // Fall through
@@ -55,6 +224,9 @@ AstNode *Parser::parse_stmt() {
     case TokenType::Fn:
         return parse_fn();
 
+    case TokenType::Async:
+        return parse_async_fn();
+
     case TokenType::If:
         return parse_if();
 
@@ -87,6 +259,9 @@ AstNode *Parser::parse_stmt() {
     case TokenType::Extern:
         return parse_extern();
 
+    case TokenType::Import:
+        return parse_import();
+
     case TokenType::MultilineComment:  // Fall through
     case TokenType::SingleLineComment: // Fall through
     case TokenType::SemiColon:
@@ -106,6 +281,8 @@ AstNode *Parser::parse_stmt() {
 }
 
 AstBlock *Parser::parse_block() {
+    auto &first = cur_tok;
+
     if(!expect(TokenType::OpenCurlyBracket,
                "Expected opening curly bracket at start of block")) {
         return nullptr;
@@ -126,9 +303,33 @@ AstBlock *Parser::parse_block() {
         while(accept(TokenType::SemiColon)) {} // Hacky, but works
     }
 
+    attach_attributes(result->statements);
+    set_range(result, first);
+
     return result;
 }
 
+void Parser::set_range(AstNode *node, const Token &first) {
+    node->offset     = first.offset;
+    node->end        = cur_tok.offset;
+    node->end_line   = cur_tok.line;
+    node->end_column = cur_tok.column;
+}
+
+void Parser::attach_attributes(const std::vector<AstNode*> &statements) {
+    std::vector<AstAttribute*> pending;
+
+    for(auto stmt : statements) {
+        if(stmt->node_type == AstNodeType::AstAttribute) {
+            pending.push_back((AstAttribute*)stmt);
+        } else {
+            stmt->attributes.insert(stmt->attributes.end(),
+                                    pending.begin(), pending.end());
+            pending.clear();
+        }
+    }
+}
+
 AstNode *Parser::parse_symbol() {
     if(peek_tok.type == TokenType::OpenParenthesis) {
         // Function call
@@ -465,6 +666,26 @@ AstFn *Parser::parse_fn(bool require_body) {
     return result;
 }
 
+AstFn *Parser::parse_async_fn() {
+    next_token();
+
+    if(cur_tok.type != TokenType::Fn) {
+        error(
+            ErrorType::UnexpectedToken,
+            cur_tok.line, cur_tok.column, cur_tok.offset, cur_tok.raw.size(),
+            "Expected `fn` after `async`");
+        return nullptr;
+    }
+
+    AstFn *result = parse_fn();
+
+    if(result) {
+        result->is_async = true;
+    }
+
+    return result;
+}
+
 AstLoop *Parser::parse_loop() {
     AstLoop *result = new AstLoop(cur_tok.line, cur_tok.column);
 
@@ -601,6 +822,17 @@ AstImpl *Parser::parse_impl() {
         return nullptr;
     }
 
+    for(auto stmt : result->block->statements) {
+        if(stmt->node_type == AstNodeType::AstFn) {
+            ((AstFn*)stmt)->type_self = result->name;
+        }
+    }
+
+    // Reparsed only along with the impl, which tells its functions what they
+    // implement
+    result->block->offset   = result->block->end        = 0;
+    result->block->end_line = result->block->end_column = 0;
+
     return result;
 }
 
@@ -624,7 +856,10 @@ AstAttribute *Parser::parse_attr() {
         }
     }
 
-    this->attributes.push_back(result);
+    if(result->name == "precedence" && !result->args.empty() &&
+       result->args[0]->node_type == AstNodeType::AstNumber) {
+        this->precedences.push_back((int)((AstNumber*)result->args[0])->value.i);
+    }
 
     return result;
 }
@@ -670,15 +905,10 @@ AstAffix *Parser::parse_affix() {
 
         Parser::affix_types[result->unmangled_name] = result->affix_type;
 
-        if(result->affix_type == AffixType::Infix) {
-            for(auto attr : this->attributes) {
-                if(attr->name == "precedence") {
-                    if(attr->args[0]->node_type == AstNodeType::AstNumber) {
-                        operator_precedences[result->unmangled_name] =
-                            (int)((AstNumber*)attr->args[0])->value.i;
-                    }
-                }
-            }
+        if(result->affix_type == AffixType::Infix &&
+           !this->precedences.empty()) {
+            operator_precedences[result->unmangled_name] =
+                this->precedences.back();
         }
     } else if(cur_tok.type == TokenType::Fn) {
         AstFn *fn = parse_fn();
@@ -702,7 +932,7 @@ AstAffix *Parser::parse_affix() {
         return nullptr;
     }
 
-    this->attributes.clear();
+    this->precedences.clear();
 
     return result;
 }
@@ -730,6 +960,19 @@ AstReturn *Parser::parse_return() {
     return result;
 }
 
+AstAwait *Parser::parse_await() {
+    AstAwait *result = new AstAwait(cur_tok.line, cur_tok.column);
+
+    next_token();
+
+    if(!(result->expr = parse_expr_primary())) {
+        delete result;
+        return nullptr;
+    }
+
+    return result;
+}
+
 AstExtern *Parser::parse_extern() {
     AstExtern *result = new AstExtern(cur_tok.line, cur_tok.column);
 
@@ -773,6 +1016,50 @@ AstExtern *Parser::parse_extern() {
     return result;
 }
 
+AstImport *Parser::parse_import() {
+    AstImport *result = new AstImport(cur_tok.line, cur_tok.column);
+
+    size_t start = this->token_index;
+
+    next_token();
+
+    result->name = cur_tok.raw;
+
+    if(!expect(TokenType::Symbol, "Expected module name after `import`")) {
+        delete result;
+        return nullptr;
+    }
+
+    while(accept(TokenType::Dot)) {
+        result->name += "." + cur_tok.raw;
+
+        if(!expect(TokenType::Symbol,
+                   "Expected module name after `.` in import")) {
+            delete result;
+            return nullptr;
+        }
+    }
+
+    if(on_import && !on_import(result)) {
+        error(
+            ErrorType::ModuleNotFound,
+            this->tokens[start].line, this->tokens[start].column,
+            this->tokens[start].offset,
+            cur_tok.offset - this->tokens[start].offset,
+            "Module `" + result->name + "` not found");
+        delete result;
+        return nullptr;
+    }
+
+    if(!expect(TokenType::SemiColon,
+               "Expected semicolon after import statement")) {
+        delete result;
+        return nullptr;
+    }
+
+    return result;
+}
+
 AstNode *Parser::parse_expr_rhs(AstNode *lhs, int prev_precedence) {
     while(true) {
         if(!token_type_is_operator(cur_tok.type)) {
@@ -871,6 +1158,10 @@ AstNode *Parser::parse_expr_primary() {
         result = parse_boolean();
         break;
 
+    case TokenType::Await:
+        result = parse_await();
+        break;
+
     case TokenType::OpenSquareBracket:
         result = parse_array();
         break;
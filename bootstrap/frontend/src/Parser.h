@@ -5,8 +5,19 @@
 #include "Error.h"
 #include "Token.h"
 #include <cstddef>
+#include <functional>
 #include <vector>
 
+/**
+ * A change of a source: the removed characters at offset were replaced by
+ * inserted characters.
+ */
+struct SourceEdit {
+    unsigned int offset;
+    unsigned int removed;
+    unsigned int inserted;
+};
+
 class Parser {
 public:
     /**
@@ -18,9 +29,37 @@ public:
      */
     Ast parse(const std::vector<Token> &tokens);
 
+    /**
+     * Parses the tokens of a changed source into the AST of the source before
+     * the change. Only the innermost block around the change, or else the top
+     * level statement it is in, is parsed again and spliced in. Every other
+     * node is kept along with its id, so what Semantics found out about it
+     * still holds, and moved to where the change put it.
+     *
+     * The whole source is parsed anew if the change is not inside a single
+     * top level statement, or changes where the part parsed again ends.
+     *
+     * @param ast    The AST of the source before the change, updated in place
+     * @param tokens The list of tokens of the source after the change
+     * @param edit   The change
+     *
+     * @return Whether the AST was updated in place rather than parsed anew
+     */
+    bool reparse(Ast &ast, const std::vector<Token> &tokens,
+                 const SourceEdit &edit);
+
     /** List of errors that occurred during parsing */
     std::vector<Error> errors;
 
+    /**
+     * Called for every import statement as soon as it has been parsed, so the
+     * imported module (and the operators it declares) is available to the
+     * rest of the file.
+     *
+     * Returns false if the module could not be found.
+     */
+    std::function<bool(const AstImport *)> on_import;
+
 private:
     Ast parse_root();
 
@@ -40,6 +79,21 @@ private:
      */
     AstBlock *parse_block();
 
+    /**
+     * Attaches the attributes among statements to the statement after them.
+     * The attributes stay statements of their own as well.
+     */
+    void attach_attributes(const std::vector<AstNode*> &statements);
+
+    /**
+     * Records the source a top level statement or a block was parsed from,
+     * for reparse. Expects the current token to be the one after it.
+     *
+     * @param node  The node
+     * @param first The first token of the node
+     */
+    void set_range(AstNode *node, const Token &first);
+
     /**
      * Parses an expression starting with a symbol. This can be a symbol on its
      * own or a function call.
@@ -107,6 +161,14 @@ private:
      */
     AstFn *parse_fn(bool require_body = true);
 
+    /**
+     * Parses an async function. Expects the current token to be "async",
+     * followed by a function as parsed by parse_fn.
+     *
+     * @return The function node
+     */
+    AstFn *parse_async_fn();
+
     /**
      * Parses a loop.
      *
@@ -179,6 +241,15 @@ private:
      */
     AstReturn *parse_return();
 
+    /**
+     * Parses an await expression. Expects the current token to be "await".
+     * After this function, the current token is the one after the awaited
+     * primary expression.
+     *
+     * @return The await node
+     */
+    AstAwait *parse_await();
+
     /**
      * Parses an extern block or declaration. Expects the current token to be
      * "extern". After this function, the current token is the one after either:
@@ -189,6 +260,14 @@ private:
      */
     AstExtern *parse_extern();
 
+    /**
+     * Parses an import statement. Expects the current token to be "import".
+     * After this function, the current token is the one after the semicolon.
+     *
+     * @return The import node
+     */
+    AstImport *parse_import();
+
     /**
      * Parses the right side of an expression, stopping at an appropriate
      * operator.
@@ -278,7 +357,11 @@ private:
 
     int passes_done = 0;
 
-    std::vector<AstAttribute*> attributes;
+    /**
+     * The values of the @precedence attributes since the last operator. The
+     * attributes themselves are deleted with statements that fail to parse.
+     */
+    std::vector<int> precedences;
 
     /** Stores operator precedences for the second pass */
     static std::map<std::string, int> operator_precedences;
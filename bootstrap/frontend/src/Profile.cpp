@@ -0,0 +1,55 @@
+#include "Profile.h"
+#include <fstream>
+#include "Ast.h"
+
+// A function is hot when entered at least this fraction of the times the
+// hottest function was
+#define HOT_FRACTION 100
+
+bool Profile::load(const std::string &path)
+{
+    std::ifstream stream(path);
+
+    if (!stream)
+    {
+        return false;
+    }
+
+    std::string site;
+    uint64_t count;
+
+    while (stream >> site >> count)
+    {
+        counts[site] += count;
+
+        if (site.compare(0, 3, "fn:") == 0 && counts[site] > max_fn_count)
+        {
+            max_fn_count = counts[site];
+        }
+    }
+
+    return true;
+}
+
+uint64_t Profile::count(const std::string &site) const
+{
+    auto it = counts.find(site);
+    return it == counts.end() ? 0 : it->second;
+}
+
+bool Profile::is_hot(uint64_t count) const
+{
+    return count && count * HOT_FRACTION >= max_fn_count;
+}
+
+std::string Profile::fn_site(const std::string &fn)
+{
+    return "fn:" + fn;
+}
+
+std::string Profile::site(const char *kind, const std::string &fn,
+                          const AstNode *node, const char *edge)
+{
+    return std::string(kind) + ":" + fn + ":" + std::to_string(node->line) +
+           ":" + std::to_string(node->column) + ":" + edge;
+}
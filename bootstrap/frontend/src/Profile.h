@@ -0,0 +1,36 @@
+#ifndef FRONTEND_PROFILE_H
+#define FRONTEND_PROFILE_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include "AstDefs.h"
+
+/**
+ * Execution counts written by a program built with --profile-generate, read
+ * back by --profile-use. Counters are named after their site rather than
+ * numbered, e.g. "fn:maini32" or "if:maini32:12:5:then", so a profile still
+ * applies to the parts of a program that did not change since it was taken.
+ */
+class Profile
+{
+public:
+  bool load(const std::string &path);
+
+  bool empty() const { return counts.empty(); }
+
+  uint64_t count(const std::string &site) const;
+
+  /** Whether a function entered count times is among the hottest ones */
+  bool is_hot(uint64_t count) const;
+
+  static std::string fn_site(const std::string &fn);
+  static std::string site(const char *kind, const std::string &fn,
+                          const AstNode *node, const char *edge);
+
+private:
+  std::map<std::string, uint64_t> counts;
+  uint64_t max_fn_count = 0;
+};
+
+#endif // FRONTEND_PROFILE_H
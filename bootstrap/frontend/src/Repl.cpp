@@ -0,0 +1,397 @@
+#include "Repl.h"
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include "CodeGen.h"
+#include "Terminal.h"
+
+#ifdef _WIN32
+#include <io.h>
+#define isatty _isatty
+#define fileno _fileno
+#endif
+
+// Declarations are loaded into the engine, everything else is run
+static bool is_declaration(const AstNode *stmt)
+{
+    switch (stmt->node_type)
+    {
+    case AstNodeType::AstFn:
+    case AstNodeType::AstStruct:
+    case AstNodeType::AstImpl:
+    case AstNodeType::AstAffix:
+    case AstNodeType::AstExtern:
+    case AstNodeType::AstAttribute:
+    case AstNodeType::AstImport:
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+static void print_error(const std::string &message, const std::string &path,
+                        unsigned int line, unsigned int column)
+{
+    printf("%s%s%s", term_fg[TermColour::Yellow], message.c_str(), term_reset);
+
+    if (line)
+    {
+        printf(" @ %s:%u:%u", path.c_str(), line, column);
+    }
+
+    printf("\n");
+}
+
+// Whether the input read so far can be run: its brackets are all closed,
+// outside of strings and comments, and it is not the start of a declaration
+// or statement still missing its block
+static bool is_complete(const std::string &source)
+{
+    int depth = 0;
+    bool in_string = false;
+
+    for (size_t i = 0; i < source.size(); i++)
+    {
+        auto c = source[i];
+
+        if (in_string)
+        {
+            if (c == '\\')
+            {
+                i++;
+            }
+            else if (c == '"')
+            {
+                in_string = false;
+            }
+        }
+        else if (c == '"')
+        {
+            in_string = true;
+        }
+        else if (source.compare(i, 2, "//") == 0)
+        {
+            i = source.find('\n', i);
+
+            if (i == std::string::npos)
+            {
+                break;
+            }
+        }
+        else if (source.compare(i, 2, "/*") == 0)
+        {
+            i = source.find("*/", i + 2);
+
+            if (i == std::string::npos)
+            {
+                return false;
+            }
+
+            i++;
+        }
+        else if (c == '(' || c == '[' || c == '{')
+        {
+            depth++;
+        }
+        else if (c == ')' || c == ']' || c == '}')
+        {
+            depth--;
+        }
+    }
+
+    if (depth > 0)
+    {
+        return false;
+    }
+
+    // A declaration or statement with a block can have its opening bracket
+    // on the next line
+    static const char *const openers[] = {
+        "fn",     "async", "struct", "impl",  "extern", "infix",
+        "prefix", "suffix", "if",    "else",  "loop",
+    };
+
+    auto last = source.find_last_not_of(" \t\r\n");
+
+    if (last == std::string::npos || source[last] == ';' ||
+        source[last] == '}')
+    {
+        return true;
+    }
+
+    auto begin = source.find_first_not_of(" \t\r\n");
+
+    if (source[begin] == '@')
+    {
+        return false;
+    }
+
+    auto end = source.find_first_of(" \t\r\n({", begin);
+    auto word = source.substr(begin, end - begin);
+
+    for (auto opener : openers)
+    {
+        if (word == opener)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+int Repl::run(const std::vector<std::string> &inputs)
+{
+    for (auto &input : inputs)
+    {
+        auto module = loader.load_file(input);
+        std::vector<Module *> added;
+
+        if (!analyse(module, added) || !execute(module, added))
+        {
+            return 1;
+        }
+    }
+
+    bool interactive = isatty(fileno(stdin));
+    std::string source;
+    std::string line;
+
+    while (true)
+    {
+        if (interactive)
+        {
+            printf(source.empty() ? "> " : "... ");
+            fflush(stdout);
+        }
+
+        if (!std::getline(std::cin, line))
+        {
+            break;
+        }
+
+        source += line + "\n";
+
+        if (!is_complete(source))
+        {
+            continue;
+        }
+
+        eval(source);
+        source.clear();
+    }
+
+    if (interactive)
+    {
+        printf("\n");
+    }
+
+    return 0;
+}
+
+Repl::~Repl()
+{
+    for (auto &module : lines)
+    {
+        delete module->ast.root;
+    }
+}
+
+bool Repl::eval(const std::string &source)
+{
+    auto last = source.find_last_not_of(" \t\r\n");
+
+    if (last == std::string::npos)
+    {
+        return true;
+    }
+
+    // An expression on its own does not need the semicolon
+    std::unique_ptr<Module> module(loader.load_source(
+        "<input>", source[last] == ';' || source[last] == '}'
+                       ? source
+                       : source.substr(0, last + 1) + ";\n"));
+
+    std::vector<Module *> added;
+
+    if (!analyse(module.get(), added))
+    {
+        delete module->ast.root;
+        return false;
+    }
+
+    lines.push_back(std::move(module));
+    return execute(lines.back().get(), added);
+}
+
+// Analyses module along with the modules it imports for the first time, which
+// are added to added
+bool Repl::analyse(Module *module, std::vector<Module *> &added)
+{
+    added.assign(loader.modules.begin() + analysed, loader.modules.end());
+
+    if (std::find(added.begin(), added.end(), module) == added.end())
+    {
+        added.push_back(module);
+    }
+
+    bool parsed = true;
+
+    for (auto m : added)
+    {
+        for (auto errors : {&m->tokens.errors, &m->errors})
+        {
+            for (auto &error : *errors)
+            {
+                print_error(error.message, m->path, error.line, error.column);
+                parsed = false;
+            }
+        }
+    }
+
+    if (!parsed)
+    {
+        return false;
+    }
+
+    // Nothing of the analysis of input that fails is kept
+    auto analysis = sem;
+    auto declared = scope;
+
+    // Variables declared again replace those before
+    for (auto stmt : module->ast.root->statements)
+    {
+        if (stmt->node_type == AstNodeType::AstDec)
+        {
+            auto name = ((AstDec *)stmt)->name;
+
+            scope.erase(std::remove_if(scope.begin(), scope.end(),
+                                       [&](AstDec *decl) {
+                                           return decl->name == name;
+                                       }),
+                        scope.end());
+        }
+    }
+
+    auto before = scope;
+
+    for (auto m : added)
+    {
+        sem.pass1(m->ast);
+    }
+
+    for (auto m : added)
+    {
+        sem.pass2(m->ast);
+    }
+
+    for (auto m : added)
+    {
+        sem.pass3(m->ast);
+    }
+
+    if (!sem.errors.empty())
+    {
+        for (auto &error : sem.errors)
+        {
+            print_error(error.message, module->path, error.line,
+                        error.column);
+        }
+
+        sem = analysis;
+        scope = declared;
+        return false;
+    }
+
+    for (auto m : added)
+    {
+        optimizer.optimize(m->ast);
+    }
+
+    analysed = loader.modules.size();
+
+    // Code generation declares the variables again as it goes
+    scope = before;
+    return true;
+}
+
+// Loads the declarations of the analysed modules and runs the other
+// statements of module
+bool Repl::execute(Module *module, const std::vector<Module *> &added)
+{
+    ILemitter declarations;
+    std::vector<AstNode *> statements;
+
+    for (auto m : added)
+    {
+        source_path = m->path;
+
+        for (auto stmt : m->ast.root->statements)
+        {
+            if (is_declaration(stmt))
+            {
+                generate_il(stmt, declarations, sem);
+            }
+            else if (m == module)
+            {
+                statements.push_back(stmt);
+            }
+        }
+    }
+
+    if (!engine.load(declarations))
+    {
+        print_error(engine.error, module->path, 0, 0);
+        return false;
+    }
+
+    for (auto stmt : statements)
+    {
+        ILemitter il;
+        generate_il(stmt, il, sem);
+
+        std::vector<ILvalue> results;
+
+        if (!engine.run(il, results))
+        {
+            print_error(engine.error, module->path, stmt->line, stmt->column);
+            return false;
+        }
+
+        if (!results.empty())
+        {
+            print_result(stmt, results.back());
+        }
+    }
+
+    return true;
+}
+
+// Prints the value an expression statement left, as the type it has
+void Repl::print_result(AstNode *stmt, const ILvalue &value)
+{
+    std::unique_ptr<AstType> type(sem.infer_type(stmt));
+    auto il_type = value.type;
+
+    if (type && !type->is_array)
+    {
+        if (type->name == "bool")
+        {
+            printf("%s\n", value.bits ? "true" : "false");
+            return;
+        }
+
+        auto found = type_map.find(type->name);
+
+        if (found != type_map.end())
+        {
+            il_type = found->second;
+        }
+    }
+
+    if (il_type != VOID)
+    {
+        printf("%s\n", engine.format(value, il_type).c_str());
+    }
+}
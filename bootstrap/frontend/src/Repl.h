@@ -0,0 +1,56 @@
+#ifndef FRONTEND_REPL_H
+#define FRONTEND_REPL_H
+
+#include <memory>
+#include <string>
+#include <vector>
+#include "ILengine.h"
+#include "ModuleLoader.h"
+#include "Optimizer.h"
+#include "Semantics.h"
+
+/**
+ * Reads statements and runs them as soon as they are complete. The analysis
+ * of everything before stays in sem, so only the new input and the modules it
+ * imports for the first time are analysed, and their code is generated and
+ * run in the engine right away. Functions, structs and variables declared at
+ * the top level are there for all input after. Input that does not analyse is
+ * dropped along with everything the analysis found out about it.
+ */
+class Repl
+{
+public:
+  Repl(ModuleLoader &loader, Semantics &sem)
+      : loader(loader), sem(sem), optimizer(sem)
+  {
+  }
+
+  ~Repl();
+
+  /**
+   * Runs the files, then reads and runs the standard input until it ends.
+   * Returns 1 if one of the files does not run.
+   */
+  int run(const std::vector<std::string> &inputs);
+
+  /** Analyses and runs a piece of input, returns whether it ran */
+  bool eval(const std::string &source);
+
+private:
+  ModuleLoader &loader;
+  Semantics &sem;
+  Optimizer optimizer;
+  ILengine engine;
+
+  // How many of the modules of the loader are analysed and loaded
+  size_t analysed = 0;
+
+  // The input read that was analysed, which the analysis keeps referring to
+  std::vector<std::unique_ptr<Module>> lines;
+
+  bool analyse(Module *module, std::vector<Module *> &added);
+  bool execute(Module *module, const std::vector<Module *> &added);
+  void print_result(AstNode *stmt, const ILvalue &value);
+};
+
+#endif // FRONTEND_REPL_H
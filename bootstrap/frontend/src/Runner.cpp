@@ -0,0 +1,409 @@
+#include "Runner.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include "CodeGen.h"
+#include "Optimizer.h"
+
+// How often the files of the program are checked for changes
+static const std::chrono::milliseconds poll_interval(200);
+
+static std::string read_file(const std::string &path)
+{
+    std::ifstream stream(path);
+    return std::string(std::istreambuf_iterator<char>(stream),
+                       std::istreambuf_iterator<char>());
+}
+
+// Errors of the analysis do not know their file
+static void print_error(const Error &error, const std::string &path)
+{
+    fprintf(stderr, "%s @ %s%s%u:%u\n", error.message.c_str(), path.c_str(),
+            path.empty() ? "" : ":", error.line, error.column);
+}
+
+static void clear_scopes()
+{
+    scope.clear();
+    args.clear();
+
+    while (!scope_stack.empty())
+    {
+        scope_stack.pop();
+    }
+
+    while (!arg_stack.empty())
+    {
+        arg_stack.pop();
+    }
+}
+
+static std::string type_name(const AstType *type)
+{
+    if (!type)
+    {
+        return "";
+    }
+
+    return type->is_array ? type_name(type->subtype) + "[]" : type->name;
+}
+
+// The name a function is written with, methods with their type
+static std::string source_name(const AstFn *fn)
+{
+    return fn->type_self.empty() ? fn->unmangled_name
+                                 : fn->type_self + "." + fn->unmangled_name;
+}
+
+// The fields of a struct in order, which decide where each of them is
+static std::string layout_of(const AstStruct *node)
+{
+    std::string layout;
+
+    for (auto stmt : node->block->statements)
+    {
+        if (stmt->node_type == AstNodeType::AstDec)
+        {
+            auto field = (AstDec *)stmt;
+            layout += field->name + ":" + type_name(field->type) + ";";
+        }
+    }
+
+    return layout;
+}
+
+int Runner::run(const std::vector<std::string> &inputs)
+{
+    this->inputs = inputs;
+
+    ILemitter il;
+
+    // IL written before, with --lto for one, runs as it is. As no source is
+    // loaded there is nothing to watch for changes.
+    auto &first = inputs.front();
+    bool prebuilt = inputs.size() == 1 && first.size() > 4 &&
+                    first.compare(first.size() - 4, 4, ".fil") == 0;
+
+    if (prebuilt)
+    {
+        std::ifstream stream(first, std::ios::binary);
+        il.stream.assign(std::istreambuf_iterator<char>(stream),
+                         std::istreambuf_iterator<char>());
+
+        if (il.stream.empty())
+        {
+            fprintf(stderr, "Could not read %s\n", first.c_str());
+            return 1;
+        }
+    }
+    else if (!compile(il, layouts))
+    {
+        return 1;
+    }
+
+    if (!engine.load(il))
+    {
+        fprintf(stderr, "%s\n", engine.error.c_str());
+        return 1;
+    }
+
+    // A snapshot that does not restore is saved again
+    bool restored = false;
+
+    if (!snapshot.empty())
+    {
+        restored = std::ifstream(snapshot).good() && engine.restore(snapshot);
+
+        if (!restored)
+        {
+            if (!engine.error.empty())
+            {
+                fprintf(stderr, "%s\n", engine.error.c_str());
+            }
+
+            engine.snapshot_path = snapshot;
+        }
+    }
+
+    std::mutex mutex;
+    std::condition_variable finished;
+    bool done = false;
+    bool ran = false;
+    std::vector<ILvalue> results;
+
+    std::thread program([&] {
+        ran = restored ? engine.resume(results) : engine.run("main", results);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        done = true;
+        finished.notify_one();
+    });
+
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while (!finished.wait_for(lock, poll_interval, [&] { return done; }))
+    {
+        lock.unlock();
+        reload();
+        lock.lock();
+    }
+
+    lock.unlock();
+    program.join();
+
+    if (!ran)
+    {
+        // What the program printed comes before the error it ended with
+        fflush(stdout);
+        fprintf(stderr, "%s\n", engine.error.c_str());
+        return 1;
+    }
+
+    return results.empty() ? 0 : (int)(int32_t)results.back().bits;
+}
+
+// Compiles the program as it is in its files now, without the optimizations
+// of the whole program, so every function keeps its name and the code of the
+// ones unchanged stays the same
+bool Runner::compile(ILemitter &il, std::map<std::string, std::string> &layouts)
+{
+    if (loader.modules.empty())
+    {
+        for (auto &input : inputs)
+        {
+            loader.load_file(input);
+        }
+    }
+
+    bool parsed = true;
+
+    for (auto module : loader.modules)
+    {
+        for (auto errors : {&module->tokens.errors, &module->errors})
+        {
+            for (auto &error : *errors)
+            {
+                print_error(error, module->path);
+                parsed = false;
+            }
+        }
+    }
+
+    if (!parsed)
+    {
+        return false;
+    }
+
+    // The trees as parsed are kept for the next change
+    std::vector<Ast> trees;
+    std::vector<std::unique_ptr<AstBlock>> copies;
+
+    for (auto module : loader.modules)
+    {
+        copies.emplace_back((AstBlock *)clone_ast(module->ast.root));
+        trees.push_back({copies.back().get(), module->path});
+    }
+
+    Semantics sem;
+    sem.bounds_check = bounds_check;
+
+    clear_scopes();
+
+    for (auto &ast : trees)
+    {
+        sem.pass1(ast);
+    }
+
+    for (auto &ast : trees)
+    {
+        sem.pass2(ast);
+    }
+
+    for (auto &ast : trees)
+    {
+        sem.pass3(ast);
+    }
+
+    if (!sem.errors.empty())
+    {
+        for (auto &error : sem.errors)
+        {
+            print_error(error, "");
+        }
+
+        return false;
+    }
+
+    Optimizer optimizer(sem);
+
+    for (auto &ast : trees)
+    {
+        optimizer.optimize(ast);
+    }
+
+    clear_scopes();
+
+    for (auto &ast : trees)
+    {
+        source_path = ast.path;
+        generate_il(ast.root, il, sem);
+
+        for (auto stmt : ast.root->statements)
+        {
+            if (stmt->node_type == AstNodeType::AstStruct)
+            {
+                auto node = (AstStruct *)stmt;
+                layouts[node->name] = layout_of(node);
+            }
+            else if (stmt->node_type == AstNodeType::AstFn)
+            {
+                auto node = (AstFn *)stmt;
+                names[sem.symbol(node)] = source_name(node);
+            }
+            else if (stmt->node_type == AstNodeType::AstAffix)
+            {
+                auto node = (AstAffix *)stmt;
+                names[sem.symbol(node)] = node->unmangled_name;
+            }
+            else if (stmt->node_type == AstNodeType::AstImpl)
+            {
+                for (auto method : ((AstImpl *)stmt)->block->statements)
+                {
+                    if (method->node_type == AstNodeType::AstFn)
+                    {
+                        names[sem.symbol((AstFn *)method)] =
+                            source_name((AstFn *)method);
+                    }
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
+// Parses again the part of every file of the program that changed since it
+// was last parsed, returns whether one did
+bool Runner::edit()
+{
+    bool changed = false;
+
+    // A change can import modules not loaded so far, they come last
+    for (size_t i = 0; i < loader.modules.size(); i++)
+    {
+        auto module = loader.modules[i];
+        auto text = read_file(module->path);
+        auto &source = module->source;
+
+        if (text == source)
+        {
+            continue;
+        }
+
+        // The change is what lies between the start and the end both share
+        size_t start = 0;
+        size_t end = 0;
+
+        while (start < text.size() && start < source.size() &&
+               text[start] == source[start])
+        {
+            start++;
+        }
+
+        while (end < text.size() - start && end < source.size() - start &&
+               text[text.size() - 1 - end] == source[source.size() - 1 - end])
+        {
+            end++;
+        }
+
+        loader.edit(module, start, source.size() - start - end,
+                    text.substr(start, text.size() - start - end));
+        changed = true;
+
+        if (check_reparse)
+        {
+            ModuleLoader full;
+            full.search_path = search_path;
+            auto parsed = full.load_source(module->path, module->source);
+
+            if (!same_ast(module->ast.root, parsed->ast.root))
+            {
+                fprintf(stderr, "Parsing the change of %s gave another tree "
+                                "than parsing all of it\n",
+                        module->path.c_str());
+            }
+
+            delete parsed->ast.root;
+            delete parsed;
+        }
+    }
+
+    return changed;
+}
+
+// Compiles the program again if it changed, and replaces the functions that
+// changed in the running engine
+void Runner::reload()
+{
+    // A change that does not compile is not tried again until the next one
+    if (!edit())
+    {
+        return;
+    }
+
+    ILemitter il;
+    std::map<std::string, std::string> changed_layouts;
+
+    if (!compile(il, changed_layouts))
+    {
+        fprintf(stderr, "The program does not compile, it keeps running as "
+                        "it was\n");
+        return;
+    }
+
+    for (auto &layout : layouts)
+    {
+        auto found = changed_layouts.find(layout.first);
+
+        if (found != changed_layouts.end() && found->second != layout.second)
+        {
+            fprintf(stderr, "The fields of %s changed, changing them needs a "
+                            "restart\n", layout.first.c_str());
+            return;
+        }
+    }
+
+    std::vector<std::string> replaced;
+    std::string reason;
+
+    if (!engine.replace(il, names, replaced, reason))
+    {
+        fprintf(stderr, "%s\n", reason.c_str());
+        return;
+    }
+
+    layouts.insert(changed_layouts.begin(), changed_layouts.end());
+
+    if (!replaced.empty())
+    {
+        std::string list;
+
+        // Overloads share their name in the source
+        for (size_t i = 0; i < replaced.size(); i++)
+        {
+            if (std::find(replaced.begin(), replaced.begin() + i,
+                          replaced[i]) == replaced.begin() + i)
+            {
+                list += (list.empty() ? "" : ", ") + replaced[i];
+            }
+        }
+
+        fprintf(stderr, "Replaced %s\n", list.c_str());
+    }
+}
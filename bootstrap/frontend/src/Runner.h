@@ -0,0 +1,72 @@
+#ifndef FRONTEND_RUNNER_H
+#define FRONTEND_RUNNER_H
+
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <vector>
+#include "ILengine.h"
+#include "ModuleLoader.h"
+
+/**
+ * Runs main of a program in the engine, and keeps compiling the program again
+ * while it runs whenever one of its files changes. Functions whose code
+ * changed are replaced in the running engine, so a long running program
+ * picks up a change without a restart. Changes that would not fit the state
+ * of the running program are refused: new functions, changed parameter or
+ * return types, and structs whose fields changed, as their layout is that of
+ * every instance already allocated.
+ *
+ * Only the part of a file a change is in is parsed again. With the
+ * DUSK_CHECK_REPARSE environment variable set, the trees this gives are
+ * compared with those of parsing the whole file, and every difference is
+ * reported.
+ *
+ * An input that is IL compiled before, a .fil file, is run as it is and not
+ * watched, so a program built with --lto or the other optimizations of the
+ * whole program can be run too.
+ *
+ * With a snapshot file, the program resumes from the state saved in it, or
+ * saves its state there when it calls dusk_snapshot, so the initialization
+ * before runs only once.
+ */
+class Runner
+{
+public:
+  Runner(const std::vector<std::string> &search_path, bool bounds_check,
+         const std::string &snapshot)
+      : search_path(search_path), bounds_check(bounds_check),
+        snapshot(snapshot), check_reparse(getenv("DUSK_CHECK_REPARSE") != nullptr)
+  {
+    loader.search_path = search_path;
+  }
+
+  /** Runs main of the program made of inputs, returns what main returns */
+  int run(const std::vector<std::string> &inputs);
+
+private:
+  std::vector<std::string> search_path;
+  bool bounds_check;
+  std::string snapshot;
+  bool check_reparse;
+
+  std::vector<std::string> inputs;
+  ILengine engine;
+
+  // The files of the program as they were parsed, with every change made to
+  // them since. Analysis and the optimizer work on copies of the trees.
+  ModuleLoader loader;
+
+  // The fields of every struct of the running program, by struct
+  std::map<std::string, std::string> layouts;
+
+  // The name in the source of every function compiled so far, by its name in
+  // the IL, for messages
+  std::map<std::string, std::string> names;
+
+  bool compile(ILemitter &il, std::map<std::string, std::string> &layouts);
+  bool edit();
+  void reload();
+};
+
+#endif // FRONTEND_RUNNER_H
@@ -1,5 +1,6 @@
 #include "Semantics.h"
 
+#include <set>
 #include <string>
 #include "Ast.h"
 #include "CodeGen.h"
@@ -8,19 +9,71 @@ using namespace std::literals::string_literals;
 
 static AstType *clone_type(const AstType *type)
 {
+    if (!type)
+    {
+        return nullptr;
+    }
+
     auto clone = new AstType();
     auto result = clone;
     clone->name = type->name;
+    clone->is_array = type->is_array;
     while (type->subtype)
     {
         clone->subtype = new AstType();
         clone->subtype->name = type->subtype->name;
+        clone->subtype->is_array = type->subtype->is_array;
         type = type->subtype;
         clone = clone->subtype;
     }
     return result;
 }
 
+// Variables that do not fit the 4 byte slots of @parallel environments and
+// async frames
+static bool is_wide(const AstType *type)
+{
+    return type && !type->is_array &&
+           (type->name == "u64" || type->name == "i64" || type->name == "f64");
+}
+
+static bool is_integer(const AstType *type)
+{
+    static const std::set<std::string> names = {
+        "u8", "u16", "u32", "u64", "i8", "i16", "i32", "i64"};
+
+    return type && !type->is_array && names.count(type->name);
+}
+
+// The await making up a whole statement, so nothing is left on the stack when
+// its function suspends, nullptr if there is none
+static AstAwait *statement_await(AstNode *stmt)
+{
+    auto expr = stmt;
+
+    if (stmt->node_type == AstNodeType::AstDec)
+    {
+        expr = ((AstDec *)stmt)->value;
+    }
+    else if (stmt->node_type == AstNodeType::AstReturn)
+    {
+        expr = ((AstReturn *)stmt)->expr;
+    }
+    else if (stmt->node_type == AstNodeType::AstBinaryExpr &&
+             ((AstBinaryExpr *)stmt)->op == "=" &&
+             ((AstBinaryExpr *)stmt)->lhs->node_type == AstNodeType::AstSymbol)
+    {
+        expr = ((AstBinaryExpr *)stmt)->rhs;
+    }
+
+    if (expr && expr->node_type == AstNodeType::AstAwait)
+    {
+        return (AstAwait *)expr;
+    }
+
+    return nullptr;
+}
+
 bool Semantics::p1_has_symbol(const std::string &symbol)
 {
     for (auto sym : p1_funcs)
@@ -95,7 +148,7 @@ AstFn *Semantics::p2_get_fn(const std::string &name)
 {
     for (auto sym : p2_funcs)
     {
-        if (sym->mangled_name == name)
+        if (symbol(sym) == name)
         {
             return sym;
         }
@@ -149,7 +202,7 @@ AstAffix *Semantics::p2_get_affix(const std::string &name)
 {
     for (auto sym : p2_affixes)
     {
-        if (sym->mangled_name == name)
+        if (symbol(sym) == name)
         {
             return sym;
         }
@@ -212,14 +265,6 @@ void Semantics::pass1_node(AstNode *node)
         break;
 
     case AstNodeType::AstImpl:
-        for (auto stmt : ((AstImpl *)node)->block->statements)
-        {
-            if (stmt->node_type == AstNodeType::AstFn)
-            {
-                ((AstFn *)stmt)->type_self = ((AstImpl *)node)->name;
-            }
-        }
-
         pass1_node(((AstImpl *)node)->block);
         break;
 
@@ -235,6 +280,22 @@ void Semantics::pass1_node(AstNode *node)
     }
 }
 
+AstType *Semantics::own(AstType *type)
+{
+    if (type)
+    {
+        owned.emplace_back(type);
+    }
+
+    return type;
+}
+
+AstDec *Semantics::own(AstDec *decl)
+{
+    owned.emplace_back(decl);
+    return decl;
+}
+
 void Semantics::pass1(Ast &ast)
 {
     pass1_node(ast.root);
@@ -296,10 +357,12 @@ static std::string type_to_string(const AstType *node)
 
 void Semantics::p2_affix(AstAffix *node)
 {
-    node->mangled_name += node->unmangled_name;
+    auto &symbol = symbols[node->id];
+
+    symbol = node->mangled_name + node->unmangled_name;
     for (auto a : node->params)
     {
-        node->mangled_name += type_to_string(a->type);
+        symbol += type_to_string(a->type);
     }
 
     if (node->return_type)
@@ -332,20 +395,24 @@ void Semantics::p2_affix(AstAffix *node)
 
 void Semantics::p2_fn(AstFn *node)
 {
+    auto &symbol = symbols[node->id];
+
+    symbol = node->mangled_name;
+
     if (node->body)
     {
         for (auto param : node->params)
         {
-            node->mangled_name += type_to_string(param->type);
+            symbol += type_to_string(param->type);
         }
     }
 
     if (node->type_self != "")
     {
 
-        node->mangled_name = node->type_self + "_" + node->mangled_name;
+        symbol = node->type_self + "_" + symbol;
 
-        //  printf("%s \n", node->mangled_name.c_str());
+        //  printf("%s \n", symbol.c_str());
 
         if (!p1_has_symbol(node->type_self))
         {
@@ -356,13 +423,15 @@ void Semantics::p2_fn(AstFn *node)
         }
 
         // we need to add implicit self
-        AstDec *self = new AstDec();
+        AstDec *self = own(new AstDec());
         self->name = "self";
 
         self->type = new AstType();
         self->type->name = node->type_self;
 
-        node->params.insert(node->params.begin(), self);
+        auto &params = method_params[node->id];
+        params = node->params;
+        params.insert(params.begin(), self);
         add_arg(self);
     }
 
@@ -377,7 +446,7 @@ void Semantics::p2_fn(AstFn *node)
         }
     }
 
-    for (auto param : node->params)
+    for (auto param : params(node))
     {
         if (param->type)
         {
@@ -430,63 +499,747 @@ void Semantics::pass3(Ast &ast)
     pass3_node(ast.root);
 }
 
+// Only top level attributes are emitted, not those in functions
 void Semantics::pass3_nest_att(AstNode *node)
 {
-    if (node->node_type == AstNodeType::AstAttribute)
+    if (node->node_type == AstNodeType::AstAttribute && nest_in_fn)
+    {
+        hidden.insert(node->id);
+    }
+
+    switch (node->node_type)
+    {
+    case AstNodeType::AstBlock:
+    {
+        auto block = (AstBlock *)node;
+
+        for (auto stmt : block->statements)
+        {
+            pass3_nest_att(stmt);
+        }
+
+        break;
+    }
+
+    case AstNodeType::AstStruct:
+    {
+        auto struc = (AstStruct *)node;
+
+        for (auto stmt : struc->block->statements)
+        {
+            pass3_nest_att(stmt);
+        }
+
+        break;
+    }
+
+    case AstNodeType::AstImpl:
+    {
+        auto impl = (AstImpl *)node;
+
+        for (auto stmt : impl->block->statements)
+        {
+            pass3_nest_att(stmt);
+        }
+
+        break;
+    }
+
+    case AstNodeType::AstFn:
+    {
+        auto fn = (AstFn *)node;
+
+        if (fn->body)
+        {
+            auto outer = nest_in_fn;
+            nest_in_fn = true;
+            pass3_nest_att(fn->body);
+            nest_in_fn = outer;
+        }
+
+        break;
+    }
+
+    case AstNodeType::AstIf:
+    {
+        auto if_stmt = (AstIf *)node;
+
+        pass3_nest_att(if_stmt->true_block);
+
+        if (if_stmt->false_block)
+        {
+            pass3_nest_att(if_stmt->false_block);
+        }
+
+        break;
+    }
+
+    case AstNodeType::AstLoop:
+        pass3_nest_att(((AstLoop *)node)->body);
+        break;
+
+    default:
+        break;
+    }
+}
+
+void Semantics::p3_attributes(AstNode *node)
+{
+    for (auto attribute : node->attributes)
     {
-        nest_flag = true;
-        attributes.push_back((AstAttribute *)node);
+        if (attribute->name == "il")
+        {
+            hidden.insert(node->id);
+        }
+        else if (attribute->name == "arena")
+        {
+            // @arena(name) or @arena(name, chunk_size)
+            auto &args = attribute->args;
+
+            if (node->node_type != AstNodeType::AstBlock &&
+                node->node_type != AstNodeType::AstFn)
+            {
+                this->errors.emplace_back(
+                    ErrorType::InvalidAttribute, attribute,
+                    "@arena can only be applied to a block or a function");
+            }
+            else if (args.empty() || args.size() > 2 ||
+                     args[0]->node_type != AstNodeType::AstSymbol ||
+                     (args.size() == 2 &&
+                      args[1]->node_type != AstNodeType::AstNumber))
+            {
+                this->errors.emplace_back(
+                    ErrorType::InvalidAttribute, attribute,
+                    "Expected @arena(name) or @arena(name, chunk_size)");
+            }
+        }
+        else if (attribute->name == "parallel")
+        {
+            // @parallel, or @parallel(a, b) to reduce into a and b
+            if (node->node_type != AstNodeType::AstLoop ||
+                !((AstLoop *)node)->is_foreach)
+            {
+                this->errors.emplace_back(
+                    ErrorType::InvalidAttribute, attribute,
+                    "@parallel can only be applied to a counted loop");
+            }
+
+            for (auto arg : attribute->args)
+            {
+                if (arg->node_type != AstNodeType::AstSymbol)
+                {
+                    this->errors.emplace_back(
+                        ErrorType::InvalidAttribute, arg,
+                        "Expected the name of a variable to reduce into");
+                }
+            }
+        }
+        else if (attribute->name == "hot" || attribute->name == "cold")
+        {
+            if (node->node_type != AstNodeType::AstFn)
+            {
+                this->errors.emplace_back(
+                    ErrorType::InvalidAttribute, attribute,
+                    "@hot and @cold can only be applied to a function");
+            }
+            else if (find_attribute(node, "hot") && find_attribute(node, "cold"))
+            {
+                this->errors.emplace_back(
+                    ErrorType::InvalidAttribute, attribute,
+                    "A function can not be both @hot and @cold");
+            }
+        }
+        else if (attribute->name == "likely" || attribute->name == "unlikely")
+        {
+            if (node->node_type != AstNodeType::AstIf)
+            {
+                this->errors.emplace_back(
+                    ErrorType::InvalidAttribute, attribute,
+                    "@likely and @unlikely can only be applied to an if");
+            }
+            else if (find_attribute(node, "likely") &&
+                     find_attribute(node, "unlikely"))
+            {
+                this->errors.emplace_back(
+                    ErrorType::InvalidAttribute, attribute,
+                    "An if can not be both @likely and @unlikely");
+            }
+        }
+        else if (attribute->name == "pure")
+        {
+            if (node->node_type != AstNodeType::AstFn)
+            {
+                this->errors.emplace_back(
+                    ErrorType::InvalidAttribute, attribute,
+                    "@pure can only be applied to a function");
+            }
+            else if (((AstFn *)node)->is_async)
+            {
+                this->errors.emplace_back(
+                    ErrorType::InvalidAttribute, attribute,
+                    "An async function can not be @pure");
+            }
+        }
+    }
+}
+
+// What the body of a @parallel loop touches
+struct ParallelCheck
+{
+    AstLoop *loop;
+    ParallelLoop shared;
+    std::set<std::string> locals; // Declared by the body, counters included
+    std::map<std::string, std::string> reductions; // To the operator used
+    std::set<std::string> stored;    // Arrays stored to at the counter
+    std::set<std::string> scattered; // Arrays accessed at another index
+};
+
+static bool is_counter(const AstNode *node, const AstLoop *loop)
+{
+    return node->node_type == AstNodeType::AstSymbol &&
+           ((AstSymbol *)node)->name == loop->name;
+}
+
+static void add_capture(std::vector<AstDec *> &decls, AstDec *decl)
+{
+    for (auto known : decls)
+    {
+        if (known == decl)
+        {
+            return;
+        }
+    }
+
+    decls.push_back(decl);
+}
+
+// Iterations of a @parallel loop run in any order and at the same time, so
+// its body may only store to arrays at the counter, to its own variables and
+// into the declared reductions, which must be of the form `x = x + ...` or
+// `x = x * ...`. Outer variables are read through copies.
+void Semantics::p3_parallel(AstLoop *loop, AstAttribute *attribute)
+{
+    ParallelCheck check;
+    check.loop = loop;
+    check.locals.insert(loop->name);
+
+    auto &shared = parallel_loops[loop->id];
+    shared = ParallelLoop();
+
+    auto type = type_of(counter(loop));
+
+    if (!type || type->name != "i32")
+    {
+        this->errors.emplace_back(
+            ErrorType::InvalidAttribute, attribute,
+            "A @parallel loop must count with an i32");
+        return;
+    }
+
+    for (auto arg : attribute->args)
+    {
+        auto name = ((AstSymbol *)arg)->name;
+        auto decl = get_local(name);
+
+        if (!decl || decl->immutable)
+        {
+            this->errors.emplace_back(
+                ErrorType::InvalidAttribute, arg,
+                "Only mutable local variables can be reduced into");
+            continue;
+        }
+
+        static const std::set<std::string> reducible = {
+            "u8", "u16", "u32", "i8", "i16", "i32", "f32"};
+
+        if (!type_of(decl) || type_of(decl)->is_array ||
+            !reducible.count(type_of(decl)->name))
+        {
+            this->errors.emplace_back(
+                ErrorType::InvalidAttribute, arg,
+                "Only numbers of at most 32 bits can be reduced into");
+            continue;
+        }
+
+        check.reductions[name] = "";
+        add_capture(check.shared.captures, decl);
     }
-    else if (nest_flag)
+
+    p3_parallel_node(loop->body, check);
+
+    for (auto arg : attribute->args)
     {
-        nest_flag = false;
+        auto name = ((AstSymbol *)arg)->name;
 
-        for (auto attribute : attributes)
+        if (check.reductions.count(name))
         {
-            node->attributes.push_back(attribute);
+            check.shared.reductions.emplace_back(
+                get_local(name), check.reductions[name]);
         }
+    }
+
+    shared = check.shared;
 
-        attributes.clear();
+    for (auto &array : check.stored)
+    {
+        if (check.scattered.count(array))
+        {
+            this->errors.emplace_back(
+                ErrorType::LoopDependence, loop,
+                "An array stored to at the counter is also accessed at "
+                "another index, so iterations depend on each other");
+        }
     }
 
+    for (auto decl : shared.captures)
+    {
+        if (is_wide(type_of(decl)))
+        {
+            this->errors.emplace_back(
+                ErrorType::InvalidAttribute, loop,
+                "A @parallel loop can not use 64 bit variables of its "
+                "function");
+        }
+    }
+}
+
+void Semantics::p3_parallel_node(AstNode *node, ParallelCheck &check)
+{
+    if (!node)
+    {
+        return;
+    }
+
+    auto loop = check.loop;
+
     switch (node->node_type)
     {
     case AstNodeType::AstBlock:
+        for (auto stmt : ((AstBlock *)node)->statements)
+        {
+            p3_parallel_node(stmt, check);
+        }
+        break;
+
+    case AstNodeType::AstNumber:
+    case AstNodeType::AstString:
+    case AstNodeType::AstBoolean:
+    case AstNodeType::AstAttribute:
+    case AstNodeType::AstContinue:
+        break;
+
+    case AstNodeType::AstArray:
+        for (auto ele : ((AstArray *)node)->elements)
+        {
+            p3_parallel_node(ele, check);
+        }
+        break;
+
+    case AstNodeType::AstDec:
     {
-        auto block = (AstBlock *)node;
+        auto decl = (AstDec *)node;
+        p3_parallel_node(decl->value, check);
+        check.locals.insert(decl->name);
+        break;
+    }
+
+    case AstNodeType::AstIf:
+    {
+        auto if_stmt = (AstIf *)node;
+        p3_parallel_node(if_stmt->condition, check);
+        p3_parallel_node(if_stmt->true_block, check);
+        p3_parallel_node(if_stmt->false_block, check);
+        break;
+    }
+
+    case AstNodeType::AstLoop:
+    {
+        auto inner = (AstLoop *)node;
+
+        if (inner->is_foreach)
+        {
+            check.locals.insert(inner->name);
+        }
+
+        p3_parallel_node(inner->expr, check);
+        p3_parallel_node(inner->body, check);
+        break;
+    }
+
+    case AstNodeType::AstFnCall:
+    {
+        auto call = (AstFnCall *)node;
+        auto fn = p2_get_fn(callee(call));
+        bool is_il = false;
+
+        if (fn)
+        {
+            for (auto attribute : fn->attributes)
+            {
+                is_il = is_il || attribute->name == "il";
+            }
+        }
+
+        // Anything else might have side effects shared between iterations
+        if (!is_il && !p2_get_struct(callee(call)) && !is_array_length(call))
+        {
+            this->errors.emplace_back(
+                ErrorType::LoopDependence, call,
+                "A @parallel loop can only call @il functions");
+        }
+
+        for (auto arg : call->args)
+        {
+            p3_parallel_node(arg, check);
+        }
+        break;
+    }
+
+    case AstNodeType::AstUnaryExpr:
+        p3_parallel_node(((AstUnaryExpr *)node)->expr, check);
+        break;
+
+    case AstNodeType::AstIndex:
+    {
+        auto index = (AstIndex *)node;
+
+        if (index->array->node_type == AstNodeType::AstSymbol &&
+            !is_counter(index->expr, loop))
+        {
+            check.scattered.insert(((AstSymbol *)index->array)->name);
+        }
+
+        p3_parallel_node(index->array, check);
+        p3_parallel_node(index->expr, check);
+        break;
+    }
+
+    case AstNodeType::AstSymbol:
+    {
+        auto &name = ((AstSymbol *)node)->name;
+
+        if (check.locals.count(name))
+        {
+            break;
+        }
+
+        if (check.reductions.count(name))
+        {
+            this->errors.emplace_back(
+                ErrorType::LoopDependence, node,
+                "A reduction can only be used to accumulate into it");
+        }
+        else if (auto decl = get_local(name))
+        {
+            add_capture(check.shared.captures, decl);
+        }
+        else if (auto decl = get_arg(name))
+        {
+            add_capture(check.shared.captures, decl);
+        }
+        break;
+    }
+
+    case AstNodeType::AstBinaryExpr:
+    {
+        auto bin_expr = (AstBinaryExpr *)node;
+
+        if (bin_expr->op == ".")
+        {
+            // The right hand side names a field or a method
+            p3_parallel_node(bin_expr->lhs, check);
+
+            if (bin_expr->rhs->node_type == AstNodeType::AstFnCall)
+            {
+                p3_parallel_node(bin_expr->rhs, check);
+            }
+            break;
+        }
+
+        if (bin_expr->op != "=")
+        {
+            p3_parallel_node(bin_expr->lhs, check);
+            p3_parallel_node(bin_expr->rhs, check);
+            break;
+        }
+
+        auto lhs = bin_expr->lhs;
+        auto rhs = bin_expr->rhs;
+
+        if (lhs->node_type == AstNodeType::AstSymbol &&
+            check.locals.count(((AstSymbol *)lhs)->name))
+        {
+            p3_parallel_node(rhs, check);
+        }
+        else if (lhs->node_type == AstNodeType::AstSymbol &&
+                 check.reductions.count(((AstSymbol *)lhs)->name))
+        {
+            auto accumulate = (AstBinaryExpr *)rhs;
+            auto &op = check.reductions[((AstSymbol *)lhs)->name];
+
+            if (rhs->node_type != AstNodeType::AstBinaryExpr ||
+                (accumulate->op[0] != '+' && accumulate->op[0] != '*') ||
+                accumulate->lhs->node_type != AstNodeType::AstSymbol ||
+                ((AstSymbol *)accumulate->lhs)->name !=
+                    ((AstSymbol *)lhs)->name)
+            {
+                this->errors.emplace_back(
+                    ErrorType::LoopDependence, node,
+                    "Expected a reduction of the form `x = x + ...` or "
+                    "`x = x * ...`");
+                break;
+            }
+
+            if (!op.empty() && op != this->op(accumulate))
+            {
+                this->errors.emplace_back(
+                    ErrorType::LoopDependence, node,
+                    "A reduction must always accumulate with the same "
+                    "operator");
+            }
+
+            op = this->op(accumulate);
+            p3_parallel_node(accumulate->rhs, check);
+        }
+        else if (lhs->node_type == AstNodeType::AstIndex &&
+                 ((AstIndex *)lhs)->array->node_type ==
+                     AstNodeType::AstSymbol &&
+                 is_counter(((AstIndex *)lhs)->expr, loop))
+        {
+            auto array = (AstSymbol *)((AstIndex *)lhs)->array;
+
+            check.stored.insert(array->name);
+            p3_parallel_node(array, check);
+            p3_parallel_node(rhs, check);
+        }
+        else
+        {
+            this->errors.emplace_back(
+                ErrorType::LoopDependence, node,
+                "A @parallel loop can only store to arrays at its counter, "
+                "its own variables and its reductions");
+        }
+        break;
+    }
+
+    case AstNodeType::AstAwait:
+        this->errors.emplace_back(
+            ErrorType::LoopDependence, node,
+            "A @parallel loop can not await");
+        break;
+
+    default:
+        this->errors.emplace_back(
+            ErrorType::LoopDependence, node,
+            "A @parallel loop can not break or return");
+        break;
+    }
+}
+
+// The local variables of a @pure function, the only ones it may store to
+struct PureCheck
+{
+    std::set<std::string> locals;
+};
+
+bool Semantics::is_pure(const AstFn *fn)
+{
+    return fn && find_attribute(fn, "pure");
+}
+
+// Whether an operator only computes its result from its operands: it is
+// @pure, or inlines nothing but calls to @pure intrinsics
+bool Semantics::is_pure_op(const std::string &op)
+{
+    auto affix = p2_get_affix(op);
+
+    if (!affix || !affix->body)
+    {
+        return false;
+    }
+
+    if (find_attribute(affix, "pure"))
+    {
+        return true;
+    }
+
+    if (!find_attribute(affix, "inline"))
+    {
+        return false;
+    }
+
+    for (auto stmt : affix->body->statements)
+    {
+        if (stmt->node_type != AstNodeType::AstFnCall ||
+            !is_pure(p2_get_fn(callee((AstFnCall *)stmt))))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// A @pure function may read anything, but only store to its own variables
+// and only call @pure functions and operators, so a call can be evaluated
+// any number of times, including none
+void Semantics::p3_pure(AstFn *fn)
+{
+    PureCheck check;
+
+    for (auto param : params(fn))
+    {
+        check.locals.insert(param->name);
+    }
+
+    p3_pure_node(fn->body, check);
+}
+
+void Semantics::p3_pure_node(AstNode *node, PureCheck &check)
+{
+    if (!node)
+    {
+        return;
+    }
+
+    switch (node->node_type)
+    {
+    case AstNodeType::AstBlock:
+        for (auto stmt : ((AstBlock *)node)->statements)
+        {
+            p3_pure_node(stmt, check);
+        }
+        break;
+
+    case AstNodeType::AstArray:
+        this->errors.emplace_back(
+            ErrorType::ImpureFunction, node,
+            "A @pure function can not allocate arrays");
+        break;
+
+    case AstNodeType::AstDec:
+    {
+        auto decl = (AstDec *)node;
+        p3_pure_node(decl->value, check);
+        check.locals.insert(decl->name);
+        break;
+    }
+
+    case AstNodeType::AstIf:
+    {
+        auto if_stmt = (AstIf *)node;
+        p3_pure_node(if_stmt->condition, check);
+        p3_pure_node(if_stmt->true_block, check);
+        p3_pure_node(if_stmt->false_block, check);
+        break;
+    }
+
+    case AstNodeType::AstLoop:
+    {
+        auto loop = (AstLoop *)node;
+
+        if (loop->is_foreach)
+        {
+            check.locals.insert(loop->name);
+        }
+
+        p3_pure_node(loop->expr, check);
+        p3_pure_node(loop->body, check);
+        break;
+    }
+
+    case AstNodeType::AstReturn:
+        p3_pure_node(((AstReturn *)node)->expr, check);
+        break;
+
+    case AstNodeType::AstFnCall:
+    {
+        auto call = (AstFnCall *)node;
+
+        if (p2_get_struct(callee(call)))
+        {
+            this->errors.emplace_back(
+                ErrorType::ImpureFunction, call,
+                "A @pure function can not create structs");
+        }
+        else if (!is_array_length(call) && !is_pure(p2_get_fn(callee(call))))
+        {
+            this->errors.emplace_back(
+                ErrorType::ImpureFunction, call,
+                "A @pure function can only call @pure functions");
+        }
 
-        for (auto stmt : block->statements)
+        for (auto arg : call->args)
         {
-            pass3_nest_att(stmt);
+            p3_pure_node(arg, check);
         }
-
         break;
     }
 
-    case AstNodeType::AstStruct:
+    case AstNodeType::AstUnaryExpr:
     {
-        auto struc = (AstStruct *)node;
+        auto un_expr = (AstUnaryExpr *)node;
 
-        for (auto stmt : struc->block->statements)
+        if (!is_pure_op(op(un_expr)))
         {
-            pass3_nest_att(stmt);
+            this->errors.emplace_back(
+                ErrorType::ImpureFunction, un_expr,
+                "A @pure function can only use @pure operators");
         }
 
+        p3_pure_node(un_expr->expr, check);
         break;
     }
 
-    case AstNodeType::AstImpl:
+    case AstNodeType::AstIndex:
+        p3_pure_node(((AstIndex *)node)->array, check);
+        p3_pure_node(((AstIndex *)node)->expr, check);
+        break;
+
+    case AstNodeType::AstBinaryExpr:
     {
-        auto impl = (AstImpl *)node;
+        auto bin_expr = (AstBinaryExpr *)node;
 
-        for (auto stmt : impl->block->statements)
+        if (bin_expr->op == ".")
         {
-            pass3_nest_att(stmt);
+            // The right hand side names a field or a method
+            p3_pure_node(bin_expr->lhs, check);
+
+            if (bin_expr->rhs->node_type == AstNodeType::AstFnCall)
+            {
+                p3_pure_node(bin_expr->rhs, check);
+            }
+            break;
+        }
+
+        if (bin_expr->op == "=")
+        {
+            if (bin_expr->lhs->node_type != AstNodeType::AstSymbol ||
+                !check.locals.count(((AstSymbol *)bin_expr->lhs)->name))
+            {
+                this->errors.emplace_back(
+                    ErrorType::ImpureFunction, bin_expr,
+                    "A @pure function can only store to its own variables");
+            }
+        }
+        else if (!is_pure_op(op(bin_expr)))
+        {
+            this->errors.emplace_back(
+                ErrorType::ImpureFunction, bin_expr,
+                "A @pure function can only use @pure operators");
         }
 
+        p3_pure_node(bin_expr->lhs, check);
+        p3_pure_node(bin_expr->rhs, check);
         break;
     }
 
+    case AstNodeType::AstAwait:
+        this->errors.emplace_back(
+            ErrorType::ImpureFunction, node,
+            "A @pure function can not await");
+        break;
+
     default:
         break;
     }
@@ -494,13 +1247,7 @@ void Semantics::pass3_nest_att(AstNode *node)
 
 void Semantics::pass3_node(AstNode *node)
 {
-    for (auto attribute : node->attributes)
-    {
-        if (attribute->name == "il")
-        {
-            node->emit = false;
-        }
-    }
+    p3_attributes(node);
 
     switch (node->node_type)
     {
@@ -510,8 +1257,12 @@ void Semantics::pass3_node(AstNode *node)
 
         for (auto stmt : block->statements)
         {
+            if (auto await = statement_await(stmt))
+            {
+                statement_awaits.insert(await->id);
+            }
+
             pass3_node(stmt);
-            stmt = inline_if_need_be(stmt);
         }
 
         break;
@@ -530,19 +1281,25 @@ void Semantics::pass3_node(AstNode *node)
     {
         auto array = (AstArray *)node;
 
-        if (array->elements.size() == 0 && !array->ele_type)
+        if (array->elements.size() == 0 && !type_of(array))
         {
             printf("The type of the array can not be inferred, please provide type information\n");
         }
 
-        if (!array->ele_type)
+        if (!type_of(array))
         {
-            array->ele_type = infer_type(array);
+            types[array->id] = own(infer_type(array));
         }
 
         for (auto ele : array->elements)
         {
-            if (infer_type(ele)->name != array->ele_type->subtype->name)
+            auto type = infer_type(ele);
+            bool same = type && type_of(array) && type_of(array)->subtype &&
+                        type->name == type_of(array)->subtype->name;
+
+            delete type;
+
+            if (!same)
             {
                 printf("The element(s) in the array are not of the same type\n");
                 break;
@@ -555,9 +1312,16 @@ void Semantics::pass3_node(AstNode *node)
     {
         auto decl = (AstDec *)node;
 
-        if (!decl->type)
+        // The type of a call is only known once its name is mangled
+        if (!type_of(decl) && decl->value &&
+            decl->value->node_type != AstNodeType::AstArray)
+        {
+            pass3_node(decl->value);
+        }
+
+        if (!type_of(decl))
         {
-            decl->type = infer_type(decl->value);
+            types[decl->id] = own(infer_type(decl->value));
         } /*else {
             if(x->type->name != infer_type(x->value)->name) {
                 printf(
@@ -569,15 +1333,21 @@ void Semantics::pass3_node(AstNode *node)
 
         if (decl->value->node_type == AstNodeType::AstArray)
         {
-            auto arry = (AstArray *)decl->value;
-            arry->ele_type = decl->type;
+            types[decl->value->id] = own(clone_type(type_of(decl)));
         }
 
         if (decl->value)
         {
             pass3_node(decl->value);
-            decl->value = inline_if_need_be(decl->value);
         }
+
+        if (in_async && is_wide(type_of(decl)))
+        {
+            this->errors.emplace_back(
+                ErrorType::InvalidDecl, decl,
+                "Variables of async functions can be at most 32 bits wide");
+        }
+
         add_local(decl);
         break;
     }
@@ -587,20 +1357,15 @@ void Semantics::pass3_node(AstNode *node)
         auto if_stmt = (AstIf *)node;
 
         pass3_node(if_stmt->condition);
-        if_stmt->condition = inline_if_need_be(if_stmt->condition);
 
         for (auto stmt : if_stmt->true_block->statements)
         {
-            pass3_node(stmt);
-            stmt = inline_if_need_be(stmt);
-        }
-
-        if (if_stmt->false_block)
-        {
-            for (auto stmt : if_stmt->false_block->statements)
+            if (auto await = statement_await(stmt))
             {
-                stmt = inline_if_need_be(stmt);
+                statement_awaits.insert(await->id);
             }
+
+            pass3_node(stmt);
         }
 
         break;
@@ -612,7 +1377,7 @@ void Semantics::pass3_node(AstNode *node)
 
         for (auto func : p2_funcs)
         {
-            if (func != fn && func->mangled_name == fn->mangled_name)
+            if (func != fn && symbol(func) == symbol(fn))
             {
                 this->errors.emplace_back(
                     ErrorType::DuplicateFunctionDeclaration, fn,
@@ -623,10 +1388,36 @@ void Semantics::pass3_node(AstNode *node)
 
         if (fn->body)
         {
-            for (auto stmt : fn->body->statements)
+            push_scope();
+            scope.clear();
+            args.clear();
+
+            for (auto param : params(fn))
+            {
+                add_arg(param);
+
+                if (fn->is_async && is_wide(param->type))
+                {
+                    this->errors.emplace_back(
+                        ErrorType::InvalidDecl, param,
+                        "Parameters of async functions can be at most 32 "
+                        "bits wide");
+                }
+            }
+
+            in_async = fn->is_async;
+            loop_depth = 0;
+
+            pass3_node(fn->body);
+
+            in_async = false;
+
+            if (is_pure(fn) && !find_attribute(fn, "il"))
             {
-                pass3_node(fn->body);
+                p3_pure(fn);
             }
+
+            pop_scope();
         }
 
         break;
@@ -637,9 +1428,15 @@ void Semantics::pass3_node(AstNode *node)
         auto fn_call = (AstFnCall *)node;
         auto fn = p2_get_fn_unmangled(fn_call->name);
 
-        if (!fn_call->mangled && fn && fn->body)
+        // Arguments first, their types make up the mangled name
+        for (auto arg : fn_call->args)
+        {
+            pass3_node(arg);
+        }
+
+        if (!resolved_names.count(fn_call->id) && fn && fn->body)
         {
-            fn_call->mangled = true;
+            auto name = fn_call->name;
             int i = 0;
             if (fn->type_self != "")
             {
@@ -647,13 +1444,26 @@ void Semantics::pass3_node(AstNode *node)
             }
             for (; i < fn_call->args.size(); i++)
             {
-                auto arg = fn_call->args[i];
-                fn_call->name += type_to_string(infer_type(arg));
+                auto type = infer_type(fn_call->args[i]);
+
+                if (!type)
+                {
+                    this->errors.emplace_back(
+                        ErrorType::NoType, fn_call->args[i],
+                        "The type of an argument of " + fn_call->name +
+                            " can not be inferred");
+                    return;
+                }
+
+                name += type_to_string(type);
+                delete type;
             }
+
+            resolved_names[fn_call->id] = name;
         }
 
         {
-            auto fn = p2_get_fn(fn_call->name);
+            auto fn = p2_get_fn(callee(fn_call));
 
             if (fn && fn->attributes.empty())
             {
@@ -661,24 +1471,26 @@ void Semantics::pass3_node(AstNode *node)
                 {
                     if (attribute->name == "inline")
                     {
-                        fn_call->emit = false;
+                        hidden.insert(fn_call->id);
                     }
                 }
             }
         }
 
         {
-            auto fn = p2_get_fn(fn_call->name);
+            auto fn = p2_get_fn(callee(fn_call));
 
             if (fn && fn->body)
             {
-                if (fn->params.size() > fn_call->args.size())
+                auto &params = this->params(fn);
+
+                if (params.size() > fn_call->args.size())
                 {
                     this->errors.emplace_back(
                         ErrorType::TooManyArguments, fn_call,
                         "Too many arguments to function call");
                 }
-                else if (fn->params.size() < fn_call->args.size())
+                else if (params.size() < fn_call->args.size())
                 {
                     this->errors.emplace_back(
                         ErrorType::NotEnoughArguments, fn_call,
@@ -686,12 +1498,13 @@ void Semantics::pass3_node(AstNode *node)
                 }
                 else
                 {
-                    for (size_t i = 0; i < fn->params.size(); i++)
+                    for (size_t i = 0; i < params.size(); i++)
                     {
-                        auto param_type = infer_type(fn->params.at(i));
+                        auto param_type = clone_type(params.at(i)->type);
                         auto arg_type = infer_type(fn_call->args.at(i));
 
-                        if (param_type->name != arg_type->name)
+                        if (param_type && arg_type &&
+                            param_type->name != arg_type->name)
                         {
                             this->errors.emplace_back(
                                 ErrorType::TypeMismatch, param_type,
@@ -700,6 +1513,9 @@ void Semantics::pass3_node(AstNode *node)
                                     std::to_string(i + 1) + ", got " +
                                     arg_type->name.c_str());
                         }
+
+                        delete param_type;
+                        delete arg_type;
                     }
                 }
             }
@@ -707,7 +1523,6 @@ void Semantics::pass3_node(AstNode *node)
 
         for (auto arg : fn_call->args)
         {
-            arg = inline_if_need_be(arg);
             pass3_node(arg);
         }
 
@@ -720,20 +1535,65 @@ void Semantics::pass3_node(AstNode *node)
 
         pass3_node(loop->expr);
 
-        loop->expr = inline_if_need_be(loop->expr);
+        push_scope();
+
+        // `loop(i in n)` counts i from 0 up to n
+        if (loop->is_foreach && !counter(loop))
+        {
+            auto decl = own(new AstDec(loop->line, loop->column));
+            decl->name = loop->name;
+            decl->type = infer_type(loop->expr);
+            counters[loop->id] = decl;
+        }
+
+        if (counter(loop))
+        {
+            auto type = type_of(counter(loop));
+
+            if (type && !is_integer(type))
+            {
+                this->errors.emplace_back(
+                    ErrorType::TypeMismatch, loop->expr,
+                    "The bound of a counted loop must be an integer, got "s +
+                        type->name + (type->is_array ? "[]" : ""));
+            }
+
+            add_local(counter(loop));
+        }
+
+        loop_depth++;
+        pass3_node(loop->body);
+        loop_depth--;
 
-        for (auto stmt : loop->body->statements)
+        for (auto attribute : loop->attributes)
         {
-            stmt = inline_if_need_be(stmt);
+            if (attribute->name == "parallel" && counter(loop))
+            {
+                p3_parallel(loop, attribute);
+            }
         }
 
+        pop_scope();
+
         break;
     }
 
     case AstNodeType::AstContinue:
+        if (!loop_depth)
+        {
+            this->errors.emplace_back(ErrorType::InvalidJump, node,
+                                      "`continue` can only be used in a loop");
+        }
+
         break;
 
     case AstNodeType::AstBreak:
+        if (!loop_depth)
+        {
+            this->errors.emplace_back(ErrorType::InvalidJump, node,
+                                      "`break` can only be used in a loop");
+        }
+
         break;
 
     case AstNodeType::AstStruct:
@@ -746,7 +1606,6 @@ void Semantics::pass3_node(AstNode *node)
         for (auto stmt : impl->block->statements)
         {
             pass3_node(stmt);
-            stmt = inline_if_need_be(stmt);
         }
         pop_scope();
         break;
@@ -764,7 +1623,6 @@ void Semantics::pass3_node(AstNode *node)
         for (auto stmt : affix->body->statements)
         {
             pass3_node(stmt);
-            stmt = inline_if_need_be(stmt);
         }
 
         break;
@@ -773,32 +1631,34 @@ void Semantics::pass3_node(AstNode *node)
     case AstNodeType::AstUnaryExpr:
     {
         auto un_expr = (AstUnaryExpr *)node;
+        auto name = op(un_expr);
 
         {
-            auto fn = p2_get_fn(un_expr->op);
+            auto fn = p2_get_fn(name);
 
             if (fn && fn->body)
             {
-                for (auto param : fn->params)
+                for (auto param : params(fn))
                 {
-                    un_expr->op += type_to_string(param->type);
+                    name += type_to_string(param->type);
                 }
             }
         }
         {
-            auto fn = p2_get_affix(un_expr->op);
+            auto fn = p2_get_affix(name);
 
             if (fn && fn->body)
             {
                 for (auto param : fn->params)
                 {
-                    un_expr->op += type_to_string(param->type);
+                    name += type_to_string(param->type);
                 }
             }
         }
 
+        resolved_names[un_expr->id] = name;
+
         pass3_node(un_expr->expr);
-        un_expr->expr = inline_if_need_be(un_expr->expr);
 
         break;
     }
@@ -806,30 +1666,52 @@ void Semantics::pass3_node(AstNode *node)
     case AstNodeType::AstBinaryExpr:
     {
         auto bin_expr = (AstBinaryExpr *)node;
-        if (bin_expr->op != "." && !bin_expr->mangled)
-        {
-            bin_expr->op += type_to_string(infer_type(bin_expr->lhs));
-            bin_expr->op += type_to_string(infer_type(bin_expr->rhs));
-            bin_expr->mangled = true;
-        }
 
+        // Operands first, the type of a nested expression depends on its
+        // mangled operator
         pass3_node(bin_expr->lhs);
 
-        if (bin_expr->rhs->node_type == AstNodeType::AstFnCall)
+        if (bin_expr->op == "." &&
+            bin_expr->rhs->node_type == AstNodeType::AstFnCall)
         {
             auto x = (AstFnCall *)bin_expr->rhs;
-            if (!x->mangled)
+            auto lhs = infer_type(bin_expr->lhs);
+
+            if (!resolved_names.count(x->id) && lhs)
             {
-                x->name = infer_type(bin_expr->lhs)->name + "_" + x->name;
-                x->mangled = true;
+                resolved_names[x->id] = lhs->name + "_" + x->name;
             }
+
+            delete lhs;
         }
         else
         {
             pass3_node(bin_expr->rhs);
         }
-        bin_expr->lhs = inline_if_need_be(bin_expr->lhs);
-        bin_expr->rhs = inline_if_need_be(bin_expr->rhs);
+
+        // Assignments and member access are not affixes
+        if (bin_expr->op != "." && bin_expr->op != "=" &&
+            !resolved_names.count(bin_expr->id))
+        {
+            auto lhs = infer_type(bin_expr->lhs);
+            auto rhs = infer_type(bin_expr->rhs);
+
+            if (!lhs || !rhs)
+            {
+                this->errors.emplace_back(
+                    ErrorType::NoType, node,
+                    "The type of an operand of " + bin_expr->op +
+                        " can not be inferred");
+                delete lhs;
+                delete rhs;
+                break;
+            }
+
+            resolved_names[bin_expr->id] =
+                bin_expr->op + type_to_string(lhs) + type_to_string(rhs);
+            delete lhs;
+            delete rhs;
+        }
         break;
     }
 
@@ -846,7 +1728,6 @@ void Semantics::pass3_node(AstNode *node)
     {
         auto ret = (AstReturn *)node;
         pass3_node(ret->expr);
-        ret->expr = inline_if_need_be(ret->expr);
         break;
     }
 
@@ -861,6 +1742,31 @@ void Semantics::pass3_node(AstNode *node)
 
         break;
     }
+
+    case AstNodeType::AstImport:
+        break;
+
+    case AstNodeType::AstAwait:
+    {
+        auto await = (AstAwait *)node;
+
+        if (!in_async)
+        {
+            this->errors.emplace_back(
+                ErrorType::InvalidAwait, await,
+                "`await` can only be used in an async function");
+        }
+        else if (!statement_awaits.count(await->id))
+        {
+            this->errors.emplace_back(
+                ErrorType::InvalidAwait, await,
+                "`await` must be a statement of its own, the value of a "
+                "declaration, assigned to a variable or returned");
+        }
+
+        pass3_node(await->expr);
+        break;
+    }
     }
 }
 
@@ -939,33 +1845,6 @@ void Semantics::p3_affix(AstAffix *node)
     }
 }
 
-AstNode *Semantics::inline_if_need_be(AstNode *node)
-{
-
-    bool flag = false;
-
-    if (node->attributes.empty())
-    {
-        for (auto attribute : node->attributes)
-        {
-            if (attribute->name == "inline")
-            {
-                flag = true;
-                break;
-            }
-        }
-    }
-
-    if (!flag || node->node_type != AstNodeType::AstFnCall)
-    {
-        return node;
-    }
-
-    auto fn_call = (AstFnCall *)node;
-
-    return node;
-}
-
 AstType *Semantics::infer_type(AstNode *node)
 {
     if (!node)
@@ -1034,17 +1913,24 @@ AstType *Semantics::infer_type(AstNode *node)
     case AstNodeType::AstArray:
     {
         auto x = (AstArray *)node;
-        if (x->ele_type)
+        if (type_of(x))
         {
-            return x->ele_type;
+            return clone_type(type_of(x));
         }
-        else
+        else if (!x->elements.empty())
         {
             auto tp = infer_type(x->elements[0]);
+
+            if (!tp)
+            {
+                return nullptr;
+            }
+
             auto re = new AstType();
             re->subtype = new AstType();
             re->subtype->name = tp->name;
             re->is_array = true;
+            delete tp;
             return re;
         }
         break;
@@ -1054,7 +1940,7 @@ AstType *Semantics::infer_type(AstNode *node)
     {
         auto decl = (AstDec *)node;
         add_local(decl);
-        return clone_type(decl->type);
+        return clone_type(type_of(decl));
     }
 
     case AstNodeType::AstIf:
@@ -1072,8 +1958,19 @@ AstType *Semantics::infer_type(AstNode *node)
     {
         auto fn_call = (AstFnCall *)node;
 
+        // Calling an async function creates a task, its handle is the result
+        {
+            auto fn = p2_get_fn(callee(fn_call));
+
+            if (fn && fn->is_async)
+            {
+                auto handle = new AstType();
+                handle->name = "u32";
+                return handle;
+            }
+        }
         {
-            auto type = infer_type(p2_get_fn(fn_call->name));
+            auto type = infer_type(p2_get_fn(callee(fn_call)));
 
             if (type)
             {
@@ -1081,7 +1978,7 @@ AstType *Semantics::infer_type(AstNode *node)
             }
         }
         {
-            auto type = infer_type(p2_get_affix(fn_call->name));
+            auto type = infer_type(p2_get_affix(callee(fn_call)));
 
             if (type)
             {
@@ -1089,7 +1986,7 @@ AstType *Semantics::infer_type(AstNode *node)
             }
         }
         {
-            auto stct = p2_get_struct(fn_call->name);
+            auto stct = p2_get_struct(callee(fn_call));
 
             if (stct)
             {
@@ -1099,6 +1996,13 @@ AstType *Semantics::infer_type(AstNode *node)
             }
         }
 
+        if (is_array_length(fn_call))
+        {
+            auto length = new AstType();
+            length->name = "i32";
+            return length;
+        }
+
         break;
     }
 
@@ -1147,7 +2051,7 @@ AstType *Semantics::infer_type(AstNode *node)
         auto un_expr = (AstUnaryExpr *)node;
 
         {
-            auto type = infer_type(p2_get_fn(un_expr->op));
+            auto type = infer_type(p2_get_fn(op(un_expr)));
 
             if (type)
             {
@@ -1155,7 +2059,7 @@ AstType *Semantics::infer_type(AstNode *node)
             }
         }
         {
-            auto type = infer_type(p2_get_affix(un_expr->op));
+            auto type = infer_type(p2_get_affix(op(un_expr)));
 
             if (type)
             {
@@ -1170,10 +2074,8 @@ AstType *Semantics::infer_type(AstNode *node)
     {
         auto bin_expr = (AstBinaryExpr *)node;
 
-        bin_expr->rhs = inline_if_need_be(bin_expr->rhs);
-        bin_expr->lhs = inline_if_need_be(bin_expr->lhs);
         {
-            auto type = infer_type(p2_get_fn(bin_expr->op));
+            auto type = infer_type(p2_get_fn(op(bin_expr)));
 
             if (type)
             {
@@ -1181,11 +2083,11 @@ AstType *Semantics::infer_type(AstNode *node)
             }
         }
         {
-            auto type = p2_get_affix(bin_expr->op);
+            auto type = p2_get_affix(op(bin_expr));
 
             if (type)
             {
-                return type->return_type;
+                return clone_type(type->return_type);
             }
         }
 
@@ -1193,7 +2095,19 @@ AstType *Semantics::infer_type(AstNode *node)
     }
 
     case AstNodeType::AstIndex:
-        return infer_type(((AstIndex *)node)->expr);
+    {
+        // An element has the type of its array, not of its index
+        auto array = infer_type(((AstIndex *)node)->array);
+
+        if (array && array->is_array)
+        {
+            auto element = clone_type(array->subtype);
+            delete array;
+            return element;
+        }
+
+        return array;
+    }
 
     case AstNodeType::AstType:
         return clone_type((AstType *)node);
@@ -1223,7 +2137,7 @@ AstType *Semantics::infer_type(AstNode *node)
 
             if (local)
             {
-                return local->type;
+                return clone_type(type_of(local));
             }
         }
 
@@ -1232,7 +2146,7 @@ AstType *Semantics::infer_type(AstNode *node)
 
             if (arg)
             {
-                return arg->type;
+                return clone_type(type_of(arg));
             }
         }
 
@@ -1261,7 +2175,154 @@ AstType *Semantics::infer_type(AstNode *node)
             ErrorType::CompilerError, node,
             "Attempt to infer the type of an extern statement");
         break;
+
+    case AstNodeType::AstImport:
+        this->errors.emplace_back(
+            ErrorType::CompilerError, node,
+            "Attempt to infer the type of an import statement");
+        break;
+
+    case AstNodeType::AstAwait:
+    {
+        // Awaiting a call gives the result of the async function, any other
+        // handle the i32 result of its operation
+        auto expr = ((AstAwait *)node)->expr;
+
+        if (expr->node_type == AstNodeType::AstFnCall)
+        {
+            auto fn = p2_get_fn(callee((AstFnCall *)expr));
+
+            if (fn && fn->is_async)
+            {
+                return clone_type(fn->return_type);
+            }
+        }
+
+        auto result = new AstType();
+        result->name = "i32";
+        return result;
+    }
     }
 
     return nullptr;
 }
+
+// len(a) of an array is built in, unless a function called len is declared
+bool Semantics::is_array_length(AstNode *node)
+{
+    if (node->node_type != AstNodeType::AstFnCall)
+    {
+        return false;
+    }
+
+    auto call = (AstFnCall *)node;
+
+    if (callee(call) != "len" || call->args.size() != 1 ||
+        p2_get_fn_unmangled("len"))
+    {
+        return false;
+    }
+
+    auto type = infer_type(call->args[0]);
+    bool result = type && type->is_array;
+
+    delete type;
+
+    return result;
+}
+
+const std::string &Semantics::callee(const AstFnCall *call) const
+{
+    auto name = resolved_names.find(call->id);
+    return name != resolved_names.end() ? name->second : call->name;
+}
+
+const std::string &Semantics::op(const AstUnaryExpr *expr) const
+{
+    auto name = resolved_names.find(expr->id);
+    return name != resolved_names.end() ? name->second : expr->op;
+}
+
+const std::string &Semantics::op(const AstBinaryExpr *expr) const
+{
+    auto name = resolved_names.find(expr->id);
+    return name != resolved_names.end() ? name->second : expr->op;
+}
+
+const std::string &Semantics::symbol(const AstFn *fn) const
+{
+    auto symbol = symbols.find(fn->id);
+    return symbol != symbols.end() ? symbol->second : fn->mangled_name;
+}
+
+const std::string &Semantics::symbol(const AstAffix *affix) const
+{
+    auto symbol = symbols.find(affix->id);
+    return symbol != symbols.end() ? symbol->second : affix->mangled_name;
+}
+
+const std::vector<AstDec *> &Semantics::params(const AstFn *fn) const
+{
+    auto params = method_params.find(fn->id);
+    return params != method_params.end() ? params->second : fn->params;
+}
+
+AstType *Semantics::type_of(const AstDec *decl) const
+{
+    auto type = types.find(decl->id);
+    return type != types.end() ? type->second : decl->type;
+}
+
+AstType *Semantics::type_of(const AstArray *array) const
+{
+    auto type = types.find(array->id);
+    return type != types.end() ? type->second : array->ele_type;
+}
+
+AstDec *Semantics::counter(const AstLoop *loop) const
+{
+    auto counter = counters.find(loop->id);
+    return counter != counters.end() ? counter->second : nullptr;
+}
+
+const ParallelLoop &Semantics::parallel(const AstLoop *loop) const
+{
+    static const ParallelLoop none;
+
+    auto parallel = parallel_loops.find(loop->id);
+    return parallel != parallel_loops.end() ? parallel->second : none;
+}
+
+bool Semantics::emits(const AstNode *node) const
+{
+    return !hidden.count(node->id);
+}
+
+void Semantics::set_emits(const AstNode *node, bool emits)
+{
+    if (emits)
+    {
+        hidden.erase(node->id);
+    }
+    else
+    {
+        hidden.insert(node->id);
+    }
+}
+
+void Semantics::copy_results(const AstNode *from, const AstNode *to)
+{
+    auto name = resolved_names.find(from->id);
+
+    if (name != resolved_names.end())
+    {
+        resolved_names[to->id] = name->second;
+    }
+
+    auto type = types.find(from->id);
+
+    if (type != types.end())
+    {
+        types[to->id] = type->second;
+    }
+}
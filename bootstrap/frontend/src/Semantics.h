@@ -1,10 +1,26 @@
 #ifndef FRONTEND_SEMANTICS_H
 #define FRONTEND_SEMANTICS_H
 
+#include <map>
+#include <memory>
+#include <set>
 #include <vector>
 #include <string>
 #include "AstDefs.h"
 #include "Error.h"
+#include "Profile.h"
+
+struct ParallelCheck;
+struct PureCheck;
+
+// What the body of a @parallel loop shares with the function it is in
+struct ParallelLoop
+{
+  // Outer variables it reads, and those it reduces into paired with the
+  // mangled operator they accumulate with
+  std::vector<AstDec *> captures;
+  std::vector<std::pair<AstDec *, std::string>> reductions;
+};
 
 class Semantics
 {
@@ -33,20 +49,95 @@ public:
 
   AstType *infer_type(AstNode *node);
 
+  /** Whether node calls the built-in len, giving the length of an array */
+  bool is_array_length(AstNode *node);
+
+  bool is_pure(const AstFn *fn);
+  bool is_pure_op(const std::string &op);
+
+  /** The name of the function a call calls, mangled for its overload */
+  const std::string &callee(const AstFnCall *call) const;
+
+  /** The operator an expression applies, mangled for its overload */
+  const std::string &op(const AstUnaryExpr *expr) const;
+  const std::string &op(const AstBinaryExpr *expr) const;
+
+  /** The mangled name a function or operator is emitted under */
+  const std::string &symbol(const AstFn *fn) const;
+  const std::string &symbol(const AstAffix *affix) const;
+
+  /** The parameters of a function, methods start with the implicit self */
+  const std::vector<AstDec *> &params(const AstFn *fn) const;
+
+  /** The declared or inferred type of a variable, or of an array literal */
+  AstType *type_of(const AstDec *decl) const;
+  AstType *type_of(const AstArray *array) const;
+
+  /** The variable a counted loop counts with, nullptr for other loops */
+  AstDec *counter(const AstLoop *loop) const;
+
+  /** What a @parallel loop captures and reduces into */
+  const ParallelLoop &parallel(const AstLoop *loop) const;
+
+  /** Whether code is generated for a node */
+  bool emits(const AstNode *node) const;
+  void set_emits(const AstNode *node, bool emits);
+
+  /** Gives a copy of a node the names and types resolved for the node */
+  void copy_results(const AstNode *from, const AstNode *to);
+
   std::vector<Error> errors;
 
+  /** Whether code generation counts executions into a profile */
+  bool profile_generate = false;
+
+  /** Counts of a previous run, steering optimization when not empty */
+  Profile profile;
+
+  /** Whether functions call runtime hooks when they are entered and left */
+  bool instrument_functions = false;
+
+  /** Whether allocations are counted per site by a tracking allocator */
+  bool track_allocations = false;
+
+  /** Whether the IL of the whole program is optimized once generated */
+  bool link_time_optimization = false;
+
+  /** Whether indexing an array checks the index against its length */
+  bool bounds_check = false;
+
 private:
   std::vector<AstFn *> p2_funcs;
   std::vector<AstAffix *> p2_affixes;
   std::vector<AstStruct *> p2_structs;
   std::vector<AstDec *> p2_dec;
 
-  bool nest_flag = false;
-  std::vector<AstAttribute *> attributes;
+  bool nest_in_fn = false;
+  bool in_async = false;
+  unsigned int loop_depth = 0;
+
+  // What the analysis found out, by node id. The tree is left as parsed, so
+  // it can be analysed again or shared.
+  std::map<unsigned int, std::string> resolved_names; // Calls and operators
+  std::map<unsigned int, std::string> symbols;        // Functions and affixes
+  std::map<unsigned int, std::vector<AstDec *>> method_params;
+  std::map<unsigned int, AstType *> types;            // Variables and arrays
+  std::map<unsigned int, AstDec *> counters;
+  std::map<unsigned int, ParallelLoop> parallel_loops;
+  std::set<unsigned int> statement_awaits;
+  std::set<unsigned int> hidden;                      // Not emitted
+
+  // The types and declarations allocated for the tables above. The REPL
+  // copies the analysis to roll back input that fails, so the copies share
+  // them and the last one destroyed frees them.
+  std::vector<std::shared_ptr<AstNode>> owned;
 
   std::vector<std::string> p1_funcs;
   std::vector<std::string> p1_structs;
 
+  AstType *own(AstType *type);
+  AstDec *own(AstDec *decl);
+
   void pass1_node(AstNode *node);
   void p1_struct(AstStruct *node);
   void p1_fn(AstFn *node);
@@ -58,10 +149,13 @@ private:
 
   void pass3_node(AstNode *node);
   void pass3_nest_att(AstNode *node);
+  void p3_attributes(AstNode *node);
+  void p3_parallel(AstLoop *loop, AstAttribute *attribute);
+  void p3_parallel_node(AstNode *node, ParallelCheck &check);
+  void p3_pure(AstFn *fn);
+  void p3_pure_node(AstNode *node, PureCheck &check);
   void p3_struct(AstStruct *node);
   void p3_affix(AstAffix *node);
-
-  AstNode *inline_if_need_be(AstNode *node);
 };
 
 #endif // FRONTEND_SEMANTICS_H
@@ -45,6 +45,9 @@
     F(Loop), \
     F(In), \
     F(Extern), \
+    F(Import), \
+    F(Async), \
+    F(Await), \
     \
     F(Colon), \
     F(SemiColon), \
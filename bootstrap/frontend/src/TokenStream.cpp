@@ -23,6 +23,9 @@ static const std::map<std::string, TokenType> keywords = {
     {"prefix",   TokenType::Prefix},
     {"infix",    TokenType::Infix},
     {"extern",   TokenType::Extern},
+    {"import",   TokenType::Import},
+    {"async",    TokenType::Async},
+    {"await",    TokenType::Await},
     {"true",     TokenType::Boolean},
     {"false",    TokenType::Boolean},
 };
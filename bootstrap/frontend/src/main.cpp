@@ -1,9 +1,13 @@
-#include <fstream>
+#include <cstdlib>
 #include <iostream>
 #include <vector>
 #include "AstPrettyPrinter.h"
 #include "CodeGen.h"
+#include "ModuleLoader.h"
+#include "Optimizer.h"
 #include "Parser.h"
+#include "Repl.h"
+#include "Runner.h"
 #include "TokenStream.h"
 #include "Terminal.h"
 
@@ -11,23 +15,183 @@
 #include <windows.h>
 #endif
 
-std::string load_text_from_file(std::string filepath)
+static void print_errors(const Module *module)
 {
-    std::ifstream stream(filepath);
-    std::string str(
-        (std::istreambuf_iterator<char>(stream)),
-        std::istreambuf_iterator<char>());
-    return str;
+    for (Error error : module->tokens.errors)
+    {
+        printf("\n%s%s @ %s%s:%s%d%s:%s%d%s\n",
+               term_fg[TermColour::Yellow],
+               error.message.c_str(),
+               term_reset,
+               module->path.c_str(),
+               term_fg[TermColour::Blue], error.line, term_reset,
+               term_fg[TermColour::Blue], error.column, term_reset);
+        syntax_highlight_print_error(
+            module->source, module->tokens,
+            error.line, error.offset, error.count);
+    }
+
+    for (Error error : module->errors)
+    {
+        printf("\n-----------------------------\n\n");
+        printf("\n%s%s @ %s%s:%s%d%s:%s%d%s\n",
+            term_fg[TermColour::Yellow],
+            error.message.c_str(),
+            term_reset,
+            module->path.c_str(),
+            term_fg[TermColour::Blue], error.line, term_reset,
+            term_fg[TermColour::Blue], error.column, term_reset
+        );
+        syntax_highlight_print_error(
+            module->source, module->tokens,
+            error.line, error.offset, error.count);
+    }
+}
+
+static void print_usage()
+{
+    printf("Usage: frontend [options] <output> <input>...\n");
+    printf("       frontend --repl [options] [<input>...]\n");
+    printf("       frontend --run [options] <input>...\n");
+    printf("  -I <dir>  Add a directory to the module search path\n");
+    printf("  -g  Add a table of the source position of the code to the IL\n");
+    printf("  --profile-generate  Count executions, written to $DUSK_PROFILE or\n"
+           "                      dusk.profile when the program exits\n");
+    printf("  --profile-use <file>  Optimize for the counts of a profile\n");
+    printf("  --instrument-functions  Time every function, written as collapsed\n"
+           "                          stacks to $DUSK_FLAME or dusk.folded\n");
+    printf("  --track-allocations  Report allocations per site when the program\n"
+           "                       exits\n");
+    printf("  --lto  Optimize across modules once the whole program is generated\n");
+    printf("  --bounds-check  Check array indices that can not be proven in bounds\n");
+    printf("  --repl  Run the inputs, then read and run statements as they are typed\n");
+    printf("  --run  Run main, replacing functions whose source changes meanwhile,\n"
+           "         or of an IL file as it is\n");
+    printf("  --snapshot <file>  With --run, resume from the state saved in the file\n"
+           "                     or save it there when dusk_snapshot is called\n");
 }
 
 int main(int argc, char **argv)
 {
-    if (argc < 3)
+    ModuleLoader loader;
+    std::string output;
+    std::vector<std::string> inputs;
+    bool profile_generate = false;
+    bool instrument_functions = false;
+    bool track_allocations = false;
+    bool link_time_optimization = false;
+    bool bounds_check = false;
+    bool lines = false;
+    bool repl = false;
+    bool run = false;
+    std::string profile_use;
+    std::string snapshot;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+
+        if (arg == "-I" && i + 1 < argc)
+        {
+            loader.search_path.push_back(argv[++i]);
+        }
+        else if (arg.compare(0, 2, "-I") == 0 && arg.size() > 2)
+        {
+            loader.search_path.push_back(arg.substr(2));
+        }
+        else if (arg == "-g")
+        {
+            lines = true;
+        }
+        else if (arg == "--profile-generate")
+        {
+            profile_generate = true;
+        }
+        else if (arg == "--profile-use" && i + 1 < argc)
+        {
+            profile_use = argv[++i];
+        }
+        else if (arg == "--instrument-functions")
+        {
+            instrument_functions = true;
+        }
+        else if (arg == "--track-allocations")
+        {
+            track_allocations = true;
+        }
+        else if (arg == "--lto")
+        {
+            link_time_optimization = true;
+        }
+        else if (arg == "--bounds-check")
+        {
+            bounds_check = true;
+        }
+        else if (arg == "--repl")
+        {
+            repl = true;
+        }
+        else if (arg == "--run")
+        {
+            run = true;
+        }
+        else if (arg == "--snapshot" && i + 1 < argc)
+        {
+            snapshot = argv[++i];
+        }
+        else if (arg.size() > 1 && arg[0] == '-')
+        {
+            printf("Unknown option %s\n", arg.c_str());
+            print_usage();
+            return 1;
+        }
+        else if (output.empty())
+        {
+            output = arg;
+        }
+        else
+        {
+            inputs.push_back(arg);
+        }
+    }
+
+    // Running in the compiler writes no output, so every file is an input
+    if ((repl || run) && !output.empty())
+    {
+        inputs.insert(inputs.begin(), output);
+        output.clear();
+    }
+
+    if (inputs.empty() && !repl)
     {
         printf("Missing filename in args.\n");
+        print_usage();
         return 1;
     }
 
+    if (const char *dusk_path = getenv("DUSK_PATH"))
+    {
+        std::string paths = dusk_path;
+        size_t start = 0;
+
+        while (start <= paths.size())
+        {
+            size_t end = paths.find(':', start);
+
+            if (end == std::string::npos)
+            {
+                end = paths.size();
+            }
+
+            if (end > start)
+            {
+                loader.search_path.push_back(paths.substr(start, end - start));
+            }
+
+            start = end + 1;
+        }
+    }
+
 #ifdef _WIN32
     // Set output mode to handle virtual terminal sequences
     HANDLE hOut = GetStdHandle(STD_OUTPUT_HANDLE);
@@ -49,79 +213,62 @@ int main(int argc, char **argv)
     }
 #endif
 
-    std::vector<TokenStream> toks;
-    std::vector<Ast> asts;
+    if (repl)
+    {
+        Semantics sem;
+        sem.bounds_check = bounds_check;
 
-    bool errors_occurred = false;
+        return Repl(loader, sem).run(inputs);
+    }
+
+    if (run)
+    {
+        return Runner(loader.search_path, bounds_check, snapshot).run(inputs);
+    }
 
-    for (int i = 2; i < argc; i++)
+    for (auto &input : inputs)
     {
-        std::string file_contents = load_text_from_file(argv[i]);
+        loader.load_file(input);
+    }
 
-        TokenStream stream;
-        stream.lex(file_contents);
-        toks.push_back(stream);
+    bool errors_occurred = false;
 
-        if (!stream.errors.empty())
+    for (auto module : loader.modules)
+    {
+        if (!module->tokens.errors.empty() || !module->errors.empty())
         {
             errors_occurred = true;
-            for (Error error : stream.errors)
-            {
-                printf("\n%s%s @ %s%s%d%s:%s%d%s\n",
-                       term_fg[TermColour::Yellow],
-                       error.message.c_str(),
-                       term_reset,
-                       term_fg[TermColour::Blue], error.line, term_reset,
-                       term_fg[TermColour::Blue], error.column, term_reset);
-                syntax_highlight_print_error(
-                    file_contents, stream,
-                    error.line, error.offset, error.count);
-            }
-        }
-        else
-        {
-            Parser parser;
-            Ast ast = parser.parse(stream.tokens);
-            delete ast.root;
-
-            if (!parser.errors.empty())
-            {
-                errors_occurred = true;
-                for (Error error : parser.errors)
-                {
-                    printf("\n-----------------------------\n\n");
-                    printf("\n%s%s @ %s%s%d%s:%s%d%s\n",
-                        term_fg[TermColour::Yellow],
-                        error.message.c_str(),
-                        term_reset,
-                        term_fg[TermColour::Blue], error.line, term_reset,
-                        term_fg[TermColour::Blue], error.column, term_reset
-                    );
-                    syntax_highlight_print_error(
-                        file_contents, stream,
-                        error.line, error.offset, error.count);
-                }
-            }
+            print_errors(module);
         }
     }
 
     if (errors_occurred)
     {
-        for (auto &ast : asts)
-        {
-            delete ast.root;
-        }
-
         printf("\n------------------------\nErrors occurred, exiting\n");
         return 1;
     }
 
-    for(auto &stream : toks) {
-        Parser parser;
-        asts.push_back(parser.parse(stream.tokens));
+    loader.prune_unreferenced();
+
+    std::vector<Ast> asts;
+
+    for (auto module : loader.modules)
+    {
+        asts.push_back(module->ast);
     }
 
     Semantics sem;
+    sem.profile_generate = profile_generate;
+    sem.instrument_functions = instrument_functions;
+    sem.track_allocations = track_allocations;
+    sem.link_time_optimization = link_time_optimization;
+    sem.bounds_check = bounds_check;
+
+    if (!profile_use.empty() && !sem.profile.load(profile_use))
+    {
+        printf("Could not read profile %s\n", profile_use.c_str());
+        return 1;
+    }
 
     for (size_t i = 0; i < asts.size(); i++)
     {
@@ -148,6 +295,13 @@ int main(int argc, char **argv)
         return 1;
     }
 
+    Optimizer optimizer(sem);
+
+    for (size_t i = 0; i < asts.size(); i++)
+    {
+        optimizer.optimize(asts[i]);
+    }
+
     scope.clear();
     args.clear();
 
@@ -162,21 +316,14 @@ int main(int argc, char **argv)
     }
 
     ILemitter il;
+    il.lines = lines;
 
-    for (size_t i = 0; i < asts.size(); i++)
-    {
-        generate_il(asts[i].root, il, sem);
-    }
+    generate_program(asts, il, sem);
 
-    FILE *file = fopen(argv[1], "wb");
+    FILE *file = fopen(output.c_str(), "wb");
     size_t size = il.stream.size();
     fwrite(&il.stream[0], size, 1, file);
     fclose(file);
 
-    for (auto &ast : asts)
-    {
-        delete ast.root;
-    }
-
     return 0;
 }
@@ -127,7 +127,10 @@ class NASMEmitter(val underscores: Boolean) : dusk.ilc.emitter.Emitter {
 				}
 				OpCodes.RETN -> {
 					val func = data.getFunction(index)
-					if (func != null && func.returnType != TypeVoid)
+					// Vectors are returned in XMM0
+					if (func != null && func.returnType is VectorType<*>)
+						result.popVector(NASMRegister.XMM0)
+					else if (func != null && func.returnType != TypeVoid)
 						result.pop(NASMRegister.EAX)
 					result.leave()
 					result.ret()
@@ -142,7 +145,9 @@ class NASMEmitter(val underscores: Boolean) : dusk.ilc.emitter.Emitter {
 					val paramSize = func.parameters.values.sumBy { it.size }
 					result.add(NASMRegister.ESP, NASMValue.LiteralInt(paramSize.toLong()))
 
-					if (func.returnType != TypeVoid)
+					if (func.returnType is VectorType<*>)
+						result.pushVector(NASMRegister.XMM0)
+					else if (func.returnType != TypeVoid)
 						result.push(NASMRegister.EAX)
 				}
 				OpCodes.CALS -> {
@@ -162,12 +167,12 @@ class NASMEmitter(val underscores: Boolean) : dusk.ilc.emitter.Emitter {
 
 				//TODO: Named locals/args
 				OpCodes.LLOC -> {
-					result.mov(NASMRegister.EAX, NASMRegister.EBP + localOffset(data.getFunction(index)!!, instr.args[0]))
-					result.push(NASMRegister.EAX)
+					val function = data.getFunction(index)!!
+					result.load(localType(function, instr.args[0]), NASMRegister.EBP + localOffset(function, instr.args[0]))
 				}
 				OpCodes.LARG -> {
-					result.mov(NASMRegister.EAX, NASMRegister.EBP + argOffset(data.getFunction(index)!!, instr.args[0]))
-					result.push(NASMRegister.EAX)
+					val function = data.getFunction(index)!!
+					result.load(function.parameters[(instr.args[0] as ArgIdentifier).value], NASMRegister.EBP + argOffset(function, instr.args[0]))
 				}
 				OpCodes.ADRL -> {
 					result.lea(NASMRegister.EAX, NASMRegister.EBP + localOffset(data.getFunction(index)!!, instr.args[0]))
@@ -183,12 +188,12 @@ class NASMEmitter(val underscores: Boolean) : dusk.ilc.emitter.Emitter {
 					result.push(NASMRegister.EBX)
 				}
 				OpCodes.SLOC -> {
-					result.pop(NASMRegister.EAX)
-					result.mov(NASMRegister.EBP + localOffset(data.getFunction(index)!!, instr.args[0]), NASMRegister.EAX)
+					val function = data.getFunction(index)!!
+					result.store(localType(function, instr.args[0]), NASMRegister.EBP + localOffset(function, instr.args[0]))
 				}
 				OpCodes.SARG -> {
-					result.pop(NASMRegister.EAX)
-					result.mov(NASMRegister.EBP + argOffset(data.getFunction(index)!!, instr.args[0]), NASMRegister.EAX)
+					val function = data.getFunction(index)!!
+					result.store(function.parameters[(instr.args[0] as ArgIdentifier).value], NASMRegister.EBP + argOffset(function, instr.args[0]))
 				}
 				OpCodes.LGLO -> TODO()
 				OpCodes.SGLO -> TODO()
@@ -204,6 +209,28 @@ class NASMEmitter(val underscores: Boolean) : dusk.ilc.emitter.Emitter {
 					result.pop(NASMRegister.EAX)
 					result.mov(NASMRegister.ECX + 0, NASMRegister.EAX)
 				}
+				OpCodes.MCPY -> {
+					// rep movsb takes EDI, ESI and ECX, the first two are callee saved
+					result.pop(NASMRegister.EAX)
+					result.pop(NASMRegister.EDX)
+					result.pop(NASMRegister.ECX)
+					result.push(NASMRegister.ESI)
+					result.push(NASMRegister.EDI)
+					result.mov(NASMRegister.EDI, NASMRegister.EAX)
+					result.mov(NASMRegister.ESI, NASMRegister.EDX)
+					result.repMovsb()
+					result.pop(NASMRegister.EDI)
+					result.pop(NASMRegister.ESI)
+				}
+				OpCodes.MSET -> {
+					result.pop(NASMRegister.EDX)
+					result.pop(NASMRegister.EAX)
+					result.pop(NASMRegister.ECX)
+					result.push(NASMRegister.EDI)
+					result.mov(NASMRegister.EDI, NASMRegister.EDX)
+					result.repStosb()
+					result.pop(NASMRegister.EDI)
+				}
 
 				OpCodes.IADD -> result.binaryOp(result::add)
 				OpCodes.ISUB -> result.binaryOp(result::sub)
@@ -244,7 +271,119 @@ class NASMEmitter(val underscores: Boolean) : dusk.ilc.emitter.Emitter {
 				OpCodes.BWOR -> result.binaryOp(result::or)
 				OpCodes.BXOR -> result.binaryOp(result::xor)
 
-				OpCodes.INFN, OpCodes.EXFN, OpCodes.FPRM, OpCodes.FLOC, OpCodes.DATA -> {}
+				OpCodes.BROL -> result.rotate(bitType(instr), result::rol)
+				OpCodes.BROR -> result.rotate(bitType(instr), result::ror)
+				OpCodes.BPOP -> {
+					result.popBits(bitType(instr))
+					result.popcnt(NASMRegister.EAX, NASMRegister.EAX)
+					result.push(NASMRegister.EAX)
+				}
+				OpCodes.BCLZ -> {
+					val type = bitType(instr)
+					result.popBits(type)
+					result.lzcnt(NASMRegister.EAX, NASMRegister.EAX)
+					// The zero extension added leading zeros of its own
+					if (type.size < 4)
+						result.sub(NASMRegister.EAX, NASMValue.LiteralInt(32L - type.size * 8))
+					result.push(NASMRegister.EAX)
+				}
+				OpCodes.BCTZ -> {
+					val type = bitType(instr)
+					result.popBits(type)
+					// A bit just above the type makes zero count as its width
+					if (type.size < 4)
+						result.or(NASMRegister.EAX, NASMValue.LiteralInt(1L shl (type.size * 8)))
+					result.tzcnt(NASMRegister.EAX, NASMRegister.EAX)
+					result.push(NASMRegister.EAX)
+				}
+				OpCodes.BSWP -> {
+					val type = bitType(instr)
+					result.popBits(type)
+					result.bswap(NASMRegister.EAX)
+					if (type.size < 4)
+						result.shr(NASMRegister.EAX, NASMValue.LiteralInt(32L - type.size * 8))
+					result.push(NASMRegister.EAX)
+				}
+
+				OpCodes.VADD -> result.vectorBinaryOp(sseCode(vectorType(instr), "addps", "paddd", "paddb"))
+				OpCodes.VSUB -> result.vectorBinaryOp(sseCode(vectorType(instr), "subps", "psubd", "psubb"))
+				OpCodes.VMUL -> {
+					val type = vectorType(instr)
+					if (type == TypeUnsigned8x16)
+						result.multiplyBytes()
+					else
+						result.vectorBinaryOp(sseCode(type, "mulps", "pmulld", ""))
+				}
+				OpCodes.VDIV -> {
+					val type = vectorType(instr)
+					if (type == TypeFloat32x4)
+						result.vectorBinaryOp("divps")
+					else
+						result.divideLanes(type)
+				}
+				OpCodes.VCPE -> result.vectorBinaryOp(sseCode(vectorType(instr), "cmpeqps", "pcmpeqd", "pcmpeqb"))
+				OpCodes.VCPG -> result.vectorGreater(vectorType(instr), NASMRegister.XMM0, NASMRegister.XMM1)
+				OpCodes.VCPL -> result.vectorGreater(vectorType(instr), NASMRegister.XMM1, NASMRegister.XMM0)
+				OpCodes.VSHF -> result.shuffle(vectorType(instr), index)
+				OpCodes.VLOD -> {
+					result.pop(NASMRegister.EAX)
+					result.sse("movdqu", NASMRegister.XMM0, NASMRegister.EAX.deref)
+					result.pushVector(NASMRegister.XMM0)
+				}
+				OpCodes.VSTR -> {
+					result.pop(NASMRegister.ECX)
+					result.popVector(NASMRegister.XMM0)
+					result.sse("movdqu", NASMRegister.ECX.deref, NASMRegister.XMM0)
+				}
+				OpCodes.VSPL -> {
+					result.pop(NASMRegister.EAX)
+					result.sse("movd", NASMRegister.XMM0, NASMRegister.EAX)
+					if (vectorType(instr) == TypeUnsigned8x16) {
+						result.sse("pxor", NASMRegister.XMM1, NASMRegister.XMM1)
+						result.sse("pshufb", NASMRegister.XMM0, NASMRegister.XMM1)
+					} else {
+						result.sse("pshufd", NASMRegister.XMM0, NASMRegister.XMM0, NASMValue.LiteralInt(0))
+					}
+					result.pushVector(NASMRegister.XMM0)
+				}
+				OpCodes.VBLD -> {
+					// Lane 0 is on top, so 32 bit lanes already are a vector
+					// and bytes only have to be packed, from the last lane
+					// down so that none is overwritten before it is read
+					if (vectorType(instr) == TypeUnsigned8x16) {
+						for (lane in 15 downTo 0) {
+							result.mov(NASMRegister.AXL, NASMRegister.ESP + lane * 4)
+							result.mov(NASMRegister.ESP + (48 + lane), NASMRegister.AXL)
+						}
+						result.add(NASMRegister.ESP, NASMValue.LiteralInt(48))
+					}
+				}
+				OpCodes.VEXT -> {
+					val type = vectorType(instr)
+					result.laneIndex(type)
+					if (type == TypeUnsigned8x16)
+						result.movzx(NASMRegister.EAX, NASMValue.Raw("byte " + NASMRegisterIndex(NASMRegister.ESP, NASMRegister.ECX, 1).text))
+					else
+						result.mov(NASMRegister.EAX, NASMRegisterIndex(NASMRegister.ESP, NASMRegister.ECX, 4))
+					result.add(NASMRegister.ESP, NASMValue.LiteralInt(20))
+					result.push(NASMRegister.EAX)
+				}
+				OpCodes.VINS -> {
+					val type = vectorType(instr)
+					result.laneIndex(type)
+					result.mov(NASMRegister.EAX, NASMRegister.ESP + 20)
+					if (type == TypeUnsigned8x16)
+						result.mov(NASMRegisterIndex(NASMRegister.ESP, NASMRegister.ECX, 1), NASMRegister.AXL)
+					else
+						result.mov(NASMRegisterIndex(NASMRegister.ESP, NASMRegister.ECX, 4), NASMRegister.EAX)
+					// Moves the vector up over the index and the value
+					result.sse("movdqu", NASMRegister.XMM0, NASMRegister.ESP.deref)
+					result.add(NASMRegister.ESP, NASMValue.LiteralInt(8))
+					result.sse("movdqu", NASMRegister.ESP.deref, NASMRegister.XMM0)
+				}
+				OpCodes.VSUM -> result.sumLanes(vectorType(instr))
+
+				OpCodes.INFN, OpCodes.EXFN, OpCodes.FPRM, OpCodes.FLOC, OpCodes.DATA, OpCodes.LINE -> {}
 //				OpCodes.INFN -> result.global((instr.args[0] as ArgIdentifier).value)
 //				OpCodes.EXFN -> result.extern((instr.args[0] as ArgIdentifier).value)
 
@@ -306,6 +445,211 @@ class NASMEmitter(val underscores: Boolean) : dusk.ilc.emitter.Emitter {
 			else -> throw UnsupportedOperationException()
 		}
 
+		private fun vectorType(instr: Instruction) = (instr.args[0] as ArgType).value as VectorType<*>
+
+		private fun sseCode(type: VectorType<*>, f32: String, i32: String, u8: String) = when (type) {
+			TypeFloat32x4 -> f32
+			TypeInt32x4 -> i32
+			else -> u8
+		}
+
+		// Vectors take 16 bytes of the stack with lane 0 at the top, which
+		// is not aligned, so they are moved with MOVDQU
+		private fun NASMInstructionList.pushVector(register: NASMRegister) {
+			sub(NASMRegister.ESP, NASMValue.LiteralInt(16))
+			sse("movdqu", NASMRegister.ESP.deref, register)
+		}
+
+		private fun NASMInstructionList.popVector(register: NASMRegister) {
+			sse("movdqu", register, NASMRegister.ESP.deref)
+			add(NASMRegister.ESP, NASMValue.LiteralInt(16))
+		}
+
+		private fun NASMInstructionList.load(type: Type<*>?, source: NASMRegisterOffset) {
+			if (type is VectorType<*>) {
+				sse("movdqu", NASMRegister.XMM0, source)
+				pushVector(NASMRegister.XMM0)
+			} else {
+				mov(NASMRegister.EAX, source)
+				push(NASMRegister.EAX)
+			}
+		}
+
+		private fun NASMInstructionList.store(type: Type<*>?, target: NASMRegisterOffset) {
+			if (type is VectorType<*>) {
+				popVector(NASMRegister.XMM0)
+				sse("movdqu", target, NASMRegister.XMM0)
+			} else {
+				pop(NASMRegister.EAX)
+				mov(target, NASMRegister.EAX)
+			}
+		}
+
+		// Pops B into XMM1 and A into XMM0 and pushes A op B
+		private fun NASMInstructionList.vectorBinaryOp(code: String) {
+			popVector(NASMRegister.XMM1)
+			popVector(NASMRegister.XMM0)
+			sse(code, NASMRegister.XMM0, NASMRegister.XMM1)
+			pushVector(NASMRegister.XMM0)
+		}
+
+		// Pushes the mask of the lanes where x is greater than y, after
+		// popping B into XMM1 and A into XMM0
+		private fun NASMInstructionList.vectorGreater(type: VectorType<*>, x: NASMRegister, y: NASMRegister) {
+			popVector(NASMRegister.XMM1)
+			popVector(NASMRegister.XMM0)
+			when (type) {
+				TypeFloat32x4 -> {
+					sse("cmpltps", y, x)
+					pushVector(y)
+				}
+				TypeInt32x4 -> {
+					sse("pcmpgtd", x, y)
+					pushVector(x)
+				}
+				else -> {
+					// There is no unsigned byte compare, x > y is max(x, y) != y
+					sse("movdqa", NASMRegister.XMM2, x)
+					sse("pmaxub", NASMRegister.XMM2, y)
+					sse("pcmpeqb", NASMRegister.XMM2, y)
+					sse("pcmpeqb", NASMRegister.XMM3, NASMRegister.XMM3)
+					sse("pxor", NASMRegister.XMM2, NASMRegister.XMM3)
+					pushVector(NASMRegister.XMM2)
+				}
+			}
+		}
+
+		// There is no byte multiply, so the even and odd bytes are
+		// multiplied as words and the low bytes of the products kept
+		private fun NASMInstructionList.multiplyBytes() {
+			popVector(NASMRegister.XMM1)
+			popVector(NASMRegister.XMM0)
+			sse("movdqa", NASMRegister.XMM2, NASMRegister.XMM0)
+			sse("movdqa", NASMRegister.XMM3, NASMRegister.XMM1)
+			sse("pmullw", NASMRegister.XMM0, NASMRegister.XMM1)
+			sse("psllw", NASMRegister.XMM0, NASMValue.LiteralInt(8))
+			sse("psrlw", NASMRegister.XMM0, NASMValue.LiteralInt(8))
+			sse("psrlw", NASMRegister.XMM2, NASMValue.LiteralInt(8))
+			sse("psrlw", NASMRegister.XMM3, NASMValue.LiteralInt(8))
+			sse("pmullw", NASMRegister.XMM2, NASMRegister.XMM3)
+			sse("psllw", NASMRegister.XMM2, NASMValue.LiteralInt(8))
+			sse("por", NASMRegister.XMM0, NASMRegister.XMM2)
+			pushVector(NASMRegister.XMM0)
+		}
+
+		// There is no integer vector divide, so each lane of A, 16 bytes
+		// down the stack, is divided by the lane of B on top in place
+		private fun NASMInstructionList.divideLanes(type: VectorType<*>) {
+			if (type == TypeUnsigned8x16) {
+				for (lane in 0 until 16) {
+					movzx(NASMRegister.EAX, NASMValue.Raw("byte " + (NASMRegister.ESP + (16 + lane)).text))
+					movzx(NASMRegister.ECX, NASMValue.Raw("byte " + (NASMRegister.ESP + lane).text))
+					mov(NASMRegister.EDX, NASMValue.LiteralInt(0))
+					div(NASMRegister.ECX)
+					mov(NASMRegister.ESP + (16 + lane), NASMRegister.AXL)
+				}
+			} else {
+				for (lane in 0 until 4) {
+					mov(NASMRegister.EAX, NASMRegister.ESP + (16 + lane * 4))
+					cdq()
+					idiv(NASMValue.Raw("dword " + (NASMRegister.ESP + lane * 4).text))
+					mov(NASMRegister.ESP + (16 + lane * 4), NASMRegister.EAX)
+				}
+			}
+			add(NASMRegister.ESP, NASMValue.LiteralInt(16))
+		}
+
+		// Lane n of the result is lane I[n] mod lanes of V, with V on top and
+		// I below it. Lanes of 32 bits become the indices of their 4 bytes,
+		// so that PSHUFB does both
+		private fun NASMInstructionList.shuffle(type: VectorType<*>, index: Int) {
+			popVector(NASMRegister.XMM0)
+			popVector(NASMRegister.XMM1)
+			if (type == TypeUnsigned8x16) {
+				vectorConstant(NASMRegister.XMM2, "ro$${index}_m", ByteArray(16) { 15.toByte() })
+				sse("pand", NASMRegister.XMM1, NASMRegister.XMM2)
+			} else {
+				vectorConstant(NASMRegister.XMM2, "ro$${index}_m", ByteArray(16) { (if (it % 4 == 0) 3 else 0).toByte() })
+				sse("pand", NASMRegister.XMM1, NASMRegister.XMM2)
+				sse("pslld", NASMRegister.XMM1, NASMValue.LiteralInt(2))
+				vectorConstant(NASMRegister.XMM2, "ro$${index}_s", ByteArray(16) { (it / 4 * 4).toByte() })
+				sse("pshufb", NASMRegister.XMM1, NASMRegister.XMM2)
+				vectorConstant(NASMRegister.XMM2, "ro$${index}_o", ByteArray(16) { (it % 4).toByte() })
+				sse("paddb", NASMRegister.XMM1, NASMRegister.XMM2)
+			}
+			sse("pshufb", NASMRegister.XMM0, NASMRegister.XMM1)
+			pushVector(NASMRegister.XMM0)
+		}
+
+		// Constants go through a register as SSE memory operands must be aligned
+		private fun NASMInstructionList.vectorConstant(register: NASMRegister, name: String, bytes: ByteArray) {
+			dataByteArray(name, bytes)
+			sse("movdqu", register, NASMValue.Raw("[$name]"))
+		}
+
+		// Loads the lane index below the vector on top of the stack into ECX,
+		// mod the lane count
+		private fun NASMInstructionList.laneIndex(type: VectorType<*>) {
+			mov(NASMRegister.ECX, NASMRegister.ESP + 16)
+			and(NASMRegister.ECX, NASMValue.LiteralInt(if (type == TypeUnsigned8x16) 15L else 3L))
+		}
+
+		// Adds the lanes in the order the engine and interpreter do, lanes
+		// half a vector apart first
+		private fun NASMInstructionList.sumLanes(type: VectorType<*>) {
+			popVector(NASMRegister.XMM0)
+			when (type) {
+				TypeFloat32x4 -> {
+					sse("movhlps", NASMRegister.XMM1, NASMRegister.XMM0)
+					sse("addps", NASMRegister.XMM0, NASMRegister.XMM1)
+					sse("movaps", NASMRegister.XMM1, NASMRegister.XMM0)
+					sse("shufps", NASMRegister.XMM1, NASMRegister.XMM1, NASMValue.LiteralInt(0x55))
+					sse("addss", NASMRegister.XMM0, NASMRegister.XMM1)
+				}
+				TypeInt32x4 -> {
+					sse("pshufd", NASMRegister.XMM1, NASMRegister.XMM0, NASMValue.LiteralInt(0x4E))
+					sse("paddd", NASMRegister.XMM0, NASMRegister.XMM1)
+					sse("pshufd", NASMRegister.XMM1, NASMRegister.XMM0, NASMValue.LiteralInt(0xB1))
+					sse("paddd", NASMRegister.XMM0, NASMRegister.XMM1)
+				}
+				else -> {
+					// Sums of absolute differences from zero are the sums of
+					// each half, the u8 result keeps the low byte
+					sse("pxor", NASMRegister.XMM1, NASMRegister.XMM1)
+					sse("psadbw", NASMRegister.XMM0, NASMRegister.XMM1)
+					sse("pshufd", NASMRegister.XMM1, NASMRegister.XMM0, NASMValue.LiteralInt(0x4E))
+					sse("paddd", NASMRegister.XMM0, NASMRegister.XMM1)
+				}
+			}
+			sse("movd", NASMRegister.EAX, NASMRegister.XMM0)
+			if (type == TypeUnsigned8x16)
+				and(NASMRegister.EAX, NASMValue.LiteralInt(0xFF))
+			push(NASMRegister.EAX)
+		}
+
+		private fun bitType(instr: Instruction): Type<*> {
+			val type = (instr.args[0] as ArgType).value
+			if (type.size > 4)
+				throw UnsupportedOperationException("NASM emitter doesn't support 64 bit " + instr.opcode.name)
+			return type
+		}
+
+		// Pops an integer into EAX, zero extended from the width of its type
+		private fun NASMInstructionList.popBits(type: Type<*>) {
+			pop(NASMRegister.EAX)
+			when (type.size) {
+				1 -> movzx(NASMRegister.EAX, NASMRegister.AXL)
+				2 -> movzx(NASMRegister.EAX, NASMRegister.AX)
+			}
+		}
+
+		private inline fun NASMInstructionList.rotate(type: Type<*>, func: (NASMValue.Source, NASMValue.Source) -> Boolean) {
+			pop(NASMRegister.ECX)
+			popBits(type)
+			func(getCastRegister(type), NASMRegister.CXL)
+			push(NASMRegister.EAX)
+		}
+
 		private inline fun NASMInstructionList.binaryOp(func: (NASMValue.Source, NASMValue.Source) -> Boolean) {
 			pop(NASMRegister.ECX)
 			pop(NASMRegister.EAX)
@@ -352,7 +696,13 @@ class NASMEmitter(val underscores: Boolean) : dusk.ilc.emitter.Emitter {
 				throw IllegalStateException("Attempt to use undefined local: $name")
 			val offset = function.locals.entries.takeWhile { it.key != name }.sumBy { it.value.size }
 
-			return -(4 + offset)
+			// Vectors start 16 bytes below their end
+			return -((if (function.locals[name] is VectorType<*>) 16 else 4) + offset)
+		}
+
+		private fun localType(function: Function, arg: Argument<*>): Type<*>? {
+			function as Function.Internal
+			return function.locals[(arg as ArgIdentifier).value]
 		}
 
 		private fun argOffset(function: Function, arg: Argument<*>): Int {
@@ -42,14 +42,26 @@ data class Add(override val a: S, override val b: S) : BinaryOp("add")
 data class Subtract(override val a: S, override val b: S) : BinaryOp("sub")
 data class Multiply(override val a: S, override val b: S) : BinaryOp("imul")
 data class Divide(val source: S) : Instr("div ${source.text}")
+data class SignedDivide(val source: S) : Instr("idiv ${source.text}")
+object SignExtendDivide : Instr("cdq")
 data class ShiftLeft(override val a: S, override val b: S) : BinaryOp("shl")
 data class ShiftRight(override val a: S, override val b: S) : BinaryOp("shr")
 data class And(override val a: S, override val b: S) : BinaryOp("and")
 data class Or(override val a: S, override val b: S) : BinaryOp("or")
 data class Xor(override val a: S, override val b: S) : BinaryOp("xor")
+data class RotateLeft(override val a: S, override val b: S) : BinaryOp("rol")
+data class RotateRight(override val a: S, override val b: S) : BinaryOp("ror")
+data class PopulationCount(override val a: S, override val b: S) : BinaryOp("popcnt")
+data class LeadingZeroCount(override val a: S, override val b: S) : BinaryOp("lzcnt")
+data class TrailingZeroCount(override val a: S, override val b: S) : BinaryOp("tzcnt")
+data class ByteSwap(val target: T) : Instr("bswap ${target.text}")
 
 data class Move(val target: T, val source: S) : Instr("mov ${target.text}, ${source.text}")
 data class LoadEffectiveAddress(val target: T, val source: S) : Instr("lea ${target.text}, ${source.text}")
+data class MoveZeroExtend(val target: T, val source: S) : Instr("movzx ${target.text}, ${source.text}")
+
+object RepeatMoveBytes : Instr("rep movsb")
+object RepeatStoreBytes : Instr("rep stosb")
 
 data class FloatingPointLoad(val source: S) : Instr("fld qword ${source.text}")
 data class FloatingPointStore(val target: T) : Instr("fstp qword ${target.text}")
@@ -60,6 +72,9 @@ object FloatingPointDivide : Instr("fdiv")
 
 object FloatingPointInit: Instr("finit")
 
+// SSE instructions differ only in their mnemonic and operands
+data class VectorInstruction(val code: String, val operands: List<NASMValue>) : Instr("$code ${operands.joinToString { it.text }}")
+
 data class Comment(val content: String) : Instr("; $content")
 
 abstract class BinaryOp(val code: String) : NASMInstruction {
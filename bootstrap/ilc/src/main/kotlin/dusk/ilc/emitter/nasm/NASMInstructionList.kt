@@ -11,6 +11,9 @@ class NASMInstructionList(val list: MutableList<NASMInstruction> = ArrayList()):
 
 	fun mov(target: NASMValue.Target, source: NASMValue.Source) = add(Move(target, source))
 	fun lea(target: NASMValue.Target, source: NASMValue.Source) = add(LoadEffectiveAddress(target, source))
+	fun movzx(target: NASMValue.Target, source: NASMValue.Source) = add(MoveZeroExtend(target, source))
+	fun repMovsb() = add(RepeatMoveBytes)
+	fun repStosb() = add(RepeatStoreBytes)
 
 	fun push(source: NASMValue.Source) = add(Push(source))
 	fun pop(target: NASMValue.Target) = add(Pop(target))
@@ -33,11 +36,19 @@ class NASMInstructionList(val list: MutableList<NASMInstruction> = ArrayList()):
 	fun sub(a: NASMValue.Source, b: NASMValue.Source) = add(Subtract(a, b))
 	fun mul(a: NASMValue.Source, b: NASMValue.Source) = add(Multiply(a, b))
 	fun div(source: NASMValue.Source) = add(Divide(source))
+	fun idiv(source: NASMValue.Source) = add(SignedDivide(source))
+	fun cdq() = add(SignExtendDivide)
 	fun shl(a: NASMValue.Source, b: NASMValue.Source) = add(ShiftLeft(a, b))
 	fun shr(a: NASMValue.Source, b: NASMValue.Source) = add(ShiftRight(a, b))
 	fun and(a: NASMValue.Source, b: NASMValue.Source) = add(And(a, b))
 	fun or(a: NASMValue.Source, b: NASMValue.Source) = add(Or(a, b))
 	fun xor(a: NASMValue.Source, b: NASMValue.Source) = add(Xor(a, b))
+	fun rol(a: NASMValue.Source, b: NASMValue.Source) = add(RotateLeft(a, b))
+	fun ror(a: NASMValue.Source, b: NASMValue.Source) = add(RotateRight(a, b))
+	fun popcnt(a: NASMValue.Source, b: NASMValue.Source) = add(PopulationCount(a, b))
+	fun lzcnt(a: NASMValue.Source, b: NASMValue.Source) = add(LeadingZeroCount(a, b))
+	fun tzcnt(a: NASMValue.Source, b: NASMValue.Source) = add(TrailingZeroCount(a, b))
+	fun bswap(target: NASMValue.Target) = add(ByteSwap(target))
 
 	fun neg(source: NASMValue.Source) = add(Negate(source))
 
@@ -52,6 +63,8 @@ class NASMInstructionList(val list: MutableList<NASMInstruction> = ArrayList()):
 	fun fmul() = add(FloatingPointMultiply)
 	fun fdiv() = add(FloatingPointDivide)
 
+	fun sse(code: String, vararg operands: NASMValue) = add(VectorInstruction(code, operands.toList()))
+
 	fun dataByteArray(name: String, bytes: ByteArray) = add(DataByteArray(name, bytes))
 	fun dataDouble(name: String, value: Double) = add(DataDouble(name, value))
 
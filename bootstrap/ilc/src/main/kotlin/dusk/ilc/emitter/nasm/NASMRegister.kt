@@ -3,7 +3,7 @@ package dusk.ilc.emitter.nasm
 import dusk.ilc.util.signChar
 import kotlin.math.absoluteValue
 
-enum class NASMRegister: NASMValue.Source, NASMValue.Target {
+enum class NASMRegister(text: String? = null): NASMValue.Source, NASMValue.Target {
 	RAX,
 	RBX,
 	RCX,
@@ -31,16 +31,21 @@ enum class NASMRegister: NASMValue.Source, NASMValue.Target {
 	BP,
 	SP,
 
-	AXL,
-	BXL,
-	CXL,
-	DXL,
+	AXL("AL"),
+	BXL("BL"),
+	CXL("CL"),
+	DXL("DL"),
 	SIL,
 	DIL,
 	BPL,
-	SPL;
+	SPL,
 
-	override val text = name
+	XMM0,
+	XMM1,
+	XMM2,
+	XMM3;
+
+	override val text = text ?: name
 
 	operator fun plus(offset: Int) = NASMRegisterOffset(this, offset)
 	operator fun minus(offset: Int) = NASMRegisterOffset(this, -offset)
@@ -53,4 +58,11 @@ data class NASMRegisterOffset(val register: NASMRegister, val offset: Int): NASM
 		0 -> "[${register.text}]"
 		else -> "[${register.text}${offset.signChar}${offset.absoluteValue}]"
 	}
+}
+
+data class NASMRegisterIndex(val register: NASMRegister, val index: NASMRegister, val scale: Int): NASMValue.Source, NASMValue.Target {
+	override val text = when (scale) {
+		1 -> "[${register.text}+${index.text}]"
+		else -> "[${register.text}+${index.text}*$scale]"
+	}
 }
\ No newline at end of file
@@ -34,6 +34,7 @@ fun main(args: Array<String>) {
 	var parserType: ParserType? = null
 
 	var interpret = false
+	var profileFile: File? = null
 	// duskilc -o test.exe -e binary -p textV2 ogl.il
 
 	var i = 0
@@ -80,6 +81,13 @@ fun main(args: Array<String>) {
 			Flags.optimization = false
 		} else if(str == "-i") {
 			interpret = true
+		} else if(str == "--profile") {
+			if (i >= args.size) {
+				System.err.println("Expected file path")
+				return
+			}
+
+			profileFile = File(args[i++])
 		} else if(inputFile == null) {
 			val result = StringBuilder()
 			i--
@@ -117,7 +125,7 @@ fun main(args: Array<String>) {
 
 	if(interpret) {
 		val parser = parserType.create()
-		executeInterpreter(inputFile, parser)
+		executeInterpreter(inputFile, parser, profileFile)
 		return
 	}
 
@@ -143,13 +151,25 @@ private fun execute(inp: File, out: File, emitter: Emitter, parser: Parser) {
 	emitter.emit(instructions, out.outputStream())
 }
 
-private fun executeInterpreter(inp: File, parser: Parser) {
+private fun executeInterpreter(inp: File, parser: Parser, profile: File?) {
 //	println("### Interpreting ${inp.path}")
 	var instructions = parser.parse(inp.inputStream()).toNonScript()
 	if(Flags.optimization)
 		instructions = Optimizer.optimize(instructions)
 	val interpreter = Interpreter(instructions)
 	interpreter.addExternalFunctionHandler(ReflectionFunctions(StandardExternalFunctions))
+
+	// Hot spots go to stderr, the collapsed stacks to the profile file
+	val profiler = if(profile != null) Profiler(instructions) else null
+	interpreter.profiler = profiler
+	profiler?.start()
+
 	interpreter.execute()
+
+	if(profiler != null && profile != null) {
+		profiler.stop()
+		profiler.report(System.err)
+		profile.writer().use { profiler.writeCollapsed(it) }
+	}
 //	println("### Interpreter done")
 }
\ No newline at end of file
@@ -3,6 +3,11 @@ package dusk.ilc.opcodes
 data class Instruction(val opcode: OpCode, val args: List<Argument<*>> = emptyList()) {
 	constructor(opcode: OpCode, vararg args: Argument<*>) : this(opcode, args.toList())
 
+	/**
+	 * The offset of this instruction in the binary IL it was read from, -1 if it was not read from binary IL
+	 */
+	var offset = -1
+
 	override fun toString(): String {
 		if (args.isEmpty())
 			return opcode.name
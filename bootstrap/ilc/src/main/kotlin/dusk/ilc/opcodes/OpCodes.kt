@@ -10,15 +10,15 @@ object OpCodes {
 			/* 0x3 */   CMPE, CMPG, CPGE, CMPL, CPLE, CPNE, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP,
 			/* 0x4 */   FUNC, RETN, CALL, CALS, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP,
 			/* 0x5 */   LABL, JUMP, JEQZ, JNEZ, JGTZ, JGEZ, JLTZ, JLEZ, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP,
-			/* 0x6 */   LLOC, SLOC, ADRL, LARG, SARG, ADRA, LGLO, SGLO, ADRG, READ, WRIT, ADRS, NOOP, NOOP, NOOP, NOOP,
+			/* 0x6 */   LLOC, SLOC, ADRL, LARG, SARG, ADRA, LGLO, SGLO, ADRG, READ, WRIT, ADRS, MCPY, MSET, NOOP, NOOP,
 			/* 0x7 */   IADD, ISUB, IMUL, IDIV, INEG, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP,
 			/* 0x8 */   FADD, FSUB, FMUL, FDIV, FNEG, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP,
-			/* 0x9 */   BSHL, BSHR, BAND, BWOR, BXOR, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP,
-			/* 0xA */   NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP,
+			/* 0x9 */   BSHL, BSHR, BAND, BWOR, BXOR, BROL, BROR, BPOP, BCLZ, BCTZ, BSWP, NOOP, NOOP, NOOP, NOOP, NOOP,
+			/* 0xA */   VADD, VSUB, VMUL, VDIV, VCPE, VCPG, VCPL, VSHF, VLOD, VSTR, VSPL, VBLD, VEXT, VINS, VSUM, NOOP,
 			/* 0xB */   NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP,
 			/* 0xC */   NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP,
 			/* 0xD */   NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP,
-			/* 0xE */   EXFN, INFN, FPRM, FLOC, GLOB, DATA, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP,
+			/* 0xE */   EXFN, INFN, FPRM, FLOC, GLOB, DATA, LINE, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP,
 			/* 0xF */   NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP, NOOP
 	)
 
@@ -104,6 +104,9 @@ object OpCodes {
 
 	object ADRS : OpCode(0x6B)
 
+	object MCPY : OpCode(0x6C)
+	object MSET : OpCode(0x6D)
+
 	// ------- Integer Arithmetic -------
 	object IADD : OpCode(0x70)
 	object ISUB : OpCode(0x71)
@@ -127,6 +130,41 @@ object OpCodes {
 	object BWOR : OpCode(0x93)
 	object BXOR : OpCode(0x94)
 
+	// ------- Bit Manipulation -------
+	abstract class BitOp(id: Int): OpCode(id, TypeType)
+
+	object BROL : BitOp(0x95)
+	object BROR : BitOp(0x96)
+
+	object BPOP : BitOp(0x97)
+	object BCLZ : BitOp(0x98)
+	object BCTZ : BitOp(0x99)
+
+	object BSWP : BitOp(0x9A)
+
+	// ------- Vector -------
+	abstract class Vector(id: Int): OpCode(id, TypeType)
+
+	object VADD : Vector(0xA0)
+	object VSUB : Vector(0xA1)
+	object VMUL : Vector(0xA2)
+	object VDIV : Vector(0xA3)
+
+	object VCPE : Vector(0xA4)
+	object VCPG : Vector(0xA5)
+	object VCPL : Vector(0xA6)
+
+	object VSHF : Vector(0xA7)
+
+	object VLOD : Vector(0xA8)
+	object VSTR : Vector(0xA9)
+
+	object VSPL : Vector(0xAA)
+	object VBLD : Vector(0xAB)
+	object VEXT : Vector(0xAC)
+	object VINS : Vector(0xAD)
+	object VSUM : Vector(0xAE)
+
 	// ------- Meta -------
 	object EXFN : OpCode(0xE0, TypeIdentifier, TypeType, TypeTypeArray)
 	object INFN : OpCode(0xE1, TypeIdentifier, TypeType)
@@ -135,6 +173,9 @@ object OpCodes {
 	object GLOB : OpCode(0xE3, TypeIdentifier, TypeIdentifier)
 	object DATA : OpCode(0xE4, TypeIdentifier, TypeByteArray)
 
+	// ------- Debug -------
+	object LINE : OpCode(0xE6, TypeStringArray, TypeByteArray)
+
 	// ------- Reserved -------
 	object NOOP : OpCode(0xFF)
 }
\ No newline at end of file
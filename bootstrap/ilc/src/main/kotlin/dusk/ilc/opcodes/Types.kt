@@ -19,6 +19,7 @@ abstract class UnsignedType<T>(id: Int, name: String, size: Int) : AbstractType<
 abstract class FloatType<T>(id: Int, name: String, size: Int) : AbstractType<T>(id, name, size)
 abstract class StringType(id: Int, name: String, size: Int) : AbstractType<String>(id, name, size)
 abstract class ArrayType<T>(id: Int, name: String, val type: Type<*>) : AbstractType<T>(id, name, 4)
+abstract class VectorType<T>(id: Int, name: String, val lane: Type<*>) : AbstractType<T>(id, name, 16)
 
 abstract class Argument<T>(val type: Type<T>, val value: T) {
 	override fun toString(): String {
@@ -49,9 +50,9 @@ val types = listOf<Type<*>>(
 		/* 0x9 */ TypeFloat64,
 		/* 0xA */ TypeString,
 		/* 0xB */ TypeIdentifier,
-		/* 0xC */ TypeVoid,
-		/* 0xD */ TypeVoid,
-		/* 0xE */ TypeVoid,
+		/* 0xC */ TypeFloat32x4,
+		/* 0xD */ TypeInt32x4,
+		/* 0xE */ TypeUnsigned8x16,
 		/* 0xF */ TypeVoid,
 		/* 0x? */ TypeStringArray, TypeTypeArray, TypeByteArray, TypeType
 )
@@ -73,6 +74,10 @@ object TypeFloat64 			: FloatType<Double>			(0x9, "f64", 8)
 object TypeString 			: StringType				(0xA, "str", 4)
 object TypeIdentifier 		: StringType				(0xB, "ptr", 4)
 
+object TypeFloat32x4		: VectorType<FloatArray>	(0xC, "f32x4", TypeFloat32)
+object TypeInt32x4			: VectorType<IntArray>		(0xD, "i32x4", TypeInt32)
+object TypeUnsigned8x16		: VectorType<ByteArray>		(0xE, "u8x16", TypeUnsigned8)
+
 object TypeVoid 			: AbstractType<Nothing?>	(0xF, "void", 0)
 
 object TypeStringArray 		: ArrayType<Array<String>>	(0xFF, "?", TypeString)
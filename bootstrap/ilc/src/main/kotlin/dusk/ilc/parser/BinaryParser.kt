@@ -3,23 +3,54 @@ package dusk.ilc.parser
 import dusk.ilc.opcodes.*
 import dusk.ilc.program.ProgramData
 import java.io.DataInputStream
+import java.io.FilterInputStream
 import java.io.InputStream
 
 object BinaryParser: Parser {
 	override fun parse(input: InputStream): ProgramData {
-		val data = DataInputStream(input)
+		val counter = CountingInputStream(input)
+		val data = DataInputStream(counter)
 
 		val result = ArrayList<Instruction>()
 
 		//TODO: This may exit early
 		while(data.available() > 0){
+			val offset = counter.count
 			val instr = readInstruction(data)
+			instr.offset = offset
 			result.add(instr)
 		}
 
 		return ProgramData(result)
 	}
 
+	/**
+	 * Counts the bytes read, so instructions know their offset
+	 */
+	private class CountingInputStream(input: InputStream): FilterInputStream(input) {
+		var count = 0
+
+		override fun read(): Int {
+			val result = super.read()
+			if(result != -1)
+				count++
+			return result
+		}
+
+		override fun read(b: ByteArray, off: Int, len: Int): Int {
+			val result = super.read(b, off, len)
+			if(result > 0)
+				count += result
+			return result
+		}
+
+		override fun skip(n: Long): Long {
+			val result = super.skip(n)
+			count += result.toInt()
+			return result
+		}
+	}
+
 	private fun readInstruction(data: DataInputStream): Instruction {
 		val opcode = OpCodes.codes[data.read()]
 		val args = opcode.argumentTypes.map { readArgument(data, it) }
@@ -0,0 +1,77 @@
+package dusk.ilc.program
+
+/**
+ * Maps offsets in the binary IL to the source positions their code was generated from, as written by the
+ * frontend with `-g`.
+ *
+ * @param files the source files positions refer to
+ * @param table the entries of the LINE instruction, delta and LEB128 encoded
+ */
+class LineTable(val files: Array<String>, table: ByteArray) {
+
+	/**
+	 * A position in a source file, a [line] of 0 is code without one
+	 */
+	data class Position(val file: String, val line: Int, val column: Int) {
+		override fun toString() = "$file:$line:$column"
+	}
+
+	private val offsets = ArrayList<Int>()
+	private val positions = ArrayList<Position>()
+
+	init {
+		var i = 0
+		var offset = 0
+		var file = 0
+		var line = 0
+		var column = 0
+
+		fun readUnsigned(): Int {
+			var result = 0
+			var shift = 0
+
+			while(true) {
+				val byte = table[i++].toInt() and 0xFF
+				result = result or ((byte and 0x7F) shl shift)
+				shift += 7
+
+				if(byte < 0x80)
+					return result
+			}
+		}
+
+		fun readSigned(): Int {
+			val zigzag = readUnsigned()
+			return (zigzag ushr 1) xor -(zigzag and 1)
+		}
+
+		while(i < table.size) {
+			val step = readUnsigned()
+			offset += step ushr 1
+
+			if((step and 1) != 0)
+				file = readUnsigned()
+
+			line += readSigned()
+			column += readSigned()
+
+			offsets.add(offset)
+			positions.add(Position(files[file], line, column))
+		}
+	}
+
+	/**
+	 * @return the position of the code at [offset], or `null` if it has none
+	 */
+	operator fun get(offset: Int): Position? {
+		var index = offsets.binarySearch(offset)
+
+		if(index < 0)
+			index = -index - 2
+
+		if(index < 0 || positions[index].line == 0)
+			return null
+
+		return positions[index]
+	}
+}
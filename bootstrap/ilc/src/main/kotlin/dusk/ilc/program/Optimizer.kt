@@ -7,10 +7,96 @@ object Optimizer {
 
 	fun optimize(program: ProgramData): ProgramData {
 		val list = program.instructions.toMutableList()
+		devirtualize(list)
 		optimize(list)
 		return ProgramData(list)
 	}
 
+	/**
+	 * Turns indirect calls of functions known from a PFUN into direct calls
+	 */
+	private fun devirtualize(instructions: MutableList<Instruction>) {
+		var end = instructions.size
+
+		// From the last function on, so calls made direct do not move the functions still to come
+		for (start in instructions.indices.reversed()) {
+			if (start != 0 && instructions[start].opcode != OpCodes.FUNC)
+				continue
+
+			devirtualize(instructions, start, end)
+			end = start
+		}
+	}
+
+	/**
+	 * Devirtualizes the calls of the function from [start] to [end]. A CALS calls a known function if it directly
+	 * follows the PFUN pushing it, or if it follows the load of a local stored once, by a PFUN earlier in the same
+	 * straight line of code, with its address never taken.
+	 */
+	private fun devirtualize(instructions: MutableList<Instruction>, start: Int, end: Int) {
+		val stores = HashMap<String, Int>()
+		val addressed = HashSet<String>()
+
+		// The function each local was stored from, with the index of the store
+		val known = HashMap<String, Pair<String, Int>>()
+
+		for (i in start until end) {
+			val instr = instructions[i]
+
+			if (instr.opcode == OpCodes.ADRL)
+				addressed.add((instr.args[0] as ArgIdentifier).value)
+
+			if (instr.opcode != OpCodes.SLOC)
+				continue
+
+			val name = (instr.args[0] as ArgIdentifier).value
+			stores[name] = (stores[name] ?: 0) + 1
+
+			if (i > start && instructions[i - 1].opcode == OpCodes.PFUN)
+				known[name] = (instructions[i - 1].args[0] as ArgIdentifier).value to i
+		}
+
+		fun storedFunction(name: String, load: Int): String? {
+			val (function, store) = known[name] ?: return null
+
+			if (stores[name] != 1 || name in addressed || store > load)
+				return null
+
+			// A label in between could be reached without passing the store
+			if ((store + 1 until load).any { instructions[it].opcode == OpCodes.LABL })
+				return null
+
+			return function
+		}
+
+		// The CALS known to call a function, found before any is rewritten so every index above is still valid
+		val calls = ArrayList<Pair<Int, String>>()
+
+		for (i in start until end - 1) {
+			if (instructions[i + 1].opcode != OpCodes.CALS)
+				continue
+
+			val instr = instructions[i]
+			val function = when (instr.opcode) {
+				OpCodes.PFUN -> (instr.args[0] as ArgIdentifier).value
+				OpCodes.LLOC -> storedFunction((instr.args[0] as ArgIdentifier).value, i)
+				else -> null
+			} ?: continue
+
+			calls.add(i to function)
+		}
+
+		// The push of the function and the CALS become one CALL, which keeps the offset of the CALS so it maps to
+		// the same source line. From the last one on, so the indices of the ones still to come do not move.
+		for ((i, function) in calls.asReversed()) {
+			val call = Instruction(OpCodes.CALL, ArgIdentifier(function))
+			call.offset = instructions[i + 1].offset
+
+			instructions.removeAt(i + 1)
+			instructions[i] = call
+		}
+	}
+
 	private fun optimize(instructions: MutableList<Instruction>) {
 		var changed = false
 
@@ -106,7 +192,8 @@ object Optimizer {
 			OpCodes.FPRM,
 			OpCodes.FLOC,
 			OpCodes.GLOB,
-			OpCodes.DATA
+			OpCodes.DATA,
+			OpCodes.LINE
 	)
 
 	private fun expectsInt(opcode: OpCode): Boolean {
@@ -25,6 +25,11 @@ class ProgramData(val instructions: List<Instruction>) {
 	 */
 	val data by lazy { findData() }
 
+	/**
+	 * The source positions of the instructions, `null` if the program has none.
+	 */
+	val lines by lazy { findLines() }
+
 	/**
 	 * `true` if this program is probably a script
 	 *
@@ -90,6 +95,27 @@ class ProgramData(val instructions: List<Instruction>) {
 		return null
 	}
 
+	/**
+	 * @return the offset in the binary IL of the instruction at [index], or of the closest one before it that was
+	 * read from binary IL. -1 if there is none.
+	 */
+	fun getOffset(index: Int): Int {
+		var i = index
+		while (i >= 0 && this[i].offset == -1)
+			i--
+
+		return if (i >= 0) this[i].offset else -1
+	}
+
+	private fun findLines(): LineTable? {
+		val instr = instructions.lastOrNull { it.opcode == OpCodes.LINE } ?: return null
+
+		val files = (instr.args[0] as ArgStringArray).value
+		val table = (instr.args[1] as ArgByteArray).value
+
+		return LineTable(files, table)
+	}
+
 	private fun findData(): Map<String, ByteBuffer> {
 		val data = HashMap<String, ByteBuffer>()
 
@@ -27,6 +27,17 @@ class Interpreter(val program: ProgramData) {
 	val currentScope: Scope?
 		get() = if(scopeStack.isEmpty()) null else scopeStack.peek()
 
+	/**
+	 * The profiler sampling this interpreter, if any
+	 */
+	var profiler: Profiler? = null
+
+	// Where each internal function starts, found when it is first called
+	private val entries = HashMap<Function, Int>()
+
+	// The inline cache of every CALS, by the index of the instruction
+	private val inlineCaches = arrayOfNulls<InlineCache>(program.instructions.size)
+
 	init {
 		val func = getFunction("main")
 		if(func != null)
@@ -54,6 +65,10 @@ class Interpreter(val program: ProgramData) {
 		if(!hasRemaining)
 			return
 
+		val profiler = profiler
+		if(profiler != null && profiler.pending)
+			profiler.sample(scopeStack)
+
 		val instr = program[index++]
 		Verbose.println("### $instr")
 //		println("Scope: ${scopeStack.size}")
@@ -97,7 +112,7 @@ class Interpreter(val program: ProgramData) {
 						?: throw IllegalStateException("Attempt to call undefined function $functionName"))
 				callFunction(func)
 			}
-			OpCodes.CALS -> callFunction(pop() as Function)
+			OpCodes.CALS -> callIndirect(index - 1, pop() as Function)
 
 			OpCodes.CMPE -> compare { a, b -> a == b }
 			OpCodes.CMPG -> compare { a, b -> a > b }
@@ -135,6 +150,8 @@ class Interpreter(val program: ProgramData) {
 
 			OpCodes.READ -> TODO()
 			OpCodes.WRIT -> TODO()
+			OpCodes.MCPY -> TODO()
+			OpCodes.MSET -> TODO()
 
 			OpCodes.IADD -> binaryIntegerOp { a, b -> a + b }
 			OpCodes.ISUB -> binaryIntegerOp { a, b -> a - b }
@@ -156,7 +173,77 @@ class Interpreter(val program: ProgramData) {
 			OpCodes.BWOR -> binaryIntegerOp { a, b -> a or b }
 			OpCodes.BXOR -> binaryIntegerOp { a, b -> a xor  b }
 
-			OpCodes.INFN, OpCodes.EXFN, OpCodes.FPRM, OpCodes.FLOC, OpCodes.DATA -> {}
+			OpCodes.BROL -> {
+				val n = (pop() as Number).toInt()
+				bitOp(instr) { x, bits -> (x shl (n % bits)) or (x ushr (bits - n % bits)) }
+			}
+			OpCodes.BROR -> {
+				val n = (pop() as Number).toInt()
+				bitOp(instr) { x, bits -> (x ushr (n % bits)) or (x shl (bits - n % bits)) }
+			}
+			OpCodes.BPOP -> bitOp(instr) { x, _ -> java.lang.Long.bitCount(x).toLong() }
+			OpCodes.BCLZ -> bitOp(instr) { x, bits -> java.lang.Long.numberOfLeadingZeros(x) - (64L - bits) }
+			OpCodes.BCTZ -> bitOp(instr) { x, bits -> if (x == 0L) bits.toLong() else java.lang.Long.numberOfTrailingZeros(x).toLong() }
+			OpCodes.BSWP -> bitOp(instr) { x, bits -> java.lang.Long.reverseBytes(x) ushr (64 - bits) }
+
+			OpCodes.VADD -> vectorOp({ a, b -> a + b }, { a, b -> a + b })
+			OpCodes.VSUB -> vectorOp({ a, b -> a - b }, { a, b -> a - b })
+			OpCodes.VMUL -> vectorOp({ a, b -> a * b }, { a, b -> a * b })
+			OpCodes.VDIV -> vectorOp({ a, b -> a / b }, { a, b -> a / b })
+			OpCodes.VCPE -> vectorCompare { a, b -> a == b }
+			OpCodes.VCPG -> vectorCompare { a, b -> a > b }
+			OpCodes.VCPL -> vectorCompare { a, b -> a < b }
+			OpCodes.VSHF -> {
+				val v = pop()
+				val lanes = pop()
+				push(when(v) {
+					is FloatArray -> FloatArray(4) { v[(lanes as IntArray)[it] and 3] }
+					is IntArray -> IntArray(4) { v[(lanes as IntArray)[it] and 3] }
+					else -> ByteArray(16) { (v as ByteArray)[(lanes as ByteArray)[it].toInt() and 15] }
+				})
+			}
+			// Like READ and WRIT these need memory
+			OpCodes.VLOD -> TODO()
+			OpCodes.VSTR -> TODO()
+			OpCodes.VSPL -> {
+				val x = pop() as Number
+				push(newVector(instr) { x })
+			}
+			OpCodes.VBLD -> {
+				val lanes = ArrayList<Number>()
+				repeat(vectorLanes(instr)) { lanes.add(pop() as Number) }
+				push(newVector(instr) { lanes[it] })
+			}
+			OpCodes.VEXT -> {
+				val v = pop()
+				val lane = (pop() as Number).toInt()
+				push(when(v) {
+					is FloatArray -> v[lane and 3]
+					is IntArray -> v[lane and 3]
+					else -> (v as ByteArray)[lane and 15]
+				})
+			}
+			OpCodes.VINS -> {
+				val v = pop()
+				val lane = (pop() as Number).toInt()
+				val x = pop() as Number
+				push(when(v) {
+					is FloatArray -> v.copyOf().also { it[lane and 3] = x.toFloat() }
+					is IntArray -> v.copyOf().also { it[lane and 3] = x.toInt() }
+					else -> (v as ByteArray).copyOf().also { it[lane and 15] = x.toByte() }
+				})
+			}
+			OpCodes.VSUM -> {
+				val v = pop()
+				push(when(v) {
+					// In the order SSE adds them, lanes half a vector apart first
+					is FloatArray -> (v[0] + v[2]) + (v[1] + v[3])
+					is IntArray -> v.sum()
+					else -> (v as ByteArray).sumBy { it.toInt() and 0xFF }.toByte()
+				})
+			}
+
+			OpCodes.INFN, OpCodes.EXFN, OpCodes.FPRM, OpCodes.FLOC, OpCodes.DATA, OpCodes.LINE -> {}
 
 			else -> throw UnsupportedOperationException(instr.toString())
 		}
@@ -185,7 +272,20 @@ class Interpreter(val program: ProgramData) {
 		val a = (original).toLong()
 		val b = (pop() as Number).toLong()
 
-		val result = body(b, a)
+		pushInteger(original, body(b, a))
+	}
+
+	// Applies body to the value on the stack, zero extended from the width of
+	// the instruction's type
+	private inline fun bitOp(instr: Instruction, body: (Long, Int) -> Long) {
+		val bits = (instr.args[0] as ArgType).value.size * 8
+		val mask = if(bits == 64) -1L else (1L shl bits) - 1
+		val original = pop() as Number
+
+		pushInteger(original, body(original.toLong() and mask, bits) and mask)
+	}
+
+	private fun pushInteger(original: Number, result: Long) {
 		when(original) {
 			is Byte -> push(result.toByte())
 			is Short -> push(result.toShort())
@@ -209,6 +309,47 @@ class Interpreter(val program: ProgramData) {
 		}
 	}
 
+	private fun vectorLanes(instr: Instruction) = if((instr.args[0] as ArgType).value == TypeUnsigned8x16) 16 else 4
+
+	// A vector of the instruction's type, with lane n set to lane(n)
+	private inline fun newVector(instr: Instruction, crossinline lane: (Int) -> Number): Any {
+		return when((instr.args[0] as ArgType).value) {
+			TypeFloat32x4 -> FloatArray(4) { lane(it).toFloat() }
+			TypeInt32x4 -> IntArray(4) { lane(it).toInt() }
+			else -> ByteArray(16) { lane(it).toByte() }
+		}
+	}
+
+	// Applies floats or ints lane by lane to A and B, with B on top. Integer lanes wrap around and u8 lanes are passed
+	// unsigned
+	private inline fun vectorOp(crossinline floats: (Float, Float) -> Float, crossinline ints: (Int, Int) -> Int) {
+		val b = pop()
+		val a = pop()
+
+		push(when(a) {
+			is FloatArray -> FloatArray(4) { floats(a[it], (b as FloatArray)[it]) }
+			is IntArray -> IntArray(4) { ints(a[it], (b as IntArray)[it]) }
+			else -> ByteArray(16) { ints((a as ByteArray)[it].toInt() and 0xFF, (b as ByteArray)[it].toInt() and 0xFF).toByte() }
+		})
+	}
+
+	// Compares A and B lane by lane, with B on top, giving all ones where body holds. The masks of f32 lanes are i32
+	// lanes and u8 lanes compare unsigned
+	private inline fun vectorCompare(crossinline body: (Double, Double) -> Boolean) {
+		val b = pop()
+		val a = pop()
+
+		push(when(a) {
+			is FloatArray -> IntArray(4) { if(body(a[it].toDouble(), (b as FloatArray)[it].toDouble())) -1 else 0 }
+			is IntArray -> IntArray(4) { if(body(a[it].toDouble(), (b as IntArray)[it].toDouble())) -1 else 0 }
+			else -> ByteArray(16) {
+				val x = (a as ByteArray)[it].toInt() and 0xFF
+				val y = (b as ByteArray)[it].toInt() and 0xFF
+				(if(body(x.toDouble(), y.toDouble())) -1 else 0).toByte()
+			}
+		})
+	}
+
 	private fun getFunction(name: String): Function? {
 		return program.functions[name]
 	}
@@ -219,10 +360,37 @@ class Interpreter(val program: ProgramData) {
 			return
 		}
 
-		val index = program.instructions.indexOfFirst {
-			it.opcode == OpCodes.FUNC && it.args[0].value == func.name
+		enterFunction(func, findEntry(func))
+	}
+
+	// Calls func from the CALS at site, looking where it starts up in the inline cache of the site first
+	private fun callIndirect(site: Int, func: Function) {
+		if(func is Function.External) {
+			callExternalFunction(func)
+			return
 		}
 
+		val cache = inlineCaches[site] ?: InlineCache().also { inlineCaches[site] = it }
+		var entry = cache.find(func)
+
+		if(entry == -1) {
+			entry = findEntry(func)
+			cache.add(func, entry)
+		}
+
+		enterFunction(func, entry)
+	}
+
+	private fun findEntry(func: Function): Int {
+		return entries.getOrPut(func) {
+			program.instructions.indexOfFirst {
+				it.opcode == OpCodes.FUNC && it.args[0].value == func.name
+			}
+		}
+	}
+
+	// Enters func, whose FUNC instruction is at index
+	private fun enterFunction(func: Function, index: Int) {
 		val scope = Scope(func.returnType)
 		for((k, _) in func.parameters) {
 			scope.args[k] = pop()
@@ -258,6 +426,38 @@ class Interpreter(val program: ProgramData) {
 		this.index = index
 	}
 
+	/**
+	 * The functions a CALS called and where they start, compared by identity. A site that only ever calls one function
+	 * is monomorphic and finds it with the first comparison. Once a site called more than [SIZE] different functions
+	 * it is megamorphic and looks the others up in [entries].
+	 */
+	private class InlineCache {
+		val functions = arrayOfNulls<Function>(SIZE)
+		val entries = IntArray(SIZE)
+		var size = 0
+
+		fun find(func: Function): Int {
+			for(i in 0 until size) {
+				if(functions[i] === func)
+					return entries[i]
+			}
+
+			return -1
+		}
+
+		fun add(func: Function, entry: Int) {
+			if(size == SIZE)
+				return
+
+			functions[size] = func
+			entries[size++] = entry
+		}
+
+		companion object {
+			const val SIZE = 4
+		}
+	}
+
 	class Scope(val returnType: Type<*>) {
 		val stack = Stack<Any>()
 		val locals: MutableMap<String, Any> = HashMap()
@@ -0,0 +1,212 @@
+package dusk.ilc.program.interpreter
+
+import dusk.ilc.program.ProgramData
+import java.io.PrintStream
+import java.io.Writer
+import java.util.Stack
+import java.util.concurrent.locks.LockSupport
+
+/**
+ * A sampling profiler for the [Interpreter].
+ *
+ * A timer thread asks for a sample every [interval] microseconds, the way a profiling signal would. The interpreter
+ * takes it before its next step, copying the instruction index of every frame into a ring buffer allocated up front.
+ * The timer thread drains the ring, so as the interpreter is its only writer and the timer thread its only reader it
+ * needs no lock. Taking a sample allocates nothing, samples that do not fit into a full ring are dropped.
+ *
+ * Samples are reported by function and by source line, using the line table of the program if it has one, and as
+ * collapsed stacks for flame graphs.
+ *
+ * @param program the program being interpreted
+ * @param interval the time between samples in microseconds
+ */
+class Profiler(private val program: ProgramData, val interval: Long = 1000) {
+
+	/**
+	 * `true` if the interpreter should call [sample] before its next step
+	 */
+	@Volatile
+	var pending = false
+		private set
+
+	@Volatile
+	private var running = false
+
+	// Samples as their depth, followed by the instruction index of each frame from the outermost one in
+	private val ring = IntArray(RING_SIZE)
+
+	@Volatile
+	private var head = 0L
+
+	@Volatile
+	private var tail = 0L
+
+	/**
+	 * The samples that were dropped as the ring was full
+	 */
+	var lost = 0
+		private set
+
+	// The number of times each stack of instruction indices was sampled
+	private val stacks = HashMap<List<Int>, Int>()
+
+	private val functionNames = HashMap<Int, String>()
+
+	private val timer = Thread {
+		while (running) {
+			LockSupport.parkNanos(interval * 1000)
+			pending = true
+			drain()
+		}
+	}
+
+	init {
+		timer.name = "profiler"
+		timer.isDaemon = true
+	}
+
+	fun start() {
+		running = true
+		timer.start()
+	}
+
+	/**
+	 * Stops sampling and collects the samples left in the ring
+	 */
+	fun stop() {
+		running = false
+		pending = false
+		timer.join()
+		drain()
+	}
+
+	/**
+	 * Takes a sample of [scopes], the frames of the interpreter. Called by the interpreter.
+	 */
+	fun sample(scopes: Stack<Interpreter.Scope>) {
+		pending = false
+
+		val size = scopes.size
+		val depth = minOf(size, MAX_DEPTH)
+
+		if (RING_SIZE - (head - tail) < depth + 1) {
+			lost++
+			return
+		}
+
+		var at = head
+		ring[(at++ and RING_MASK).toInt()] = depth
+
+		for (i in size - depth until size) {
+			// Frames below the top are at the instruction after their call
+			val index = scopes[i].index
+			ring[(at++ and RING_MASK).toInt()] = if (i == size - 1) index else index - 1
+		}
+
+		head = at
+	}
+
+	private fun drain() {
+		var at = tail
+		val end = head
+
+		while (at < end) {
+			val depth = ring[(at++ and RING_MASK).toInt()]
+			val stack = ArrayList<Int>(depth)
+
+			for (i in 0 until depth)
+				stack.add(ring[(at++ and RING_MASK).toInt()])
+
+			stacks[stack] = (stacks[stack] ?: 0) + 1
+		}
+
+		tail = at
+	}
+
+	private fun functionName(index: Int): String {
+		return functionNames.getOrPut(index) { program.getFunction(index)?.name ?: "?" }
+	}
+
+	// The source line of the instruction at index, or its function and IL offset if it has none
+	private fun lineName(index: Int): String {
+		val offset = program.getOffset(index)
+		val position = program.lines?.get(offset)
+
+		if (position != null)
+			return "${position.file}:${position.line}"
+
+		return "${functionName(index)}+$offset"
+	}
+
+	/**
+	 * Writes the share of the samples spent in every function, by itself and including what it called, and in the
+	 * hottest source lines.
+	 */
+	fun report(out: PrintStream) {
+		val total = stacks.values.sum()
+
+		out.println("$total samples, one every $interval us" + if (lost > 0) ", $lost lost" else "")
+
+		if (total == 0)
+			return
+
+		val self = HashMap<String, Int>()
+		val inclusive = HashMap<String, Int>()
+		val lines = HashMap<String, Int>()
+
+		for ((stack, count) in stacks) {
+			if (stack.isEmpty())
+				continue
+
+			val top = stack.last()
+			self[functionName(top)] = (self[functionName(top)] ?: 0) + count
+			lines[lineName(top)] = (lines[lineName(top)] ?: 0) + count
+
+			// Recursive functions count once per sample
+			for (name in stack.map { functionName(it) }.toSet())
+				inclusive[name] = (inclusive[name] ?: 0) + count
+		}
+
+		out.println()
+		out.printf("%8s %8s  %s%n", "self", "total", "function")
+
+		val functions = inclusive.entries.sortedWith(
+				compareBy<Map.Entry<String, Int>>({ -(self[it.key] ?: 0) }, { -it.value }))
+
+		for ((name, count) in functions)
+			out.printf("%7.2f%% %7.2f%%  %s%n", 100.0 * (self[name] ?: 0) / total, 100.0 * count / total, name)
+
+		out.println()
+		out.printf("%8s  %s%n", "self", "line")
+
+		for ((name, count) in lines.entries.sortedBy { -it.value }.take(HOT_LINES))
+			out.printf("%7.2f%%  %s%n", 100.0 * count / total, name)
+	}
+
+	/**
+	 * Writes the samples as collapsed stacks, one "main;work;step 12" line of functions and samples per stack, as
+	 * taken by flamegraph.pl and converted to pprof by its tools.
+	 */
+	fun writeCollapsed(out: Writer) {
+		val collapsed = HashMap<String, Int>()
+
+		for ((stack, count) in stacks) {
+			val name = stack.joinToString(";") { functionName(it) }
+			collapsed[name] = (collapsed[name] ?: 0) + count
+		}
+
+		for ((name, count) in collapsed)
+			out.write("$name $count\n")
+	}
+
+	companion object {
+		// Ints in the ring, a power of two
+		private const val RING_SIZE = 1 shl 16
+		private const val RING_MASK = RING_SIZE - 1L
+
+		// Frames sampled at most, the innermost ones are kept
+		private const val MAX_DEPTH = 64
+
+		private const val HOT_LINES = 20
+	}
+}
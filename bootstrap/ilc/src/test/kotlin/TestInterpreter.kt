@@ -1,9 +1,16 @@
+import dusk.ilc.parser.BinaryParser
 import dusk.ilc.parser.TextParser
+import dusk.ilc.program.LineTable
 import dusk.ilc.program.Optimizer
 import dusk.ilc.program.interpreter.*
 import dusk.ilc.util.Flags
+import java.io.ByteArrayOutputStream
+import java.io.PrintStream
+import java.io.StringWriter
 
 fun main(args: Array<String>) {
+	profile()
+
 //	println("### Interpreting ${inp.path}")
 	val input = ClassLoader.getSystemClassLoader().getResourceAsStream("input.il")
 	var instructions = TextParser.parse(input).toNonScript()
@@ -50,4 +57,46 @@ fun main(args: Array<String>) {
 //		if (value.toLong() == 0L)
 //			System.err.println("Test failed")
 //	}
-//}
\ No newline at end of file
+//}
+
+// Profiles profile.fil, built from profile.ds with `frontend -g`, and checks that the samples land in its functions
+// and lines
+fun profile() {
+	val input = ClassLoader.getSystemClassLoader().getResourceAsStream("profile.fil")
+	var program = BinaryParser.parse(input)
+
+	val lines = program.lines ?: throw IllegalStateException("profile.fil has no line table")
+	check(lines[203] == LineTable.Position("profile.ds", 7, 13)) { "Offset 203 is at ${lines[203]}" }
+	check(lines[208] == LineTable.Position("profile.ds", 7, 13)) { "Offset 208 is at ${lines[208]}" }
+	check(lines[309] == LineTable.Position("profile.ds", 14, 5)) { "Offset 309 is at ${lines[309]}" }
+	check(lines[64] == LineTable.Position("i32.ds", 36, 5)) { "Offset 64 is at ${lines[64]}" }
+
+	if (Flags.optimization)
+		program = Optimizer.optimize(program)
+
+	val interpreter = Interpreter(program)
+	val profiler = Profiler(program, 100)
+	interpreter.profiler = profiler
+	profiler.start()
+	interpreter.execute()
+	profiler.stop()
+
+	// Every stack is main or main calling work, and most samples are taken in its loop
+	val collapsed = StringWriter().also { profiler.writeCollapsed(it) }.toString().lines().filter { it.isNotEmpty() }
+	val counts = collapsed.associate { it.substringBeforeLast(' ') to it.substringAfterLast(' ').toInt() }
+	check(counts.keys.all { it == "main" || it == "main;worki32" }) { "Unexpected stacks $collapsed" }
+	check((counts["main;worki32"] ?: 0) > (counts["main"] ?: 0)) { "Too few samples in work: $collapsed" }
+
+	val bytes = ByteArrayOutputStream()
+	profiler.report(PrintStream(bytes, true))
+	val report = bytes.toString().lines()
+
+	// The lines are listed after their header, all of them in profile.ds and the hottest one in the loop
+	val hot = report.drop(report.indexOfFirst { it.trim() == "self  line" } + 1)
+			.filter { it.isNotBlank() }
+			.map { it.trim().substringAfter("%").trim() }
+	check(hot.isNotEmpty() && hot.all { it.startsWith("profile.ds:") }) { "Unexpected lines $hot" }
+	check(hot[0].substringAfter(':').toInt() in 6..7) { "The loop is not the hottest line: $hot" }
+
+	println("Profiled ${counts.values.sum()} samples")
+}
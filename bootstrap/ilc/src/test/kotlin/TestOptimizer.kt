@@ -1,9 +1,14 @@
 import dusk.ilc.emitter.TextEmitter
+import dusk.ilc.opcodes.ArgIdentifier
+import dusk.ilc.opcodes.OpCodes
 import dusk.ilc.parser.TextParser
 import dusk.ilc.program.Optimizer
+import dusk.ilc.program.ProgramData
 import dusk.ilc.util.OutputStreamWrapper
 
 fun main(args: Array<String>) {
+	devirtualize()
+
 	val input = ClassLoader.getSystemClassLoader().getResourceAsStream("optimize.il")
 	val program = TextParser.parse(input)
 
@@ -12,4 +17,61 @@ fun main(args: Array<String>) {
 	println("-".repeat(10))
 	println("Previous size: ${program.instructions.size}")
 	println("Optimized size: ${optimized.instructions.size}")
-}
\ No newline at end of file
+}
+
+// Parses the body of main, which can call f and h and has the locals g and p, numbering the offsets of its
+// instructions as if they were read from binary IL
+private fun parseMain(body: String): ProgramData {
+	val program = TextParser.parse("""
+		INFN f void
+		FUNC f
+		RETN
+		INFN h void
+		FUNC h
+		RETN
+		INFN main void
+		FLOC main g ptr
+		FLOC main p ptr
+		FUNC main
+		$body
+		RETN
+	""".trimIndent().byteInputStream())
+
+	program.instructions.forEachIndexed { i, instr -> instr.offset = i * 10 }
+	return program
+}
+
+// The functions main calls directly and how many calls stayed indirect
+private fun calls(program: ProgramData): Pair<List<String>, Int> {
+	val main = program.instructions.indexOfFirst { it.opcode == OpCodes.FUNC && it.args[0].value == "main" }
+	val body = program.instructions.drop(main)
+
+	return body.filter { it.opcode == OpCodes.CALL }.map { (it.args[0] as ArgIdentifier).value } to
+			body.count { it.opcode == OpCodes.CALS }
+}
+
+private fun devirtualize() {
+	// Both calls become direct, in order, each at the offset of its CALS
+	val pushed = parseMain("PFUN f; CALS void []; PFUN h; CALS void []")
+	val cals = pushed.instructions.filter { it.opcode == OpCodes.CALS }.map { it.offset }
+	val direct = Optimizer.optimize(pushed)
+	check(calls(direct) == listOf("f", "h") to 0) { "PFUN then CALS: ${calls(direct)}" }
+	check(direct.instructions.filter { it.opcode == OpCodes.CALL }.map { it.offset } == cals) { "The calls moved" }
+	check(direct.instructions.last().opcode == OpCodes.RETN) { "Lost the return of main" }
+
+	val stored = Optimizer.optimize(parseMain("PFUN f; SLOC g; PI32 1; DELE; LLOC g; CALS void []"))
+	check(calls(stored) == listOf("f") to 0) { "Stored once: ${calls(stored)}" }
+
+	val twice = Optimizer.optimize(parseMain("PFUN f; SLOC g; PFUN h; SLOC g; LLOC g; CALS void []"))
+	check(calls(twice) == emptyList<String>() to 1) { "Stored twice: ${calls(twice)}" }
+
+	// The label could be jumped to from a path that never stored g
+	val label = Optimizer.optimize(parseMain("PFUN f; SLOC g; LABL again; LLOC g; CALS void []"))
+	check(calls(label) == emptyList<String>() to 1) { "Label in between: ${calls(label)}" }
+
+	// Anything could be written to g through p
+	val address = Optimizer.optimize(parseMain("PFUN f; SLOC g; ADRL g; SLOC p; LLOC g; CALS void []"))
+	check(calls(address) == emptyList<String>() to 1) { "Address taken: ${calls(address)}" }
+
+	println("Devirtualized")
+}
@@ -11,11 +11,11 @@ if [ ! -d bin/duskilc-0.1 ]; then
 	clear
 fi
 
-../frontend/build/frontend ./bin/out.fil *.ds
+../frontend/build/frontend -I . ./bin/out.fil main.ds
 
 ./bin/duskilc-0.1/bin/duskilc -v --no-optimization -o ./bin/test.il -e text -p bin ./bin/out.fil
 ./bin/duskilc-0.1/bin/duskilc -v --no-optimization -o ./bin/test.asm -e nasm -p bin ./bin/out.fil
 nasm -f elf -o ./bin/test.o ./bin/test.asm
-gcc -m32 -lGL -lGLU -lglut -o stdlib ./bin/test.o
+gcc -m32 -pthread -lGL -lGLU -lglut -o stdlib ./bin/test.o runtime/*.c
 #clear
 ./stdlib
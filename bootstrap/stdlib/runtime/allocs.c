@@ -0,0 +1,204 @@
+/*
+ * Allocation tracking of programs built with --track-allocations.
+ *
+ * Every struct and array allocated outside an arena goes through
+ * dusk_alloc_track, passing a string literal describing the site as
+ * "<file>:<line>:<column> <type>", so the address of the description
+ * identifies the site. Sites live in an open addressed table keyed by that
+ * address. Every block remembers its site and size in a second table, keyed
+ * by the block, so dusk_alloc_free can take its bytes off the live bytes of
+ * the site. When the program exits the count, bytes and live bytes of every
+ * site are written, largest first, to $DUSK_ALLOCS or stderr.
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Sites a program can have, a power of two
+#define DUSK_ALLOC_SITES 4096
+
+typedef struct dusk_alloc_site {
+    const char *name;
+    uint64_t count;
+    uint64_t bytes;
+    uint64_t live;
+} dusk_alloc_site;
+
+typedef struct dusk_alloc_block {
+    void *ptr;
+    dusk_alloc_site *site;
+    uint32_t size;
+} dusk_alloc_block;
+
+static dusk_alloc_site dusk_alloc_sites[DUSK_ALLOC_SITES];
+
+// Live blocks, open addressed with removed blocks marked by a NULL site
+static pthread_mutex_t dusk_blocks_lock = PTHREAD_MUTEX_INITIALIZER;
+static dusk_alloc_block *dusk_blocks;
+static size_t dusk_blocks_size;
+static size_t dusk_blocks_used;
+
+static int dusk_alloc_registered;
+
+static int dusk_alloc_compare(const void *a, const void *b) {
+    const dusk_alloc_site *x = a, *y = b;
+    return (x->bytes < y->bytes) - (x->bytes > y->bytes);
+}
+
+static void dusk_alloc_write(void) {
+    const char *path = getenv("DUSK_ALLOCS");
+    FILE *file = path ? fopen(path, "w") : stderr;
+
+    if(!file)
+        return;
+
+    dusk_alloc_site sites[DUSK_ALLOC_SITES];
+    int count = 0;
+
+    for(int i = 0; i < DUSK_ALLOC_SITES; i++) {
+        dusk_alloc_site *site = &dusk_alloc_sites[i];
+
+        if(!__atomic_load_n(&site->name, __ATOMIC_ACQUIRE))
+            continue;
+
+        sites[count].name = site->name;
+        sites[count].count = __atomic_load_n(&site->count, __ATOMIC_RELAXED);
+        sites[count].bytes = __atomic_load_n(&site->bytes, __ATOMIC_RELAXED);
+        sites[count].live = __atomic_load_n(&site->live, __ATOMIC_RELAXED);
+        count++;
+    }
+
+    qsort(sites, (size_t)count, sizeof(dusk_alloc_site), dusk_alloc_compare);
+
+    fprintf(file, "%12s %12s %12s  site\n", "allocations", "bytes", "live");
+
+    for(int i = 0; i < count; i++)
+        fprintf(file, "%12llu %12llu %12llu  %s\n",
+                (unsigned long long)sites[i].count,
+                (unsigned long long)sites[i].bytes,
+                (unsigned long long)sites[i].live, sites[i].name);
+
+    if(file != stderr)
+        fclose(file);
+}
+
+static dusk_alloc_site *dusk_alloc_find(const char *name) {
+    uintptr_t hash = (uintptr_t)name * 2654435761u;
+
+    for(unsigned i = 0; i < DUSK_ALLOC_SITES; i++) {
+        dusk_alloc_site *site =
+            &dusk_alloc_sites[(hash + i) & (DUSK_ALLOC_SITES - 1)];
+        const char *expected = NULL;
+
+        if(__atomic_load_n(&site->name, __ATOMIC_ACQUIRE) == name ||
+           __atomic_compare_exchange_n(&site->name, &expected, name, 0,
+                                       __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) ||
+           expected == name)
+            return site;
+    }
+
+    return NULL;
+}
+
+static size_t dusk_block_slot(void *ptr) {
+    return ((uintptr_t)ptr >> 3) * 2654435761u;
+}
+
+// Both called with dusk_blocks_lock held
+static void dusk_block_insert(void *ptr, dusk_alloc_site *site, uint32_t size);
+
+static void dusk_blocks_grow(void) {
+    dusk_alloc_block *old = dusk_blocks;
+    size_t old_size = dusk_blocks_size;
+
+    size_t live = 0;
+
+    for(size_t i = 0; i < old_size; i++)
+        live += old[i].site != NULL;
+
+    // Removed blocks are dropped, so churn alone does not grow the table
+    dusk_blocks_size = live * 4 > old_size ? old_size * 2 : old_size;
+
+    if(!dusk_blocks_size)
+        dusk_blocks_size = 1024;
+
+    dusk_blocks = calloc(dusk_blocks_size, sizeof(dusk_alloc_block));
+    dusk_blocks_used = 0;
+
+    for(size_t i = 0; i < old_size; i++)
+        if(old[i].site)
+            dusk_block_insert(old[i].ptr, old[i].site, old[i].size);
+
+    free(old);
+}
+
+static void dusk_block_insert(void *ptr, dusk_alloc_site *site, uint32_t size) {
+    if((dusk_blocks_used + 1) * 2 > dusk_blocks_size)
+        dusk_blocks_grow();
+
+    size_t mask = dusk_blocks_size - 1;
+
+    for(size_t i = dusk_block_slot(ptr) & mask;; i = (i + 1) & mask) {
+        dusk_alloc_block *block = &dusk_blocks[i];
+
+        if(!block->ptr || (block->ptr == ptr && !block->site)) {
+            dusk_blocks_used += !block->ptr;
+            block->ptr = ptr;
+            block->site = site;
+            block->size = size;
+            return;
+        }
+    }
+}
+
+/** Allocates size bytes, counted against the site described by name. */
+void *dusk_alloc_track(const char *name, uint32_t size) {
+    if(!__atomic_exchange_n(&dusk_alloc_registered, 1, __ATOMIC_ACQ_REL))
+        atexit(dusk_alloc_write);
+
+    void *ptr = malloc(size);
+    dusk_alloc_site *site = dusk_alloc_find(name);
+
+    if(!ptr || !site)
+        return ptr;
+
+    __atomic_fetch_add(&site->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&site->bytes, size, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&site->live, size, __ATOMIC_RELAXED);
+
+    pthread_mutex_lock(&dusk_blocks_lock);
+    dusk_block_insert(ptr, site, size);
+    pthread_mutex_unlock(&dusk_blocks_lock);
+
+    return ptr;
+}
+
+/** Frees ptr, taking it off the live bytes of its site if it has one. */
+void dusk_alloc_free(void *ptr) {
+    if(!ptr)
+        return;
+
+    pthread_mutex_lock(&dusk_blocks_lock);
+
+    if(dusk_blocks_size) {
+        size_t mask = dusk_blocks_size - 1;
+
+        for(size_t i = dusk_block_slot(ptr) & mask; dusk_blocks[i].ptr;
+            i = (i + 1) & mask) {
+            dusk_alloc_block *block = &dusk_blocks[i];
+
+            if(block->ptr == ptr && block->site) {
+                __atomic_fetch_sub(&block->site->live, block->size,
+                                   __ATOMIC_RELAXED);
+                block->site = NULL;
+                break;
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&dusk_blocks_lock);
+
+    free(ptr);
+}
@@ -0,0 +1,288 @@
+/*
+ * Event loop backing async functions.
+ *
+ * An async function is compiled into a frame holding its state and variables,
+ * and a resume function that runs it from its last await until the next one
+ * that is not ready yet. Tasks and pending I/O operations are both futures;
+ * a task awaiting a future is put back on the ready queue once the future
+ * completes. I/O is done on nonblocking descriptors, and operations that
+ * would block wait on a single epoll instance.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define DUSK_MAX_EVENTS 64
+
+/** Runs a task until it awaits, returns 1 once it has returned. */
+typedef int32_t (*dusk_resume)(void *frame);
+
+enum {
+    DUSK_TASK,
+    DUSK_READ,
+    DUSK_WRITE,
+    DUSK_ACCEPT,
+};
+
+typedef struct dusk_future {
+    int kind;
+    int done;
+    int detached;
+    int32_t result;
+
+    // The task to wake when this completes
+    struct dusk_future *waiter;
+    struct dusk_future *next_ready;
+
+    // Tasks
+    dusk_resume resume;
+    void *frame;
+
+    // I/O operations
+    int fd;
+    char *buf;
+    uint32_t count;
+} dusk_future;
+
+static dusk_future *dusk_ready_head, *dusk_ready_tail;
+static dusk_future *dusk_current;
+static int dusk_epoll = -1;
+static int dusk_pending_io;
+
+static void dusk_ready(dusk_future *task) {
+    task->next_ready = NULL;
+
+    if(dusk_ready_tail) {
+        dusk_ready_tail->next_ready = task;
+    } else {
+        dusk_ready_head = task;
+    }
+
+    dusk_ready_tail = task;
+}
+
+static void dusk_future_free(dusk_future *future) {
+    free(future->frame);
+    free(future);
+}
+
+static void dusk_complete(dusk_future *future, int32_t result) {
+    future->done   = 1;
+    future->result = result;
+
+    if(future->waiter) {
+        dusk_ready(future->waiter);
+    }
+
+    if(future->detached) {
+        dusk_future_free(future);
+    }
+}
+
+static dusk_future *dusk_future_new(int kind) {
+    dusk_future *future = calloc(1, sizeof(dusk_future));
+
+    if(future) {
+        future->kind = kind;
+    }
+
+    return future;
+}
+
+/** Creates a task for a frame the compiler allocated, ready to run. */
+dusk_future *dusk_task_new(void *frame, dusk_resume resume) {
+    dusk_future *task = dusk_future_new(DUSK_TASK);
+
+    if(!task) {
+        return NULL;
+    }
+
+    task->resume = resume;
+    task->frame  = frame;
+    dusk_ready(task);
+
+    return task;
+}
+
+/** Sets the result of the running task, before its resume function ends. */
+void dusk_task_return(int32_t result) {
+    dusk_current->result = result;
+}
+
+/**
+ * Makes the running task wait for future. Returns 1 if the future is done
+ * already, in which case the task simply continues.
+ */
+int32_t dusk_task_await(dusk_future *future) {
+    if(future->done) {
+        return 1;
+    }
+
+    future->waiter = dusk_current;
+
+    return 0;
+}
+
+/** Returns the result of a completed future and frees it. */
+int32_t dusk_future_take(dusk_future *future) {
+    int32_t result = future->result;
+    dusk_future_free(future);
+
+    return result;
+}
+
+/** Lets a task run to completion without anyone awaiting it. */
+void dusk_spawn(dusk_future *task) {
+    if(task->done) {
+        dusk_future_free(task);
+    } else {
+        task->detached = 1;
+    }
+}
+
+/** Tries the operation once, returns 0 if it would block. */
+static int dusk_io_attempt(dusk_future *future) {
+    ssize_t result;
+
+    switch(future->kind) {
+    case DUSK_READ:
+        result = read(future->fd, future->buf, future->count);
+        break;
+    case DUSK_WRITE:
+        result = write(future->fd, future->buf, future->count);
+        break;
+    default:
+        result = accept(future->fd, NULL, NULL);
+
+        if(result >= 0) {
+            fcntl((int)result, F_SETFL,
+                  fcntl((int)result, F_GETFL) | O_NONBLOCK);
+        }
+        break;
+    }
+
+    if(result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK ||
+                      errno == EINTR)) {
+        return 0;
+    }
+
+    dusk_complete(future, result < 0 ? -errno : (int32_t)result);
+
+    return 1;
+}
+
+static void dusk_io_arm(dusk_future *future) {
+    struct epoll_event event = {
+        .events = (future->kind == DUSK_WRITE ? EPOLLOUT : EPOLLIN) |
+                  EPOLLONESHOT,
+        .data.ptr = future,
+    };
+
+    if(dusk_epoll < 0) {
+        dusk_epoll = epoll_create1(EPOLL_CLOEXEC);
+    }
+
+    if(epoll_ctl(dusk_epoll, EPOLL_CTL_MOD, future->fd, &event) == 0 ||
+       (errno == ENOENT &&
+        epoll_ctl(dusk_epoll, EPOLL_CTL_ADD, future->fd, &event) == 0)) {
+        dusk_pending_io++;
+        return;
+    }
+
+    dusk_complete(future, -errno);
+}
+
+static dusk_future *dusk_io_start(int kind, int32_t fd, char *buf,
+                                  uint32_t count) {
+    dusk_future *future = dusk_future_new(kind);
+
+    if(!future) {
+        return NULL;
+    }
+
+    future->fd    = fd;
+    future->buf   = buf;
+    future->count = count;
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    if(!dusk_io_attempt(future)) {
+        dusk_io_arm(future);
+    }
+
+    return future;
+}
+
+/** Reads up to count bytes, resulting in the count read or -errno. */
+dusk_future *dusk_read(int32_t fd, char *buf, uint32_t count) {
+    return dusk_io_start(DUSK_READ, fd, buf, count);
+}
+
+/** Writes up to count bytes, resulting in the count written or -errno. */
+dusk_future *dusk_write(int32_t fd, char *buf, uint32_t count) {
+    return dusk_io_start(DUSK_WRITE, fd, buf, count);
+}
+
+/** Accepts a connection, resulting in its nonblocking descriptor. */
+dusk_future *dusk_accept(int32_t fd) {
+    return dusk_io_start(DUSK_ACCEPT, fd, NULL, 0);
+}
+
+/** Runs ready tasks and waits for I/O until target is done. */
+static void dusk_run_until(dusk_future *target) {
+    struct epoll_event events[DUSK_MAX_EVENTS];
+
+    while(!target || !target->done) {
+        if(dusk_ready_head) {
+            dusk_future *task = dusk_ready_head;
+
+            dusk_ready_head = task->next_ready;
+
+            if(!dusk_ready_head) {
+                dusk_ready_tail = NULL;
+            }
+
+            dusk_current = task;
+
+            if(task->resume(task->frame)) {
+                dusk_complete(task, task->result);
+            }
+
+            dusk_current = NULL;
+            continue;
+        }
+
+        if(!dusk_pending_io) {
+            return;
+        }
+
+        int count = epoll_wait(dusk_epoll, events, DUSK_MAX_EVENTS, -1);
+
+        for(int i = 0; i < count; i++) {
+            dusk_future *future = events[i].data.ptr;
+
+            dusk_pending_io--;
+
+            if(!dusk_io_attempt(future)) {
+                dusk_io_arm(future);
+            }
+        }
+    }
+}
+
+/** Runs until every task is done. */
+void dusk_run(void) {
+    dusk_run_until(NULL);
+}
+
+/** Runs until task is done, then frees it and returns its result. */
+int32_t dusk_block_on(dusk_future *task) {
+    dusk_run_until(task);
+
+    return task->done ? dusk_future_take(task) : 0;
+}
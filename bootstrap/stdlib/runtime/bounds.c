@@ -0,0 +1,26 @@
+/*
+ * Bounds checks of programs built with --bounds-check.
+ *
+ * Arrays keep their length in the four bytes in front of their first element.
+ * Indexing an array with an index the compiler could not prove in bounds goes
+ * through dusk_bounds_check, passing a string literal describing the site as
+ * "<file>:<line>:<column>".
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/** Returns index if it is in bounds of array, aborts the program if not. */
+int32_t dusk_bounds_check(const char *site, const uint32_t *array,
+                          int32_t index) {
+    uint32_t length = array[-1];
+
+    // Negative indices are too large as unsigned
+    if((uint32_t)index < length)
+        return index;
+
+    fprintf(stderr, "%s: index %d out of bounds of an array of length %u\n",
+            site, index, length);
+    abort();
+}
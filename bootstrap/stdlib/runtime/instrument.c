@@ -0,0 +1,215 @@
+/*
+ * Function timing of programs built with --instrument-functions.
+ *
+ * Every instrumented function calls dusk_fn_enter with its id when entered
+ * and dusk_fn_exit before returning. Each thread appends these events with a
+ * timestamp to a ring buffer of its own, and folds the buffer into a tree of
+ * the call stacks it has seen whenever it fills up. When the program exits
+ * the self time of every stack, in microseconds, is written as collapsed
+ * stacks ("main;work;step 1234" lines, as taken by flamegraph.pl) to
+ * $DUSK_FLAME, or dusk.folded.
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Events per thread between folds, a power of two
+#define DUSK_RING_SIZE 4096
+
+typedef struct dusk_event {
+    uint64_t time;
+    uint32_t id;
+    uint32_t enter;
+} dusk_event;
+
+typedef struct dusk_frame {
+    uint32_t id;
+    uint64_t self_ns;
+    struct dusk_frame *parent;
+    struct dusk_frame *child;
+    struct dusk_frame *sibling;
+} dusk_frame;
+
+typedef struct dusk_thread {
+    dusk_event ring[DUSK_RING_SIZE];
+    uint32_t head;
+    uint32_t tail;
+
+    dusk_frame root;
+    dusk_frame *current;
+    uint64_t last;
+
+    struct dusk_thread *next;
+} dusk_thread;
+
+static __thread dusk_thread *dusk_self;
+
+static pthread_mutex_t dusk_threads_lock = PTHREAD_MUTEX_INITIALIZER;
+static dusk_thread *dusk_threads;
+
+static pthread_once_t dusk_instrument_once = PTHREAD_ONCE_INIT;
+
+static char **dusk_fn_names;
+static uint32_t dusk_fn_count;
+
+static uint64_t dusk_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+/** Folds the events in the ring of a thread into its tree of stacks. */
+static void dusk_fold(dusk_thread *thread) {
+    for(; thread->tail != thread->head; thread->tail++) {
+        dusk_event *event = &thread->ring[thread->tail & (DUSK_RING_SIZE - 1)];
+        dusk_frame *current = thread->current;
+
+        if(thread->last)
+            current->self_ns += event->time - thread->last;
+
+        thread->last = event->time;
+
+        if(event->enter) {
+            dusk_frame *child = current->child;
+
+            while(child && child->id != event->id)
+                child = child->sibling;
+
+            if(!child) {
+                child = calloc(1, sizeof(dusk_frame));
+                child->id = event->id;
+                child->parent = current;
+                child->sibling = current->child;
+                current->child = child;
+            }
+
+            thread->current = child;
+            continue;
+        }
+
+        // Frames left without their exit hook, by a return from an outer
+        // function, are left along with the one exiting
+        while(current->parent && current->id != event->id)
+            current = current->parent;
+
+        if(current->parent)
+            thread->current = current->parent;
+    }
+}
+
+static void dusk_instrument_write(void);
+
+static void dusk_instrument_init(void) {
+    atexit(dusk_instrument_write);
+}
+
+static void dusk_record(uint32_t id, uint32_t enter) {
+    dusk_thread *thread = dusk_self;
+
+    if(!thread) {
+        pthread_once(&dusk_instrument_once, dusk_instrument_init);
+
+        thread = calloc(1, sizeof(dusk_thread));
+        thread->current = &thread->root;
+
+        pthread_mutex_lock(&dusk_threads_lock);
+        thread->next = dusk_threads;
+        dusk_threads = thread;
+        pthread_mutex_unlock(&dusk_threads_lock);
+
+        dusk_self = thread;
+    }
+
+    if(thread->head - thread->tail == DUSK_RING_SIZE)
+        dusk_fold(thread);
+
+    dusk_event *event = &thread->ring[thread->head & (DUSK_RING_SIZE - 1)];
+    event->time = dusk_now();
+    event->id = id;
+    event->enter = enter;
+    thread->head++;
+}
+
+static void dusk_write_frame(FILE *file, dusk_frame *frame, char *stack,
+                             size_t length, size_t size) {
+    for(; frame; frame = frame->sibling) {
+        char fallback[16];
+        const char *name = fallback;
+
+        if(frame->id < dusk_fn_count)
+            name = dusk_fn_names[frame->id];
+        else
+            snprintf(fallback, sizeof(fallback), "fn%u", frame->id);
+
+        size_t end = length + strlen(name) + (length ? 1 : 0);
+
+        if(end >= size)
+            continue;
+
+        if(length)
+            stack[length] = ';';
+
+        strcpy(stack + length + (length ? 1 : 0), name);
+
+        if(frame->self_ns >= 1000)
+            fprintf(file, "%s %llu\n", stack,
+                    (unsigned long long)(frame->self_ns / 1000));
+
+        dusk_write_frame(file, frame->child, stack, end, size);
+    }
+}
+
+static void dusk_instrument_write(void) {
+    const char *path = getenv("DUSK_FLAME");
+    FILE *file = fopen(path ? path : "dusk.folded", "w");
+
+    if(!file)
+        return;
+
+    char stack[4096];
+
+    pthread_mutex_lock(&dusk_threads_lock);
+
+    for(dusk_thread *thread = dusk_threads; thread; thread = thread->next) {
+        dusk_fold(thread);
+        dusk_write_frame(file, thread->root.child, stack, 0, sizeof(stack));
+    }
+
+    pthread_mutex_unlock(&dusk_threads_lock);
+
+    fclose(file);
+}
+
+/**
+ * Takes the names of the instrumented functions, one per line in the order
+ * of their ids. Called by main before anything else.
+ */
+void dusk_instrument_names(const char *names) {
+    uint32_t count = 0;
+
+    for(const char *c = names; *c; c++)
+        count += *c == '\n';
+
+    dusk_fn_names = calloc(count, sizeof(char *));
+
+    for(uint32_t i = 0; i < count; i++) {
+        const char *end = strchr(names, '\n');
+
+        dusk_fn_names[i] = strndup(names, (size_t)(end - names));
+        names = end + 1;
+    }
+
+    dusk_fn_count = count;
+}
+
+void dusk_fn_enter(uint32_t id) {
+    dusk_record(id, 1);
+}
+
+void dusk_fn_exit(uint32_t id) {
+    dusk_record(id, 0);
+}
@@ -0,0 +1,191 @@
+/*
+ * Region and pool allocators backing mem.ds.
+ *
+ * An arena hands out memory by bumping a pointer through a chain of chunks and
+ * frees everything at once. A pool hands out fixed size objects from a free
+ * list. Both are exposed to Dusk as opaque handles.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#define DUSK_ALIGN 8
+#define DUSK_ALIGN_UP(x) (((x) + (DUSK_ALIGN - 1)) & ~(size_t)(DUSK_ALIGN - 1))
+
+typedef struct dusk_chunk {
+    struct dusk_chunk *next;
+    size_t capacity;
+    size_t used;
+    unsigned char data[];
+} dusk_chunk;
+
+typedef struct dusk_arena {
+    dusk_chunk *head;
+    size_t chunk_size;
+} dusk_arena;
+
+static dusk_chunk *dusk_chunk_new(size_t capacity, dusk_chunk *next) {
+    dusk_chunk *chunk = malloc(sizeof(dusk_chunk) + capacity);
+
+    if(!chunk) {
+        return NULL;
+    }
+
+    chunk->next     = next;
+    chunk->capacity = capacity;
+    chunk->used     = 0;
+
+    return chunk;
+}
+
+dusk_arena *dusk_arena_new(uint32_t chunk_size) {
+    dusk_arena *arena = malloc(sizeof(dusk_arena));
+
+    if(!arena) {
+        return NULL;
+    }
+
+    arena->chunk_size = chunk_size ? DUSK_ALIGN_UP(chunk_size) : 4096;
+    arena->head       = NULL;
+
+    return arena;
+}
+
+void *dusk_arena_alloc(dusk_arena *arena, uint32_t size) {
+    size_t aligned = DUSK_ALIGN_UP((size_t)size);
+    dusk_chunk *chunk = arena->head;
+
+    if(!chunk || chunk->capacity - chunk->used < aligned) {
+        size_t capacity = arena->chunk_size;
+
+        // Oversized requests get a chunk of their own
+        while(capacity < aligned) {
+            capacity *= 2;
+        }
+
+        chunk = dusk_chunk_new(capacity, arena->head);
+
+        if(!chunk) {
+            return NULL;
+        }
+
+        arena->head = chunk;
+    }
+
+    void *result = chunk->data + chunk->used;
+    chunk->used += aligned;
+
+    return result;
+}
+
+/** Frees every allocation but keeps the newest chunk for reuse. */
+void dusk_arena_reset(dusk_arena *arena) {
+    if(!arena->head) {
+        return;
+    }
+
+    dusk_chunk *chunk = arena->head->next;
+
+    while(chunk) {
+        dusk_chunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+
+    arena->head->next = NULL;
+    arena->head->used = 0;
+}
+
+void dusk_arena_release(dusk_arena *arena) {
+    dusk_chunk *chunk = arena->head;
+
+    while(chunk) {
+        dusk_chunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+
+    free(arena);
+}
+
+typedef struct dusk_pool_block {
+    struct dusk_pool_block *next;
+} dusk_pool_block;
+
+typedef struct dusk_pool {
+    size_t object_size;
+    size_t objects_per_block;
+    void *free_list;
+    dusk_pool_block *blocks;
+} dusk_pool;
+
+dusk_pool *dusk_pool_new(uint32_t object_size, uint32_t objects_per_block) {
+    dusk_pool *pool = malloc(sizeof(dusk_pool));
+
+    if(!pool) {
+        return NULL;
+    }
+
+    if(object_size < sizeof(void *)) {
+        object_size = sizeof(void *);
+    }
+
+    pool->object_size       = DUSK_ALIGN_UP((size_t)object_size);
+    pool->objects_per_block = objects_per_block ? objects_per_block : 64;
+    pool->free_list         = NULL;
+    pool->blocks            = NULL;
+
+    return pool;
+}
+
+static int dusk_pool_grow(dusk_pool *pool) {
+    size_t header = DUSK_ALIGN_UP(sizeof(dusk_pool_block));
+    dusk_pool_block *block =
+        malloc(header + pool->object_size * pool->objects_per_block);
+
+    if(!block) {
+        return 0;
+    }
+
+    block->next  = pool->blocks;
+    pool->blocks = block;
+
+    unsigned char *objects = (unsigned char *)block + header;
+
+    // Thread the new objects onto the free list, lowest address first
+    for(size_t i = pool->objects_per_block; i > 0; i--) {
+        void **object = (void **)(objects + (i - 1) * pool->object_size);
+        *object = pool->free_list;
+        pool->free_list = object;
+    }
+
+    return 1;
+}
+
+void *dusk_pool_alloc(dusk_pool *pool) {
+    if(!pool->free_list && !dusk_pool_grow(pool)) {
+        return NULL;
+    }
+
+    void **object = pool->free_list;
+    pool->free_list = *object;
+
+    return object;
+}
+
+void dusk_pool_free(dusk_pool *pool, void *object) {
+    *(void **)object = pool->free_list;
+    pool->free_list = object;
+}
+
+void dusk_pool_release(dusk_pool *pool) {
+    dusk_pool_block *block = pool->blocks;
+
+    while(block) {
+        dusk_pool_block *next = block->next;
+        free(block);
+        block = next;
+    }
+
+    free(pool);
+}
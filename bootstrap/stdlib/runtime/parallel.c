@@ -0,0 +1,247 @@
+/*
+ * Work stealing scheduler backing @parallel loops.
+ *
+ * The index range of a loop is split evenly between the workers, the calling
+ * thread being worker 0. Each worker runs its own range front to back a grain
+ * at a time, and a worker that runs out steals the back half of the largest
+ * range left. Worker threads are started on first use and kept for later
+ * loops.
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define DUSK_MAX_WORKERS 64
+
+// Grains per worker, more balance better at the cost of more locking
+#define DUSK_GRAINS_PER_WORKER 8
+
+typedef void (*dusk_parallel_body)(void *env, int32_t begin, int32_t end);
+
+typedef struct dusk_range {
+    pthread_mutex_t lock;
+    int32_t begin;
+    int32_t end;
+} dusk_range;
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    unsigned generation;
+    int running;
+
+    int workers;
+    dusk_parallel_body body;
+    void *env;
+    int32_t grain;
+    dusk_range ranges[DUSK_MAX_WORKERS];
+} dusk_pool = {
+    .lock  = PTHREAD_MUTEX_INITIALIZER,
+    .start = PTHREAD_COND_INITIALIZER,
+    .done  = PTHREAD_COND_INITIALIZER,
+};
+
+static pthread_once_t dusk_pool_once = PTHREAD_ONCE_INIT;
+
+// Held by the thread whose loop currently owns the workers
+static pthread_mutex_t dusk_pool_busy = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_mutex_t dusk_reduce_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static __thread int dusk_in_loop;
+
+/** Moves the back half of the largest other range to the range of self. */
+static int dusk_parallel_steal(int self) {
+    for(;;) {
+        int victim = -1;
+        int32_t most = 0;
+
+        for(int i = 0; i < dusk_pool.workers; i++) {
+            dusk_range *range = &dusk_pool.ranges[i];
+
+            if(i == self) {
+                continue;
+            }
+
+            pthread_mutex_lock(&range->lock);
+            int32_t left = range->end - range->begin;
+            pthread_mutex_unlock(&range->lock);
+
+            if(left > most) {
+                most   = left;
+                victim = i;
+            }
+        }
+
+        // Ranges only shrink, so once all are empty the loop is done
+        if(victim < 0) {
+            return 0;
+        }
+
+        dusk_range *range = &dusk_pool.ranges[victim];
+
+        pthread_mutex_lock(&range->lock);
+        int32_t end = range->end;
+        int32_t mid = range->begin + (end - range->begin) / 2;
+
+        if(mid < end) {
+            range->end = mid;
+        }
+        pthread_mutex_unlock(&range->lock);
+
+        if(mid < end) {
+            dusk_range *own = &dusk_pool.ranges[self];
+
+            pthread_mutex_lock(&own->lock);
+            own->begin = mid;
+            own->end   = end;
+            pthread_mutex_unlock(&own->lock);
+
+            return 1;
+        }
+    }
+}
+
+static void dusk_parallel_run(int self) {
+    dusk_range *own = &dusk_pool.ranges[self];
+
+    do {
+        for(;;) {
+            pthread_mutex_lock(&own->lock);
+            int32_t begin = own->begin;
+            int32_t end   = own->end - begin > dusk_pool.grain
+                          ? begin + dusk_pool.grain : own->end;
+            own->begin = end;
+            pthread_mutex_unlock(&own->lock);
+
+            if(begin >= end) {
+                break;
+            }
+
+            dusk_pool.body(dusk_pool.env, begin, end);
+        }
+    } while(dusk_parallel_steal(self));
+}
+
+static void *dusk_parallel_worker(void *arg) {
+    int self = (int)(intptr_t)arg;
+    unsigned seen = 0;
+
+    dusk_in_loop = 1;
+
+    pthread_mutex_lock(&dusk_pool.lock);
+
+    for(;;) {
+        while(dusk_pool.generation == seen) {
+            pthread_cond_wait(&dusk_pool.start, &dusk_pool.lock);
+        }
+
+        seen = dusk_pool.generation;
+        pthread_mutex_unlock(&dusk_pool.lock);
+
+        dusk_parallel_run(self);
+
+        pthread_mutex_lock(&dusk_pool.lock);
+
+        if(--dusk_pool.running == 0) {
+            pthread_cond_signal(&dusk_pool.done);
+        }
+    }
+
+    return NULL;
+}
+
+static void dusk_parallel_init(void) {
+    long workers = sysconf(_SC_NPROCESSORS_ONLN);
+    const char *threads = getenv("DUSK_THREADS");
+
+    if(threads) {
+        workers = atol(threads);
+    }
+
+    if(workers < 1) {
+        workers = 1;
+    } else if(workers > DUSK_MAX_WORKERS) {
+        workers = DUSK_MAX_WORKERS;
+    }
+
+    for(int i = 0; i < DUSK_MAX_WORKERS; i++) {
+        pthread_mutex_init(&dusk_pool.ranges[i].lock, NULL);
+    }
+
+    dusk_pool.workers = 1;
+
+    for(int i = 1; i < workers; i++) {
+        pthread_t thread;
+
+        if(pthread_create(&thread, NULL, dusk_parallel_worker,
+                          (void *)(intptr_t)i) != 0) {
+            break;
+        }
+
+        pthread_detach(thread);
+        dusk_pool.workers++;
+    }
+}
+
+/** Runs body over [0, n) split into ranges, on every worker. */
+void dusk_parallel_for(int32_t n, dusk_parallel_body body, void *env) {
+    if(n <= 0) {
+        return;
+    }
+
+    pthread_once(&dusk_pool_once, dusk_parallel_init);
+
+    // Nested loops, and loops started while another one owns the workers,
+    // run on the calling thread
+    if(dusk_in_loop || dusk_pool.workers == 1 || n == 1 ||
+       pthread_mutex_trylock(&dusk_pool_busy) != 0) {
+        body(env, 0, n);
+        return;
+    }
+
+    int workers = dusk_pool.workers;
+    int32_t grain = n / (workers * DUSK_GRAINS_PER_WORKER);
+
+    dusk_pool.body  = body;
+    dusk_pool.env   = env;
+    dusk_pool.grain = grain > 0 ? grain : 1;
+
+    for(int i = 0; i < workers; i++) {
+        dusk_pool.ranges[i].begin = (int32_t)((int64_t)n * i / workers);
+        dusk_pool.ranges[i].end   = (int32_t)((int64_t)n * (i + 1) / workers);
+    }
+
+    dusk_in_loop = 1;
+
+    pthread_mutex_lock(&dusk_pool.lock);
+    dusk_pool.running = workers - 1;
+    dusk_pool.generation++;
+    pthread_cond_broadcast(&dusk_pool.start);
+    pthread_mutex_unlock(&dusk_pool.lock);
+
+    dusk_parallel_run(0);
+
+    pthread_mutex_lock(&dusk_pool.lock);
+
+    while(dusk_pool.running) {
+        pthread_cond_wait(&dusk_pool.done, &dusk_pool.lock);
+    }
+
+    pthread_mutex_unlock(&dusk_pool.lock);
+
+    dusk_in_loop = 0;
+    pthread_mutex_unlock(&dusk_pool_busy);
+}
+
+/** Guards the combination of the partial results of a reduction. */
+void dusk_parallel_lock(void) {
+    pthread_mutex_lock(&dusk_reduce_lock);
+}
+
+void dusk_parallel_unlock(void) {
+    pthread_mutex_unlock(&dusk_reduce_lock);
+}
@@ -0,0 +1,65 @@
+/*
+ * Execution counters of programs built with --profile-generate.
+ *
+ * Every counted site passes its name, a string literal, so the address of the
+ * name identifies the site. Counters live in an open addressed table keyed by
+ * that address, and are written as "<site> <count>" lines to $DUSK_PROFILE,
+ * or dusk.profile, when the program exits.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Sites a program can have, a power of two
+#define DUSK_PROFILE_SITES 65536
+
+typedef struct dusk_profile_site {
+    const char *name;
+    uint64_t count;
+} dusk_profile_site;
+
+static dusk_profile_site dusk_profile_sites[DUSK_PROFILE_SITES];
+
+static int dusk_profile_registered;
+
+static void dusk_profile_write(void) {
+    const char *path = getenv("DUSK_PROFILE");
+    FILE *file = fopen(path ? path : "dusk.profile", "w");
+
+    if(!file)
+        return;
+
+    for(int i = 0; i < DUSK_PROFILE_SITES; i++) {
+        dusk_profile_site *site = &dusk_profile_sites[i];
+        const char *name = __atomic_load_n(&site->name, __ATOMIC_ACQUIRE);
+
+        if(name)
+            fprintf(file, "%s %llu\n", name, (unsigned long long)
+                    __atomic_load_n(&site->count, __ATOMIC_RELAXED));
+    }
+
+    fclose(file);
+}
+
+/** Counts an execution of the site called name, from any thread. */
+void dusk_profile_count(const char *name) {
+    if(!__atomic_exchange_n(&dusk_profile_registered, 1, __ATOMIC_ACQ_REL))
+        atexit(dusk_profile_write);
+
+    uintptr_t hash = (uintptr_t)name * 2654435761u;
+
+    for(unsigned i = 0; i < DUSK_PROFILE_SITES; i++) {
+        dusk_profile_site *site =
+            &dusk_profile_sites[(hash + i) & (DUSK_PROFILE_SITES - 1)];
+        const char *expected = NULL;
+
+        if(__atomic_load_n(&site->name, __ATOMIC_ACQUIRE) == name ||
+           __atomic_compare_exchange_n(&site->name, &expected, name, 0,
+                                       __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) ||
+           expected == name) {
+            __atomic_fetch_add(&site->count, 1, __ATOMIC_RELAXED);
+            return;
+        }
+    }
+}
@@ -0,0 +1,10 @@
+/*
+ * Snapshots of programs run in the compiler with --run --snapshot.
+ *
+ * The compiler saves the state of the program the first time it calls
+ * dusk_snapshot and resumes later runs from there. A compiled program always
+ * runs its initialization, so the call does nothing.
+ */
+
+void dusk_snapshot(void) {
+}
@@ -0,0 +1,248 @@
+/*
+ * String builder and rope backing str.ds.
+ *
+ * A builder is a growable buffer with amortised appends. A rope is an
+ * immutable concatenation tree that only copies characters when flattened.
+ * Both are exposed to Dusk as opaque handles.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+char *dusk_str_concat(const char *a, const char *b) {
+    size_t a_length = strlen(a);
+    size_t b_length = strlen(b);
+    char *result = malloc(a_length + b_length + 1);
+
+    if(!result) {
+        return NULL;
+    }
+
+    memcpy(result, a, a_length);
+    memcpy(result + a_length, b, b_length + 1);
+
+    return result;
+}
+
+typedef struct dusk_sb {
+    char *data;
+    size_t length;
+    size_t capacity;
+} dusk_sb;
+
+static int dusk_sb_reserve(dusk_sb *sb, size_t extra) {
+    size_t needed = sb->length + extra + 1;
+
+    if(needed <= sb->capacity) {
+        return 1;
+    }
+
+    size_t capacity = sb->capacity ? sb->capacity : 16;
+
+    while(capacity < needed) {
+        capacity *= 2;
+    }
+
+    char *data = realloc(sb->data, capacity);
+
+    if(!data) {
+        return 0;
+    }
+
+    sb->data     = data;
+    sb->capacity = capacity;
+
+    return 1;
+}
+
+dusk_sb *dusk_sb_new(uint32_t capacity) {
+    dusk_sb *sb = malloc(sizeof(dusk_sb));
+
+    if(!sb) {
+        return NULL;
+    }
+
+    sb->data     = NULL;
+    sb->length   = 0;
+    sb->capacity = 0;
+
+    if(!dusk_sb_reserve(sb, capacity)) {
+        free(sb);
+        return NULL;
+    }
+
+    sb->data[0] = '\0';
+
+    return sb;
+}
+
+void dusk_sb_append(dusk_sb *sb, const char *s) {
+    size_t length = strlen(s);
+
+    if(!dusk_sb_reserve(sb, length)) {
+        return;
+    }
+
+    memcpy(sb->data + sb->length, s, length + 1);
+    sb->length += length;
+}
+
+void dusk_sb_append_char(dusk_sb *sb, uint8_t c) {
+    if(!dusk_sb_reserve(sb, 1)) {
+        return;
+    }
+
+    sb->data[sb->length++] = (char)c;
+    sb->data[sb->length]   = '\0';
+}
+
+uint32_t dusk_sb_length(const dusk_sb *sb) {
+    return (uint32_t)sb->length;
+}
+
+/** Frees the builder and hands its buffer over to the caller. */
+char *dusk_sb_finish(dusk_sb *sb) {
+    char *data = sb->data;
+    free(sb);
+
+    return data;
+}
+
+void dusk_sb_release(dusk_sb *sb) {
+    free(sb->data);
+    free(sb);
+}
+
+/*
+ * Ropes are reference counted so a subtree can be shared between several
+ * concatenations. Leaves borrow their string unless they were created by
+ * rebalancing.
+ */
+#define DUSK_ROPE_MAX_DEPTH 48
+
+typedef struct dusk_rope {
+    struct dusk_rope *left, *right;
+    const char *leaf;
+    size_t length;
+    uint32_t depth;
+    uint32_t refs;
+    int owns_leaf;
+} dusk_rope;
+
+static dusk_rope *dusk_rope_alloc(void) {
+    dusk_rope *rope = calloc(1, sizeof(dusk_rope));
+
+    if(rope) {
+        rope->refs = 1;
+    }
+
+    return rope;
+}
+
+dusk_rope *dusk_rope_leaf(const char *s) {
+    dusk_rope *rope = dusk_rope_alloc();
+
+    if(!rope) {
+        return NULL;
+    }
+
+    rope->leaf   = s;
+    rope->length = strlen(s);
+
+    return rope;
+}
+
+uint32_t dusk_rope_length(const dusk_rope *rope) {
+    return (uint32_t)rope->length;
+}
+
+static void dusk_rope_copy(const dusk_rope *rope, char *out) {
+    // Walk down the right spine iteratively, the left one recursively
+    while(!rope->leaf) {
+        dusk_rope_copy(rope->left, out);
+        out += rope->left->length;
+        rope = rope->right;
+    }
+
+    memcpy(out, rope->leaf, rope->length);
+}
+
+char *dusk_rope_flatten(const dusk_rope *rope) {
+    char *result = malloc(rope->length + 1);
+
+    if(!result) {
+        return NULL;
+    }
+
+    dusk_rope_copy(rope, result);
+    result[rope->length] = '\0';
+
+    return result;
+}
+
+uint8_t dusk_rope_char_at(const dusk_rope *rope, uint32_t index) {
+    if(index >= rope->length) {
+        return 0;
+    }
+
+    while(!rope->leaf) {
+        if(index < rope->left->length) {
+            rope = rope->left;
+        } else {
+            index -= (uint32_t)rope->left->length;
+            rope = rope->right;
+        }
+    }
+
+    return (uint8_t)rope->leaf[index];
+}
+
+void dusk_rope_release(dusk_rope *rope) {
+    while(rope && --rope->refs == 0) {
+        dusk_rope *right = rope->right;
+
+        if(rope->owns_leaf) {
+            free((char *)rope->leaf);
+        }
+
+        dusk_rope_release(rope->left);
+        free(rope);
+
+        rope = right;
+    }
+}
+
+dusk_rope *dusk_rope_concat(dusk_rope *left, dusk_rope *right) {
+    dusk_rope *rope = dusk_rope_alloc();
+
+    if(!rope) {
+        return NULL;
+    }
+
+    left->refs++;
+    right->refs++;
+
+    rope->left   = left;
+    rope->right  = right;
+    rope->length = left->length + right->length;
+    rope->depth  = 1 + (left->depth > right->depth ? left->depth : right->depth);
+
+    // Degenerate trees are collapsed into a single leaf to bound the depth
+    if(rope->depth > DUSK_ROPE_MAX_DEPTH) {
+        char *flat = dusk_rope_flatten(rope);
+
+        if(flat) {
+            dusk_rope_release(left);
+            dusk_rope_release(right);
+
+            rope->left      = NULL;
+            rope->right     = NULL;
+            rope->leaf      = flat;
+            rope->owns_leaf = 1;
+            rope->depth     = 0;
+        }
+    }
+
+    return rope;
+}
@@ -0,0 +1,53 @@
+#!/bin/sh
+# Changes a copy of hot-swap.ds while it runs, each change followed by a line
+# for it to read: a change that is replaced, and changes that need a restart
+# and are undone again.
+
+frontend=$1
+stdlib=$2
+sample=$(cd "$(dirname "$0")" && pwd)/hot-swap.ds
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+cd "$dir"
+cp "$sample" hot-swap.ds
+mkfifo input
+
+"$frontend" --run -I "$stdlib" hot-swap.ds < input > stdout 2> stderr &
+exec 3> input
+
+# Gives the frontend time to start or to see a change, then lets the program
+# go on
+step() {
+    sleep 1
+    echo >&3
+}
+
+step
+sed -i 's/n \* 10/n * 20/' hot-swap.ds
+step
+
+# Each of these is refused, and undone by the change after it. A change is
+# moved in place whole, so it is never seen half written.
+cp hot-swap.ds replaced.ds
+
+change() {
+    sed "$1" replaced.ds > next.ds
+    mv next.ds hot-swap.ds
+}
+
+change '$a fn added() : i32 { return 1; }'
+step
+change 's/step(n: i32)/step(n: u32)/'
+step
+change 's/b: i32/b: u32/'
+step
+change 's/n \* 20/n * 30/'
+step
+
+exec 3>&-
+wait $!
+status=$?
+
+cat stdout stderr
+echo "exit $status"
@@ -0,0 +1,20 @@
+#!/bin/sh
+# Runs lto.ds, then runs its IL built with --lto, which has to print the same,
+# and lists the functions of lto.ds left in that IL.
+
+frontend=$1
+stdlib=$2
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+functions() {
+    echo $(grep -a -o -E 'double_[ab]i32|scalei32i32|main' "$1" | sort -u)
+}
+
+"$frontend" --run -I "$stdlib" lto.ds
+echo "exit $?"
+
+"$frontend" --lto -I "$stdlib" "$dir/lto.fil" lto.ds &&
+    echo "with --lto: $(functions "$dir/lto.fil")"
+"$frontend" --run "$dir/lto.fil"
+echo "exit $?"
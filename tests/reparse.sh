@@ -0,0 +1,44 @@
+#!/bin/sh
+# Changes a copy of reparse.ds while it runs, each change followed by a line
+# for it to read, and checks that the trees of parsing only a change are those
+# of parsing the whole file.
+
+frontend=$1
+stdlib=$2
+sample=$(cd "$(dirname "$0")" && pwd)/reparse.ds
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+cd "$dir"
+cp "$sample" reparse.ds
+mkfifo input
+
+DUSK_CHECK_REPARSE=1 "$frontend" --run -I "$stdlib" reparse.ds \
+    < input > stdout 2> stderr &
+exec 3> input
+
+# Gives the frontend time to start or to see a change, then lets the program
+# go on
+step() {
+    sleep 1
+    echo >&3
+}
+
+step
+sed -i 's/n \* 10/n * 100/' reparse.ds
+step
+sed -i 's/^fn step/\/\/ Moves everything after it\n\nfn step/' reparse.ds
+step
+sed -i 's/return n \* 100;/var m = n * 3;\n        return m;/' reparse.ds
+step
+sed -i 's/n \* 3/n */' reparse.ds
+step
+sed -i 's/n \*;/n * 40;/' reparse.ds
+step
+
+exec 3>&-
+wait $!
+status=$?
+
+cat stdout stderr
+echo "exit $status"
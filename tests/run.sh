@@ -0,0 +1,41 @@
+#!/bin/sh
+# Runs every sample with a <sample>.out in the engine of the frontend and
+# compares what it prints and the code it exits with against that file.
+# <sample>.flags holds extra options for the frontend, and a <sample>.sh is
+# run instead for samples that need more than one run, with the frontend and
+# the stdlib directory as its arguments.
+#
+# Usage: tests/run.sh <frontend>
+
+if [ $# -ne 1 ]; then
+    echo "Usage: $0 <frontend>"
+    exit 2
+fi
+
+frontend=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+tests=$(cd "$(dirname "$0")" && pwd)
+stdlib=$tests/../bootstrap/stdlib
+failed=0
+
+cd "$tests"
+
+for expected in *.out; do
+    name=${expected%.out}
+
+    if [ -f "$name.sh" ]; then
+        actual=$(sh "$name.sh" "$frontend" "$stdlib" 2>&1)
+    else
+        flags=$(cat "$name.flags" 2>/dev/null)
+        actual=$("$frontend" --run $flags -I "$stdlib" "$name.ds" 2>&1; echo "exit $?")
+    fi
+
+    if [ "$actual" = "$(cat "$expected")" ]; then
+        echo "ok $name"
+    else
+        echo "FAIL $name"
+        echo "$actual" | diff "$expected" -
+        failed=1
+    fi
+done
+
+exit $failed
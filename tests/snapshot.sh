@@ -0,0 +1,24 @@
+#!/bin/sh
+# Runs a copy of snapshot.ds three times with the same snapshot file: the
+# first run saves it, the second resumes from it, and the third, of a changed
+# program, saves it again.
+
+frontend=$1
+stdlib=$2
+sample=$(cd "$(dirname "$0")" && pwd)/snapshot.ds
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+cd "$dir"
+cp "$sample" snapshot.ds
+
+run() {
+    "$frontend" --run --snapshot state -I "$stdlib" snapshot.ds
+    echo "exit $?"
+}
+
+run
+run
+sed -i 's/total + squares\[i\]/total + squares[i] + 1/' snapshot.ds
+run
+run